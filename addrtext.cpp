@@ -0,0 +1,558 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Conversion of IP addresses to and from text without allocation
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <cstring>
+#include <net/if.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "addrtext.hpp"
+
+static const char s_hexDigits[] = "0123456789abcdef";
+
+#ifdef __SSE2__
+/*
+ * Load up to sixteen bytes of text into a vector, zero filled past len. Copying
+ * the text into a zeroed block first would be simpler, but loading the block
+ * right after the copy stalls on store forwarding and cost more than the rest
+ * of the parse, so the bytes are gathered with loads of the text that stay
+ * inside it, overlapping where len is not a whole number of them.
+ */
+static __m128i
+LoadText(const char *text, size_t len)
+{
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+
+    if (len >= 16) {
+        return _mm_loadu_si128((const __m128i *)text);
+    }
+    if (len >= 8) {
+        memcpy(&lo, text, 8);
+        if (len > 8) {
+            memcpy(&hi, text + len - 8, 8);
+            hi >>= 8 * (16 - len);
+        }
+    } else if (len >= 4) {
+        uint32_t head;
+        uint32_t tail;
+
+        memcpy(&head, text, 4);
+        memcpy(&tail, text + len - 4, 4);
+        lo = head | ((uint64_t)tail << (8 * (len - 4)));
+    } else {
+        for (size_t i = 0; i < len; i++) {
+            lo |= (uint64_t)(uint8_t)text[i] << (8 * i);
+        }
+    }
+    return _mm_set_epi64x((long long)hi, (long long)lo);
+}
+#endif
+
+/*
+ * Parse "a.b.c.d" or "a.b.c.d:port". The sixteen bytes of the address are
+ * classified at once so the dot positions come out of a single mask and the
+ * octets are converted without rescanning the string. Returns 1 on success,
+ * 0 for a malformed dotted quad and -1 if the text is not of that shape.
+ */
+static int
+ParseIpv4Fast(const char *text, size_t len, InetAddress &addr)
+{
+    size_t   addrLen = len;
+    uint16_t port = 0;
+
+    for (size_t i = 7; i < len; i++) {
+        if (text[i] == ':') {
+            uint32_t value = 0;
+            if (i + 1 == len || len - i - 1 > 5) {
+                return -1;
+            }
+            for (size_t j = i + 1; j < len; j++) {
+                if (text[j] < '0' || text[j] > '9') {
+                    return -1;
+                }
+                value = value * 10 + (uint32_t)(text[j] - '0');
+            }
+            if (value > 65535) {
+                return -1;
+            }
+            port = (uint16_t)value;
+            addrLen = i;
+            break;
+        }
+    }
+
+    if (addrLen < 7 || addrLen > 15) {
+        return -1;
+    }
+
+    uint8_t  digits[16];
+    uint32_t dotMask;
+
+#ifdef __SSE2__
+    __m128i chars = LoadText(text, addrLen);
+    __m128i value = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(value, _mm_set1_epi8(9)), value);
+    __m128i isDot = _mm_cmpeq_epi8(chars, _mm_set1_epi8('.'));
+    uint32_t used = (1U << addrLen) - 1;
+
+    if (((uint32_t)_mm_movemask_epi8(_mm_or_si128(isDigit, isDot)) & used) != used) {
+        return -1;
+    }
+    dotMask = (uint32_t)_mm_movemask_epi8(isDot) & used;
+    _mm_storeu_si128((__m128i *)digits, value);
+#else
+    dotMask = 0;
+    for (size_t i = 0; i < addrLen; i++) {
+        if (text[i] == '.') {
+            dotMask |= 1U << i;
+        } else if (text[i] < '0' || text[i] > '9') {
+            return -1;
+        }
+        digits[i] = (uint8_t)(text[i] - '0');
+    }
+#endif
+
+    if (__builtin_popcount(dotMask) != 3) {
+        return 0;
+    }
+
+    uint32_t hostAddr = 0;
+    uint32_t start = 0;
+    dotMask |= 1U << addrLen;
+
+    for (int octet = 0; octet < 4; octet++) {
+        uint32_t end = (uint32_t)__builtin_ctz(dotMask);
+        uint32_t width = end - start;
+        uint32_t number;
+
+        dotMask &= dotMask - 1;
+
+        // Leading zeros are refused, as inet_pton() does.
+        if (width > 1 && digits[start] == 0) {
+            return 0;
+        }
+
+        switch (width) {
+            case 1:  number = digits[start]; break;
+            case 2:  number = digits[start] * 10U + digits[start + 1]; break;
+            case 3:  number = digits[start] * 100U + digits[start + 1] * 10U + digits[start + 2];
+                     break;
+            default: return 0;
+        }
+        if (number > 255) {
+            return 0;
+        }
+
+        hostAddr = (hostAddr << 8) | number;
+        start = end + 1;
+    }
+
+    addr = InetAddress::FromIpv4(hostAddr, port);
+    return 1;
+}
+
+/*
+ * Parse a decimal port or zone index of at most max.
+ */
+static bool
+ParseNumber(const char *text, size_t len, uint32_t max, uint32_t &value)
+{
+    uint64_t number = 0;
+
+    if (len == 0 || len > 10) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] < '0' || text[i] > '9') {
+            return false;
+        }
+        number = number * 10 + (uint32_t)(text[i] - '0');
+    }
+    if (number > max) {
+        return false;
+    }
+    value = (uint32_t)number;
+    return true;
+}
+
+/*
+ * Parse colon notation with an optional numeric "%scope", as ParseIpv4Fast()
+ * does dotted quads: the characters are classified sixteen at a time, the
+ * colon positions come out as one mask and each group is converted from its
+ * precomputed nibbles. Returns 1 on success, 0 for malformed colon notation
+ * and -1 for anything else, such as an embedded dotted quad or a zone given
+ * by name, which is left to the common parser.
+ */
+static int
+ParseIpv6Fast(const char *text, size_t len, uint16_t port, InetAddress &addr)
+{
+    uint32_t    scope = 0;
+    const char *pZone = (const char *)memchr(text, '%', len);
+
+    if (pZone != NULL) {
+        size_t zoneLen = (size_t)(text + len - pZone - 1);
+
+        if (zoneLen == 0 || pZone[1] < '0' || pZone[1] > '9') {
+            return -1;
+        }
+        if (!ParseNumber(pZone + 1, zoneLen, 0xffffffffU, scope)) {
+            return 0;
+        }
+        len = (size_t)(pZone - text);
+    }
+
+    // "ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff" is the longest without a quad.
+    if (len < 2 || len > 39) {
+        return -1;
+    }
+
+    uint8_t  nibbles[48];
+    uint64_t colonMask = 0;
+    uint64_t used = (1ULL << len) - 1;
+
+#ifdef __SSE2__
+    uint64_t validMask = 0;
+
+    for (size_t b = 0; b < 3; b++) {
+        __m128i chars = 16 * b < len ? LoadText(text + 16 * b, len - 16 * b) : _mm_setzero_si128();
+        __m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+        __m128i letter = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+        __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+        __m128i isLetter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+        __m128i isColon = _mm_cmpeq_epi8(chars, _mm_set1_epi8(':'));
+        __m128i value = _mm_or_si128(_mm_and_si128(isDigit, digit),
+                                     _mm_and_si128(isLetter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+
+        _mm_storeu_si128((__m128i *)(nibbles + 16 * b), value);
+        colonMask |= (uint64_t)(uint32_t)_mm_movemask_epi8(isColon) << (16 * b);
+        validMask |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(isDigit, isLetter),
+                                                                         isColon)) << (16 * b);
+    }
+    if ((validMask & used) != used) {
+        return -1;
+    }
+    colonMask &= used;
+#else
+    for (size_t i = 0; i < len; i++) {
+        char c = text[i];
+
+        if (c == ':') {
+            colonMask |= 1ULL << i;
+        } else if (c >= '0' && c <= '9') {
+            nibbles[i] = (uint8_t)(c - '0');
+        } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+            nibbles[i] = (uint8_t)((c | 0x20) - 'a' + 10);
+        } else {
+            return -1;
+        }
+    }
+#endif
+
+    uint16_t groups[8];
+    int      count = 0;
+    int      gap = -1;
+    bool     afterGap = false;
+    uint32_t start = 0;
+
+    colonMask |= 1ULL << len;
+    if (text[0] == ':') {
+        if (text[1] != ':') {
+            return 0;
+        }
+        gap = 0;
+        afterGap = true;
+        start = 2;
+        colonMask &= ~3ULL;
+    }
+
+    for (;;) {
+        uint32_t end = (uint32_t)__builtin_ctzll(colonMask);
+        uint32_t width = end - start;
+
+        colonMask &= colonMask - 1;
+
+        // An empty group is the second colon of "::", or the end after one.
+        if (width == 0) {
+            if (end == len) {
+                if (!afterGap) {
+                    return 0;
+                }
+                break;
+            }
+            if (gap >= 0) {
+                return 0;
+            }
+            gap = count;
+            afterGap = true;
+            start = end + 1;
+            continue;
+        }
+        if (width > 4 || count == 8) {
+            return 0;
+        }
+
+        const uint8_t *pNibble = nibbles + start;
+        uint32_t       group = 0;
+
+        for (uint32_t i = 0; i < width; i++) {
+            group = (group << 4) | pNibble[i];
+        }
+        groups[count++] = (uint16_t)group;
+        afterGap = false;
+        if (end == len) {
+            break;
+        }
+        start = end + 1;
+    }
+
+    // "::" must stand for at least one group.
+    if (gap < 0 ? count != 8 : count == 8) {
+        return 0;
+    }
+
+    uint8_t bytes[16] = {};
+    int     head = gap < 0 ? count : gap;
+    int     skip = 8 - count;
+
+    for (int i = 0; i < count; i++) {
+        int slot = i < head ? i : i + skip;
+
+        bytes[2 * slot] = (uint8_t)(groups[i] >> 8);
+        bytes[2 * slot + 1] = (uint8_t)groups[i];
+    }
+    addr = InetAddress::FromIpv6(bytes, port, scope);
+    return 1;
+}
+
+bool
+ParseAddress(const char *text, size_t len, InetAddress &addr)
+{
+    if (len == 0 || len >= ADDRTEXT_MAX + IF_NAMESIZE) {
+        return false;
+    }
+
+    if (text[0] != '[') {
+        int rc = ParseIpv4Fast(text, len, addr);
+        if (rc < 0) {
+            rc = ParseIpv6Fast(text, len, 0, addr);
+        }
+        if (rc >= 0) {
+            return rc == 1;
+        }
+    } else {
+        const char *pClose = (const char *)memchr(text, ']', len);
+        uint32_t    port = 0;
+
+        if (pClose == NULL) {
+            return false;
+        }
+
+        size_t tail = (size_t)(text + len - pClose - 1);
+
+        if (tail == 0 || (pClose[1] == ':' && ParseNumber(pClose + 2, tail - 1, 65535, port))) {
+            int rc = ParseIpv6Fast(text + 1, (size_t)(pClose - text - 1), (uint16_t)port, addr);
+            if (rc >= 0) {
+                return rc == 1;
+            }
+        }
+    }
+
+    // A zone given as an interface name is replaced by its index so the
+    // remainder can go through the common parser.
+    const char *pZone = (const char *)memchr(text, '%', len);
+    if (pZone != NULL && pZone + 1 < text + len && (pZone[1] < '0' || pZone[1] > '9')) {
+        char        name[IF_NAMESIZE];
+        char        copy[ADDRTEXT_MAX + IF_NAMESIZE];
+        const char *pEnd = pZone + 1;
+        size_t      nameLen;
+
+        while (pEnd < text + len && *pEnd != ']') {
+            pEnd++;
+        }
+        nameLen = (size_t)(pEnd - pZone - 1);
+        if (nameLen >= IF_NAMESIZE) {
+            return false;
+        }
+        memcpy(name, pZone + 1, nameLen);
+        name[nameLen] = '\0';
+
+        unsigned int index = if_nametoindex(name);
+        if (index == 0) {
+            return false;
+        }
+
+        size_t head = (size_t)(pZone + 1 - text);
+        size_t tail = (size_t)(text + len - pEnd);
+        char   number[11];
+        size_t digits = 0;
+
+        do {
+            number[digits++] = (char)('0' + index % 10);
+            index /= 10;
+        } while (index != 0);
+
+        // A short name can be replaced by a longer index.
+        if (head + digits + tail > sizeof(copy)) {
+            return false;
+        }
+        memcpy(copy, text, head);
+        for (size_t i = 0; i < digits; i++) {
+            copy[head + i] = number[digits - 1 - i];
+        }
+        memcpy(copy + head + digits, pEnd, tail);
+        return InetAddress::TryParse(copy, head + digits + tail, addr);
+    }
+
+    return InetAddress::TryParse(text, len, addr);
+}
+
+static char *
+FormatDecimal(char *pOut, uint32_t value)
+{
+    char   digits[10];
+    size_t count = 0;
+
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    while (count != 0) {
+        *pOut++ = digits[--count];
+    }
+    return pOut;
+}
+
+static char *
+FormatOctet(char *pOut, uint32_t octet)
+{
+    if (octet >= 100) {
+        *pOut++ = (char)('0' + octet / 100);
+        octet %= 100;
+        *pOut++ = (char)('0' + octet / 10);
+    } else if (octet >= 10) {
+        *pOut++ = (char)('0' + octet / 10);
+    }
+    *pOut++ = (char)('0' + octet % 10);
+    return pOut;
+}
+
+static char *
+FormatQuad(char *pOut, const uint8_t *pBytes)
+{
+    pOut = FormatOctet(pOut, pBytes[0]);
+    *pOut++ = '.';
+    pOut = FormatOctet(pOut, pBytes[1]);
+    *pOut++ = '.';
+    pOut = FormatOctet(pOut, pBytes[2]);
+    *pOut++ = '.';
+    return FormatOctet(pOut, pBytes[3]);
+}
+
+static char *
+FormatIpv6(char *pOut, const uint8_t *pBytes)
+{
+    uint32_t groups[8];
+    int      bestStart = -1;
+    int      bestLen = 1;
+    int      runStart = -1;
+
+    for (int i = 0; i < 8; i++) {
+        groups[i] = ((uint32_t)pBytes[2 * i] << 8) | pBytes[2 * i + 1];
+    }
+
+    // RFC 5952: compress the first longest run of two or more zero groups.
+    for (int i = 0; i <= 8; i++) {
+        if (i < 8 && groups[i] == 0) {
+            if (runStart < 0) {
+                runStart = i;
+            }
+        } else if (runStart >= 0) {
+            if (i - runStart > bestLen) {
+                bestStart = runStart;
+                bestLen = i - runStart;
+            }
+            runStart = -1;
+        }
+    }
+
+    bool mapped = (bestStart == 0 && bestLen == 5 && groups[5] == 0xffff);
+
+    for (int i = 0; i < 8; i++) {
+        if (i == bestStart) {
+            *pOut++ = ':';
+            if (i == 0) {
+                *pOut++ = ':';
+            }
+            i += bestLen - 1;
+            continue;
+        }
+
+        if (mapped && i == 6) {
+            return FormatQuad(pOut, pBytes + 12);
+        }
+
+        uint32_t group = groups[i];
+        int      shift = (group == 0) ? 0 : ((31 - __builtin_clz(group)) & ~3);
+
+        for (; shift >= 0; shift -= 4) {
+            *pOut++ = s_hexDigits[(group >> shift) & 0xf];
+        }
+        if (i != 7) {
+            *pOut++ = ':';
+        }
+    }
+    return pOut;
+}
+
+size_t
+FormatAddress(const InetAddress &addr, char *buff, size_t len, int flags)
+{
+    char  text[ADDRTEXT_MAX];
+    char *pOut = text;
+    bool  withPort = (flags & ADDRTEXT_WITH_PORT) != 0;
+
+    if (addr.IsIpv6()) {
+        if (withPort) {
+            *pOut++ = '[';
+        }
+        pOut = FormatIpv6(pOut, addr.GetBytes());
+        if (addr.GetScopeId() != 0) {
+            *pOut++ = '%';
+            pOut = FormatDecimal(pOut, addr.GetScopeId());
+        }
+        if (withPort) {
+            *pOut++ = ']';
+        }
+    } else {
+        pOut = FormatQuad(pOut, addr.GetBytes());
+    }
+
+    if (withPort) {
+        *pOut++ = ':';
+        pOut = FormatDecimal(pOut, addr.GetPortNumber());
+    }
+
+    size_t textLen = (size_t)(pOut - text);
+    if (textLen >= len) {
+        return 0;
+    }
+    memcpy(buff, text, textLen);
+    buff[textLen] = '\0';
+    return textLen;
+}
@@ -0,0 +1,64 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Conversion of IP addresses to and from text without allocation
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef ADDRTEXT_HPP
+#define ADDRTEXT_HPP
+
+#include <cstddef>
+#include "inetaddr.hpp"
+
+/***
+ * Buffer size that holds the longest string FormatAddress() can produce,
+ * "[ffff:ffff:ffff:ffff:ffff:ffff:255.255.255.255%4294967295]:65535" plus the NUL.
+ */
+#define ADDRTEXT_MAX    68
+
+/***
+ * Format flags for FormatAddress().
+ */
+enum AddrTextFlags {
+    ADDRTEXT_ADDR_ONLY = 0,     // Address and zone only
+    ADDRTEXT_WITH_PORT = 1,     // Append :port, bracketing IPv6 addresses
+};
+
+/***
+ * Parse an address in any form accepted by InetAddress::Parse(). A zone may also
+ * be an interface name such as "fe80::1%eth0". The routine keeps no state and
+ * may be called from any number of threads.
+ *
+ * @param[IN]  text - Address string, need not be NUL terminated.
+ * @param[IN]  len  - Length of the string.
+ * @param[OUT] addr - Receives the parsed address.
+ *
+ * @return true on success, false if the text is not a valid address.
+ */
+bool    ParseAddress(const char *text, size_t len, InetAddress &addr);
+
+/***
+ * Write the address in dot or RFC 5952 colon notation into a caller supplied buffer.
+ * The routine keeps no state and may be called from any number of threads.
+ *
+ * @param[IN]  addr  - Address to format.
+ * @param[OUT] buff  - Output buffer, ADDRTEXT_MAX bytes is always sufficient.
+ * @param[IN]  len   - Size of the output buffer.
+ * @param[IN]  flags - ADDRTEXT_WITH_PORT to append the port number.
+ *
+ * @return Length of the string excluding the NUL, or 0 if the buffer is too small.
+ */
+size_t  FormatAddress(const InetAddress &addr, char *buff, size_t len,
+                      int flags = ADDRTEXT_ADDR_ONLY);
+
+#endif
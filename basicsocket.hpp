@@ -0,0 +1,349 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Sockets whose address family and protocol are fixed at compile time
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef BASICSOCKET_HPP
+#define BASICSOCKET_HPP
+
+#include <stdint.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "inetaddr.hpp"
+#include "socktap.hpp"
+
+/***
+ * Address families for BasicEndpoint and BasicSocket. Each names its sockaddr
+ * type and gives direct access to the fields that Socket reaches through a
+ * branch on sa_family.
+ */
+struct Ipv4
+{
+    typedef sockaddr_in SockAddr;
+
+    static constexpr int FAMILY = AF_INET;
+
+    static in_port_t   &Port(SockAddr &sa) { return sa.sin_port; }
+    static in_port_t    Port(const SockAddr &sa) { return sa.sin_port; }
+    static void         SetAny(SockAddr &sa) { sa.sin_addr.s_addr = htonl(INADDR_ANY); }
+
+    static InetAddress  ToInet(const SockAddr &sa)
+    {
+        return InetAddress::FromIpv4(ntohl(sa.sin_addr.s_addr), ntohs(sa.sin_port));
+    }
+};
+
+struct Ipv6
+{
+    typedef sockaddr_in6 SockAddr;
+
+    static constexpr int FAMILY = AF_INET6;
+
+    static in_port_t   &Port(SockAddr &sa) { return sa.sin6_port; }
+    static in_port_t    Port(const SockAddr &sa) { return sa.sin6_port; }
+    static void         SetAny(SockAddr &sa) { sa.sin6_addr = in6addr_any; }
+
+    static InetAddress  ToInet(const SockAddr &sa) { return InetAddress::FromSockAddr((const sockaddr *)&sa); }
+};
+
+/***
+ * Protocols for BasicSocket. STREAM selects which operations compile.
+ */
+struct Tcp
+{
+    static constexpr int  TYPE = SOCK_STREAM;
+    static constexpr int  PROTOCOL = IPPROTO_TCP;
+    static constexpr bool STREAM = true;
+};
+
+struct Udp
+{
+    static constexpr int  TYPE = SOCK_DGRAM;
+    static constexpr int  PROTOCOL = IPPROTO_UDP;
+    static constexpr bool STREAM = false;
+};
+
+/***
+ * @class Socket address of one family. The structure is held by value and its
+ *        size is a constant, so nothing here branches on the family.
+ */
+template<typename Family>
+class BasicEndpoint
+{
+public:
+    typedef typename Family::SockAddr SockAddr;
+
+    static constexpr socklen_t SIZE = sizeof(SockAddr);
+
+    /***
+     * Construct the wildcard address with port 0.
+     */
+                        BasicEndpoint()
+    {
+        memset(&m_addr, 0, sizeof(m_addr));
+        ((sockaddr *)&m_addr)->sa_family = Family::FAMILY;
+        Family::SetAny(m_addr);
+    }
+
+    /***
+     * Construct from an InetAddress.
+     *
+     * @throws std::invalid_argument if the address is of the other family.
+     */
+    explicit            BasicEndpoint(const InetAddress &addr)
+    {
+        InetSockAddr sa;
+
+        if (addr.GetAddrFamily() != Family::FAMILY) {
+            throw std::invalid_argument("address family does not match the endpoint");
+        }
+        addr.ToSockAddr(sa);
+        memcpy(&m_addr, &sa, sizeof(m_addr));
+    }
+
+    uint16_t            GetPortNumber() const { return ntohs(Family::Port(m_addr)); }
+    void                SetPortNumber(uint16_t port) { Family::Port(m_addr) = htons(port); }
+    void                SetAddressAny() { Family::SetAny(m_addr); }
+
+    InetAddress         ToInetAddress() const { return Family::ToInet(m_addr); }
+
+    sockaddr           *Get() { return (sockaddr *)&m_addr; }
+    const sockaddr     *Get() const { return (const sockaddr *)&m_addr; }
+
+private:
+    SockAddr            m_addr;
+};
+
+/***
+ * @class Socket whose address family and protocol are template arguments, so
+ *        that addresses need no runtime family checks and the calls are inlined
+ *        here. Operations that the protocol does not support, such as Listen()
+ *        on UDP or SendTo() on TCP, fail to compile instead of failing with
+ *        EOPNOTSUPP. Errors throw std::system_error as Socket does, and the
+ *        operations are reported to an active SocketTap.
+ *
+ *        Socket remains the class to use when the family or type is only known
+ *        at run time. Release() hands the descriptor over to a Socket:
+ *
+ *            TcpSocket4 sock;
+ *            sock.Connect(Endpoint4(InetAddress::Parse("10.0.0.1:80")));
+ *            Socket legacy(sock.Release());
+ */
+template<typename Family, typename Protocol>
+class BasicSocket
+{
+public:
+    typedef BasicEndpoint<Family> Endpoint;
+
+    /***
+     * Class constructor. Opens a new socket.
+     *
+     * @throws std::system_error if the socket cannot be created.
+     */
+                        BasicSocket()
+    {
+        if ((m_sockfd = socket(Family::FAMILY, Protocol::TYPE, Protocol::PROTOCOL)) < 0)
+        {
+	    throw std::system_error(errno, std::system_category());
+        }
+    }
+
+    /***
+     * Take ownership of an open descriptor of the right family and protocol.
+     */
+    explicit            BasicSocket(int sockfd) : m_sockfd(sockfd) {}
+
+                        BasicSocket(BasicSocket &&other) : m_sockfd(other.m_sockfd)
+    {
+        other.m_sockfd = -1;
+    }
+
+                        ~BasicSocket()
+    {
+        Close();
+    }
+
+    BasicSocket        &operator=(BasicSocket &&other)
+    {
+        if (this != &other) {
+            Close();
+            m_sockfd = other.m_sockfd;
+            other.m_sockfd = -1;
+        }
+        return *this;
+    }
+
+    int                 Connect(const Endpoint &addr)
+    {
+        return Check(connect(m_sockfd, addr.Get(), Endpoint::SIZE));
+    }
+
+    int                 Bind(const Endpoint &addr)
+    {
+        return Check(bind(m_sockfd, addr.Get(), Endpoint::SIZE));
+    }
+
+    int                 Listen(int backlog)
+    {
+        static_assert(Protocol::STREAM, "Listen() needs a stream protocol");
+        return Check(listen(m_sockfd, backlog));
+    }
+
+    /***
+     * Accept a connection.
+     *
+     * @param[OUT] remote - Receives the accepted socket, closing what it held.
+     * @param[OUT] peer   - Receives the address of the peer.
+     */
+    int                 Accept(BasicSocket &remote, Endpoint &peer)
+    {
+        static_assert(Protocol::STREAM, "Accept() needs a stream protocol");
+        socklen_t len = Endpoint::SIZE;
+        int       fd = Check(accept(m_sockfd, peer.Get(), &len));
+
+        remote = BasicSocket(fd);
+        return fd;
+    }
+
+    int                 Send(const void *buff, int len, uint32_t flags)
+    {
+        int bytes = Check(send(m_sockfd, buff, len, flags));
+
+        Report(TAP_SEND, buff, bytes, NULL);
+        return bytes;
+    }
+
+    int                 Recv(void *buff, int len, uint32_t flags)
+    {
+        int bytes = Check(recv(m_sockfd, buff, len, flags));
+
+        Report(TAP_RECV, buff, bytes, NULL);
+        return bytes;
+    }
+
+    int                 SendTo(const void *buff, int len, uint32_t flags, const Endpoint &peer)
+    {
+        static_assert(!Protocol::STREAM, "SendTo() needs a datagram protocol");
+        int bytes = Check(sendto(m_sockfd, buff, len, flags, peer.Get(), Endpoint::SIZE));
+
+        Report(TAP_SEND, buff, bytes, &peer);
+        return bytes;
+    }
+
+    int                 RecvFrom(void *buff, int len, uint32_t flags, Endpoint &peer)
+    {
+        static_assert(!Protocol::STREAM, "RecvFrom() needs a datagram protocol");
+        socklen_t saLen = Endpoint::SIZE;
+        int       bytes = Check(recvfrom(m_sockfd, buff, len, flags, peer.Get(), &saLen));
+
+        Report(TAP_RECV, buff, bytes, &peer);
+        return bytes;
+    }
+
+    /***
+     * Turn Nagle's algorithm off or on.
+     */
+    int                 SetNoDelay(bool on)
+    {
+        static_assert(Protocol::PROTOCOL == IPPROTO_TCP, "SetNoDelay() needs TCP");
+        int value = on ? 1 : 0;
+
+        return SetSockOpt(IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+    }
+
+    int                 GetSockOpt(int level, int optName, void *optVal, socklen_t *optLen)
+    {
+        return Check(getsockopt(m_sockfd, level, optName, optVal, optLen));
+    }
+
+    int                 SetSockOpt(int level, int optName, const void *optVal, socklen_t optLen)
+    {
+        return Check(setsockopt(m_sockfd, level, optName, optVal, optLen));
+    }
+
+    int                 GetSockName(Endpoint &addr)
+    {
+        socklen_t len = Endpoint::SIZE;
+
+        return Check(getsockname(m_sockfd, addr.Get(), &len));
+    }
+
+    int                 GetDescriptor() const { return m_sockfd; }
+
+    /***
+     * Give up ownership of the descriptor, for instance to a Socket.
+     */
+    int                 Release()
+    {
+        int fd = m_sockfd;
+
+        m_sockfd = -1;
+        return fd;
+    }
+
+private:
+                        BasicSocket(const BasicSocket &);
+    BasicSocket        &operator=(const BasicSocket &);
+
+    static int          Check(int rc)
+    {
+        if (rc < 0)
+        {
+	    throw std::system_error(errno, std::system_category());
+        }
+        return rc;
+    }
+
+    void                Report(int direction, const void *buff, int bytes, const Endpoint *pPeer)
+    {
+        SocketTap *pTap = SocketTap::Active();
+
+        if (pTap != NULL) {
+            InetAddress peer;
+
+            if (pPeer != NULL) {
+                peer = pPeer->ToInetAddress();
+            }
+            pTap->Capture(m_sockfd, direction, buff, bytes, pPeer != NULL ? &peer : NULL);
+        }
+    }
+
+    void                Close()
+    {
+        if (m_sockfd >= 0) {
+            if (SocketTap::Active() != NULL) {
+                SocketTap::Forget(m_sockfd);
+            }
+            close(m_sockfd);
+            m_sockfd = -1;
+        }
+    }
+
+    int                 m_sockfd;
+};
+
+typedef BasicEndpoint<Ipv4>         Endpoint4;
+typedef BasicEndpoint<Ipv6>         Endpoint6;
+typedef BasicSocket<Ipv4, Tcp>      TcpSocket4;
+typedef BasicSocket<Ipv6, Tcp>      TcpSocket6;
+typedef BasicSocket<Ipv4, Udp>      UdpSocket4;
+typedef BasicSocket<Ipv6, Udp>      UdpSocket6;
+
+#endif
@@ -0,0 +1,201 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+ParseAddress and FormatAddress against inet_pton and inet_ntop
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * addrtextbench [rounds]
+ *
+ *   g++ -std=c++14 -O2 -I. bench/addrtextbench.cpp addrtext.cpp -o addrtextbench
+ *
+ * Parses and formats 4096 random addresses of each kind rounds times (200 by
+ * default) and prints the nanoseconds per address:
+ *
+ *   ipv4         - "a.b.c.d"
+ *   ipv6 full    - eight groups, no zero run to compress
+ *   ipv6 zeros   - a zero run of two to six groups, written with "::"
+ *   ipv4 port    - "a.b.c.d:port"
+ *   ipv6 port    - "[addr%scope]:port"
+ *
+ * The first three are also run through inet_pton() and inet_ntop(), which
+ * have no port or scope forms, and every address is checked to parse to the
+ * same bytes. Formatting is checked to give the same text as inet_ntop();
+ * any difference is counted and the first one printed.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+
+#include "addrtext.hpp"
+
+static const int ADDRESSES = 4096;
+
+enum Kind { IPV4, IPV6_FULL, IPV6_ZEROS, IPV4_PORT, IPV6_PORT };
+
+static volatile size_t s_sink;
+
+static double
+NsPer(std::chrono::steady_clock::time_point start, long count)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+           count;
+}
+
+static std::string
+Generate(Kind kind, std::mt19937 &rng)
+{
+    char     buff[ADDRTEXT_MAX];
+    uint16_t groups[8];
+
+    if (kind == IPV4 || kind == IPV4_PORT) {
+        snprintf(buff, sizeof(buff), "%u.%u.%u.%u", (unsigned)(rng() % 256), (unsigned)(rng() % 256),
+                 (unsigned)(rng() % 256), (unsigned)(rng() % 256));
+        if (kind == IPV4_PORT) {
+            snprintf(buff + strlen(buff), sizeof(buff) - strlen(buff), ":%u", (unsigned)(1 + rng() % 65535));
+        }
+        return buff;
+    }
+
+    for (int i = 0; i < 8; i++) {
+        groups[i] = (uint16_t)(1 + rng() % 0xfffe);
+    }
+    if (kind != IPV6_FULL) {
+        int run = 2 + rng() % 5;
+        // Six leading zero groups would be an IPv4 compatible address,
+        // which inet_ntop() writes in dotted form and RFC 5952 does not.
+        int start = run == 6 ? 1 + rng() % 2 : rng() % (9 - run);
+
+        memset(groups + start, 0, run * sizeof(groups[0]));
+    }
+
+    unsigned char bytes[16];
+    char          text[INET6_ADDRSTRLEN];
+
+    for (int i = 0; i < 8; i++) {
+        bytes[2 * i] = groups[i] >> 8;
+        bytes[2 * i + 1] = groups[i] & 0xff;
+    }
+    inet_ntop(AF_INET6, bytes, text, sizeof(text));
+    if (kind == IPV6_PORT) {
+        snprintf(buff, sizeof(buff), "[%s%%%u]:%u", text, (unsigned)(1 + rng() % 16),
+                 (unsigned)(1 + rng() % 65535));
+        return buff;
+    }
+    return text;
+}
+
+static void
+Run(const char *name, Kind kind, long rounds, std::mt19937 &rng)
+{
+    std::vector<std::string> texts;
+    std::vector<InetAddress> addrs(ADDRESSES);
+    bool                     libc = kind == IPV4 || kind == IPV6_FULL || kind == IPV6_ZEROS;
+    int                      family = kind == IPV4 || kind == IPV4_PORT ? AF_INET : AF_INET6;
+    int                      flags = libc ? ADDRTEXT_ADDR_ONLY : ADDRTEXT_WITH_PORT;
+    char                     buff[ADDRTEXT_MAX];
+    unsigned char            bytes[16];
+    long                     count = rounds * ADDRESSES;
+    size_t                   sum = 0;
+    int                      mismatches = 0;
+
+    for (int i = 0; i < ADDRESSES; i++) {
+        texts.push_back(Generate(kind, rng));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (long r = 0; r < rounds; r++) {
+        for (int i = 0; i < ADDRESSES; i++) {
+            sum += ParseAddress(texts[i].data(), texts[i].size(), addrs[i]);
+        }
+    }
+    double parse = NsPer(start, count);
+
+    start = std::chrono::steady_clock::now();
+    for (long r = 0; r < rounds; r++) {
+        for (int i = 0; i < ADDRESSES; i++) {
+            sum += FormatAddress(addrs[i], buff, sizeof(buff), flags);
+        }
+    }
+    double format = NsPer(start, count);
+
+    for (int i = 0; i < ADDRESSES; i++) {
+        size_t len = FormatAddress(addrs[i], buff, sizeof(buff), flags);
+
+        if (std::string(buff, len) != texts[i] && mismatches++ == 0) {
+            printf("  round trip: %s -> %s\n", texts[i].c_str(), buff);
+        }
+    }
+
+    printf("%-11s parse %6.1f ns  format %6.1f ns", name, parse, format);
+    if (!libc) {
+        printf("\n");
+    } else {
+        start = std::chrono::steady_clock::now();
+        for (long r = 0; r < rounds; r++) {
+            for (int i = 0; i < ADDRESSES; i++) {
+                sum += inet_pton(family, texts[i].c_str(), bytes);
+            }
+        }
+        double pton = NsPer(start, count);
+
+        start = std::chrono::steady_clock::now();
+        for (long r = 0; r < rounds; r++) {
+            for (int i = 0; i < ADDRESSES; i++) {
+                sum += inet_ntop(family, addrs[i].GetBytes(), buff, sizeof(buff)) != NULL;
+            }
+        }
+        double ntop = NsPer(start, count);
+
+        printf("   inet_pton %6.1f ns  inet_ntop %6.1f ns   (%.1fx, %.1fx)\n", pton, ntop, pton / parse,
+               ntop / format);
+
+        for (int i = 0; i < ADDRESSES; i++) {
+            size_t len = FormatAddress(addrs[i], buff, sizeof(buff));
+            char   text[INET6_ADDRSTRLEN];
+
+            inet_pton(family, texts[i].c_str(), bytes);
+            inet_ntop(family, bytes, text, sizeof(text));
+            if ((memcmp(bytes, addrs[i].GetBytes(), family == AF_INET ? 4 : 16) != 0 ||
+                 std::string(buff, len) != text) && mismatches++ == 0) {
+                printf("  differs from libc: %s -> %s, inet_ntop %s\n", texts[i].c_str(), buff, text);
+            }
+        }
+    }
+    if (mismatches != 0) {
+        printf("  %d mismatches\n", mismatches);
+    }
+    s_sink = sum;
+}
+
+int
+main(int argc, char *argv[])
+{
+    long         rounds = argc > 1 ? atol(argv[1]) : 200;
+    std::mt19937 rng(1);
+
+    printf("%d addresses of each kind, %ld rounds\n", ADDRESSES, rounds);
+    Run("ipv4", IPV4, rounds, rng);
+    Run("ipv6 full", IPV6_FULL, rounds, rng);
+    Run("ipv6 zeros", IPV6_ZEROS, rounds, rng);
+    Run("ipv4 port", IPV4_PORT, rounds, rng);
+    Run("ipv6 port", IPV6_PORT, rounds, rng);
+    return 0;
+}
@@ -0,0 +1,166 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+GetOpt argv permutation and response file benchmark
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * argvbench [entries]
+ *
+ *   g++ -std=c++14 -O2 -Igetopt_windows bench/argvbench.cpp \
+ *       getopt_windows/getopt.cpp getopt_windows/respfile.cpp -o argvbench
+ *
+ * Parses argv vectors of increasing size, up to entries elements (1M by
+ * default), in which options and operands alternate. That is the worst case
+ * for moving operands to the end. The same arguments are then read from a
+ * response file. Every run checks that all options and operands came out in
+ * order.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "getopt.h"
+
+static double
+Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * Build "prog -v f0 -o x f1 -v f2 ..." with count elements after the program name.
+ */
+static void
+BuildArgs(int count, std::vector<std::string> &storage, std::vector<char *> &argv)
+{
+    storage.clear();
+    storage.push_back("prog");
+    for (int i = 0; storage.size() <= (size_t)count; i++) {
+        if (i % 3 == 1 && storage.size() + 1 <= (size_t)count) {
+            storage.push_back("-o");
+            storage.push_back("x" + std::to_string(i));
+        } else {
+            storage.push_back(i % 2 == 0 ? "-v" : "f" + std::to_string(i));
+        }
+    }
+
+    argv.clear();
+    for (size_t i = 0; i < storage.size(); i++) {
+        argv.push_back(&storage[i][0]);
+    }
+    argv.push_back(NULL);
+}
+
+/*
+ * Parse with GetOpt and check every option and operand against the original order.
+ */
+static bool
+Parse(GetOpt &parser, const std::vector<std::string> &storage, size_t &options)
+{
+    std::vector<const char *> operands;
+    int                       opt;
+
+    for (size_t i = 1; i < storage.size(); i++) {
+        if (storage[i][0] != '-' && storage[i - 1] != "-o") {
+            operands.push_back(storage[i].c_str());
+        }
+    }
+
+    options = 0;
+    while ((opt = parser.getopt(NULL)) != -1) {
+        if (opt != 'v' && opt != 'o') {
+            return false;
+        }
+        options++;
+    }
+
+    if (parser.argc() - parser.optind != (int)operands.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < operands.size(); i++) {
+        if (strcmp(parser.argv()[parser.optind + i], operands[i]) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int                      entries = argc > 1 ? atoi(argv[1]) : 1000000;
+    std::vector<std::string> storage;
+    std::vector<char *>      args;
+    size_t                   options;
+    bool                     ok = true;
+
+    printf("%-10s %10s %10s\n", "entries", "seconds", "ns/arg");
+    for (int n = 1024; n <= entries; n = (n < entries / 16 || n == entries) ? n * 16 : entries) {
+        BuildArgs(n, storage, args);
+
+        auto   start = std::chrono::steady_clock::now();
+        GetOpt parser((int)args.size() - 1, &args[0], "vo:", NULL);
+        ok &= Parse(parser, storage, options);
+        double seconds = Seconds(start);
+
+        printf("%-10d %10.4f %10.1f\n", n, seconds, seconds * 1e9 / n);
+    }
+
+    // The same arguments from a response file, expanded lazily.
+    char path[] = "/tmp/argvbenchXXXXXX";
+    int  fd = mkstemp(path);
+    FILE *fp = fd >= 0 ? fdopen(fd, "w") : NULL;
+
+    if (fp == NULL) {
+        perror("mkstemp");
+        return 1;
+    }
+    BuildArgs(entries, storage, args);
+    for (size_t i = 1; i < storage.size(); i++) {
+        fprintf(fp, "%s\n", storage[i].c_str());
+    }
+    fclose(fp);
+
+    std::string  at = std::string("@") + path;
+    char        *fileArgs[] = { &storage[0][0], &at[0], NULL };
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        ArgStream stream(1, &fileArgs[1]);
+        size_t    count = 0;
+
+        while (stream.Next() != NULL) {
+            count++;
+        }
+        ok &= count == storage.size() - 1;
+    }
+    double streamed = Seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    {
+        GetOpt parser(2, fileArgs, "vo:", NULL, true);
+        ok &= Parse(parser, storage, options);
+    }
+    double parsed = Seconds(start);
+    unlink(path);
+
+    printf("@file, %d entries: ArgStream %.4f s, GetOpt %.4f s\n", entries, streamed, parsed);
+    printf("%s\n", ok ? "all arguments in order" : "MISMATCH");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+UDP ping-pong latency and CPU with AdaptiveReceiver against poll()
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * busypollbench [rounds [maxSpinUs]]
+ *
+ *   g++ -std=c++14 -O2 -pthread -I. bench/busypollbench.cpp busypoll.cpp socket.cpp \
+ *       sockaddr.cpp ipaddr.cpp addrtext.cpp socktap.cpp -o busypollbench
+ *
+ * Bounces a 64 byte datagram off an echo thread on loopback for rounds round
+ * trips (50000 by default), waiting for each reply first with
+ * Socket::Recv() and a timeout, which goes straight to poll(), and then with
+ * an AdaptiveReceiver spinning for up to maxSpinUs (50). For each it reports
+ * the round trip percentiles and the client thread's CPU time per round trip;
+ * for the AdaptiveReceiver also how the replies were caught and the time
+ * spinning (wall and CPU) and blocked.
+ *
+ * AdaptiveReceiver does not spin on a single CPU host, where the echo thread
+ * could not run while it did; the two runs are then the same path.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "busypoll.hpp"
+
+static const int MESSAGE_SIZE = 64;
+
+static uint64_t
+ClockNs(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Answer every datagram until an empty one arrives.
+ */
+static void
+Echo(Socket *pSock)
+{
+    char        buff[MESSAGE_SIZE];
+    InetAddress from;
+
+    for (;;) {
+        int bytes = pSock->RecvFrom(buff, sizeof(buff), 0, from);
+
+        if (bytes <= 0) {
+            return;
+        }
+        pSock->SendTo(buff, bytes, 0, from);
+    }
+}
+
+static void
+Report(const char *name, std::vector<double> &rtt, uint64_t cpuNs)
+{
+    std::sort(rtt.begin(), rtt.end());
+    printf("%-18s p50 %6.1f us  p90 %6.1f us  p99 %6.1f us  p99.9 %7.1f us  cpu %6.1f us/rt\n", name,
+           rtt[rtt.size() / 2], rtt[rtt.size() * 9 / 10], rtt[rtt.size() * 99 / 100],
+           rtt[rtt.size() * 999 / 1000], cpuNs / 1000.0 / rtt.size());
+}
+
+int
+main(int argc, char *argv[])
+{
+    int         rounds = argc > 1 ? atoi(argv[1]) : 50000;
+    uint32_t    maxSpinUs = argc > 2 ? (uint32_t)atoi(argv[2]) : 50;
+    Socket      echo(false, SOCK_DGRAM);
+    Socket      client(false, SOCK_DGRAM);
+    InetAddress to = InetAddress::FromIpv4(INADDR_LOOPBACK);
+    char        buff[MESSAGE_SIZE] = { 0 };
+
+    echo.Bind(to);
+    echo.GetSockName(to);
+    client.Connect(to);
+    std::thread echoThread(Echo, &echo);
+
+    printf("%d round trips of %d bytes, spin up to %u us, %u cores\n", rounds, MESSAGE_SIZE, maxSpinUs,
+           std::thread::hardware_concurrency());
+
+    {
+        std::vector<double> rtt;
+        uint64_t            cpuStart = ClockNs(CLOCK_THREAD_CPUTIME_ID);
+
+        for (int i = 0; i < rounds; i++) {
+            uint64_t start = ClockNs(CLOCK_MONOTONIC);
+
+            client.Send(buff, sizeof(buff), 0);
+            client.Recv(buff, sizeof(buff), 0, 1000);
+            rtt.push_back((ClockNs(CLOCK_MONOTONIC) - start) / 1000.0);
+        }
+        Report("Socket::Recv", rtt, ClockNs(CLOCK_THREAD_CPUTIME_ID) - cpuStart);
+    }
+
+    {
+        AdaptiveReceiver    receiver(client, maxSpinUs);
+        std::vector<double> rtt;
+        uint64_t            cpuStart = ClockNs(CLOCK_THREAD_CPUTIME_ID);
+
+        for (int i = 0; i < rounds; i++) {
+            uint64_t start = ClockNs(CLOCK_MONOTONIC);
+
+            client.Send(buff, sizeof(buff), 0);
+            receiver.Recv(buff, sizeof(buff), 0, 1000);
+            rtt.push_back((ClockNs(CLOCK_MONOTONIC) - start) / 1000.0);
+        }
+        Report("AdaptiveReceiver", rtt, ClockNs(CLOCK_THREAD_CPUTIME_ID) - cpuStart);
+
+        const AdaptiveReceiver::Stats &stats = receiver.GetStats();
+        printf("  %llu immediate, %llu spin hits, %llu spin misses, %llu blocked, %llu timeouts\n",
+               (unsigned long long)stats.immediate, (unsigned long long)stats.spinHits,
+               (unsigned long long)stats.spinMisses, (unsigned long long)stats.blocked,
+               (unsigned long long)stats.timeouts);
+        printf("  spinning %.1f ms wall, %.1f ms cpu (spinCpuNs); blocked %.1f ms (blockNs)\n",
+               stats.spinNs / 1e6, stats.spinCpuNs / 1e6, stats.blockNs / 1e6);
+    }
+
+    client.Send(buff, 0, 0);
+    echoThread.join();
+    return 0;
+}
@@ -0,0 +1,153 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Bytes per idle connection in a ConnectionTable against Socket objects
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * conntablebench [connections...]
+ *
+ *   g++ -std=c++14 -O2 -I. bench/conntablebench.cpp connection.cpp socket.cpp \
+ *       sockaddr.cpp ipaddr.cpp addrtext.cpp socktap.cpp -o conntablebench
+ *
+ * Fills a ConnectionTable with 100000 and 1000000 idle connections, or the
+ * counts given, once grown one Add() at a time and once reserved up front,
+ * and reports the heap bytes per connection as malloc counts them and as
+ * MemoryUsage() reports them. The entries get descriptor numbers above the
+ * process limit, which are never open: the table's memory does not depend on
+ * the descriptor, and a million real connections would need two million
+ * sockets. Closing them at the end fails harmlessly.
+ *
+ * For comparison it opens 5000 loopback connections and measures a Socket
+ * object per connection, and the cold record a ConnectionTable builds when
+ * a connection's peer address is asked for.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <malloc.h>
+#include <vector>
+#include <netinet/in.h>
+
+#include "connection.hpp"
+
+static const int PLACEHOLDER_FD = 1 << 24;
+static const int REAL_CONNECTIONS = 5000;
+
+static size_t
+HeapBytes()
+{
+    struct mallinfo2 info = mallinfo2();
+
+    return info.uordblks + info.hblkhd;
+}
+
+static void
+Fill(size_t count, bool reserve)
+{
+    size_t           before = HeapBytes();
+    ConnectionTable *pTable = new ConnectionTable(reserve ? count : 0);
+
+    for (size_t i = 0; i < count; i++) {
+        pTable->Add(PLACEHOLDER_FD + (int)i);
+    }
+
+    double heap = (double)(HeapBytes() - before) / count;
+    double usage = (double)pTable->MemoryUsage() / count;
+
+    printf("%-9zu %-8s %8.1f bytes/conn heap  %8.1f bytes/conn MemoryUsage()\n", count,
+           reserve ? "reserved" : "grown", heap, usage);
+    delete pTable;
+}
+
+int
+main(int argc, char *argv[])
+{
+    std::vector<size_t> counts;
+
+    for (int i = 1; i < argc; i++) {
+        counts.push_back(strtoul(argv[i], NULL, 10));
+    }
+    if (counts.empty()) {
+        counts.push_back(100000);
+        counts.push_back(1000000);
+    }
+
+    printf("ConnectionTable, idle connections (HotState is %zu bytes)\n", sizeof(ConnectionTable::HotState));
+    for (size_t i = 0; i < counts.size(); i++) {
+        Fill(counts[i], false);
+        Fill(counts[i], true);
+    }
+
+    Socket      listener(false, SOCK_STREAM);
+    InetAddress addr = InetAddress::FromIpv4(INADDR_LOOPBACK);
+
+    listener.Bind(addr);
+    listener.Listen(128);
+    listener.GetSockName(addr);
+
+    // Socket objects as a server without the table would hold them.
+    {
+        std::vector<Socket *> clients;
+        std::vector<Socket *> accepted;
+        size_t                bytes = 0;
+
+        clients.reserve(REAL_CONNECTIONS);
+        accepted.reserve(REAL_CONNECTIONS);
+        for (int i = 0; i < REAL_CONNECTIONS; i++) {
+            clients.push_back(new Socket(false, SOCK_STREAM));
+            clients.back()->Connect(addr);
+
+            size_t before = HeapBytes();
+
+            accepted.push_back(new Socket(false, SOCK_STREAM));
+            listener.Accept(*accepted.back());
+            bytes += HeapBytes() - before;
+        }
+        printf("Socket objects: %.1f bytes/conn heap (sizeof(Socket) is %zu)\n", (double)bytes / REAL_CONNECTIONS,
+               sizeof(Socket));
+
+        for (int i = 0; i < REAL_CONNECTIONS; i++) {
+            delete accepted[i];
+            delete clients[i];
+        }
+    }
+
+    // Cold records, built only for connections whose peer is asked for.
+    {
+        std::vector<Socket *>   clients;
+        std::vector<ConnHandle> handles;
+        ConnectionTable         table(REAL_CONNECTIONS);
+        size_t                  before;
+        size_t                  usage;
+
+        for (int i = 0; i < REAL_CONNECTIONS; i++) {
+            clients.push_back(new Socket(false, SOCK_STREAM));
+            clients.back()->Connect(addr);
+            handles.push_back(table.Accept(listener));
+        }
+        before = HeapBytes();
+        usage = table.MemoryUsage();
+        for (int i = 0; i < REAL_CONNECTIONS; i++) {
+            table.GetPeerAddressText(handles[i]);
+        }
+        printf("cold record: %.1f bytes/conn heap, %.1f bytes/conn MemoryUsage()\n",
+               (double)(HeapBytes() - before) / REAL_CONNECTIONS,
+               (double)(table.MemoryUsage() - usage) / REAL_CONNECTIONS);
+
+        for (int i = 0; i < REAL_CONNECTIONS; i++) {
+            delete clients[i];
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Per call cost of BasicEndpoint and BasicSocket against SocketAddress and Socket
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * endpointbench [iterations]
+ *
+ *   g++ -std=c++14 -O2 -I. bench/endpointbench.cpp socket.cpp sockaddr.cpp \
+ *       ipaddr.cpp addrtext.cpp socktap.cpp -o endpointbench
+ *
+ * Times two things:
+ * - Setting a port, reading it back and taking the address size, which
+ *   SocketAddress does in out of line calls that branch on the family and
+ *   Endpoint4 does inline. This runs for iterations rounds (50M by default).
+ * - A loopback UDP sendto and recvfrom round trip, once through Socket and
+ *   InetAddress and once through UdpSocket4 and Endpoint4. This runs for
+ *   iterations / 100 rounds.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <netinet/in.h>
+
+#include "socket.hpp"
+#include "basicsocket.hpp"
+
+// Keeps the compiler from folding the loop body away or hoisting it out.
+#define CLOBBER(x) asm volatile("" : : "r"(&(x)) : "memory")
+
+static double
+NsPerCall(std::chrono::steady_clock::time_point start, long iterations)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+           iterations;
+}
+
+int
+main(int argc, char *argv[])
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 50000000;
+    long total = 0;
+
+    {
+        SocketAddress addr;
+        auto          start = std::chrono::steady_clock::now();
+
+        for (long i = 0; i < iterations; i++) {
+            int port;
+
+            addr.SetPortNumber((int)(i & 0xffff));
+            addr.GetPortNumber(port);
+            total += port + addr.SizeOf();
+            CLOBBER(addr);
+        }
+        printf("SocketAddress set/get port + size    %8.2f ns\n", NsPerCall(start, iterations));
+    }
+
+    {
+        Endpoint4 addr;
+        auto      start = std::chrono::steady_clock::now();
+
+        for (long i = 0; i < iterations; i++) {
+            addr.SetPortNumber((uint16_t)(i & 0xffff));
+            total += addr.GetPortNumber() + Endpoint4::SIZE;
+            CLOBBER(addr);
+        }
+        printf("Endpoint4 set/get port + SIZE        %8.2f ns\n", NsPerCall(start, iterations));
+    }
+
+    long rounds = iterations / 100;
+    char buff[64] = { 0 };
+
+    {
+        Socket      server(false, SOCK_DGRAM);
+        Socket      client(false, SOCK_DGRAM);
+        InetAddress local = InetAddress::FromIpv4(INADDR_LOOPBACK);
+        InetAddress to;
+        InetAddress from;
+
+        server.Bind(local);
+        server.GetSockName(to);
+        auto start = std::chrono::steady_clock::now();
+
+        for (long i = 0; i < rounds; i++) {
+            client.SendTo(buff, sizeof(buff), 0, to);
+            total += server.RecvFrom(buff, sizeof(buff), 0, from);
+        }
+        printf("Socket sendto + recvfrom             %8.0f ns\n", NsPerCall(start, rounds));
+    }
+
+    {
+        UdpSocket4 server;
+        UdpSocket4 client;
+        Endpoint4  to(InetAddress::FromIpv4(INADDR_LOOPBACK));
+        Endpoint4  from;
+
+        server.Bind(to);
+        server.GetSockName(to);
+        auto start = std::chrono::steady_clock::now();
+
+        for (long i = 0; i < rounds; i++) {
+            client.SendTo(buff, sizeof(buff), 0, to);
+            total += server.RecvFrom(buff, sizeof(buff), 0, from);
+        }
+        printf("UdpSocket4 sendto + recvfrom         %8.0f ns\n", NsPerCall(start, rounds));
+    }
+
+    return total == 0;
+}
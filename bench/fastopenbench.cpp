@@ -0,0 +1,154 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Loopback request latency with and without TCP Fast Open
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * fastopenbench [requests]
+ *
+ *   g++ -std=c++14 -O2 -pthread -I. bench/fastopenbench.cpp socket.cpp \
+ *       sockaddr.cpp ipaddr.cpp addrtext.cpp socktap.cpp -o fastopenbench
+ *
+ * Makes requests (5000 by default) on fresh loopback connections to a Fast
+ * Open listener, each a 64 byte request answered by a 64 byte reply, first
+ * with connect() and send() and then with the request carried in the SYN.
+ * It reports the time per request and the Fast Open outcome counters. Both
+ * sides need Fast Open enabled:
+ *
+ *   sysctl -w net.ipv4.tcp_fastopen=3
+ *
+ * Loopback has next to no round trip time, so the difference measured here
+ * is mostly the handshake's processing; on a real path Fast Open saves one
+ * round trip per request on top of that.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+
+#include "socket.hpp"
+
+static const int MESSAGE_SIZE = 64;
+
+/*
+ * Answer every request with a reply of the same size and close.
+ */
+static void
+Serve(Socket *pListener)
+{
+    char buff[MESSAGE_SIZE];
+
+    for (;;) {
+        try {
+            Socket conn(false, SOCK_STREAM);
+            int    have = 0;
+
+            pListener->Accept(conn);
+            while (have < MESSAGE_SIZE) {
+                int bytes = conn.Recv(buff + have, MESSAGE_SIZE - have, 0);
+                if (bytes == 0) {
+                    break;
+                }
+                have += bytes;
+            }
+            conn.Send(buff, have, MSG_NOSIGNAL);
+            conn.GetFastOpenResult();
+        } catch (const std::system_error &e) {
+            fprintf(stderr, "server: %s\n", e.what());
+        }
+    }
+}
+
+static void
+Run(const char *name, const InetAddress &addr, int requests, bool fastOpen)
+{
+    std::vector<double> latency;
+    char                buff[MESSAGE_SIZE] = { 0 };
+
+    for (int i = 0; i < requests; i++) {
+        auto   start = std::chrono::steady_clock::now();
+        Socket sock(false, SOCK_STREAM);
+        int    have = 0;
+
+        if (fastOpen) {
+            sock.Connect(addr, buff, sizeof(buff), MSG_NOSIGNAL);
+        } else {
+            sock.Connect(addr);
+            sock.Send(buff, sizeof(buff), MSG_NOSIGNAL);
+        }
+        while (have < MESSAGE_SIZE) {
+            int bytes = sock.Recv(buff + have, MESSAGE_SIZE - have, 0);
+            if (bytes == 0) {
+                break;
+            }
+            have += bytes;
+        }
+        if (fastOpen) {
+            sock.GetFastOpenResult();
+        }
+        latency.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    std::sort(latency.begin(), latency.end());
+    double sum = 0;
+    for (size_t i = 0; i < latency.size(); i++) {
+        sum += latency[i];
+    }
+    printf("%-20s mean %7.1f us  p50 %7.1f us  p99 %7.1f us\n", name, sum / latency.size(),
+           latency[latency.size() / 2], latency[latency.size() * 99 / 100]);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int   requests = argc > 1 ? atoi(argv[1]) : 5000;
+    FILE *fp = fopen("/proc/sys/net/ipv4/tcp_fastopen", "r");
+    int   sysctl = -1;
+
+    if (fp != NULL) {
+        if (fscanf(fp, "%d", &sysctl) != 1) {
+            sysctl = -1;
+        }
+        fclose(fp);
+    }
+    if ((sysctl & 3) != 3) {
+        fprintf(stderr, "net.ipv4.tcp_fastopen is %d; Fast Open needs 3 for a loopback test\n", sysctl);
+    }
+
+    Socket      listener(false, SOCK_STREAM);
+    InetAddress addr = InetAddress::FromIpv4(INADDR_LOOPBACK);
+
+    listener.Bind(addr);
+    listener.Listen(128, 256);
+    listener.GetSockName(addr);
+    std::thread(Serve, &listener).detach();
+
+    Run("connect + send", addr, requests, false);
+    Run("Fast Open", addr, requests, true);
+
+    FastOpenStats stats = Socket::GetFastOpenStats();
+    printf("attempts %llu: %llu accepted, %llu no cookie, %llu not acked, %llu SYN retransmitted, "
+           "%llu fallback\n",
+           (unsigned long long)stats.attempts, (unsigned long long)stats.accepted,
+           (unsigned long long)stats.noCookie, (unsigned long long)stats.notAcked,
+           (unsigned long long)stats.synRetransmitted, (unsigned long long)stats.fallback);
+    printf("server: %llu accepted with data in the SYN, %llu plain\n",
+           (unsigned long long)stats.passiveAccepted, (unsigned long long)stats.passiveRegular);
+    return 0;
+}
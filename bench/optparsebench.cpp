@@ -0,0 +1,226 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Concurrent parsing of command requests with OptionParser
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * optparsebench [threads [requests]]
+ *
+ *   g++ -std=c++14 -O2 -pthread -Igetopt_windows bench/optparsebench.cpp \
+ *       getopt_windows/opttable.cpp getopt_windows/getopt.cpp \
+ *       getopt_windows/respfile.cpp -o optparsebench
+ *
+ * Parses command request lines such as
+ *
+ *   stats -v -n 12 --format=json --msg="a b" --since 300 conn7
+ *
+ * on 1, 2, 4 ... up to threads threads (the number of cores by default), each
+ * thread parsing requests lines (200000) taken round robin from a set of 1024.
+ * Each line is split with SplitTokens() and parsed by an OptionParser on the
+ * thread, as a command server's workers would. For comparison the same is done
+ * with the global getopt_long(), which needs the tokens copied into an argv
+ * and a lock held for the whole parse because its results are globals.
+ *
+ * Every parse is checked against a checksum of the options, their arguments
+ * and the operand index computed beforehand with getopt_long().
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "opttable.h"
+
+static const int LINES = 1024;
+static const int MAX_TOKENS = 32;
+
+static constexpr OptDef s_opts[] = {
+    { 'v', "verbose", no_argument,       NULL,   'v' },
+    { 'n', "count",   required_argument, NULL,   'n' },
+    { 'f', "format",  required_argument, NULL,   'f' },
+    { 0,   "msg",     required_argument, NULL,   'm' },
+    { 's', "since",   required_argument, NULL,   's' },
+    { 'a', "all",     no_argument,       NULL,   'a' },
+};
+static constexpr auto s_table = MakeOptionTable(s_opts);
+
+static const struct option s_longOpts[] = {
+    { "verbose", no_argument,       NULL,   'v' },
+    { "count",   required_argument, NULL,   'n' },
+    { "format",  required_argument, NULL,   'f' },
+    { "msg",     required_argument, NULL,   'm' },
+    { "since",   required_argument, NULL,   's' },
+    { "all",     no_argument,       NULL,   'a' },
+    { NULL,      0,                 NULL,   0 },
+};
+
+static std::mutex s_getoptLock;
+
+static std::string
+Generate(std::mt19937 &rng)
+{
+    static const char *verbs[] = { "stats", "close", "list", "trace" };
+    static const char *formats[] = { "json", "text", "csv" };
+    std::string        line = verbs[rng() % 4];
+    int                options = 1 + rng() % 6;
+
+    for (int i = 0; i < options; i++) {
+        switch (rng() % 7) {
+        case 0: line += " -v"; break;
+        case 1: line += " -n " + std::to_string(rng() % 1000); break;
+        case 2: line += " --format=" + std::string(formats[rng() % 3]); break;
+        case 3: line += " --msg=\"drain " + std::to_string(rng() % 100) + " now\""; break;
+        case 4: line += " --since " + std::to_string(rng() % 3600); break;
+        case 5: line += " -vn" + std::to_string(rng() % 50); break;
+        default: line += " --all"; break;
+        }
+    }
+    for (int i = rng() % 3; i > 0; i--) {
+        line += " conn" + std::to_string(rng() % 10000);
+    }
+    return line;
+}
+
+static size_t
+Mix(size_t sum, int opt, const char *pArg, size_t len)
+{
+    sum = sum * 31 + (size_t)opt;
+    for (size_t i = 0; pArg != NULL && i < len; i++) {
+        sum = sum * 31 + (unsigned char)pArg[i];
+    }
+    return sum;
+}
+
+static size_t
+ParseTable(const std::string &line)
+{
+    TokenSpan tokens[MAX_TOKENS];
+    int       count = SplitTokens(line.data(), line.size(), tokens, MAX_TOKENS);
+    size_t    sum = 0;
+    int       opt;
+
+    OptionParser parser(s_table, count, tokens);
+    while ((opt = parser.getopt(NULL)) != -1) {
+        sum = Mix(sum, opt, parser.optarg, parser.optlen);
+    }
+    return Mix(sum, parser.optind, NULL, 0);
+}
+
+static size_t
+ParseGlobal(const std::string &line)
+{
+    TokenSpan                tokens[MAX_TOKENS];
+    int                      count = SplitTokens(line.data(), line.size(), tokens, MAX_TOKENS);
+    std::vector<std::string> storage;
+    std::vector<char *>      argv;
+    size_t                   sum = 0;
+    int                      opt;
+
+    for (int i = 0; i < count; i++) {
+        storage.push_back(std::string(tokens[i].ptr, tokens[i].len));
+    }
+    for (int i = 0; i < count; i++) {
+        argv.push_back(&storage[i][0]);
+    }
+    argv.push_back(NULL);
+
+    std::lock_guard<std::mutex> lock(s_getoptLock);
+
+    optind = 0;
+    while ((opt = getopt_long(count, &argv[0], "vn:f:s:a", s_longOpts, NULL)) != -1) {
+        sum = Mix(sum, opt, optarg, optarg != NULL ? strlen(optarg) : 0);
+    }
+    return Mix(sum, optind, NULL, 0);
+}
+
+/*
+ * Parse requests lines on each of threads threads and return the requests
+ * parsed per second, counting every wrong result in wrong.
+ */
+template<typename Parse>
+static double
+Run(Parse parse, int threads, long requests, const std::vector<std::string> &lines,
+    const std::vector<size_t> &expect, long &wrong)
+{
+    std::vector<std::thread> workers;
+    std::vector<long>        errors(threads);
+    auto                     start = std::chrono::steady_clock::now();
+
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread([&, t]() {
+            long count = 0;
+
+            for (long i = 0; i < requests; i++) {
+                size_t line = (size_t)(i + t * 97) % lines.size();
+
+                if (parse(lines[line]) != expect[line]) {
+                    count++;
+                }
+            }
+            errors[t] = count;
+        }));
+    }
+    for (int t = 0; t < threads; t++) {
+        workers[t].join();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (int t = 0; t < threads; t++) {
+        wrong += errors[t];
+    }
+    return threads * requests / seconds;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int                      threads = argc > 1 ? atoi(argv[1]) : (int)std::thread::hardware_concurrency();
+    long                     requests = argc > 2 ? atol(argv[2]) : 200000;
+    std::mt19937             rng(34);
+    std::vector<std::string> lines;
+    std::vector<size_t>      expect;
+
+    if (threads < 1) {
+        threads = 1;
+    }
+    for (int i = 0; i < LINES; i++) {
+        lines.push_back(Generate(rng));
+        expect.push_back(ParseGlobal(lines.back()));
+    }
+
+    printf("%ld requests per thread, e.g. \"%s\"\n", requests, lines[0].c_str());
+    for (int n = 1; ; n = (n * 2 < threads) ? n * 2 : threads) {
+        long   wrong = 0;
+        double table = Run(ParseTable, n, requests, lines, expect, wrong);
+        double global = Run(ParseGlobal, n, requests, lines, expect, wrong);
+
+        printf("%3d threads  OptionParser %6.2f M/s  getopt_long %6.2f M/s  (%.1fx)", n, table / 1e6,
+               global / 1e6, table / global);
+        if (wrong != 0) {
+            printf("  %ld WRONG", wrong);
+        }
+        printf("\n");
+        if (n == threads) {
+            break;
+        }
+    }
+    return 0;
+}
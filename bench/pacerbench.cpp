@@ -0,0 +1,159 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+PacedSender rate accuracy and batching on loopback
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * pacerbench [packets [rate [size]]]
+ *
+ *   g++ -std=c++14 -O2 -pthread -I. bench/pacerbench.cpp pacer.cpp socket.cpp \
+ *       sockaddr.cpp ipaddr.cpp addrtext.cpp socktap.cpp -o pacerbench
+ *
+ * Sends packets (20000 by default) datagrams of size bytes (1400) through a
+ * PacedSender to a receiver thread on loopback, at rate bytes per second
+ * (50000000) with a burst of one packet. The receiver stamps each arrival.
+ * Each run reports the achieved rate against the configured one, the
+ * spread of the gaps between arrivals against the ideal gap, and the
+ * packets sent per system call. The runs are:
+ *
+ *   SendTo                 - one packet per call
+ *   SendBatch              - batches of 64, no batch window
+ *   SendBatch window 100us - batches of 64, packets due within 100 us share
+ *                            one sendmmsg()
+ *   SendBatch unlimited    - no rate; every batch should be one sendmmsg()
+ *
+ * Loopback delivers a datagram to the receiving socket during the send, so
+ * the arrival times are close to the departure times. A receiver that falls
+ * behind only shifts a run's stamps late; the gaps stay honest as long as
+ * nothing is lost, and the lost count is printed. The program fails if the
+ * unlimited run does not batch.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+
+#include "pacer.hpp"
+
+static uint64_t
+NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * Stamp the arrival of up to count datagrams, stopping after a quiet 200 ms.
+ */
+static void
+Receive(Socket *pSock, int count, std::vector<uint64_t> *pStamps)
+{
+    std::vector<char> buff(65536);
+
+    pStamps->clear();
+    while ((int)pStamps->size() < count) {
+        if (pSock->Recv(&buff[0], (int)buff.size(), 0, 200) <= 0) {
+            break;
+        }
+        pStamps->push_back(NowNs());
+    }
+}
+
+static bool
+Run(const char *name, Socket &receiver, const InetAddress &to, int packets, uint64_t rate,
+    uint32_t size, bool batch, uint64_t window)
+{
+    Socket                    sock(false, SOCK_DGRAM);
+    PacedSender               sender(sock, rate, size);
+    std::vector<char>         payload(size, 'p');
+    std::vector<uint64_t>     stamps;
+    std::vector<PacedMessage> msgs(PacedSender::BATCH_MAX);
+
+    sender.SetBatchWindow(window);
+    std::thread reader(Receive, &receiver, packets, &stamps);
+
+    for (size_t i = 0; i < msgs.size(); i++) {
+        msgs[i].buff = &payload[0];
+        msgs[i].len = size;
+        msgs[i].peer = to;
+    }
+    for (int sent = 0; sent < packets; ) {
+        if (batch) {
+            int n = std::min(packets - sent, (int)msgs.size());
+            sent += sender.SendBatch(&msgs[0], n, 0);
+        } else {
+            sender.SendTo(&payload[0], size, 0, to);
+            sent++;
+        }
+    }
+    reader.join();
+
+    const PacedSender::Stats &stats = sender.GetStats();
+    double perCall = (double)stats.packets / stats.syscalls;
+
+    if (stamps.size() < 2) {
+        printf("%-24s nothing received\n", name);
+        return false;
+    }
+
+    std::vector<double> gaps;
+    for (size_t i = 1; i < stamps.size(); i++) {
+        gaps.push_back((stamps[i] - stamps[i - 1]) / 1000.0);
+    }
+    std::sort(gaps.begin(), gaps.end());
+
+    double seconds = (stamps.back() - stamps.front()) / 1e9;
+    double achieved = (stamps.size() - 1) * (double)size / seconds;
+
+    printf("%-24s", name);
+    if (rate != 0) {
+        printf(" %7.2f MB/s %6.1f%%", achieved / 1e6, 100.0 * achieved / rate);
+    } else {
+        printf(" %7.2f MB/s %7s", achieved / 1e6, "-");
+    }
+    printf("  gap p1 %6.1f p50 %6.1f p99 %7.1f max %7.1f us  %5.1f pkt/call  lost %zu\n",
+           gaps[gaps.size() / 100], gaps[gaps.size() / 2], gaps[gaps.size() * 99 / 100], gaps.back(),
+           perCall, packets - stamps.size());
+    return stats.syscalls < stats.packets;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int      packets = argc > 1 ? atoi(argv[1]) : 20000;
+    uint64_t rate = argc > 2 ? strtoull(argv[2], NULL, 10) : 50000000;
+    uint32_t size = argc > 3 ? (uint32_t)atoi(argv[3]) : 1400;
+    Socket   receiver(false, SOCK_DGRAM);
+    InetAddress to = InetAddress::FromIpv4(INADDR_LOOPBACK);
+    int      rcvbuf = 32 << 20;
+
+    receiver.SetSockOpt(SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    receiver.Bind(to);
+    receiver.GetSockName(to);
+
+    printf("%d packets of %u bytes at %.2f MB/s, ideal gap %.1f us\n", packets, size, rate / 1e6,
+           size * 1e6 / rate);
+    Run("SendTo", receiver, to, packets, rate, size, false, 0);
+    Run("SendBatch", receiver, to, packets, rate, size, true, 0);
+    Run("SendBatch window 100us", receiver, to, packets, rate, size, true, 100000);
+    if (!Run("SendBatch unlimited", receiver, to, packets, 0, size, true, 0)) {
+        printf("SendBatch did not batch\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,275 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+PeerTable inserts, lookups and expiry with millions of peers
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * peertablebench [peers [operations]]
+ *
+ *   g++ -std=c++14 -O2 -I. bench/peertablebench.cpp addrtext.cpp -o peertablebench
+ *
+ * Inserts peers (2000000 by default, half IPv4 and half IPv6, each with a
+ * port) one at a time into a PeerTable created with the default capacity, so
+ * it grows through every size on the way, and reports the mean insert time
+ * and its 50th, 99th, 99.9th percentile and worst case. The same peers go
+ * into an unordered_map keyed by the formatted address, as a server without
+ * the table would keep them, for comparison.
+ *
+ * It then times operations (1000000) lookups of random known peers with
+ * Find(), with FindBatch() in batches of 64 and in the unordered_map, the
+ * last including formatting the address.
+ *
+ * Finally it adds peers until the table starts another resize and, while
+ * the resize is in progress, runs a mix of lookups, inserts of new peers and
+ * Expire() calls with a budget of 64 slots, timing each kind separately. The
+ * same mix is timed again once the resize has finished. The clock advances
+ * one unit per 1024 operations and peers idle for more than half the clock
+ * are expired.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "addrtext.hpp"
+#include "peertable.hpp"
+
+static const int BATCH = 64;
+static const size_t EXPIRE_BUDGET = 64;
+
+struct Session
+{
+    uint64_t packets;
+    uint64_t bytes;
+    uint32_t seq;
+};
+
+struct Latency
+{
+    std::vector<uint32_t> ns;
+    double                total;
+};
+
+static volatile size_t s_sink;
+
+static std::chrono::steady_clock::time_point
+Now()
+{
+    return std::chrono::steady_clock::now();
+}
+
+static uint32_t
+NsSince(std::chrono::steady_clock::time_point start)
+{
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Now() - start).count();
+}
+
+/*
+ * The n'th peer. The multipliers are odd, so distinct n give distinct peers.
+ */
+static InetAddress
+Peer(uint64_t n)
+{
+    uint64_t k = (n >> 1) * 0x9e3779b97f4a7c15ull;
+    uint16_t port = (uint16_t)(1024 + (n >> 1) % 60000);
+
+    if ((n & 1) == 0) {
+        return InetAddress::FromIpv4((uint32_t)(n >> 1) * 0x2545f491u, port);
+    }
+
+    uint8_t bytes[16] = { 0x20, 0x01, 0x0d, 0xb8 };
+
+    for (int i = 0; i < 8; i++) {
+        bytes[8 + i] = (uint8_t)(k >> (8 * i));
+    }
+    return InetAddress::FromIpv6(bytes, port);
+}
+
+static std::string
+Text(const InetAddress &peer)
+{
+    char buff[ADDRTEXT_MAX];
+
+    return std::string(buff, FormatAddress(peer, buff, sizeof(buff), ADDRTEXT_WITH_PORT));
+}
+
+static void
+Report(const char *name, Latency &latency)
+{
+    std::vector<uint32_t> &ns = latency.ns;
+
+    if (ns.empty()) {
+        printf("  %-10s no operations\n", name);
+        return;
+    }
+    std::sort(ns.begin(), ns.end());
+    printf("  %-10s %9zu  mean %6.1f ns  p50 %5u  p99 %6u  p99.9 %7u  max %9u ns\n", name, ns.size(),
+           latency.total / ns.size(), ns[ns.size() / 2], ns[ns.size() * 99 / 100],
+           ns[ns.size() * 999 / 1000], ns.back());
+}
+
+/*
+ * Run the mix of lookups, inserts and expiry for operations steps, or until
+ * the resize finishes if whileResizing is set.
+ */
+static size_t
+Mix(PeerTable<Session> &table, uint64_t &next, uint32_t &clock, size_t operations, bool whileResizing,
+    std::mt19937_64 &rng)
+{
+    Latency find = Latency();
+    Latency insert = Latency();
+    Latency expire = Latency();
+    size_t  removed = 0;
+    size_t  i;
+
+    for (i = 0; i < operations && (!whileResizing || table.Resizing()); i++) {
+        if (i % 1024 == 0) {
+            clock++;
+        }
+
+        auto     start = Now();
+        uint32_t ns;
+
+        if (i % 16 == 15) {
+            removed += table.Expire(clock, clock / 2, EXPIRE_BUDGET,
+                                    [](const InetAddress &, Session &) {});
+            ns = NsSince(start);
+            expire.ns.push_back(ns);
+            expire.total += ns;
+        } else if (i % 4 == 3) {
+            bool inserted;
+
+            table.Insert(Peer(next++), clock, inserted)->packets++;
+            ns = NsSince(start);
+            insert.ns.push_back(ns);
+            insert.total += ns;
+        } else {
+            Session *pSession = table.Find(Peer(rng() % next), clock);
+
+            s_sink += pSession != NULL;
+            ns = NsSince(start);
+            find.ns.push_back(ns);
+            find.total += ns;
+        }
+    }
+    Report("find", find);
+    Report("insert", insert);
+    Report("expire", expire);
+    printf("  %zu sessions expired, %zu left\n", removed, table.Size());
+    return i;
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t             peers = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000000;
+    size_t             operations = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+    PeerTable<Session> table;
+    std::mt19937_64    rng(30);
+    Latency            latency = Latency();
+
+    {
+        auto start = Now();
+        for (int i = 0; i < 1000; i++) {
+            s_sink += NsSince(start);
+        }
+        printf("%zu peers, each time below includes about %.0f ns of clock reads\n", peers,
+               NsSince(start) / 1000.0);
+    }
+
+    printf("insert, growing from the default capacity\n");
+    for (size_t i = 0; i < peers; i++) {
+        InetAddress peer = Peer(i);
+        auto        start = Now();
+        bool        inserted;
+
+        table.Insert(peer, (uint32_t)(i >> 10), inserted)->packets++;
+        uint32_t ns = NsSince(start);
+        latency.ns.push_back(ns);
+        latency.total += ns;
+    }
+    Report("PeerTable", latency);
+
+    {
+        std::unordered_map<std::string, Session> map;
+        std::vector<std::string>                 texts;
+
+        texts.reserve(peers);
+        for (size_t i = 0; i < peers; i++) {
+            texts.push_back(Text(Peer(i)));
+        }
+
+        latency = Latency();
+        for (size_t i = 0; i < peers; i++) {
+            auto start = Now();
+
+            map[texts[i]].packets++;
+            uint32_t ns = NsSince(start);
+            latency.ns.push_back(ns);
+            latency.total += ns;
+        }
+        Report("string map", latency);
+
+        std::vector<InetAddress> lookups;
+        std::vector<Session *>   sessions(BATCH);
+        size_t                   found = 0;
+
+        for (size_t i = 0; i < operations; i++) {
+            lookups.push_back(Peer(rng() % peers));
+        }
+
+        printf("lookup of %zu random known peers\n", operations);
+        auto start = Now();
+        for (size_t i = 0; i < operations; i++) {
+            found += table.Find(lookups[i], 1) != NULL;
+        }
+        printf("  Find       %6.1f ns\n", NsSince(start) / (double)operations);
+
+        start = Now();
+        for (size_t i = 0; i + BATCH <= operations; i += BATCH) {
+            table.FindBatch(&lookups[i], BATCH, &sessions[0], 1);
+            found += sessions[BATCH - 1] != NULL;
+        }
+        printf("  FindBatch  %6.1f ns\n", NsSince(start) / (double)(operations / BATCH * BATCH));
+
+        start = Now();
+        for (size_t i = 0; i < operations; i++) {
+            found += map.find(Text(lookups[i])) != map.end();
+        }
+        printf("  string map %6.1f ns, formatting included\n", NsSince(start) / (double)operations);
+        s_sink += found;
+    }
+
+    uint64_t next = peers;
+    uint32_t clock = (uint32_t)(peers >> 10);
+
+    while (!table.Resizing()) {
+        bool inserted;
+        table.Insert(Peer(next++), clock, inserted);
+    }
+    printf("mix during a resize, started at %zu peers\n", table.Size());
+    size_t done = Mix(table, next, clock, (size_t)-1, true, rng);
+
+    while (table.Resizing()) {
+        table.Expire(clock, clock / 2, EXPIRE_BUDGET, [](const InetAddress &, Session &) {});
+    }
+    printf("same mix with no resize in progress\n");
+    Mix(table, next, clock, done, false, rng);
+    return 0;
+}
@@ -0,0 +1,210 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+PrefixTable memory and lookup cost at 100k prefixes
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * prefixtablebench [prefixes [lookups]]
+ *
+ *   g++ -std=c++14 -O2 -I. bench/prefixtablebench.cpp prefixtable.cpp addrtext.cpp \
+ *       sockaddr.cpp ipaddr.cpp -o prefixtablebench
+ *
+ * Builds tables of random prefixes (100000 by default) and reports the build
+ * time, MemoryUsage() and the cost of lookups (1M by default) one at a time
+ * and in batches of 64:
+ *
+ *   ipv4      - lengths spread evenly from /8 to /32
+ *   ipv6 /64  - all /64, as for per-subscriber routes
+ *   ipv6 mix  - lengths spread evenly from /16 to /128
+ *
+ * Half the addresses looked up fall inside a random prefix of the table and
+ * half are random. Before timing, 2000 of them are checked against a linear
+ * scan of the prefixes for the longest match.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "prefixtable.hpp"
+
+static const int CHECKS = 2000;
+static const int BATCH = 64;
+
+struct Prefix
+{
+    InetAddress addr;
+    int         length;
+    uint32_t    value;
+};
+
+static volatile uint32_t s_sink;
+
+static double
+Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static InetAddress
+RandomAddress(bool ipv6, std::mt19937 &rng)
+{
+    uint8_t bytes[16];
+
+    for (int i = 0; i < 16; i++) {
+        bytes[i] = (uint8_t)rng();
+    }
+    if (!ipv6) {
+        return InetAddress::FromIpv4(((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) |
+                                     ((uint32_t)bytes[2] << 8) | bytes[3]);
+    }
+    // Keep clear of ::ffff:0:0/96, which is looked up in the IPv4 table.
+    bytes[0] |= 0x20;
+    return InetAddress::FromIpv6(bytes);
+}
+
+/*
+ * An address inside the prefix, the host bits taken from rng.
+ */
+static InetAddress
+Inside(const Prefix &prefix, std::mt19937 &rng)
+{
+    InetAddress    other = RandomAddress(prefix.addr.IsIpv6(), rng);
+    const uint8_t *pNet = prefix.addr.GetBytes();
+    const uint8_t *pHost = other.GetBytes();
+    uint8_t        bytes[16];
+
+    for (int bit = 0; bit < 128; bit++) {
+        const uint8_t *pFrom = bit < prefix.length ? pNet : pHost;
+        uint8_t        mask = (uint8_t)(0x80 >> (bit & 7));
+
+        bytes[bit >> 3] = (uint8_t)((bytes[bit >> 3] & ~mask) | (pFrom[bit >> 3] & mask));
+    }
+    if (!prefix.addr.IsIpv6()) {
+        return InetAddress::FromIpv4(((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) |
+                                     ((uint32_t)bytes[2] << 8) | bytes[3]);
+    }
+    return InetAddress::FromIpv6(bytes);
+}
+
+static bool
+Contains(const Prefix &prefix, const InetAddress &addr)
+{
+    const uint8_t *pNet = prefix.addr.GetBytes();
+    const uint8_t *pBytes = addr.GetBytes();
+
+    for (int bit = 0; bit < prefix.length; bit++) {
+        uint8_t mask = (uint8_t)(0x80 >> (bit & 7));
+
+        if ((pNet[bit >> 3] & mask) != (pBytes[bit >> 3] & mask)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * The value of the longest prefix containing addr, the last added on a tie.
+ */
+static uint32_t
+Scan(const std::vector<Prefix> &prefixes, const InetAddress &addr)
+{
+    uint32_t value = PREFIX_NO_MATCH;
+    int      best = -1;
+
+    for (size_t i = 0; i < prefixes.size(); i++) {
+        if (prefixes[i].length >= best && Contains(prefixes[i], addr)) {
+            best = prefixes[i].length;
+            value = prefixes[i].value;
+        }
+    }
+    return value;
+}
+
+static void
+Run(const char *name, bool ipv6, int minLength, int maxLength, size_t count, size_t lookups)
+{
+    std::mt19937        rng(29);
+    std::vector<Prefix> prefixes;
+    PrefixTableBuilder  builder;
+
+    for (size_t i = 0; i < count; i++) {
+        Prefix prefix;
+
+        prefix.addr = RandomAddress(ipv6, rng);
+        prefix.length = minLength + (int)(rng() % (maxLength - minLength + 1));
+        prefix.value = (uint32_t)i;
+        prefixes.push_back(prefix);
+        builder.Add(prefix.addr, prefix.length, prefix.value);
+    }
+
+    auto                               start = std::chrono::steady_clock::now();
+    std::shared_ptr<const PrefixTable> table = builder.Build();
+    double                             build = Seconds(start);
+    std::vector<InetAddress>           addrs;
+
+    for (size_t i = 0; i < lookups; i++) {
+        addrs.push_back(i % 2 ? RandomAddress(ipv6, rng) : Inside(prefixes[rng() % count], rng));
+    }
+
+    int wrong = 0;
+
+    for (int i = 0; i < CHECKS; i++) {
+        uint32_t expect = Scan(prefixes, addrs[i]);
+
+        if (table->Lookup(addrs[i]) != expect && wrong++ == 0) {
+            printf("  lookup %d: %u, expected %u\n", i, table->Lookup(addrs[i]), expect);
+        }
+    }
+
+    uint32_t sum = 0;
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < lookups; i++) {
+        sum += table->Lookup(addrs[i]);
+    }
+    double single = Seconds(start);
+
+    std::vector<uint32_t> values(BATCH);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i + BATCH <= lookups; i += BATCH) {
+        table->Lookup(&addrs[i], BATCH, &values[0]);
+        sum += values[0];
+    }
+    double batch = Seconds(start);
+
+    s_sink = sum;
+    printf("%-9s %7zu prefixes  build %6.0f ms  %8.1f MB  lookup %5.1f ns  batch %5.1f ns", name,
+           table->Size(), build * 1e3, table->MemoryUsage() / 1e6, single * 1e9 / lookups,
+           batch * 1e9 / (lookups / BATCH * BATCH));
+    if (wrong != 0) {
+        printf("  %d of %d WRONG", wrong, CHECKS);
+    }
+    printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+    size_t lookups = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+
+    Run("ipv4", false, 8, 32, count, lookups);
+    Run("ipv6 /64", true, 64, 64, count, lookups);
+    Run("ipv6 mix", true, 16, 128, count, lookups);
+    return 0;
+}
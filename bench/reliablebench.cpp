@@ -0,0 +1,223 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+ReliableEndpoint goodput on loopback against TCP
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * reliablebench [messages [loss [delayUs]]]
+ *
+ *   g++ -std=c++14 -O2 -pthread -I. bench/reliablebench.cpp reliable.cpp pacer.cpp \
+ *       socket.cpp sockaddr.cpp ipaddr.cpp addrtext.cpp socktap.cpp -o reliablebench
+ *
+ * Sends messages (2000 by default) of 1 to 60000 bytes over one
+ * ReliableConnection on loopback, spread over 4 streams. The receiver checks
+ * that every message arrives whole and in order within its stream. The
+ * same messages then go over a TCP connection, each with a length prefix.
+ * Goodput is message bytes delivered per second.
+ *
+ * loss and delayUs are applied by both ReliableEndpoints to the datagrams
+ * they receive. The TCP run has no impairment, so it is only comparable to a
+ * run without loss or delay.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+
+#include "reliable.hpp"
+
+static const int STREAMS = 4;
+static const int MESSAGE_MAX = 60000;
+
+static int
+MessageLength(int index)
+{
+    return 1 + (int)((index * 7919L) % MESSAGE_MAX);
+}
+
+/*
+ * Message index goes in the first bytes, the rest is a pattern of index and
+ * stream, so a misordered or corrupted message is caught.
+ */
+static void
+FillMessage(uint8_t *pBuff, int index)
+{
+    int len = MessageLength(index);
+
+    for (int j = 0; j < len; j++) {
+        pBuff[j] = (uint8_t)(index + j * (index % STREAMS));
+    }
+    memcpy(pBuff, &index, len < (int)sizeof(index) ? len : sizeof(index));
+}
+
+static bool
+CheckMessage(const uint8_t *pBuff, int len, int index, std::vector<uint8_t> &expect)
+{
+    FillMessage(&expect[0], index);
+    return len == MessageLength(index) && memcmp(pBuff, &expect[0], len) == 0;
+}
+
+static double
+Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool
+RunReliable(int messages, double loss, uint32_t delayUs, double &mbps)
+{
+    ReliableOptions serverOptions;
+
+    serverOptions.lossRate = loss;
+    serverOptions.delayUs = delayUs;
+    serverOptions.seed = 7;
+
+    ReliableOptions clientOptions = serverOptions;
+    clientOptions.seed = 9;
+
+    ReliableEndpoint server(InetAddress::FromIpv4(INADDR_LOOPBACK), serverOptions);
+    InetAddress      addr = server.GetLocalAddress();
+    auto             start = std::chrono::steady_clock::now();
+    bool             ok = true;
+    uint64_t         total = 0;
+
+    server.Listen(1);
+    std::thread client([&]() {
+        ReliableEndpoint      endpoint(InetAddress::FromIpv4(INADDR_LOOPBACK), clientOptions);
+        ReliableConnection   *pConn = endpoint.Connect(addr, 5000);
+        std::vector<uint8_t>  buff(MESSAGE_MAX);
+
+        for (int i = 0; i < messages; i++) {
+            FillMessage(&buff[0], i);
+            pConn->Send((uint16_t)(i % STREAMS), &buff[0], MessageLength(i), -1);
+        }
+        pConn->Close(20000);
+    });
+
+    ReliableConnection *pConn = server.Accept(5000);
+    std::vector<uint8_t> buff(MESSAGE_MAX);
+    std::vector<uint8_t> expect(MESSAGE_MAX);
+    int                  next[STREAMS];
+    int                  received = 0;
+
+    for (int s = 0; s < STREAMS; s++) {
+        next[s] = s;
+    }
+    while (pConn != NULL) {
+        uint16_t stream;
+        int      len = pConn->Recv(stream, &buff[0], (int)buff.size(), 20000);
+
+        if (len == 0 || stream >= STREAMS) {
+            ok = len == 0 && pConn->IsPeerClosed();
+            break;
+        }
+        if (!CheckMessage(&buff[0], len, next[stream], expect)) {
+            ok = false;
+            break;
+        }
+        next[stream] += STREAMS;
+        total += len;
+        received++;
+    }
+    mbps = total / Seconds(start) / 1e6;
+
+    if (pConn != NULL) {
+        ReliableConnection::Stats stats = pConn->GetStats();
+        printf("  server: %llu packets received\n", (unsigned long long)stats.packetsReceived);
+        pConn->Close(0);
+    }
+    client.join();
+    return ok && received == messages;
+}
+
+static bool
+RunTcp(int messages, double &mbps)
+{
+    Socket      listener(false, SOCK_STREAM);
+    InetAddress addr = InetAddress::FromIpv4(INADDR_LOOPBACK);
+
+    listener.Bind(addr);
+    listener.Listen(1);
+    listener.GetSockName(addr);
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread client([&]() {
+        Socket               sock(false, SOCK_STREAM);
+        std::vector<uint8_t> buff(sizeof(uint32_t) + MESSAGE_MAX);
+
+        sock.Connect(addr);
+        for (int i = 0; i < messages; i++) {
+            uint32_t len = MessageLength(i);
+
+            memcpy(&buff[0], &len, sizeof(len));
+            FillMessage(&buff[sizeof(len)], i);
+            for (size_t sent = 0; sent < sizeof(len) + len; ) {
+                sent += sock.Send(&buff[sent], (int)(sizeof(len) + len - sent), MSG_NOSIGNAL);
+            }
+        }
+    });
+
+    Socket               conn(false, SOCK_STREAM);
+    std::vector<uint8_t> buff(MESSAGE_MAX);
+    std::vector<uint8_t> expect(MESSAGE_MAX);
+    uint64_t             total = 0;
+    bool                 ok = true;
+
+    listener.Accept(conn);
+    for (int i = 0; i < messages && ok; i++) {
+        uint32_t len;
+        size_t   have = 0;
+
+        while (have < sizeof(len) && ok) {
+            int bytes = conn.Recv((uint8_t *)&len + have, (int)(sizeof(len) - have), 0);
+            ok = bytes > 0;
+            have += bytes;
+        }
+        for (have = 0; ok && have < len; ) {
+            int bytes = conn.Recv(&buff[have], (int)(len - have), 0);
+            ok = bytes > 0;
+            have += bytes;
+        }
+        ok = ok && CheckMessage(&buff[0], (int)len, i, expect);
+        total += len;
+    }
+    mbps = total / Seconds(start) / 1e6;
+    client.join();
+    return ok;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int      messages = argc > 1 ? atoi(argv[1]) : 2000;
+    double   loss = argc > 2 ? atof(argv[2]) : 0;
+    uint32_t delayUs = argc > 3 ? (uint32_t)atoi(argv[3]) : 0;
+    double   reliable;
+    double   tcp;
+    bool     ok;
+
+    printf("%d messages of 1 to %d bytes, loss %.3f, delay %u us\n", messages, MESSAGE_MAX, loss, delayUs);
+    ok = RunReliable(messages, loss, delayUs, reliable);
+    printf("ReliableEndpoint  %8.1f MB/s%s\n", reliable, ok ? "" : "  MISMATCH");
+    if (!RunTcp(messages, tcp)) {
+        printf("TCP               MISMATCH\n");
+        return 1;
+    }
+    printf("TCP               %8.1f MB/s%s\n", tcp, loss > 0 || delayUs > 0 ? "  (no impairment)" : "");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,80 @@
+#!/bin/sh
+#
+# Copyright (C) 2012 Charles E Sluder
+# Refused connects and latency while the loadgen server restarts
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+# restart.sh [loadgen [port [startup]]]
+#
+#   g++ -std=c++14 -O2 -pthread -I. -Igetopt_windows loadgen.cpp socket.cpp \
+#       sockaddr.cpp ipaddr.cpp addrtext.cpp socktap.cpp connection.cpp \
+#       handoff.cpp getopt_windows/opttable.cpp -o loadgen
+#
+# Runs a reconnecting client (a new connection for every message) against a
+# loadgen server and restarts the server in the middle of the measurement,
+# twice:
+#
+#   stop/start - the server is killed and a new one binds the port again
+#   handoff    - a new server takes the listener over with --handoff and the
+#                old one drains and exits
+#
+# The new server sleeps startup seconds (0.2) before it starts, standing in
+# for the initialisation of a real server. For each run the client reports
+# connects, refused connects, connections reset and the latency percentiles,
+# which include the connect.
+
+LOADGEN=${1:-./loadgen}
+PORT=${2:-9300}
+STARTUP=${3:-0.2}
+CONTROL=@loadgen-restart-$$
+CLIENT="-c -R -p $PORT -n 4 -w 1 -d 4"
+
+run()
+{
+    echo "== $1"
+    $LOADGEN $CLIENT &
+    client=$!
+    sleep 2.5
+    $2
+    wait $client
+    kill $server 2>/dev/null
+    wait $server 2>/dev/null
+    echo
+}
+
+stopstart()
+{
+    kill $server
+    wait $server 2>/dev/null
+    sleep $STARTUP
+    $LOADGEN -s -p $PORT > /dev/null &
+    server=$!
+}
+
+handoff()
+{
+    sleep $STARTUP
+    $LOADGEN -s -p $PORT -H $CONTROL > /dev/null &
+    server=$!
+}
+
+$LOADGEN -s -p $PORT > /dev/null &
+server=$!
+sleep 0.5
+run "stop/start" stopstart
+
+$LOADGEN -s -p $PORT -H $CONTROL > /dev/null &
+server=$!
+sleep 0.5
+run "handoff" handoff
+exit 0
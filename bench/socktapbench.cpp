@@ -0,0 +1,153 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Cost SocketTap adds to Socket sends and receives
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * socktapbench [iterations [size [path]]]
+ *
+ *   g++ -std=c++14 -O2 -I. bench/socktapbench.cpp socket.cpp sockaddr.cpp \
+ *       ipaddr.cpp addrtext.cpp socktap.cpp -o socktapbench
+ *
+ * Times a loopback exchange of size byte messages (512 by default) for
+ * iterations rounds (200000), over UDP with SendTo() and RecvFrom() and over
+ * TCP with Send() and Recv(), each three ways:
+ *
+ *   no tap    - the only cost is the check for an active tap
+ *   tap       - every send and receive captured in full
+ *   snap 64   - a tap keeping 64 payload bytes per operation
+ *
+ * Each round is one send and one receive, so two captured records. The
+ * capture goes to path (/tmp/socktapbench.pcap), which is removed at the end;
+ * put it on the file system a production tap would write to.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <unistd.h>
+#include <netinet/in.h>
+
+#include "socket.hpp"
+#include "socktap.hpp"
+
+static double
+NsPerRound(std::chrono::steady_clock::time_point start, long rounds)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+           rounds;
+}
+
+static double
+RunUdp(long rounds, std::vector<char> &buff)
+{
+    Socket      server(false, SOCK_DGRAM);
+    Socket      client(false, SOCK_DGRAM);
+    InetAddress to = InetAddress::FromIpv4(INADDR_LOOPBACK);
+    InetAddress from;
+
+    server.Bind(to);
+    server.GetSockName(to);
+    auto start = std::chrono::steady_clock::now();
+
+    for (long i = 0; i < rounds; i++) {
+        client.SendTo(&buff[0], (int)buff.size(), 0, to);
+        server.RecvFrom(&buff[0], (int)buff.size(), 0, from);
+    }
+    return NsPerRound(start, rounds);
+}
+
+static double
+RunTcp(long rounds, std::vector<char> &buff)
+{
+    Socket      listener(false, SOCK_STREAM);
+    Socket      client(false, SOCK_STREAM);
+    Socket      server(false, SOCK_STREAM);
+    InetAddress addr = InetAddress::FromIpv4(INADDR_LOOPBACK);
+
+    listener.Bind(addr);
+    listener.Listen(1);
+    listener.GetSockName(addr);
+    client.Connect(addr);
+    listener.Accept(server);
+    auto start = std::chrono::steady_clock::now();
+
+    for (long i = 0; i < rounds; i++) {
+        client.Send(&buff[0], (int)buff.size(), 0);
+        for (size_t have = 0; have < buff.size(); ) {
+            have += server.Recv(&buff[have], (int)(buff.size() - have), 0);
+        }
+    }
+    return NsPerRound(start, rounds);
+}
+
+/*
+ * Run both exchanges with a tap keeping snapLen bytes, or none if snapLen is 0.
+ */
+static void
+Run(const char *name, const char *path, uint32_t snapLen, long rounds, std::vector<char> &buff,
+    double base[2])
+{
+    std::unique_ptr<SocketTap> pTap;
+    double                     ns[2];
+
+    if (snapLen != 0) {
+        pTap.reset(new SocketTap(path, snapLen));
+        pTap->Start();
+    }
+    ns[0] = RunUdp(rounds, buff);
+    ns[1] = RunTcp(rounds, buff);
+
+    printf("%-10s udp %7.0f ns", name, ns[0]);
+    if (base[0] > 0) {
+        printf(" (%+5.1f%%)", 100.0 * (ns[0] - base[0]) / base[0]);
+    } else {
+        printf("         ");
+    }
+    printf("   tcp %7.0f ns", ns[1]);
+    if (base[1] > 0) {
+        printf(" (%+5.1f%%)", 100.0 * (ns[1] - base[1]) / base[1]);
+    } else {
+        printf("         ");
+    }
+
+    if (pTap) {
+        pTap->Stop();
+        SocketTap::Stats stats = pTap->GetStats();
+        printf("   %llu records, %.1f MB, %llu dropped", (unsigned long long)stats.records, stats.bytes / 1e6,
+               (unsigned long long)stats.dropped);
+    } else {
+        base[0] = ns[0];
+        base[1] = ns[1];
+    }
+    printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    long              rounds = argc > 1 ? atol(argv[1]) : 200000;
+    size_t            size = argc > 2 ? strtoul(argv[2], NULL, 10) : 512;
+    const char       *path = argc > 3 ? argv[3] : "/tmp/socktapbench.pcap";
+    std::vector<char> buff(size, 'x');
+    double            base[2] = { 0, 0 };
+
+    printf("%ld rounds of one send and one receive, %zu bytes\n", rounds, size);
+    Run("no tap", path, 0, rounds, buff, base);
+    Run("tap", path, 65535, rounds, buff, base);
+    Run("snap 64", path, 64, rounds, buff, base);
+    unlink(path);
+    return 0;
+}
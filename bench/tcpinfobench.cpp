@@ -0,0 +1,251 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+TcpInfoSampler sampling cost at 100k sockets
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * tcpinfobench [sockets [limit]]
+ *
+ *   g++ -std=c++14 -O2 -I. bench/tcpinfobench.cpp tcpinfo.cpp connection.cpp socket.cpp \
+ *       sockaddr.cpp ipaddr.cpp addrtext.cpp socktap.cpp -o tcpinfobench
+ *
+ * Opens sockets / 2 loopback TCP connections (100000 sockets by default) and
+ * tracks both ends of each, then times:
+ *
+ *   getsockopt full  - Sample() of every socket, one getsockopt() each
+ *   getsockopt limit - Sample(limit) calls (limit 10000) until every socket
+ *                      has been sampled once; the cost of one call is what
+ *                      a caller sweeping a large set pays at a time
+ *   netlink          - Sample() through one sock_diag dump of the namespace
+ *
+ * Each is run five times and the cost per call and per socket is printed.
+ * The loopback connections are spread over several listening ports so the
+ * ephemeral port range is not exhausted.
+ *
+ * The process raises its descriptor limit to fit every socket, which needs
+ * CAP_SYS_RESOURCE above the hard limit. If that is refused it tracks as many
+ * sockets as fit and child processes hold the rest open. The netlink dump
+ * still walks every socket in the namespace then, but fewer are tracked,
+ * and the getsockopt runs cover only the tracked ones.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "tcpinfo.hpp"
+
+static const int    RUNS = 5;
+static const size_t PER_LISTENER = 20000;
+
+/*
+ * Raise the descriptor limit towards wanted.
+ *
+ * @return Descriptors this process may now open.
+ */
+static size_t
+RaiseFileLimit(size_t wanted)
+{
+    struct rlimit rl;
+
+    getrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur >= wanted) {
+        return rl.rlim_cur;
+    }
+
+    struct rlimit raised = rl;
+
+    raised.rlim_cur = wanted;
+    if (raised.rlim_max < wanted) {
+        raised.rlim_max = wanted;
+    }
+    if (setrlimit(RLIMIT_NOFILE, &raised) == 0) {
+        return wanted;
+    }
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    return rl.rlim_cur;
+}
+
+/*
+ * Open count loopback connections and return both ends of each.
+ */
+static bool
+Open(size_t count, std::vector<int> &fds)
+{
+    std::vector<Socket *> listeners;
+
+    for (size_t i = 0; i < count; i++) {
+        if (i % PER_LISTENER == 0) {
+            Socket *pListener = new Socket(false, SOCK_STREAM);
+
+            pListener->Bind(InetAddress::FromIpv4(INADDR_LOOPBACK));
+            pListener->Listen(128);
+            listeners.push_back(pListener);
+        }
+
+        Socket     *pListener = listeners.back();
+        InetSockAddr sa;
+        InetAddress addr;
+        int         fd = socket(AF_INET, SOCK_STREAM, 0);
+        int         peer;
+
+        pListener->GetSockName(addr);
+        if (fd < 0 || connect(fd, &sa.sa, addr.ToSockAddr(sa)) < 0 ||
+            (peer = accept(pListener->GetDescriptor(), NULL, NULL)) < 0) {
+            fprintf(stderr, "connection %zu: %s\n", i, strerror(errno));
+            return false;
+        }
+        fds.push_back(fd);
+        fds.push_back(peer);
+    }
+
+    for (size_t i = 0; i < listeners.size(); i++) {
+        delete listeners[i];
+    }
+    return true;
+}
+
+/*
+ * Hold count loopback connections open in a child process until the write
+ * end of release is closed.
+ *
+ * @return false if the child could not open them.
+ */
+static bool
+Hold(size_t count, int release[2])
+{
+    int   ready[2];
+    char  ok = 0;
+    pid_t pid;
+
+    if (pipe(ready) < 0 || (pid = fork()) < 0) {
+        return false;
+    }
+    if (pid == 0) {
+        std::vector<int> fds;
+
+        close(ready[0]);
+        close(release[1]);
+        ok = Open(count, fds) ? 1 : 0;
+        if (write(ready[1], &ok, 1) == 1 && ok) {
+            while (read(release[0], &ok, 1) > 0) {
+            }
+        }
+        _exit(0);
+    }
+    close(ready[1]);
+    if (read(ready[0], &ok, 1) != 1) {
+        ok = 0;
+    }
+    close(ready[0]);
+    return ok != 0;
+}
+
+static void
+Report(const char *name, std::vector<uint64_t> &ns, size_t syscalls, size_t sampled)
+{
+    std::sort(ns.begin(), ns.end());
+    printf("%-18s %9.2f ms per call (min %7.2f, max %7.2f)  %7zu syscalls  %6.0f ns per socket\n", name,
+           ns[ns.size() / 2] / 1e6, ns.front() / 1e6, ns.back() / 1e6, syscalls,
+           (double)ns[ns.size() / 2] / sampled);
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t           sockets = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+    size_t           limit = argc > 2 ? strtoul(argv[2], NULL, 10) : 10000;
+    std::vector<int> fds;
+    size_t           room = (RaiseFileLimit(sockets + 256) - 256) & ~(size_t)1;
+    size_t           tracked = std::min(sockets, room);
+    int              release[2];
+
+    if (pipe(release) < 0) {
+        return 1;
+    }
+    for (size_t held = tracked; held < sockets; held += room) {
+        if (!Hold(std::min(room, sockets - held) / 2, release)) {
+            fprintf(stderr, "cannot hold %zu more sockets open\n", sockets - held);
+            return 1;
+        }
+    }
+    close(release[0]);
+    if (!Open(tracked / 2, fds)) {
+        return 1;
+    }
+    printf("%zu sockets, %zu tracked, limit %zu\n", sockets, fds.size(), limit);
+
+    {
+        TcpInfoSampler        sampler(TcpInfoSampler::SAMPLE_GETSOCKOPT);
+        std::vector<uint64_t> full;
+        std::vector<uint64_t> limited;
+        size_t                syscalls = 0;
+        size_t                sampled = 0;
+
+        for (size_t i = 0; i < fds.size(); i++) {
+            sampler.Track(fds[i]);
+        }
+
+        for (int run = 0; run < RUNS; run++) {
+            sampled = sampler.Sample();
+            full.push_back(sampler.GetLastCost().elapsedNs);
+            syscalls = sampler.GetLastCost().syscalls;
+        }
+        Report("getsockopt full", full, syscalls, sampled);
+
+        syscalls = 0;
+        for (int run = 0; run < RUNS; run++) {
+            for (size_t done = 0; done < fds.size(); ) {
+                done += sampler.Sample(limit);
+                limited.push_back(sampler.GetLastCost().elapsedNs);
+                syscalls = std::max(syscalls, sampler.GetLastCost().syscalls);
+            }
+        }
+        Report("getsockopt limit", limited, syscalls, std::min(limit, fds.size()));
+    }
+
+    {
+        TcpInfoSampler        sampler(TcpInfoSampler::SAMPLE_NETLINK);
+        std::vector<uint64_t> dump;
+        size_t                syscalls = 0;
+        size_t                sampled = 0;
+
+        for (size_t i = 0; i < fds.size(); i++) {
+            sampler.Track(fds[i]);
+        }
+        for (int run = 0; run < RUNS; run++) {
+            sampled = sampler.Sample();
+            dump.push_back(sampler.GetLastCost().elapsedNs);
+            syscalls = sampler.GetLastCost().syscalls;
+        }
+        Report("netlink", dump, syscalls, sampled);
+        if (sampled != fds.size()) {
+            printf("netlink sampled %zu of %zu sockets\n", sampled, fds.size());
+        }
+    }
+
+    for (size_t i = 0; i < fds.size(); i++) {
+        close(fds[i]);
+    }
+    close(release[1]);
+    return 0;
+}
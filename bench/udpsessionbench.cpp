@@ -0,0 +1,172 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+UdpSessionServer echo rate with and without connected peer sockets
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * udpsessionbench [datagrams [peers...]]
+ *
+ *   g++ -std=c++14 -O2 -I. bench/udpsessionbench.cpp udpsession.cpp socket.cpp \
+ *       sockaddr.cpp ipaddr.cpp addrtext.cpp socktap.cpp -o udpsessionbench
+ *
+ * Echoes datagrams (100000 by default) through a UdpSessionServer on the
+ * loopback address for 100, 500 and 2000 peers, or the counts given. Each
+ * count is run twice: with every peer on the shared socket, and with every
+ * peer promoted to its own connected socket. The peers send in turn, a
+ * batch of 64 at a time; the server reads and echoes the batch and the
+ * peers read their replies. Client and server run on one thread, so the
+ * rate is for one core doing both sides.
+ */
+
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "udpsession.hpp"
+
+static const int    BATCH = 64;
+static const int    WARMUP_ROUNDS = 8;
+static const size_t MESSAGE_SIZE = 64;
+
+struct Result
+{
+    double      pps;
+    size_t      hot;
+    uint64_t    lost;
+};
+
+/*
+ * Send one datagram from each of the peers [first, last), echo them through the
+ * server and read the replies. Lost datagrams are counted, not waited for.
+ */
+static uint64_t
+Exchange(UdpSessionServer &server, const std::vector<int> &peers, size_t first, size_t last)
+{
+    char        buff[MESSAGE_SIZE];
+    InetAddress from;
+    uint64_t    lost = 0;
+
+    memset(buff, 'x', sizeof(buff));
+    for (size_t i = first; i < last; i++) {
+        send(peers[i], buff, sizeof(buff), 0);
+    }
+
+    for (size_t i = first; i < last; i++) {
+        int bytes = server.RecvFrom(buff, sizeof(buff), from, 100);
+        if (bytes == 0) {
+            lost++;
+            continue;
+        }
+        server.SendTo(buff, bytes, from);
+    }
+
+    for (size_t i = first; i < last; i++) {
+        if (recv(peers[i], buff, sizeof(buff), 0) <= 0) {
+            lost++;
+        }
+    }
+    return lost;
+}
+
+static Result
+Run(size_t peerCount, bool promote, uint64_t datagrams)
+{
+    UdpSessionServer::Options options;
+    Result                    result;
+
+    options.hotPackets = promote ? 4 : UINT32_MAX;
+    options.maxHot = peerCount;
+
+    UdpSessionServer server(InetAddress::FromIpv4(INADDR_LOOPBACK), options);
+    InetSockAddr     sa;
+    socklen_t        len = server.GetLocalAddress().ToSockAddr(sa);
+    std::vector<int> peers;
+
+    // Replies that never come are reported as lost after the timeout.
+    struct timeval tv = { 0, 100000 };
+    for (size_t i = 0; i < peerCount; i++) {
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd < 0 || connect(fd, &sa.sa, len) < 0) {
+            perror("peer socket");
+            exit(EXIT_FAILURE);
+        }
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        peers.push_back(fd);
+    }
+
+    // Enough rounds to promote every peer, or none.
+    for (int round = 0; round < WARMUP_ROUNDS; round++) {
+        for (size_t i = 0; i < peerCount; i += BATCH) {
+            Exchange(server, peers, i, i + BATCH < peerCount ? i + BATCH : peerCount);
+        }
+    }
+    result.hot = server.HotPeers();
+    result.lost = 0;
+
+    uint64_t done = 0;
+    size_t   next = 0;
+    auto     start = std::chrono::steady_clock::now();
+
+    while (done < datagrams) {
+        size_t last = next + BATCH < peerCount ? next + BATCH : peerCount;
+        result.lost += Exchange(server, peers, next, last);
+        done += last - next;
+        next = last == peerCount ? 0 : last;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.pps = done / seconds;
+
+    for (size_t i = 0; i < peers.size(); i++) {
+        close(peers[i]);
+    }
+    return result;
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint64_t            datagrams = argc > 1 ? strtoull(argv[1], NULL, 10) : 100000;
+    std::vector<size_t> counts;
+
+    for (int i = 2; i < argc; i++) {
+        counts.push_back(strtoul(argv[i], NULL, 10));
+    }
+    if (counts.empty()) {
+        counts.push_back(100);
+        counts.push_back(500);
+        counts.push_back(2000);
+    }
+
+    printf("%-8s %14s %14s %10s %8s\n", "peers", "shared pps", "promoted pps", "hot peers", "lost");
+    for (size_t i = 0; i < counts.size(); i++) {
+        Result shared = Run(counts[i], false, datagrams);
+        Result promoted = Run(counts[i], true, datagrams);
+
+        if (promoted.hot == 0) {
+            printf("%-8zu %14.0f %14s %10s %8llu\n", counts[i], shared.pps, "-", "no cbpf",
+                   (unsigned long long)shared.lost);
+            continue;
+        }
+        printf("%-8zu %14.0f %14.0f %10zu %8llu\n", counts[i], shared.pps, promoted.pps, promoted.hot,
+               (unsigned long long)(shared.lost + promoted.lost));
+    }
+    return 0;
+}
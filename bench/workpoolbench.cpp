@@ -0,0 +1,310 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+WorkerPool tail latency under skewed load against static assignment
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * workpoolbench [seconds [workers]]
+ *
+ *   g++ -std=c++14 -O2 -pthread -I. bench/workpoolbench.cpp workpool.cpp socket.cpp \
+ *       sockaddr.cpp ipaddr.cpp addrtext.cpp socktap.cpp -o workpoolbench
+ *
+ * Opens 16 loopback TCP connections and keeps one request outstanding on
+ * each for seconds (5 by default). A request costs 20 us of CPU on the
+ * server, except on the first two connections, where it costs 2 ms, 100
+ * times as much. The same load runs twice with workers threads (4):
+ *
+ *   round robin - connection i is served by thread i % workers from its own
+ *                 epoll loop, as a server that assigns connections at accept
+ *                 time does; the light connections that share a thread with
+ *                 a heavy one wait behind it
+ *   WorkerPool  - work stealing, with connections migrating to their thief
+ *
+ * Latency is measured by the client from send to reply and reported
+ * separately for the light and the heavy connections. The client runs in
+ * the same process, so it needs a core of its own; with fewer cores than
+ * workers + 1 the scheduler dominates the tail.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "workpool.hpp"
+
+static const int      CONNECTIONS = 16;
+static const int      HEAVY = 2;
+static const uint64_t LIGHT_NS = 20000;
+static const uint64_t HEAVY_NS = 100 * LIGHT_NS;
+
+static uint64_t
+NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void
+Spin(uint64_t ns)
+{
+    uint64_t end = NowNs() + ns;
+
+    while (NowNs() < end) {
+    }
+}
+
+/*
+ * Serve the requests waiting on a non-blocking connection. A request is one
+ * byte, 'h' for a heavy one, answered by the same byte. One read is served
+ * per call; a connection whose client keeps it busy would otherwise never
+ * give up its thread, and the level triggered loops report what is left.
+ *
+ * @return false once the client has closed the connection.
+ */
+static bool
+Serve(int fd)
+{
+    char    buff[64];
+    ssize_t bytes = read(fd, buff, sizeof(buff));
+
+    if (bytes == 0) {
+        return false;
+    }
+    if (bytes < 0) {
+        return errno == EAGAIN || errno == EINTR;
+    }
+    for (ssize_t i = 0; i < bytes; i++) {
+        Spin(buff[i] == 'h' ? HEAVY_NS : LIGHT_NS);
+    }
+    return write(fd, buff, bytes) == bytes;
+}
+
+class BenchHandler : public ConnectionHandler
+{
+public:
+    virtual bool        OnReadable(PoolConnection &conn) { return Serve(conn.GetSocket().GetDescriptor()); }
+};
+
+/*
+ * One thread of the round robin server, with an epoll loop of its own.
+ */
+static void
+ServeStatic(std::vector<int> fds, std::atomic<bool> *pStop)
+{
+    int                epollFd = epoll_create1(0);
+    struct epoll_event events[CONNECTIONS];
+
+    for (size_t i = 0; i < fds.size(); i++) {
+        struct epoll_event ev;
+
+        ev.events = EPOLLIN;
+        ev.data.fd = fds[i];
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fds[i], &ev);
+    }
+    while (!pStop->load()) {
+        int count = epoll_wait(epollFd, events, CONNECTIONS, 100);
+
+        for (int i = 0; i < count; i++) {
+            if (!Serve(events[i].data.fd)) {
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, events[i].data.fd, NULL);
+            }
+        }
+    }
+    close(epollFd);
+}
+
+static void
+Percentiles(const char *name, std::vector<double> &latency, double seconds)
+{
+    std::sort(latency.begin(), latency.end());
+    if (latency.empty()) {
+        printf("  %-6s no replies\n", name);
+        return;
+    }
+    printf("  %-6s %8.0f req/s  p50 %8.1f us  p99 %8.1f us  p99.9 %8.1f us  max %8.1f us\n", name,
+           latency.size() / seconds, latency[latency.size() / 2], latency[latency.size() * 99 / 100],
+           latency[latency.size() * 999 / 1000], latency.back());
+}
+
+/*
+ * Keep one request outstanding on every connection until the time is up.
+ */
+static void
+Drive(std::vector<Socket *> &socks, double seconds)
+{
+    int                 epollFd = epoll_create1(0);
+    struct epoll_event  events[CONNECTIONS];
+    uint64_t            sent[CONNECTIONS];
+    uint64_t            end = NowNs() + (uint64_t)(seconds * 1e9);
+    std::vector<double> light;
+    std::vector<double> heavy;
+    int                 outstanding = 0;
+
+    for (int i = 0; i < CONNECTIONS; i++) {
+        struct epoll_event ev;
+        char               request = i < HEAVY ? 'h' : 'l';
+
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, socks[i]->GetDescriptor(), &ev);
+        sent[i] = NowNs();
+        socks[i]->Send(&request, 1, 0);
+        outstanding++;
+    }
+
+    while (outstanding > 0) {
+        int count = epoll_wait(epollFd, events, CONNECTIONS, 1000);
+
+        if (count <= 0) {
+            break;
+        }
+        for (int e = 0; e < count; e++) {
+            int      i = events[e].data.u32;
+            char     request;
+            uint64_t now;
+
+            if (socks[i]->Recv(&request, 1, 0) != 1) {
+                continue;
+            }
+            now = NowNs();
+            (i < HEAVY ? heavy : light).push_back((now - sent[i]) / 1000.0);
+            if (now < end) {
+                sent[i] = now;
+                socks[i]->Send(&request, 1, 0);
+            } else {
+                outstanding--;
+            }
+        }
+    }
+    close(epollFd);
+
+    Percentiles("light", light, seconds);
+    Percentiles("heavy", heavy, seconds);
+}
+
+static void
+Connect(Socket &listener, std::vector<Socket *> &socks, std::vector<int> *pAccepted)
+{
+    InetAddress addr;
+    int         one = 1;
+
+    listener.GetSockName(addr);
+    for (int i = 0; i < CONNECTIONS; i++) {
+        Socket *pSock = new Socket(false, SOCK_STREAM);
+
+        pSock->Connect(addr);
+        pSock->SetSockOpt(IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        socks.push_back(pSock);
+        if (pAccepted != NULL) {
+            int fd = listener.Accept();
+
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            pAccepted->push_back(fd);
+        }
+    }
+}
+
+static void
+Disconnect(std::vector<Socket *> &socks)
+{
+    for (size_t i = 0; i < socks.size(); i++) {
+        delete socks[i];
+    }
+    socks.clear();
+}
+
+int
+main(int argc, char *argv[])
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 5;
+    size_t workers = argc > 2 ? (size_t)atoi(argv[2]) : 4;
+
+    printf("%d connections, %d of them %llu us per request, the rest %llu us, %zu workers, %u cores\n",
+           CONNECTIONS, HEAVY, (unsigned long long)(HEAVY_NS / 1000), (unsigned long long)(LIGHT_NS / 1000),
+           workers, std::thread::hardware_concurrency());
+
+    {
+        Socket                   listener(false, SOCK_STREAM);
+        std::vector<Socket *>    socks;
+        std::vector<int>         accepted;
+        std::vector<std::thread> threads;
+        std::atomic<bool>        stop(false);
+
+        listener.Bind(InetAddress::FromIpv4(INADDR_LOOPBACK));
+        listener.Listen(CONNECTIONS);
+        Connect(listener, socks, &accepted);
+
+        for (size_t w = 0; w < workers; w++) {
+            std::vector<int> mine;
+
+            for (size_t i = w; i < accepted.size(); i += workers) {
+                mine.push_back(accepted[i]);
+            }
+            threads.push_back(std::thread(ServeStatic, mine, &stop));
+        }
+
+        printf("round robin\n");
+        Drive(socks, seconds);
+        stop.store(true);
+        for (size_t w = 0; w < threads.size(); w++) {
+            threads[w].join();
+        }
+        for (size_t i = 0; i < accepted.size(); i++) {
+            close(accepted[i]);
+        }
+        Disconnect(socks);
+    }
+
+    {
+        Socket                listener(false, SOCK_STREAM);
+        BenchHandler          handler;
+        WorkerPool            pool(handler, workers);
+        std::vector<Socket *> socks;
+        uint64_t              stolen = 0;
+        uint64_t              migrated = 0;
+
+        listener.Bind(InetAddress::FromIpv4(INADDR_LOOPBACK));
+        listener.Listen(CONNECTIONS);
+        pool.AddListener(listener);
+        pool.Start();
+        Connect(listener, socks, NULL);
+
+        printf("WorkerPool\n");
+        Drive(socks, seconds);
+        Disconnect(socks);
+        pool.Drain(1000);
+        pool.Stop();
+
+        for (size_t w = 0; w < pool.Size(); w++) {
+            WorkerPool::WorkerStats stats = pool.GetStats(w);
+
+            stolen += stats.stolen;
+            migrated += stats.migrated;
+        }
+        printf("  %llu tasks stolen, %llu connections migrated\n", (unsigned long long)stolen,
+               (unsigned long long)migrated);
+    }
+    return 0;
+}
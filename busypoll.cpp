@@ -0,0 +1,242 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Adaptive busy poll receive for latency critical sockets
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "busypoll.hpp"
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL            46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL     69
+#endif
+
+// Weight of a new sample in the wait average is 1 / 2^WAIT_SHIFT.
+static const int WAIT_SHIFT = 3;
+
+// Enough halvings to take any budget to zero.
+static const uint32_t MAX_MISS_STREAK = 32;
+
+static uint64_t
+ClockNs(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void
+CpuRelax()
+{
+#ifdef __SSE2__
+    _mm_pause();
+#endif
+}
+
+AdaptiveReceiver::AdaptiveReceiver(Socket &sock, uint32_t maxSpinUs) : m_sock(sock)
+{
+    m_maxSpinNs = (uint64_t)maxSpinUs * 1000;
+    m_avgWaitNs = 0;
+    m_missStreak = 0;
+
+    // With one CPU the sender cannot run while we spin.
+    if (sysconf(_SC_NPROCESSORS_ONLN) <= 1) {
+        m_maxSpinNs = 0;
+    }
+    ResetStats();
+}
+
+void
+AdaptiveReceiver::ResetStats()
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void
+AdaptiveReceiver::SetKernelBusyPoll(int usec, bool prefer)
+{
+    int on = 1;
+
+    m_sock.SetSockOpt(SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+
+    // Kernels before 5.11 do not know the option; leave it alone unless asked.
+    if (prefer) {
+        m_sock.SetSockOpt(SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on));
+    }
+}
+
+uint64_t
+AdaptiveReceiver::GetSpinBudget() const
+{
+    // Data that usually arrives later than we would spin is not worth chasing.
+    if (m_avgWaitNs > m_maxSpinNs) {
+        return 0;
+    }
+    uint64_t budget = 2 * m_avgWaitNs;
+    if (budget > m_maxSpinNs) {
+        budget = m_maxSpinNs;
+    }
+
+    // Each spin in a row that found nothing halves the next one.
+    return budget >> m_missStreak;
+}
+
+void
+AdaptiveReceiver::Observe(uint64_t waitNs)
+{
+    int64_t delta = (int64_t)waitNs - (int64_t)m_avgWaitNs;
+    m_avgWaitNs = (uint64_t)((int64_t)m_avgWaitNs + delta / (1 << WAIT_SHIFT));
+}
+
+/*
+ * Non-blocking receive. Returns -1 if nothing is queued.
+ */
+int
+AdaptiveReceiver::TryRecv(void *buff, int len, uint32_t flags, InetAddress *pPeer)
+{
+    int     fd = m_sock.GetDescriptor();
+    ssize_t bytes;
+
+    if (pPeer != NULL) {
+        InetSockAddr sa;
+        socklen_t    saLen = sizeof(sa);
+
+        bytes = recvfrom(fd, buff, len, flags | MSG_DONTWAIT, &sa.sa, &saLen);
+        if (bytes >= 0) {
+            *pPeer = InetAddress::FromSockAddr(&sa.sa);
+        }
+    } else {
+        bytes = recv(fd, buff, len, flags | MSG_DONTWAIT);
+    }
+
+    if (bytes < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return -1;
+        }
+	throw std::system_error(errno, std::system_category());
+    }
+    return (int)bytes;
+}
+
+int
+AdaptiveReceiver::Receive(void *buff, int len, uint32_t flags, InetAddress *pPeer, int timeout)
+{
+    int bytes = TryRecv(buff, len, flags, pPeer);
+
+    if (bytes >= 0) {
+        m_stats.immediate++;
+        Observe(0);
+        return bytes;
+    }
+
+    uint64_t start = ClockNs(CLOCK_MONOTONIC);
+    uint64_t budget = GetSpinBudget();
+    uint64_t now = start;
+
+    if (timeout >= 0 && budget > (uint64_t)timeout * 1000000) {
+        budget = (uint64_t)timeout * 1000000;
+    }
+
+    if (budget > 0) {
+        uint64_t cpuStart = ClockNs(CLOCK_THREAD_CPUTIME_ID);
+        uint64_t deadline = start + budget;
+
+        do {
+            CpuRelax();
+            bytes = TryRecv(buff, len, flags, pPeer);
+            now = ClockNs(CLOCK_MONOTONIC);
+        } while (bytes < 0 && now < deadline);
+
+        m_stats.spinNs += now - start;
+        m_stats.spinCpuNs += ClockNs(CLOCK_THREAD_CPUTIME_ID) - cpuStart;
+
+        if (bytes >= 0) {
+            m_stats.spinHits++;
+            m_missStreak = 0;
+            Observe(now - start);
+            return bytes;
+        }
+        m_stats.spinMisses++;
+        if (m_missStreak < MAX_MISS_STREAK) {
+            m_missStreak++;
+        }
+    }
+
+    // Fall back to sleeping until the socket is readable.
+    for (;;) {
+        struct pollfd pfd;
+        int           wait = -1;
+
+        if (timeout >= 0) {
+            uint64_t elapsedMs = (now - start) / 1000000;
+            wait = elapsedMs >= (uint64_t)timeout ? 0 : timeout - (int)elapsedMs;
+        }
+
+        pfd.fd = m_sock.GetDescriptor();
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        uint64_t blockStart = ClockNs(CLOCK_MONOTONIC);
+        int rc = poll(&pfd, 1, wait);
+        now = ClockNs(CLOCK_MONOTONIC);
+        m_stats.blockNs += now - blockStart;
+
+        if (rc < 0 && errno != EINTR)
+        {
+	    throw std::system_error(errno, std::system_category());
+        }
+        if (rc == 0) {
+            m_stats.timeouts++;
+            Observe(now - start);
+            return 0;
+        }
+
+        // A wakeup can find the data already taken, for example by another
+        // socket sharing the queue; if so wait again.
+        if (rc > 0 && (bytes = TryRecv(buff, len, flags, pPeer)) >= 0) {
+            m_stats.blocked++;
+            if (budget == 0 && m_missStreak > 0) {
+                // Let the budget recover if the traffic pattern has changed.
+                m_missStreak--;
+            }
+            Observe(now - start);
+            return bytes;
+        }
+    }
+}
+
+int
+AdaptiveReceiver::Recv(void *buff, int len, uint32_t flags, int timeout)
+{
+    return Receive(buff, len, flags, NULL, timeout);
+}
+
+int
+AdaptiveReceiver::RecvFrom(void *buff, int len, uint32_t flags, InetAddress &peer, int timeout)
+{
+    return Receive(buff, len, flags, &peer, timeout);
+}
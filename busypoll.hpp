@@ -0,0 +1,113 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Adaptive busy poll receive for latency critical sockets
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef BUSYPOLL_HPP
+#define BUSYPOLL_HPP
+
+#include <stdint.h>
+#include "socket.hpp"
+#include "inetaddr.hpp"
+
+/***
+ * @class Receive path that spins before it sleeps. Socket::Recv() with a
+ *        timeout goes straight to poll(), so every message pays for a
+ *        scheduler wakeup. This class first retries a non-blocking receive
+ *        for a spin budget and only then blocks in poll().
+ *
+ *        The budget follows an exponentially weighted average of how long
+ *        recent receives waited for data. While messages arrive within the
+ *        maximum spin time it is twice that average, so most of them are
+ *        caught spinning; when they stop doing so the budget drops to zero
+ *        and the receiver just blocks, spending no CPU on a quiet socket.
+ *        Spins that find nothing halve the next budget, so a peer that only
+ *        answers after we sleep, or a single CPU host, does not make us spin.
+ *
+ *        An object is used by one thread at a time.
+ */
+class AdaptiveReceiver
+{
+public:
+    /***
+     * Time and CPU spent receiving.
+     */
+    struct Stats
+    {
+        uint64_t        immediate;      // Data was already queued
+        uint64_t        spinHits;       // Data arrived while spinning
+        uint64_t        spinMisses;     // Spun for the whole budget, then blocked
+        uint64_t        blocked;        // Received after blocking in poll()
+        uint64_t        timeouts;
+        uint64_t        spinNs;         // Wall time spent spinning
+        uint64_t        spinCpuNs;      // Thread CPU time spent spinning
+        uint64_t        blockNs;        // Wall time spent in poll()
+    };
+
+    /***
+     * Class constructor.
+     *
+     * @param[IN] sock     - Socket to receive on. Its blocking mode is not changed.
+     * @param[IN] maxSpinUs - Longest spin in microseconds.
+     */
+                        AdaptiveReceiver(Socket &sock, uint32_t maxSpinUs = 50);
+
+    /***
+     * Receive as Socket::Recv() with a timeout.
+     *
+     * @param[IN] timeout - Milliseconds to wait, negative to wait forever.
+     *
+     * @return Bytes received, or 0 on timeout or end of stream.
+     *
+     * @throws std::system_error if the receive fails.
+     */
+    int                 Recv(void *buff, int len, uint32_t flags, int timeout);
+
+    /***
+     * @overload Receive a datagram and its sender.
+     */
+    int                 RecvFrom(void *buff, int len, uint32_t flags, InetAddress &peer, int timeout);
+
+    /***
+     * Also let the kernel busy poll the device queue, for usec microseconds per
+     * receive, with SO_BUSY_POLL and optionally SO_PREFER_BUSY_POLL. Needs
+     * CAP_NET_ADMIN to raise the value above the net.core.busy_read default.
+     * SO_PREFER_BUSY_POLL needs Linux 5.11 and is only set if prefer is true.
+     *
+     * @throws std::system_error if the kernel rejects an option. SO_BUSY_POLL
+     *         stays set if only SO_PREFER_BUSY_POLL is rejected.
+     */
+    void                SetKernelBusyPoll(int usec, bool prefer);
+
+    /***
+     * Spin budget the next receive will use, in nanoseconds.
+     */
+    uint64_t            GetSpinBudget() const;
+
+    const Stats        &GetStats() const { return m_stats; }
+    void                ResetStats();
+
+private:
+    int                 Receive(void *buff, int len, uint32_t flags, InetAddress *pPeer, int timeout);
+    int                 TryRecv(void *buff, int len, uint32_t flags, InetAddress *pPeer);
+    void                Observe(uint64_t waitNs);
+
+    Socket             &m_sock;
+    uint64_t            m_maxSpinNs;
+    uint64_t            m_avgWaitNs;
+    uint32_t            m_missStreak;   // Consecutive spins that found nothing
+    Stats               m_stats;
+};
+
+#endif
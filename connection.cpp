@@ -0,0 +1,273 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Compact per-connection state for servers holding very large numbers of sockets
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <system_error>
+
+#include "connection.hpp"
+
+static uint32_t
+CoarseSeconds()
+{
+    struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint32_t)ts.tv_sec;
+}
+
+ConnectionTable::ConnectionTable(size_t reserve)
+{
+    m_used = 0;
+    m_coldCount = 0;
+    m_hostBytes = 0;
+    m_hot.reserve(reserve);
+    m_cold.reserve(reserve);
+}
+
+ConnectionTable::~ConnectionTable()
+{
+    for (uint32_t i = 0; i < m_hot.size(); i++) {
+        if (m_hot[i].fd >= 0) {
+            close(m_hot[i].fd);
+        }
+        ReleaseCold(i);
+    }
+}
+
+ConnHandle
+ConnectionTable::Add(int fd)
+{
+    ConnHandle handle;
+    HotState  *pHot;
+
+    if (!m_free.empty()) {
+        handle.index = m_free.back();
+        m_free.pop_back();
+        pHot = &m_hot[handle.index];
+    } else {
+        handle.index = (uint32_t)m_hot.size();
+        m_hot.push_back(HotState());
+        m_cold.push_back((ColdState *)NULL);
+        pHot = &m_hot.back();
+        pHot->generation = 0;
+    }
+
+    pHot->fd = fd;
+    pHot->flags = 0;
+    pHot->lastActive = CoarseSeconds();
+    pHot->bytesIn = 0;
+    pHot->bytesOut = 0;
+    handle.generation = pHot->generation;
+
+    m_used++;
+    return handle;
+}
+
+ConnHandle
+ConnectionTable::Accept(Socket &listener)
+{
+    return Add(listener.Accept());
+}
+
+void
+ConnectionTable::Close(ConnHandle handle)
+{
+    HotState *pHot = Lookup(handle);
+
+    if (pHot == NULL) {
+        return;
+    }
+
+    close(pHot->fd);
+    pHot->fd = -1;
+    pHot->generation++;
+    ReleaseCold(handle.index);
+
+    m_free.push_back(handle.index);
+    m_used--;
+}
+
+ConnectionTable::HotState *
+ConnectionTable::Get(ConnHandle handle)
+{
+    return Lookup(handle);
+}
+
+int
+ConnectionTable::Recv(ConnHandle handle, void *buff, int len, uint32_t flags)
+{
+    int       bytes;
+    HotState *pHot = Lookup(handle);
+
+    if (pHot == NULL) {
+        throw std::system_error(EBADF, std::system_category());
+    }
+
+    if ( ( bytes = recv(pHot->fd, buff, len, flags) ) < 0 )
+    {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    pHot->bytesIn += bytes;
+    pHot->lastActive = CoarseSeconds();
+    return bytes;
+}
+
+int
+ConnectionTable::Send(ConnHandle handle, const void *buff, int len, uint32_t flags)
+{
+    int       bytes;
+    HotState *pHot = Lookup(handle);
+
+    if (pHot == NULL) {
+        throw std::system_error(EBADF, std::system_category());
+    }
+
+    if ( ( bytes = send(pHot->fd, buff, len, flags) ) < 0 )
+    {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    pHot->bytesOut += bytes;
+    pHot->lastActive = CoarseSeconds();
+    return bytes;
+}
+
+const sockaddr *
+ConnectionTable::GetPeerAddress(ConnHandle handle, socklen_t &len)
+{
+    ColdState *pCold = Cold(handle);
+
+    len = pCold->addrLen;
+    return (const sockaddr *)&pCold->addr;
+}
+
+const char *
+ConnectionTable::GetPeerAddressText(ConnHandle handle)
+{
+    ColdState *pCold = Cold(handle);
+
+    if (pCold->text[0] == '\0') {
+        if (pCold->addr.sin6_family == AF_INET6) {
+            inet_ntop(AF_INET6, &pCold->addr.sin6_addr, pCold->text, sizeof(pCold->text));
+        } else {
+            inet_ntop(AF_INET, &((sockaddr_in *)&pCold->addr)->sin_addr, pCold->text,
+                      sizeof(pCold->text));
+        }
+    }
+    return pCold->text;
+}
+
+const char *
+ConnectionTable::GetPeerHostName(ConnHandle handle)
+{
+    ColdState *pCold = Cold(handle);
+    char       host[NI_MAXHOST];
+
+    if (pCold->hostName == NULL) {
+        if (getnameinfo((const sockaddr *)&pCold->addr, pCold->addrLen, host, sizeof(host),
+                        NULL, 0, 0) != 0) {
+            return GetPeerAddressText(handle);
+        }
+        if ((pCold->hostName = strdup(host)) == NULL) {
+            return GetPeerAddressText(handle);
+        }
+        m_hostBytes += strlen(pCold->hostName) + 1;
+    }
+    return pCold->hostName;
+}
+
+size_t
+ConnectionTable::MemoryUsage() const
+{
+    size_t bytes = sizeof(*this);
+
+    bytes += m_hot.capacity() * sizeof(HotState);
+    bytes += m_cold.capacity() * sizeof(ColdState *);
+    bytes += m_free.capacity() * sizeof(uint32_t);
+    bytes += m_coldCount * sizeof(ColdState);
+    bytes += m_hostBytes;
+
+    return bytes;
+}
+
+ConnectionTable::HotState *
+ConnectionTable::Lookup(ConnHandle handle)
+{
+    if (handle.index >= m_hot.size()) {
+        return NULL;
+    }
+
+    HotState *pHot = &m_hot[handle.index];
+    if (pHot->generation != handle.generation || pHot->fd < 0) {
+        return NULL;
+    }
+    return pHot;
+}
+
+ConnectionTable::ColdState *
+ConnectionTable::Cold(ConnHandle handle)
+{
+    HotState *pHot = Lookup(handle);
+
+    if (pHot == NULL) {
+        throw std::system_error(EBADF, std::system_category());
+    }
+
+    ColdState *pCold = m_cold[handle.index];
+    if (pCold == NULL) {
+        pCold = (ColdState *)calloc(1, sizeof(ColdState));
+        if (pCold == NULL) {
+            throw std::system_error(ENOMEM, std::system_category());
+        }
+
+        pCold->addrLen = sizeof(pCold->addr);
+        if (getpeername(pHot->fd, (sockaddr *)&pCold->addr, &pCold->addrLen) < 0) {
+            int err = errno;
+            free(pCold);
+            throw std::system_error(err, std::system_category());
+        }
+
+        m_cold[handle.index] = pCold;
+        m_coldCount++;
+    }
+    return pCold;
+}
+
+void
+ConnectionTable::ReleaseCold(uint32_t index)
+{
+    ColdState *pCold = m_cold[index];
+
+    if (pCold != NULL) {
+        if (pCold->hostName != NULL) {
+            m_hostBytes -= strlen(pCold->hostName) + 1;
+            free(pCold->hostName);
+        }
+        free(pCold);
+        m_cold[index] = NULL;
+        m_coldCount--;
+    }
+}
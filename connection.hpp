@@ -0,0 +1,163 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Compact per-connection state for servers holding very large numbers of sockets
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef CONNECTION_HPP
+#define CONNECTION_HPP
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "socket.hpp"
+
+/***
+ * @struct Handle to a connection stored in a ConnectionTable. A handle is only
+ *         the slot index and a generation count so a stale handle to a slot that
+ *         has been closed and reused is detected instead of acting on the wrong
+ *         descriptor.
+ */
+struct ConnHandle
+{
+    uint32_t index;
+    uint32_t generation;
+};
+
+/***
+ * @class Table of accepted connections. A Socket object carries a sockaddr_storage,
+ *        the SocketAddress pointers and the IPAddress strings, which is several
+ *        hundred bytes per idle connection. The table keeps only the descriptor and
+ *        the counters touched on every I/O in a dense array of 32 byte entries, two
+ *        per cache line. Peer address and host name are looked up on first request
+ *        and kept in a separately allocated cold record.
+ */
+class ConnectionTable
+{
+public:
+    /***
+     * Per connection state read or written on every I/O.
+     */
+    struct HotState
+    {
+        int32_t  fd;
+        uint32_t generation;
+        uint32_t flags;
+        uint32_t lastActive;
+        uint64_t bytesIn;
+        uint64_t bytesOut;
+    };
+
+    /***
+     * Class constructor.
+     *
+     * @param[IN] reserve - Number of connection slots to allocate up front.
+     */
+                        ConnectionTable(size_t reserve = 0);
+
+    /***
+     * Class destructor. Closes every descriptor still held by the table.
+     */
+                        ~ConnectionTable();
+
+    /***
+     * Take ownership of an open socket descriptor.
+     *
+     * @param[IN] fd - Connected socket descriptor.
+     *
+     * @return Handle used for all further operations on the connection.
+     */
+    ConnHandle          Add(int fd);
+
+    /***
+     * Accept the next connection queued on a listening socket and add it to the table.
+     * The peer address is not copied; it is fetched with getpeername() if requested.
+     *
+     * @param[IN] listener - Listening socket.
+     */
+    ConnHandle          Accept(Socket &listener);
+
+    /***
+     * Close the descriptor and release the slot for reuse.
+     */
+    void                Close(ConnHandle handle);
+
+    /***
+     * Returns the hot state for a handle or NULL if the handle is stale.
+     */
+    HotState           *Get(ConnHandle handle);
+
+    int                 Recv(ConnHandle handle, void *buff, int len, uint32_t flags);
+    int                 Send(ConnHandle handle, const void *buff, int len, uint32_t flags);
+
+    /***
+     * Returns the remote address of the connection, calling getpeername() the first
+     * time it is requested.
+     *
+     * @param[OUT] len - Length of the returned structure.
+     */
+    const sockaddr     *GetPeerAddress(ConnHandle handle, socklen_t &len);
+
+    /***
+     * Returns the remote address in dot or colon notation. The string belongs to
+     * the table and stays valid until the connection is closed.
+     */
+    const char         *GetPeerAddressText(ConnHandle handle);
+
+    /***
+     * Returns the resolved name of the remote host. The lookup is done once and
+     * the result kept until the connection is closed.
+     */
+    const char         *GetPeerHostName(ConnHandle handle);
+
+    /***
+     * Number of open connections.
+     */
+    size_t              Size() const { return m_used; }
+
+    /***
+     * Bytes of heap held by the table including all materialized cold records
+     * and the host names they hold.
+     */
+    size_t              MemoryUsage() const;
+
+private:
+    /***
+     * Peer data that is only built when somebody asks for it.
+     */
+    struct ColdState
+    {
+        sockaddr_in6    addr;
+        socklen_t       addrLen;
+        char            text[INET6_ADDRSTRLEN];
+        char           *hostName;
+    };
+
+                        ConnectionTable(const ConnectionTable &);
+    ConnectionTable    &operator=(const ConnectionTable &);
+
+    HotState           *Lookup(ConnHandle handle);
+    ColdState          *Cold(ConnHandle handle);
+    void                ReleaseCold(uint32_t index);
+
+    std::vector<HotState>   m_hot;
+    std::vector<ColdState*> m_cold;
+    std::vector<uint32_t>   m_free;
+    size_t                  m_used;
+    size_t                  m_coldCount;
+    size_t                  m_hostBytes;    // strdup'd host names, terminators included
+};
+
+#endif
@@ -22,8 +22,9 @@
  */
 
 #include <getopt.h>
+#include <algorithm>
+#include <cstring>
 #include <iostream>
-#include <list>
 
 char* optarg;
 int opterr = 1;
@@ -34,7 +35,7 @@ int
 getopt(int argc, char* const argv[], char *opts)
 {
     int rOpt = '?';
-    static GetOpt* pGetopt = NULL;
+    static thread_local GetOpt* pGetopt = NULL;
 
     if ( (pGetopt == NULL) || (optind == 0) ) {
         if (pGetopt != NULL) {
@@ -45,15 +46,19 @@ getopt(int argc, char* const argv[], char *opts)
 
     rOpt = pGetopt->getopt( NULL );
 
-    if (rOpt == '?' && opterr != 0) {
-        std::cerr << "Unrecogniced option" << optopt << std::endl;
-    }
-
     optarg = pGetopt->optarg;
     optind = pGetopt->optind;
     optopt = pGetopt->optopt;
 
-    if (rOpt == 0) {
+    if (rOpt == '?' && opterr != 0) {
+        if (optopt != 0) {
+            std::cerr << "Unrecognized option or missing argument -" << (char)optopt << std::endl;
+        } else {
+            std::cerr << "Unrecognized option " << argv[ optind - 1 ] << std::endl;
+        }
+    }
+
+    if (rOpt == -1) {
         delete pGetopt;
         pGetopt = NULL;
     }
@@ -66,25 +71,29 @@ getopt_long( int argc, char* const argv[], const char *shortopts,
     const struct option* longopts, int* longind )
 {
     int rOpt = '?';
-    static GetOpt* pGetopt = NULL;
+    static thread_local GetOpt* pGetopt = NULL;
 
     if ((pGetopt == NULL) || (optind == 0)) {
         if (pGetopt != NULL) {
             delete pGetopt;
         }
-        pGetopt = new GetOpt( argc, argv, shortopts, (const struct option*)NULL );
+        pGetopt = new GetOpt( argc, argv, shortopts, longopts );
     }
 
-    rOpt = pGetopt->getopt( NULL );
-
-    if (rOpt == '?' && opterr != 0) {
-        std::cerr << "Unrecogniced option" << optopt << std::endl;
-    }
+    rOpt = pGetopt->getopt( longind );
 
     optarg = pGetopt->optarg;
     optind = pGetopt->optind;
     optopt = pGetopt->optopt;
 
+    if (rOpt == '?' && opterr != 0) {
+        if (optopt != 0) {
+            std::cerr << "Unrecognized option or missing argument -" << (char)optopt << std::endl;
+        } else {
+            std::cerr << "Unrecognized option " << argv[ optind - 1 ] << std::endl;
+        }
+    }
+
     if ( rOpt == -1 ) {
         delete pGetopt;
         pGetopt = NULL;
@@ -94,15 +103,22 @@ getopt_long( int argc, char* const argv[], const char *shortopts,
 }
 
 
-GetOpt::GetOpt(int argc, char* const argv[], const char *opts, const option* longopts)
+GetOpt::GetOpt(int argc, char* const argv[], const char *opts, const option* longopts,
+               bool responseFiles)
 {
 
     m_argc = argc;
     m_argv = (char**)argv;
+    if ( responseFiles ) {
+        m_expanded.reset( new ArgVector( argc, argv ) );
+        m_argc = m_expanded->Count();
+        m_argv = m_expanded->Get();
+    }
+    m_total = m_argc;
     optind = 1;
     m_nextChar = 0;
 
-    optarg = argv[optind];
+    optarg = m_argv[optind];
     
     int len = strlen(opts);
     if ( len > 0 ) {
@@ -117,8 +133,9 @@ GetOpt::GetOpt(int argc, char* const argv[], const char *opts, const option* lon
                     if ( ++i < len && opts[ i ] == ':' ) {
                         args.has_arg = optional_argument;
                         i++;
-                    } 
-                    args.has_arg = required_argument;
+                    } else {
+                        args.has_arg = required_argument;
+                    }
                 } else {
                     args.has_arg = no_argument;
                 }
@@ -147,6 +164,8 @@ GetOpt::GetOpt(int argc, char* const argv[], const char *opts, const option* lon
             args.indx = indx;
 
             m_options.insert( std::pair< std::string, parms>( longopts->name, args ) );
+            longopts++;
+            indx++;
         }
     }
 
@@ -157,48 +176,119 @@ GetOpt::~GetOpt()
     m_options.erase( m_options.begin(), m_options.end() );
 }
 
-GetOpt::iterator GetOpt::getopt_long()
+/**
+ * @brief Check whether an option argument is followed by a separate argument
+ *        element, as in "-o file" or "--output file".
+ */
+bool
+GetOpt::NeedsArgument( const char* arg ) const
 {
-    m_nextChar++;
-    char* current = m_argv[ optind ];
-    iterator it;
-
-    std::string needle;
-
-    needle = &current[ m_nextChar ];
-    int offset = needle.find( '=' );
-    if ( offset == std::string::npos ) {
-        optind++;
-        m_nextChar = 0;
-        current = m_argv[ optind ];
-    } else {
-        m_nextChar += (offset + 1);
-        needle = needle.substr( 0, offset - 1 );
-    }
+    const_iterator it;
 
-    it = m_options.lower_bound( needle );
+    if ( arg[ 1 ] == '-' ) {
+        if ( strchr( arg, '=' ) != NULL ) {
+            return false;
+        }
+        it = FindLong( &arg[ 2 ], strlen( &arg[ 2 ] ) );
+        return it != m_options.end() && it->second.has_arg == required_argument;
+    }
 
-    if ( it != m_options.end() ) {
-        // check if exact match or substring. If substring than check next
-        // container to verify the needle is not a substring of it.
-        if (needle.compare( it->first ) != 0) {
-            iterator itnext = it;
-            itnext++;
+    // Short options may be grouped. The first one taking an argument uses the
+    // rest of the element or, if it is last, the next element.
+    for (int i = 1; arg[ i ] != '\0'; i++) {
+        char key[ 2 ] = { arg[ i ], '\0' };
+        it = m_options.find( (const char*)key );
+        if ( it != m_options.end() && it->second.has_arg != no_argument ) {
+            return arg[ i + 1 ] == '\0' && it->second.has_arg == required_argument;
+        }
+    }
+    return false;
+}
 
-            if (itnext->first.compare( needle ) == 0) {
-                it = m_options.end();
+/**
+ * @brief Stable in place partition of argv into options, each followed by its
+ *        separate argument if it has one, and then operands.
+ *
+ * Whether an element is an option argument depends only on the element before
+ * it, so the range is split on an option boundary, each half partitioned, and
+ * the operands of the left half rotated past the options of the right half.
+ * This needs no memory beyond a small stack buffer and O(n log n) moves, and
+ * only O(n) when the operands are already grouped, which is the usual case.
+ *
+ * @return The number of elements that belong to options.
+ */
+int
+GetOpt::PartitionArgs( char** argv, int count ) const
+{
+    const int chunk = 64;
+
+    if ( count <= chunk ) {
+        char* operands[ chunk ];
+        int options = 0;
+        int nOperands = 0;
+
+        for (int i = 0; i < count; i++) {
+            if ( IsOption( argv[ i ] ) ) {
+                bool takesNext = NeedsArgument( argv[ i ] );
+                argv[ options++ ] = argv[ i ];
+                if ( takesNext && i + 1 < count && !IsOption( argv[ i + 1 ] ) ) {
+                    argv[ options++ ] = argv[ ++i ];
+                }
+            } else {
+                operands[ nOperands++ ] = argv[ i ];
             }
         }
+
+        memcpy( &argv[ options ], operands, nOperands * sizeof( char* ) );
+        return options;
+    }
+
+    int mid = count / 2;
+    if ( !IsOption( argv[ mid ] ) && IsOption( argv[ mid - 1 ] ) && NeedsArgument( argv[ mid - 1 ] ) ) {
+        mid++;
+    }
+
+    int left = PartitionArgs( argv, mid );
+    int right = PartitionArgs( &argv[ mid ], count - mid );
+
+    std::rotate( &argv[ left ], &argv[ mid ], &argv[ mid + right ] );
+    return left + right;
+}
+
+/**
+ * @brief Look up a long option by name or by an unambiguous abbreviation.
+ */
+GetOpt::const_iterator
+GetOpt::FindLong( const char* name, size_t len ) const
+{
+    // An empty name, as in "--=x", would abbreviate every option.
+    if ( len == 0 ) {
+        return m_options.end();
+    }
+
+    std::string needle( name, len );
+    const_iterator it = m_options.lower_bound( needle );
+
+    if ( it == m_options.end() || it->first.compare( 0, len, needle ) != 0 ) {
+        return m_options.end();
+    }
+
+    // An abbreviation must not also be the start of the next name.
+    if ( it->first.size() != len ) {
+        const_iterator itnext = it;
+        itnext++;
+        if ( itnext != m_options.end() && itnext->first.compare( 0, len, needle ) == 0 ) {
+            return m_options.end();
+        }
     }
-     return it;
+    return it;
 }
 
 int
 GetOpt::getopt( int* longIndex )
 {
     char* current = m_argv[optind];
-    std::string needle;
-    iterator it;
+    const_iterator it;
     this->optarg = NULL;
     this->optopt = 0;
 
@@ -208,96 +298,101 @@ GetOpt::getopt( int* longIndex )
         return -1;
     }
 
+    // "--" ends the options. Anything after it is left for the caller.
+    if ( m_nextChar == 0 && strcmp( current, "--" ) == 0 ) {
+        this->optind++;
+        m_argc = this->optind;
+        return -1;
+    }
+
     // To emulate gcc behavior non-option arguments need to be shifted to the
-    // end of the argv array. 
-    if ( m_nextChar == 0 && current[ 0 ] != '-' ) {
-        char* ptr = m_argv[ this->optind ];
-        int indx = this->optind;
-        int next = this->optind;
-        std::list<char*> fifo;
-
-        fifo.push_back( m_argv[ indx ] );
-        while (++indx != m_argc) {
-            if (m_argv[ indx ][ 0 ] != '-') {
-                fifo.push_back( m_argv[ indx ] );
-            } else {
-                m_argv[ next++ ] = m_argv[ indx ];
-            }
+    // end of the argv array. The remaining arguments up to any "--" are
+    // partitioned once, in place, so options come first.
+    if ( m_nextChar == 0 && !IsOption( current ) ) {
+        int end = this->optind;
+        while (end < m_argc && strcmp( m_argv[ end ], "--" ) != 0) {
+            end++;
         }
 
-        // If reordering of pointers occurred then all options have been
-        // processed.
-        if (next == this->optind) {
-            fifo.erase( fifo.begin(), fifo.end() );
+        int options = PartitionArgs( &m_argv[ this->optind ], end - this->optind );
+
+        // Move a "--" in front of the operands so it is consumed with the options.
+        if (end < m_argc) {
+            std::rotate( &m_argv[ this->optind + options ], &m_argv[ end ], &m_argv[ end + 1 ] );
+            options++;
+        } else if (options == 0) {
             return -1;
         }
-        
-        while (!fifo.empty()) {
-            m_argv[ next++ ] = fifo.front();
-            fifo.pop_front();
-
-            // Change the internal argc so that we don't need to run through
-            // the reordered data again after the options are processed.
-            m_argc--;
-        }
+
+        // Change the internal argc so that we don't need to run through
+        // the reordered data again after the options are processed.
+        m_argc = this->optind + options;
 
         // Reset current to the new value at optind
         current = m_argv[ this->optind ];
-    }
-        
-    if ( m_nextChar != 0 ) {
-        // In the middle of an option string
-        needle = &current[ m_nextChar ];
-        it = m_options.find( needle );
-
-    } else if ( current[ 0 ] == '-' ) {
-        // Start of a new option string
-        if (current[ 1 ] != '-') {
-            // Get an iterator for a short option.
-            needle = &current[ ++m_nextChar ];
-            it = m_options.find( needle );
-        } else {
-            // Get an iterator for the long option.
-            m_nextChar += 2;
-            it = getopt_long();
+        if ( strcmp( current, "--" ) == 0 ) {
+            this->optind++;
+            m_argc = this->optind;
+            return -1;
         }
     }
 
-    // Unrecognized option
-    if ( it == m_options.end() ) {
-        if ( !needle.empty() ) {
-            this->optopt = needle.at( 0 );
-        }
-        return '?';
-    }
+    const char* attached = NULL;
 
-    if ( longIndex != NULL ) {
-        *longIndex = it->second.indx;
-    }
+    if ( m_nextChar == 0 && current[ 1 ] == '-' ) {
+        // A long option, with its argument attached after '=' if there is one.
+        const char* name = &current[ 2 ];
+        const char* value = strchr( name, '=' );
+        size_t len = (value != NULL) ? (size_t)(value - name) : strlen( name );
 
-    if ( current[ ++m_nextChar ] == 0 ) {
-        m_nextChar = 0;
+        it = FindLong( name, len );
         this->optind++;
-        if ( this->optind < m_argc ) {
-            current = m_argv[ this->optind ];
+        if ( value != NULL ) {
+            attached = value + 1;
         }
-    }
 
+        if ( it == m_options.end() || (attached != NULL && it->second.has_arg == no_argument) ) {
+            if ( it != m_options.end() ) {
+                this->optopt = it->second.val;
+            }
+            return '?';
+        }
+    } else {
+        // A short option, possibly one of a group such as -abc or -ofile.
+        if ( m_nextChar == 0 ) {
+            m_nextChar = 1;
+        }
+        char key = current[ m_nextChar++ ];
+        it = m_options.find( std::string( 1, key ) );
+
+        if ( current[ m_nextChar ] == '\0' ) {
+            m_nextChar = 0;
+            this->optind++;
+        } else if ( it != m_options.end() && it->second.has_arg != no_argument ) {
+            attached = &current[ m_nextChar ];
+            m_nextChar = 0;
+            this->optind++;
+        }
 
-    //Process optional and required arguments
-    if ( it->second.has_arg != no_argument ) {
-        if ( optind == m_argc || current[ m_nextChar ] == '-' ) {
-            if ( it->second.has_arg == required_argument ) {
-                if ( !needle.empty() ) {
-                    optopt = needle.at( 0 );
-                }
-                return '?';
-            }        
+        if ( it == m_options.end() ) {
+            this->optopt = key;
+            return '?';
         }
+    }
 
-        optarg = &current[ m_nextChar ];
-        this->optind++;
-        m_nextChar = 0;
+    if ( longIndex != NULL ) {
+        *longIndex = it->second.indx;
+    }
+
+    // Process optional and required arguments
+    if ( attached != NULL ) {
+        this->optarg = (char*)attached;
+    } else if ( it->second.has_arg == required_argument ) {
+        if ( this->optind == m_argc || IsOption( m_argv[ this->optind ] ) ) {
+            this->optopt = it->second.val;
+            return '?';
+        }
+        this->optarg = m_argv[ this->optind++ ];
     }
 
     if ( it->second.flag != NULL ) {
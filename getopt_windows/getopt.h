@@ -22,7 +22,11 @@
 #ifndef GETOPT_H_
 #define GETOPT_H_
 #include <map>
+#include <memory>
 #include <string>
+#include <vector>
+#include <cstddef>
+#include "respfile.h"
 
 extern int opterr;
 extern int optind;
@@ -33,6 +37,12 @@ struct option {
     int val;
 };
 
+/*
+ * The parser behind getopt() and getopt_long() is kept per thread, but the
+ * results are returned in the globals above and below as POSIX requires, so
+ * these two must not be used by more than one thread at a time. Threads that
+ * parse concurrently should each use an OptionParser from opttable.h.
+ */
 extern int optopt;
 extern char *optarg;
 extern int getopt(int argc, char* const argv[], char* opts);
@@ -50,11 +60,21 @@ class GetOpt {
 public:
 
 
-    GetOpt(int argc, char* const argv[], const char *opts, const option* longopts);
+    /**
+     * @brief With responseFiles set each "@file" argument is replaced by the
+     *        arguments in the file before parsing, as gcc does. The vector that
+     *        is parsed and permuted is then a copy; argc() and argv() return it,
+     *        and its operands start at optind once getopt() returns -1.
+     */
+    GetOpt(int argc, char* const argv[], const char *opts, const option* longopts,
+           bool responseFiles = false);
     ~GetOpt();
 
     int getopt( int* longIndex );
 
+    int    argc() const { return m_total; }
+    char** argv() const { return m_argv; }
+
     int   optopt;
     char* optarg;
     int   optind;
@@ -69,14 +89,63 @@ private:
 
     
     bool ValidOption( char c ) { return true; }; // XXX fix this someday
-    typedef std::map<std::string, parms>::iterator iterator;
+    typedef std::map<std::string, parms, std::less<> >::iterator iterator;
+    typedef std::map<std::string, parms, std::less<> >::const_iterator const_iterator;
     int m_argc;
+    int m_total;
     int m_nextChar;
     char** m_argv;
-    std::map <std::string, parms> m_options;
-    iterator getopt_long();
+    std::unique_ptr<ArgVector> m_expanded;
+    std::map <std::string, parms, std::less<> > m_options;
+    const_iterator FindLong( const char* name, size_t len ) const;
+
+    bool IsOption( const char* arg ) const { return arg[ 0 ] == '-' && arg[ 1 ] != '\0'; }
+    bool NeedsArgument( const char* arg ) const;
+    int  PartitionArgs( char** argv, int count ) const;
 };
 
 extern int getsubopt( char **optionp, char* const* tokens, char **valuep );
 
+/**
+ * @brief Hash index over a NULL terminated getsubopt token array. Build it once
+ *        and reuse it for every suboption string parsed against those tokens.
+ */
+class SubOptTable {
+public:
+    SubOptTable( const char* const* tokens );
+
+    /**
+     * @brief Return the index of the token equal to name[0..len) or -1.
+     */
+    int Find( const char* name, size_t len ) const;
+
+private:
+    static size_t Hash( const char* name, size_t len );
+
+    const char* const* m_tokens;
+    std::vector<int>   m_slots;
+    size_t             m_mask;
+};
+
+/**
+ * @brief One suboption as returned by the non mutating getsubopt. The strings
+ *        point into the option string and are not NUL terminated. value is
+ *        NULL if the suboption had no '='.
+ */
+struct SubOptValue {
+    const char* name;
+    size_t      nameLen;
+    const char* value;
+    size_t      valueLen;
+};
+
+/**
+ * @brief getsubopt that leaves the option string untouched and looks tokens up
+ *        by hash. *optionp is advanced past the suboption returned.
+ *
+ * @return Index of the matching token, or -1 if the name is not a token or the
+ *         string is exhausted (**optionp == '\0').
+ */
+extern int getsubopt( const char **optionp, const SubOptTable& tokens, SubOptValue& value );
+
 #endif
\ No newline at end of file
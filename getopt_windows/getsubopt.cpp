@@ -27,6 +27,38 @@
 #include <cstring>
 
 
+/**
+ * @brief Split off the suboption at start: its name, and its value if there is
+ *        an '=' before the next ','. Nothing is written.
+ *
+ * @return The ',' or NUL that ends the suboption.
+ */
+static const char*
+SplitSubOpt( const char* start, SubOptValue& value )
+{
+    const char* pEnd = start;
+    const char* pValue = NULL;
+
+    while (*pEnd != '\0' && *pEnd != ',') {
+        if (*pEnd == '=' && pValue == NULL) {
+            pValue = pEnd;
+        }
+        pEnd++;
+    }
+
+    value.name = start;
+    if (pValue != NULL) {
+        value.nameLen = (size_t)(pValue - start);
+        value.value = pValue + 1;
+        value.valueLen = (size_t)(pEnd - pValue - 1);
+    } else {
+        value.nameLen = (size_t)(pEnd - start);
+        value.value = NULL;
+        value.valueLen = 0;
+    }
+    return pEnd;
+}
+
 /**
  * @brief Provide Unix compatability for Operating systems that don't support
  *        getsubopt.
@@ -39,6 +71,8 @@
 int
 getsubopt( char** subopts, char* const* tokens, char** value )
 {
+    SubOptValue sub;
+
     // Check that params are valid.  GNU C requires the token pointer, but
     // that isn't always needed or wanted. So don't fail if it isn't passed.
     if ( value == NULL ) {
@@ -46,58 +80,115 @@ getsubopt( char** subopts, char* const* tokens, char** value )
     }
 
     // Check if parsing of option string is complete
-    if (*subopts[ 0 ] == '\0') {
+    if (**subopts == '\0') {
         return -1;
     }
- 
-    // If we don't find a token then we are going to return everything upto the
-    // next suboption delimiter
-    *value = *subopts;
-
-    // Find the delimiters for the value and next suboption.
-    char* pValue = strchr( *subopts, '=' );
-    char* pNext = strchr( *subopts, ',' );
-
-    // If there was a value delimiter set the value to point to it.
-    if (pValue != NULL) {
-        // Set delimiter to 0 to create token used for searching token array.
-        // Don't destroy pValue since the delimiter may need to be restored if
-        // the token isn't found in the array.
-        *pValue = '\0';
-    } 
 
+    char* pNext = (char*)SplitSubOpt( *subopts, sub );
 
-    // Assuming the delimiter is the end of the first suboption. Replace it with 0
-    // to create the token or value string. 
-    if ( pNext != NULL ) {
+    // The value is returned as a string, so the ',' after it is the one byte
+    // written, as POSIX specifies. The name is compared by length and the '='
+    // is left alone.
+    if (*pNext == ',') {
         *pNext++ = '\0';
-    } else {
-        // Finished, set subopts to point to NULL at end of string
-        pNext = *subopts + strlen( *subopts );
     }
-    
+
+    //Stage subopts for the next call
+    *subopts = pNext;
 
     if (tokens != NULL) {
         for (int i = 0; tokens[ i ] != NULL; ++i) {
-            if (strcmp( *subopts, tokens[ i ] ) == 0) {
-                // If delimiter was found then advance pointer to point to
-                // start of value string.
-                if ( pValue != NULL ) pValue++;
-                *value = pValue;
+            if (strncmp( tokens[ i ], sub.name, sub.nameLen ) == 0 && tokens[ i ][ sub.nameLen ] == '\0') {
+                *value = (char*)sub.value;
                 return i;
             }
         }
     }
-    
-    // Not found. Restore and return entire suboption string.
-    if (pValue != NULL) {
-        *pValue = '=';
+
+    // Not found. Return the entire suboption string.
+    *value = (char*)sub.name;
+    return -1;
+}
+
+
+
+SubOptTable::SubOptTable( const char* const* tokens )
+{
+    size_t count = 0;
+
+    m_tokens = tokens;
+    while (tokens != NULL && tokens[ count ] != NULL) {
+        count++;
     }
 
+    // Keep the load at or below one half so probes stay short.
+    size_t size = 8;
+    while (size < count * 2) {
+        size <<= 1;
+    }
+    m_mask = size - 1;
+    m_slots.assign( size, -1 );
 
-    //Stage subopts for the next call
-    *subopts = pNext;
+    for (size_t i = 0; i < count; i++) {
+        size_t len = strlen( tokens[ i ] );
+        size_t slot = Hash( tokens[ i ], len ) & m_mask;
 
-    return -1;
+        // The first of duplicate tokens wins, as it does in the linear scan.
+        while (m_slots[ slot ] != -1 && strcmp( tokens[ m_slots[ slot ] ], tokens[ i ] ) != 0) {
+            slot = (slot + 1) & m_mask;
+        }
+        if (m_slots[ slot ] == -1) {
+            m_slots[ slot ] = (int)i;
+        }
+    }
+}
+
+/**
+ * @brief FNV-1a, enough to spread the few dozen short names a token array has.
+ */
+size_t
+SubOptTable::Hash( const char* name, size_t len )
+{
+    size_t hash = 2166136261U;
+
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)name[ i ]) * 16777619U;
+    }
+    return hash;
 }
 
+int
+SubOptTable::Find( const char* name, size_t len ) const
+{
+    size_t slot = Hash( name, len ) & m_mask;
+
+    for (;;) {
+        int index = m_slots[ slot ];
+        if (index == -1) {
+            return -1;
+        }
+
+        const char* token = m_tokens[ index ];
+        if (strncmp( token, name, len ) == 0 && token[ len ] == '\0') {
+            return index;
+        }
+        slot = (slot + 1) & m_mask;
+    }
+}
+
+int
+getsubopt( const char** subopts, const SubOptTable& tokens, SubOptValue& value )
+{
+    const char* start = *subopts;
+
+    if (*start == '\0') {
+        return -1;
+    }
+
+    const char* pEnd = SplitSubOpt( start, value );
+
+    //Stage subopts for the next call
+    *subopts = (*pEnd == ',') ? pEnd + 1 : pEnd;
+
+    return tokens.Find( value.name, value.nameLen );
+}
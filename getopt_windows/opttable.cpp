@@ -0,0 +1,278 @@
+/** @file opttable.cpp
+ *  @brief Allocation free option parser over compile time option tables
+ *  @copyright
+ *  Copyright (C) 2014 Charles E Sluder
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ *  @author Charles Sluder
+ */
+
+#include <cstring>
+#include "opttable.h"
+
+OptionParser::OptionParser(const OptionTableView& table, int argc, char* const argv[])
+{
+    m_table = table;
+    m_count = argc;
+    m_argv = argv;
+    m_tokens = NULL;
+    m_nextChar = 0;
+    optind = 1;
+    optarg = NULL;
+    optlen = 0;
+    optopt = 0;
+}
+
+OptionParser::OptionParser(const OptionTableView& table, int count, const TokenSpan* tokens)
+{
+    m_table = table;
+    m_count = count;
+    m_argv = NULL;
+    m_tokens = tokens;
+    m_nextChar = 0;
+    optind = 1;
+    optarg = NULL;
+    optlen = 0;
+    optopt = 0;
+}
+
+const char*
+OptionParser::Token( int index, size_t& len ) const
+{
+    if (m_tokens != NULL) {
+        len = m_tokens[ index ].len;
+        return m_tokens[ index ].ptr;
+    }
+    len = strlen( m_argv[ index ] );
+    return m_argv[ index ];
+}
+
+/**
+ * @brief Find a long option by name or unambiguous abbreviation.
+ *
+ * @return Index of the definition or -1 if none or more than one matches.
+ */
+int
+OptionParser::FindLong( const char* name, size_t len ) const
+{
+    size_t lo = 0;
+    size_t hi = m_table.longCount;
+
+    // An empty name, as in "--=x", would abbreviate every option.
+    if (len == 0) {
+        return -1;
+    }
+
+    // First long name whose leading len characters are not less than name. An
+    // exact match sorts ahead of every longer name it abbreviates.
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const char* candidate = m_table.defs[ m_table.longOrder[ mid ] ].longName;
+        int cmp = strncmp( candidate, name, len );
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == m_table.longCount) {
+        return -1;
+    }
+
+    const OptDef& found = m_table.defs[ m_table.longOrder[ lo ] ];
+    if (strncmp( found.longName, name, len ) != 0) {
+        return -1;
+    }
+
+    // An exact match always wins, otherwise the abbreviation must be unique.
+    if (found.longName[ len ] != '\0' && lo + 1 < m_table.longCount) {
+        const OptDef& next = m_table.defs[ m_table.longOrder[ lo + 1 ] ];
+        if (strncmp( next.longName, name, len ) == 0) {
+            return -1;
+        }
+    }
+
+    return m_table.longOrder[ lo ];
+}
+
+int
+OptionParser::Finish( int index, int* longIndex )
+{
+    const OptDef& def = m_table.defs[ index ];
+
+    if (longIndex != NULL) {
+        *longIndex = index;
+    }
+
+    if (def.flag != NULL) {
+        *def.flag = def.val;
+        return 0;
+    }
+    return def.val;
+}
+
+int
+OptionParser::getopt( int* longIndex )
+{
+    const char* current;
+    size_t len;
+
+    optarg = NULL;
+    optlen = 0;
+    optopt = 0;
+
+    if (m_nextChar == 0) {
+        if (optind >= m_count) {
+            return -1;
+        }
+
+        current = Token( optind, len );
+
+        // An operand or a lone "-" ends the options.
+        if (len < 2 || current[ 0 ] != '-') {
+            return -1;
+        }
+
+        if (current[ 1 ] == '-') {
+            if (len == 2) {
+                optind++;
+                return -1;
+            }
+
+            const char* name = &current[ 2 ];
+            const char* value = (const char*)memchr( name, '=', len - 2 );
+            size_t nameLen = (value != NULL) ? (size_t)(value - name) : len - 2;
+            int index = FindLong( name, nameLen );
+
+            optind++;
+            if (index < 0) {
+                return '?';
+            }
+
+            const OptDef& def = m_table.defs[ index ];
+            if (def.has_arg == no_argument) {
+                if (value != NULL) {
+                    optopt = def.val;
+                    return '?';
+                }
+            } else if (value != NULL) {
+                optarg = value + 1;
+                optlen = len - 2 - nameLen - 1;
+            } else if (def.has_arg == required_argument) {
+                if (optind == m_count) {
+                    optopt = def.val;
+                    return '?';
+                }
+                optarg = Token( optind++, optlen );
+            }
+            return Finish( index, longIndex );
+        }
+
+        m_nextChar = 1;
+    }
+
+    // Inside a group of short options such as -abc
+    current = Token( optind, len );
+    char c = current[ m_nextChar++ ];
+    bool last = ((size_t)m_nextChar == len);
+    int index = (unsigned char)c < 128 ? m_table.shortIndex[ (unsigned char)c ] : -1;
+
+    if (last) {
+        optind++;
+        m_nextChar = 0;
+    }
+
+    if (index < 0) {
+        optopt = c;
+        return '?';
+    }
+
+    const OptDef& def = m_table.defs[ index ];
+    if (def.has_arg != no_argument) {
+        if (!last) {
+            // Argument attached as in -ofile
+            optarg = &current[ m_nextChar ];
+            optlen = len - m_nextChar;
+            optind++;
+            m_nextChar = 0;
+        } else if (def.has_arg == required_argument) {
+            if (optind == m_count) {
+                optopt = c;
+                return '?';
+            }
+            optarg = Token( optind++, optlen );
+        }
+    }
+
+    return Finish( index, longIndex );
+}
+
+static bool
+IsBlank( char c )
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+int
+SplitTokens( const char* line, size_t len, TokenSpan* tokens, int maxTokens )
+{
+    size_t pos = 0;
+    int count = 0;
+
+    for (;;) {
+        while (pos < len && IsBlank( line[ pos ] )) {
+            pos++;
+        }
+        if (pos == len) {
+            return count;
+        }
+        if (count == maxTokens) {
+            return -1;
+        }
+
+        TokenSpan& token = tokens[ count++ ];
+        size_t start = pos;
+        size_t firstClose = 0;
+
+        // White space inside quotes does not end the token, wherever in the
+        // token the quotes open.
+        while (pos < len && !IsBlank( line[ pos ] )) {
+            char quote = line[ pos ];
+            if (quote == '"' || quote == '\'') {
+                const char* close = (const char*)memchr( &line[ pos + 1 ], quote, len - pos - 1 );
+                if (close == NULL) {
+                    return -1;
+                }
+                pos = (size_t)(close - line);
+                if (firstClose == 0) {
+                    firstClose = pos;
+                }
+            }
+            pos++;
+        }
+
+        // Only a token quoted as a whole loses its quotes. Quotes inside a
+        // token, as in --msg="a b", stay in the span since the line is not
+        // copied.
+        if ((line[ start ] == '"' || line[ start ] == '\'') && firstClose == pos - 1) {
+            token.ptr = &line[ start + 1 ];
+            token.len = pos - start - 2;
+        } else {
+            token.ptr = &line[ start ];
+            token.len = pos - start;
+        }
+    }
+}
@@ -0,0 +1,214 @@
+/** @file opttable.h
+ *  @brief Compile time option tables and an allocation free option parser
+ *  @copyright
+ *  Copyright (C) 2014 Charles E Sluder
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ *  @author Charles Sluder
+ */
+
+#ifndef OPTTABLE_H_
+#define OPTTABLE_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <stdexcept>
+#include "getopt.h"
+
+/**
+ * @brief One option definition. An option may have a short name, a long name or
+ *        both, in which case they are aliases.
+ */
+struct OptDef {
+    char        shortName;      // 0 if the option has no short form
+    const char* longName;       // NULL if the option has no long form
+    int         has_arg;        // no_argument, required_argument or optional_argument
+    int*        flag;           // As in struct option
+    int         val;
+};
+
+/**
+ * @brief Lookup structures shared by every OptionTable size. This is what the
+ *        parser works on so it does not have to be a template.
+ */
+struct OptionTableView {
+    const OptDef*   defs;
+    const int16_t*  shortIndex;     // 128 entries, definition index or -1
+    const uint16_t* longOrder;      // Definition indexes sorted by long name
+    size_t          longCount;
+};
+
+/**
+ * @brief Option table built at compile time:
+ *
+ *      static constexpr OptDef s_opts[] = {
+ *          { 'v', "verbose", no_argument,       NULL, 'v' },
+ *          { 'o', "output",  required_argument, NULL, 'o' },
+ *      };
+ *      static constexpr auto s_table = MakeOptionTable(s_opts);
+ *
+ * Short options are looked up directly by character and long options by binary
+ * search over the sorted names, which also finds unambiguous abbreviations. A
+ * duplicate short or long name, an invalid short option character, or a short
+ * and long alias disagreeing on has_arg fails to compile.
+ */
+template<size_t N>
+class OptionTable {
+public:
+    constexpr OptionTable(const OptDef (&defs)[N])
+        : m_defs(), m_shortIndex(), m_longOrder(), m_longCount(0)
+    {
+        for (size_t c = 0; c < 128; c++) {
+            m_shortIndex[c] = -1;
+        }
+
+        for (size_t i = 0; i < N; i++) {
+            m_defs[i] = defs[i];
+
+            if (defs[i].has_arg < no_argument || defs[i].has_arg > optional_argument) {
+                throw std::logic_error("invalid has_arg in option table");
+            }
+
+            if (defs[i].shortName != 0) {
+                unsigned char c = (unsigned char)defs[i].shortName;
+                if (c >= 128 || c <= ' ' || c == '-' || c == ':' || c == '?') {
+                    throw std::logic_error("invalid short option character");
+                }
+                if (m_shortIndex[c] != -1) {
+                    throw std::logic_error("duplicate short option");
+                }
+                m_shortIndex[c] = (int16_t)i;
+            }
+
+            if (defs[i].longName != NULL) {
+                // Insertion sort keeps the long names ordered for binary search.
+                size_t pos = m_longCount++;
+                while (pos > 0 && Compare(defs[i].longName, defs[m_longOrder[pos - 1]].longName) < 0) {
+                    m_longOrder[pos] = m_longOrder[pos - 1];
+                    pos--;
+                }
+                if (pos > 0 && Compare(defs[i].longName, defs[m_longOrder[pos - 1]].longName) == 0) {
+                    throw std::logic_error("duplicate long option");
+                }
+                m_longOrder[pos] = (uint16_t)i;
+            }
+        }
+
+        // Aliases that return the same value must agree on their argument.
+        for (size_t i = 0; i < N; i++) {
+            for (size_t j = i + 1; j < N; j++) {
+                if (defs[i].val == defs[j].val && defs[i].flag == defs[j].flag &&
+                    defs[i].has_arg != defs[j].has_arg) {
+                    throw std::logic_error("short and long option alias disagree on argument");
+                }
+            }
+        }
+    }
+
+    constexpr OptionTableView View() const
+    {
+        return OptionTableView{ m_defs, m_shortIndex, m_longOrder, m_longCount };
+    }
+
+    constexpr operator OptionTableView() const { return View(); }
+
+    constexpr int FindShort(char c) const
+    {
+        return ((unsigned char)c < 128) ? m_shortIndex[(unsigned char)c] : -1;
+    }
+
+private:
+    static constexpr int Compare(const char* a, const char* b)
+    {
+        while (*a != '\0' && *a == *b) {
+            a++;
+            b++;
+        }
+        return (unsigned char)*a - (unsigned char)*b;
+    }
+
+    OptDef      m_defs[N];
+    int16_t     m_shortIndex[128];
+    uint16_t    m_longOrder[N];
+    size_t      m_longCount;
+};
+
+template<size_t N>
+constexpr OptionTable<N> MakeOptionTable(const OptDef (&defs)[N])
+{
+    return OptionTable<N>(defs);
+}
+
+/**
+ * @brief A token borrowed from a larger buffer such as a request line. The text
+ *        is not NUL terminated.
+ */
+struct TokenSpan {
+    const char* ptr;
+    size_t      len;
+};
+
+/**
+ * @brief Split a command line into tokens without copying it. Tokens are
+ *        separated by white space; quoting with ' or " anywhere in a token keeps
+ *        white space in it. The span of a token quoted as a whole, as in "a b",
+ *        excludes the quotes. Quotes inside a token, as in --msg="a b", cannot be
+ *        removed without copying and are left in the span.
+ *
+ * @return Number of tokens, or -1 if there are more than maxTokens or a quote
+ *         is not closed.
+ */
+int SplitTokens( const char* line, size_t len, TokenSpan* tokens, int maxTokens );
+
+/**
+ * @brief Option parser over an OptionTable. It keeps its whole state in the object,
+ *        touches no globals and never allocates, so parsers may run concurrently on
+ *        any number of threads. It reads either an argv array or borrowed token
+ *        spans. Parsing stops at the first operand or after "--"; optind is then
+ *        the index of the first operand.
+ */
+class OptionParser {
+public:
+    OptionParser(const OptionTableView& table, int argc, char* const argv[]);
+    OptionParser(const OptionTableView& table, int count, const TokenSpan* tokens);
+
+    /**
+     * @brief Return the next option as getopt_long() would.
+     *
+     * @param[OUT] longIndex - If not NULL receives the index in the definition
+     *                         array of the option found.
+     *
+     * @return The option value, 0 if the option sets a flag, '?' for an unknown
+     *         option or missing argument, -1 when the options are exhausted.
+     */
+    int getopt( int* longIndex );
+
+    int         optopt;
+    const char* optarg;     // Argument of the option or NULL
+    size_t      optlen;     // Length of optarg, which is only NUL terminated for argv
+    int         optind;
+
+private:
+    const char* Token( int index, size_t& len ) const;
+    int         FindLong( const char* name, size_t len ) const;
+    int         Finish( int index, int* longIndex );
+
+    OptionTableView  m_table;
+    int              m_count;
+    int              m_nextChar;
+    char* const*     m_argv;
+    const TokenSpan* m_tokens;
+};
+
+#endif
@@ -0,0 +1,347 @@
+/** @file respfile.cpp
+ *  @brief Lazily expanded @file response file arguments
+ *  @copyright
+ *  Copyright (C) 2014 Charles E Sluder
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ *  @author Charles Sluder
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "respfile.h"
+
+struct ResponseFile::Retired {
+    Retired* next;
+    size_t   mapSize;
+};
+
+ResponseFile::ResponseFile()
+{
+    m_base = NULL;
+    m_size = 0;
+    m_mapSize = 0;
+    m_pos = 0;
+}
+
+ResponseFile::~ResponseFile()
+{
+    Close();
+}
+
+#ifdef _WIN32
+/**
+ * @brief Windows cannot place a file view over an anonymous reservation, so the
+ *        file is read once into a buffer with room for the final NUL and the
+ *        Retired record.
+ */
+bool
+ResponseFile::Open( const char* path )
+{
+    FILE* fp;
+
+    Close();
+
+    if ((fp = fopen( path, "rb" )) == NULL) {
+        return false;
+    }
+
+    fseek( fp, 0, SEEK_END );
+    m_size = (size_t)ftell( fp );
+    fseek( fp, 0, SEEK_SET );
+    m_mapSize = ((m_size + 1 + sizeof( void* ) - 1) & ~(sizeof( void* ) - 1)) + sizeof( Retired );
+
+    if ((m_base = (char*)malloc( m_mapSize )) == NULL ||
+        fread( m_base, 1, m_size, fp ) != m_size) {
+        free( m_base );
+        m_base = NULL;
+        fclose( fp );
+        errno = EIO;
+        return false;
+    }
+    fclose( fp );
+
+    m_base[ m_size ] = '\0';
+    m_pos = 0;
+    return true;
+}
+
+void
+ResponseFile::Close()
+{
+    free( m_base );
+    m_base = NULL;
+    m_size = 0;
+    m_pos = 0;
+}
+
+static void
+FreeMapping( char* base, size_t size )
+{
+    (void)size;
+    free( base );
+}
+#else
+/**
+ * @brief The file is mapped private and writable over an anonymous reservation
+ *        that extends past the end of the file. The last argument can then be
+ *        NUL terminated even when the file ends exactly on a page boundary, and
+ *        the tail holds the Retired record.
+ */
+bool
+ResponseFile::Open( const char* path )
+{
+    struct stat st;
+    int fd;
+
+    Close();
+
+    if ((fd = open( path, O_RDONLY )) < 0) {
+        return false;
+    }
+
+    if (fstat( fd, &st ) < 0) {
+        int err = errno;
+        close( fd );
+        errno = err;
+        return false;
+    }
+
+    size_t page = (size_t)sysconf( _SC_PAGESIZE );
+    m_size = (size_t)st.st_size;
+    m_mapSize = (m_size + 1 + sizeof( Retired ) + page - 1) & ~(page - 1);
+
+    void* base = mmap( NULL, m_mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if (base == MAP_FAILED) {
+        close( fd );
+        return false;
+    }
+
+    if (m_size != 0 &&
+        mmap( base, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0 ) == MAP_FAILED) {
+        int err = errno;
+        munmap( base, m_mapSize );
+        close( fd );
+        errno = err;
+        return false;
+    }
+    close( fd );
+
+    madvise( base, m_size, MADV_SEQUENTIAL );
+    m_base = (char*)base;
+    m_pos = 0;
+    return true;
+}
+
+void
+ResponseFile::Close()
+{
+    if (m_base != NULL) {
+        munmap( m_base, m_mapSize );
+        m_base = NULL;
+    }
+    m_size = 0;
+    m_pos = 0;
+}
+
+static void
+FreeMapping( char* base, size_t size )
+{
+    munmap( base, size );
+}
+#endif
+
+void
+ResponseFile::Retire( Retired*& list )
+{
+    if (m_base == NULL) {
+        return;
+    }
+
+    Retired* record = (Retired*)(m_base + m_mapSize - sizeof( Retired ));
+    record->next = list;
+    record->mapSize = m_mapSize;
+    list = record;
+
+    m_base = NULL;
+    m_size = 0;
+    m_pos = 0;
+}
+
+void
+ResponseFile::Release( Retired* list )
+{
+    while (list != NULL) {
+        Retired* next = list->next;
+        size_t   size = list->mapSize;
+
+        FreeMapping( (char*)list + sizeof( Retired ) - size, size );
+        list = next;
+    }
+}
+
+static bool
+IsSpace( char c )
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+char*
+ResponseFile::Next()
+{
+    if (m_base == NULL) {
+        return NULL;
+    }
+
+    for (;;) {
+        while (m_pos < m_size && IsSpace( m_base[ m_pos ] )) {
+            m_pos++;
+        }
+        if (m_pos == m_size) {
+            return NULL;
+        }
+
+        if (m_base[ m_pos ] != '#') {
+            break;
+        }
+        while (m_pos < m_size && m_base[ m_pos ] != '\n') {
+            m_pos++;
+        }
+    }
+
+    // Unquote in place. The write position never passes the read position so
+    // the argument can be compacted over its own quotes.
+    char* arg = &m_base[ m_pos ];
+    char* out = arg;
+    char  quote = 0;
+
+    while (m_pos < m_size) {
+        char c = m_base[ m_pos ];
+
+        if (quote == 0 && IsSpace( c )) {
+            break;
+        }
+        m_pos++;
+
+        if (quote == 0 && (c == '"' || c == '\'')) {
+            quote = c;
+        } else if (c == quote) {
+            quote = 0;
+        } else if (c == '\\' && quote != '\'' && m_pos < m_size &&
+                   (m_base[ m_pos ] == '"' || m_base[ m_pos ] == '\\' ||
+                    (quote == 0 && (m_base[ m_pos ] == '\'' || IsSpace( m_base[ m_pos ] ))))) {
+            *out++ = m_base[ m_pos++ ];
+        } else {
+            *out++ = c;
+        }
+    }
+
+    // Step over the separator that is about to be overwritten.
+    if (m_pos < m_size) {
+        m_pos++;
+    }
+    *out = '\0';
+    return arg;
+}
+
+ArgStream::ArgStream( int argc, char* const argv[] )
+{
+    m_argc = argc;
+    m_argv = argv;
+    m_index = 0;
+    m_depth = 0;
+    m_retired = NULL;
+}
+
+ArgStream::~ArgStream()
+{
+    ResponseFile::Release( m_retired );
+}
+
+char*
+ArgStream::Next()
+{
+    for (;;) {
+        char* arg;
+
+        if (m_depth > 0) {
+            arg = m_files[ m_depth - 1 ].Next();
+            if (arg == NULL) {
+                // Arguments already handed out point into the mapping.
+                m_files[ --m_depth ].Retire( m_retired );
+                continue;
+            }
+        } else if (m_index < m_argc) {
+            arg = m_argv[ m_index++ ];
+        } else {
+            return NULL;
+        }
+
+        if (arg[ 0 ] != '@' || arg[ 1 ] == '\0' || m_depth == MAX_DEPTH) {
+            return arg;
+        }
+
+        if (!m_files[ m_depth ].Open( &arg[ 1 ] )) {
+            return arg;
+        }
+        m_depth++;
+    }
+}
+
+/**
+ * @brief argv[ 0 ] is the program name and is never expanded.
+ */
+ArgVector::ArgVector( int argc, char* const argv[] )
+    : m_stream( argc > 0 ? argc - 1 : 0, argc > 0 ? &argv[ 1 ] : argv )
+{
+    char* arg;
+
+    m_args.reserve( (size_t)argc + 1 );
+    if (argc > 0) {
+        m_args.push_back( argv[ 0 ] );
+    }
+    while ((arg = m_stream.Next()) != NULL) {
+        m_args.push_back( arg );
+    }
+    m_args.push_back( NULL );
+}
+
+void
+expandargv( int* argcp, char*** argvp )
+{
+    static std::vector<std::unique_ptr<ArgVector> > s_expanded;
+
+    int i = 1;
+    while (i < *argcp && ((*argvp)[ i ][ 0 ] != '@' || (*argvp)[ i ][ 1 ] == '\0')) {
+        i++;
+    }
+    if (i == *argcp) {
+        return;
+    }
+
+    ArgVector* expanded = new ArgVector( *argcp, *argvp );
+    s_expanded.push_back( std::unique_ptr<ArgVector>( expanded ) );
+    *argcp = expanded->Count();
+    *argvp = expanded->Get();
+}
@@ -0,0 +1,143 @@
+/** @file respfile.h
+ *  @brief Lazily expanded @file response file arguments
+ *  @copyright
+ *  Copyright (C) 2014 Charles E Sluder
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ *  @author Charles Sluder
+ */
+
+#ifndef RESPFILE_H_
+#define RESPFILE_H_
+#include <stddef.h>
+#include <vector>
+
+/**
+ * @brief Arguments read from a response file. The file is memory mapped copy on
+ *        write and each argument is unquoted and NUL terminated in place when it
+ *        is reached, so a file of any size costs one mapping and no copies. On
+ *        Windows the file is read into one buffer instead.
+ *
+ * Arguments are separated by white space. Single quotes preserve everything up
+ * to the closing quote, double quotes allow backslash escapes of '"' and '\\',
+ * and a '#' at the start of an argument comments out the rest of the line.
+ */
+class ResponseFile {
+public:
+    /**
+     * @brief A mapping given up by Retire(). The record is kept in spare space
+     *        at the end of the mapping itself, so retiring allocates nothing.
+     */
+    struct Retired;
+
+    ResponseFile();
+    ~ResponseFile();
+
+    /**
+     * @brief Map a response file.
+     *
+     * @return false if the file cannot be opened or mapped; errno is set.
+     */
+    bool  Open( const char* path );
+    void  Close();
+
+    /**
+     * @brief Return the next argument or NULL at the end of the file. The string
+     *        lives in the mapping and is valid until Close().
+     */
+    char* Next();
+
+    /**
+     * @brief Stop reading the file but keep the arguments already returned valid.
+     *        The mapping is pushed onto list and stays until Release( list ).
+     */
+    void  Retire( Retired*& list );
+    static void Release( Retired* list );
+
+private:
+    ResponseFile( const ResponseFile& );
+    ResponseFile& operator=( const ResponseFile& );
+
+    char*  m_base;
+    size_t m_size;
+    size_t m_mapSize;
+    size_t m_pos;
+};
+
+/**
+ * @brief Walks argv replacing each "@file" with the arguments in that file, which
+ *        may in turn name other response files. Nothing is expanded before it is
+ *        asked for and no memory is allocated.
+ */
+class ArgStream {
+public:
+    static const int MAX_DEPTH = 8;
+
+    ArgStream( int argc, char* const argv[] );
+
+    /**
+     * @brief Unmaps every response file read, finished or not.
+     */
+    ~ArgStream();
+
+    /**
+     * @brief Return the next argument or NULL when all have been returned.
+     *        A response file that cannot be read is returned as the literal
+     *        "@file" argument, as gcc does. Arguments from response files stay
+     *        valid until the ArgStream is destroyed.
+     */
+    char* Next();
+
+private:
+    ArgStream( const ArgStream& );
+    ArgStream& operator=( const ArgStream& );
+
+    int          m_argc;
+    int          m_index;
+    char* const* m_argv;
+    int          m_depth;
+    ResponseFile m_files[ MAX_DEPTH ];
+    ResponseFile::Retired* m_retired;   // Files read to the end
+};
+
+/**
+ * @brief argv with every "@file" expanded, for parsers that need the whole
+ *        vector at once to permute it. Only the pointers are copied; the strings
+ *        stay in argv and the mapped files and are valid while this exists.
+ */
+class ArgVector {
+public:
+    ArgVector( int argc, char* const argv[] );
+
+    int    Count() const { return (int)m_args.size() - 1; }
+    char** Get() { return &m_args[ 0 ]; }     // NULL terminated
+
+private:
+    ArgVector( const ArgVector& );
+    ArgVector& operator=( const ArgVector& );
+
+    ArgStream          m_stream;
+    std::vector<char*> m_args;
+};
+
+/**
+ * @brief Replace *argcp and *argvp with the expanded vector if any argument
+ *        names a response file, as libiberty's expandargv() does, so getopt()
+ *        and getopt_long() see the file contents. Call it before parsing; the
+ *        expanded vector lasts until static destruction at exit.
+ */
+extern void expandargv( int* argcp, char*** argvp );
+
+#endif
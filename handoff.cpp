@@ -0,0 +1,391 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Hand listening and established sockets to a replacement process
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <system_error>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "handoff.hpp"
+
+/*
+ * Every message is a header, then count entries whose descriptors travel in
+ * the same message as SCM_RIGHTS. SOCK_SEQPACKET keeps the messages whole.
+ */
+static const uint32_t HANDOFF_MAGIC = 0x48444f46;
+static const int      FDS_PER_MESSAGE = 64;
+
+enum MessageType
+{
+    MESSAGE_HELLO = 1,      // New process has connected
+    MESSAGE_SOCKETS,        // A batch of descriptors
+    MESSAGE_DONE,           // All descriptors have been sent
+    MESSAGE_READY           // New process is serving
+};
+
+struct MessageHeader
+{
+    uint32_t    magic;
+    uint16_t    type;
+    uint16_t    count;
+};
+
+struct WireEntry
+{
+    char        name[HANDOFF_NAME_MAX];
+    uint32_t    kind;
+};
+
+struct Message
+{
+    MessageHeader   header;
+    WireEntry       entries[FDS_PER_MESSAGE];
+};
+
+static socklen_t
+MakeAddress(const char *path, sockaddr_un &addr)
+{
+    size_t len = strlen(path);
+
+    if (len >= sizeof(addr.sun_path))
+    {
+	throw std::system_error(ENAMETOOLONG, std::system_category());
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, len);
+
+    // A leading '@' names a socket in the abstract namespace, which has no file.
+    if (path[0] == '@') {
+        addr.sun_path[0] = '\0';
+        return (socklen_t)(offsetof(sockaddr_un, sun_path) + len);
+    }
+    return (socklen_t)sizeof(addr);
+}
+
+static bool
+WaitFor(int fd, short events, int timeout)
+{
+    struct pollfd pfd;
+    int rc;
+
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+
+    while ((rc = poll(&pfd, 1, timeout)) < 0 && errno == EINTR) {
+    }
+    return rc > 0;
+}
+
+/*
+ * Only a process of the same user may take part in a handoff.
+ */
+static bool
+SameUser(int fd)
+{
+    struct ucred cred;
+    socklen_t    len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+        return false;
+    }
+    return cred.uid == geteuid();
+}
+
+static bool
+SendMessage(int fd, uint16_t type, const HandoffEntry *pEntries, int count)
+{
+    Message        msg;
+    struct iovec   iov;
+    struct msghdr  hdr;
+    char           control[CMSG_SPACE(sizeof(int) * FDS_PER_MESSAGE)];
+
+    msg.header.magic = HANDOFF_MAGIC;
+    msg.header.type = type;
+    msg.header.count = (uint16_t)count;
+
+    iov.iov_base = &msg;
+    iov.iov_len = sizeof(msg.header) + count * sizeof(WireEntry);
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+
+    if (count > 0) {
+        memset(control, 0, sizeof(control));
+        hdr.msg_control = control;
+        hdr.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+        struct cmsghdr *pCmsg = CMSG_FIRSTHDR(&hdr);
+        pCmsg->cmsg_level = SOL_SOCKET;
+        pCmsg->cmsg_type = SCM_RIGHTS;
+        pCmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+
+        int *pFds = (int *)CMSG_DATA(pCmsg);
+        for (int i = 0; i < count; i++) {
+            memcpy(msg.entries[i].name, pEntries[i].name, HANDOFF_NAME_MAX);
+            msg.entries[i].kind = pEntries[i].kind;
+            pFds[i] = pEntries[i].fd;
+        }
+    }
+
+    return sendmsg(fd, &hdr, MSG_NOSIGNAL) == (ssize_t)iov.iov_len;
+}
+
+/*
+ * Receive one message. Descriptors that arrive are stored in pFds and belong
+ * to the caller, even when false is returned for a malformed message.
+ *
+ * @return false on timeout, end of connection or a message that is not ours.
+ */
+static bool
+RecvMessage(int fd, int timeout, Message &msg, int *pFds, int &nFds)
+{
+    struct iovec   iov;
+    struct msghdr  hdr;
+    char           control[CMSG_SPACE(sizeof(int) * FDS_PER_MESSAGE)];
+    ssize_t        bytes;
+
+    nFds = 0;
+    if (!WaitFor(fd, POLLIN, timeout)) {
+        return false;
+    }
+
+    iov.iov_base = &msg;
+    iov.iov_len = sizeof(msg);
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    if ((bytes = recvmsg(fd, &hdr, MSG_CMSG_CLOEXEC)) <= 0) {
+        return false;
+    }
+
+    for (struct cmsghdr *pCmsg = CMSG_FIRSTHDR(&hdr); pCmsg != NULL; pCmsg = CMSG_NXTHDR(&hdr, pCmsg)) {
+        if (pCmsg->cmsg_level == SOL_SOCKET && pCmsg->cmsg_type == SCM_RIGHTS) {
+            int n = (int)((pCmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            memcpy(&pFds[nFds], CMSG_DATA(pCmsg), n * sizeof(int));
+            nFds += n;
+        }
+    }
+
+    return (size_t)bytes >= sizeof(msg.header) &&
+           msg.header.magic == HANDOFF_MAGIC &&
+           (hdr.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) == 0 &&
+           (size_t)bytes == sizeof(msg.header) + msg.header.count * sizeof(WireEntry) &&
+           nFds == (msg.header.type == MESSAGE_SOCKETS ? msg.header.count : 0);
+}
+
+HandoffSender::HandoffSender(const char *path)
+{
+    sockaddr_un addr;
+    socklen_t   len = MakeAddress(path, addr);
+
+    strncpy(m_path, path, sizeof(m_path) - 1);
+    m_path[sizeof(m_path) - 1] = '\0';
+
+    if ((m_listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0)
+    {
+	throw std::system_error(errno, std::system_category());
+    }
+
+    if (path[0] != '@') {
+        unlink(path);
+    }
+
+    if (bind(m_listenFd, (sockaddr *)&addr, len) < 0 || listen(m_listenFd, 1) < 0)
+    {
+        int err = errno;
+        close(m_listenFd);
+	throw std::system_error(err, std::system_category());
+    }
+}
+
+HandoffSender::~HandoffSender()
+{
+    close(m_listenFd);
+    if (m_path[0] != '@') {
+        unlink(m_path);
+    }
+}
+
+void
+HandoffSender::Add(const char *name, Socket &sock, uint32_t kind)
+{
+    Add(name, sock.GetDescriptor(), kind);
+}
+
+void
+HandoffSender::Add(const char *name, int fd, uint32_t kind)
+{
+    HandoffEntry entry;
+
+    memset(&entry, 0, sizeof(entry));
+    strncpy(entry.name, name, sizeof(entry.name) - 1);
+    entry.kind = kind;
+    entry.fd = fd;
+    m_entries.push_back(entry);
+}
+
+bool
+HandoffSender::SendEntries(int fd)
+{
+    for (size_t i = 0; i < m_entries.size(); i += FDS_PER_MESSAGE) {
+        int count = (int)(m_entries.size() - i);
+        if (count > FDS_PER_MESSAGE) {
+            count = FDS_PER_MESSAGE;
+        }
+        if (!SendMessage(fd, MESSAGE_SOCKETS, &m_entries[i], count)) {
+            return false;
+        }
+    }
+    return SendMessage(fd, MESSAGE_DONE, NULL, 0);
+}
+
+bool
+HandoffSender::Handoff(int timeout)
+{
+    Message msg;
+    int     fds[FDS_PER_MESSAGE];
+    int     nFds = 0;
+    int     fd;
+    bool    ok = false;
+
+    if (!WaitFor(m_listenFd, POLLIN, timeout)) {
+        return false;
+    }
+    if ((fd = accept4(m_listenFd, NULL, NULL, SOCK_CLOEXEC)) < 0) {
+        return false;
+    }
+
+    if (SameUser(fd) &&
+        RecvMessage(fd, timeout, msg, fds, nFds) && msg.header.type == MESSAGE_HELLO &&
+        SendEntries(fd) &&
+        RecvMessage(fd, timeout, msg, fds, nFds) && msg.header.type == MESSAGE_READY) {
+        ok = true;
+    }
+
+    // The successor never sends descriptors; drop any that arrive.
+    for (int i = 0; i < nFds; i++) {
+        close(fds[i]);
+    }
+    close(fd);
+    return ok;
+}
+
+HandoffReceiver::HandoffReceiver()
+{
+    m_controlFd = -1;
+}
+
+HandoffReceiver::~HandoffReceiver()
+{
+    for (size_t i = 0; i < m_entries.size(); i++) {
+        if (m_entries[i].fd >= 0) {
+            close(m_entries[i].fd);
+        }
+    }
+    if (m_controlFd >= 0) {
+        close(m_controlFd);
+    }
+}
+
+bool
+HandoffReceiver::Receive(const char *path, int timeout)
+{
+    sockaddr_un addr;
+    socklen_t   len = MakeAddress(path, addr);
+
+    if ((m_controlFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0)
+    {
+	throw std::system_error(errno, std::system_category());
+    }
+
+    if (connect(m_controlFd, (sockaddr *)&addr, len) < 0) {
+        int err = errno;
+        close(m_controlFd);
+        m_controlFd = -1;
+        if (err == ENOENT || err == ECONNREFUSED) {
+            return false;
+        }
+	throw std::system_error(err, std::system_category());
+    }
+
+    if (!SameUser(m_controlFd) || !SendMessage(m_controlFd, MESSAGE_HELLO, NULL, 0))
+    {
+	throw std::system_error(EPERM, std::system_category());
+    }
+
+    for (;;) {
+        Message msg;
+        int     fds[FDS_PER_MESSAGE];
+        int     nFds;
+        bool    ok = RecvMessage(m_controlFd, timeout, msg, fds, nFds);
+
+        if (ok && msg.header.type == MESSAGE_DONE) {
+            return true;
+        }
+        if (!ok || msg.header.type != MESSAGE_SOCKETS) {
+            for (int i = 0; i < nFds; i++) {
+                close(fds[i]);
+            }
+	    throw std::system_error(EPROTO, std::system_category());
+        }
+
+        for (int i = 0; i < nFds; i++) {
+            HandoffEntry entry;
+            memcpy(entry.name, msg.entries[i].name, HANDOFF_NAME_MAX);
+            entry.name[HANDOFF_NAME_MAX - 1] = '\0';
+            entry.kind = msg.entries[i].kind;
+            entry.fd = fds[i];
+            m_entries.push_back(entry);
+        }
+    }
+}
+
+int
+HandoffReceiver::Take(const char *name, uint32_t kind)
+{
+    for (size_t i = 0; i < m_entries.size(); i++) {
+        HandoffEntry &entry = m_entries[i];
+
+        if (entry.fd >= 0 && entry.kind == kind && strcmp(entry.name, name) == 0) {
+            int fd = entry.fd;
+            entry.fd = -1;
+            return fd;
+        }
+    }
+    return -1;
+}
+
+void
+HandoffReceiver::Ready()
+{
+    if (m_controlFd < 0) {
+        return;
+    }
+    SendMessage(m_controlFd, MESSAGE_READY, NULL, 0);
+    close(m_controlFd);
+    m_controlFd = -1;
+}
@@ -0,0 +1,182 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Hand listening and established sockets to a replacement process
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef HANDOFF_HPP
+#define HANDOFF_HPP
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+#include "socket.hpp"
+
+#define HANDOFF_NAME_MAX    32
+
+enum HandoffKind
+{
+    HANDOFF_LISTENER = 1,
+    HANDOFF_CONNECTION = 2
+};
+
+/***
+ * @struct One socket passed between processes. The name is chosen by the
+ *         server, for example "http" or "admin", and is how the new process
+ *         finds the socket it needs.
+ */
+struct HandoffEntry
+{
+    char        name[HANDOFF_NAME_MAX];
+    uint32_t    kind;
+    int         fd;
+};
+
+/*
+ * A restart goes through these steps:
+ *
+ *   old: HandoffSender sender(path);      bound at startup, polled with the
+ *                                         other descriptors
+ *   new: HandoffReceiver receiver;
+ *        receiver.Receive(path, 5000);    connects and gets every descriptor
+ *   old: sender.Handoff(5000);            run when the control socket becomes
+ *                                         readable; returns once the new process
+ *                                         is ready
+ *   new: Socket listener(receiver.Take("http"));
+ *        ... start accepting ...
+ *        receiver.Ready();
+ *   old: close the listeners, finish the requests in progress on the
+ *        connections it kept, and exit
+ *
+ * The listening socket is the same kernel object in both processes, so its
+ * accept queue is never closed and no connection is refused during the
+ * restart. Until the old process closes its copy both processes may accept.
+ * Connections that were passed must be closed by the old process without
+ * shutdown(), which would end them for the new process too.
+ */
+
+/***
+ * @class The side of the process being replaced. It listens on an AF_UNIX
+ *        SOCK_SEQPACKET socket for its successor. Only a process running as
+ *        the same user is given the sockets.
+ */
+class HandoffSender
+{
+public:
+    /***
+     * Class constructor. Binds the control socket, replacing a stale socket
+     * file left by an earlier run.
+     *
+     * @param[IN] path - File system path, or a name starting with '@' for the
+     *                   Linux abstract namespace.
+     *
+     * @throws std::system_error if the control socket cannot be created.
+     */
+    explicit            HandoffSender(const char *path);
+
+    /***
+     * Class destructor. Closes the control socket and removes its file. The
+     * descriptors that were added are not closed.
+     */
+                        ~HandoffSender();
+
+    /***
+     * Add a socket to pass on. The sender does not take ownership.
+     *
+     * @param[IN] name - Name the successor looks the socket up by.
+     * @param[IN] kind - HANDOFF_LISTENER or HANDOFF_CONNECTION.
+     */
+    void                Add(const char *name, Socket &sock, uint32_t kind = HANDOFF_LISTENER);
+    void                Add(const char *name, int fd, uint32_t kind);
+
+    /***
+     * Descriptor that becomes readable when a successor connects, so it can be
+     * waited on along with the server's other sockets.
+     */
+    int                 GetDescriptor() const { return m_listenFd; }
+
+    /***
+     * Accept a successor, send it every socket that was added and wait until
+     * it reports that it is serving. If this fails the old process simply
+     * keeps running and a later attempt can be made.
+     *
+     * @param[IN] timeout - Milliseconds to wait at each step.
+     *
+     * @return true once the successor owns the sockets and the caller should
+     *         drain, false on timeout or if the successor went away.
+     */
+    bool                Handoff(int timeout);
+
+private:
+                        HandoffSender(const HandoffSender &);
+    HandoffSender      &operator=(const HandoffSender &);
+
+    bool                SendEntries(int fd);
+
+    std::vector<HandoffEntry>   m_entries;
+    char                        m_path[108];
+    int                         m_listenFd;
+};
+
+/***
+ * @class The side of the replacement process.
+ */
+class HandoffReceiver
+{
+public:
+                        HandoffReceiver();
+
+    /***
+     * Class destructor. Closes every received descriptor that was not taken.
+     */
+                        ~HandoffReceiver();
+
+    /***
+     * Connect to the running process and receive its sockets.
+     *
+     * @param[IN] path    - Control socket path given to the HandoffSender.
+     * @param[IN] timeout - Milliseconds to wait for each message.
+     *
+     * @return false if no process is listening on the path, in which case the
+     *         caller starts cold and binds its own sockets.
+     *
+     * @throws std::system_error on a failure part way through the transfer.
+     */
+    bool                Receive(const char *path, int timeout);
+
+    /***
+     * Take ownership of the first received socket with a name and kind. The
+     * descriptor is usually handed straight to Socket(int).
+     *
+     * @return The descriptor or -1 if there is none left.
+     */
+    int                 Take(const char *name, uint32_t kind = HANDOFF_LISTENER);
+
+    /***
+     * Tell the old process that the sockets are being served so it can stop
+     * accepting and drain.
+     */
+    void                Ready();
+
+    size_t              Size() const { return m_entries.size(); }
+    const HandoffEntry &operator[](size_t index) const { return m_entries[index]; }
+
+private:
+                        HandoffReceiver(const HandoffReceiver &);
+    HandoffReceiver    &operator=(const HandoffReceiver &);
+
+    std::vector<HandoffEntry>   m_entries;
+    int                         m_controlFd;
+};
+
+#endif
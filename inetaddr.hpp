@@ -0,0 +1,454 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Compact value type for IPv4 and IPv6 socket addresses
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef INETADDR_HPP
+#define INETADDR_HPP
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/***
+ * @union Storage large enough for any address InetAddress can describe. Used to
+ *        hand an InetAddress to the socket system calls.
+ */
+union InetSockAddr
+{
+    sockaddr            sa;
+    sockaddr_in         v4;
+    sockaddr_in6        v6;
+};
+
+/***
+ * @class Value type holding an IPv4 or IPv6 address, port and scope id in 24 bytes.
+ *        Unlike SocketAddress it has no pointers into itself, so it may be copied
+ *        with memcpy, used as a hash key and built at compile time from a literal:
+ *
+ *            constexpr InetAddress peer = InetAddress::Parse("[fe80::1%2]:8080");
+ *
+ *        IPv4 addresses occupy the first four bytes of the address in network
+ *        order and the remaining bytes are always zero so equality is a plain
+ *        compare of the object. The port is kept in host order.
+ */
+class InetAddress
+{
+public:
+    /***
+     * Construct the unspecified address with no family.
+     */
+    constexpr           InetAddress() : m_addr{}, m_port(0), m_family(0), m_scope(0) {}
+
+    /***
+     * Parse an address literal. Accepts "a.b.c.d", "a.b.c.d:port", IPv6 in any of
+     * the RFC 4291 forms with an optional numeric "%scope", and "[ipv6]:port". A
+     * malformed literal is a compile error in a constant expression and throws
+     * std::invalid_argument otherwise.
+     *
+     * @param[IN] text - NUL terminated address string.
+     */
+    static constexpr InetAddress Parse(const char *text)
+    {
+        InetAddress addr;
+
+        if (!TryParse(text, Length(text), addr)) {
+            throw std::invalid_argument("malformed IP address literal");
+        }
+        return addr;
+    }
+
+    /***
+     * Non throwing form of Parse() for a string of known length.
+     *
+     * @return true if the text was a valid address, otherwise false and addr is
+     *         left unspecified.
+     */
+    static constexpr bool TryParse(const char *text, size_t len, InetAddress &addr)
+    {
+        size_t colons = 0;
+
+        addr = InetAddress();
+        if (len == 0) {
+            return false;
+        }
+
+        if (text[0] == '[') {
+            size_t close = 1;
+            while (close < len && text[close] != ']') {
+                close++;
+            }
+            if (close == len || !ParseIpv6(text + 1, close - 1, addr)) {
+                return false;
+            }
+            if (close + 1 == len) {
+                return true;
+            }
+            if (text[close + 1] != ':') {
+                return false;
+            }
+            return ParsePort(text + close + 2, len - close - 2, addr.m_port);
+        }
+
+        for (size_t i = 0; i < len; i++) {
+            colons += (text[i] == ':');
+        }
+
+        if (colons > 1) {
+            return ParseIpv6(text, len, addr);
+        }
+
+        if (colons == 1) {
+            size_t colon = 0;
+            while (text[colon] != ':') {
+                colon++;
+            }
+            return ParseIpv4(text, colon, addr) &&
+                   ParsePort(text + colon + 1, len - colon - 1, addr.m_port);
+        }
+
+        return ParseIpv4(text, len, addr);
+    }
+
+    /***
+     * Build an IPv4 address from a host order value.
+     */
+    static constexpr InetAddress FromIpv4(uint32_t hostAddr, uint16_t port = 0)
+    {
+        InetAddress addr;
+
+        addr.m_family = AF_INET;
+        addr.m_addr[0] = (uint8_t)(hostAddr >> 24);
+        addr.m_addr[1] = (uint8_t)(hostAddr >> 16);
+        addr.m_addr[2] = (uint8_t)(hostAddr >> 8);
+        addr.m_addr[3] = (uint8_t)hostAddr;
+        addr.m_port = port;
+        return addr;
+    }
+
+    /***
+     * Build an IPv6 address from its sixteen bytes in network order.
+     */
+    static constexpr InetAddress FromIpv6(const uint8_t *pBytes, uint16_t port = 0,
+                                          uint32_t scope = 0)
+    {
+        InetAddress addr;
+
+        addr.m_family = AF_INET6;
+        for (size_t i = 0; i < 16; i++) {
+            addr.m_addr[i] = pBytes[i];
+        }
+        addr.m_port = port;
+        addr.m_scope = scope;
+        return addr;
+    }
+
+    /***
+     * Build an address from a sockaddr filled in by the kernel.
+     */
+    static InetAddress  FromSockAddr(const sockaddr *pAddr)
+    {
+        InetAddress addr;
+
+        if (pAddr->sa_family == AF_INET6) {
+            const sockaddr_in6 *pIpv6 = (const sockaddr_in6 *)pAddr;
+            addr.m_family = AF_INET6;
+            memcpy(addr.m_addr, &pIpv6->sin6_addr, 16);
+            addr.m_port = ntohs(pIpv6->sin6_port);
+            addr.m_scope = pIpv6->sin6_scope_id;
+        } else if (pAddr->sa_family == AF_INET) {
+            const sockaddr_in *pIpv4 = (const sockaddr_in *)pAddr;
+            addr.m_family = AF_INET;
+            memcpy(addr.m_addr, &pIpv4->sin_addr, 4);
+            addr.m_port = ntohs(pIpv4->sin_port);
+        }
+        return addr;
+    }
+
+    /***
+     * Fill in a sockaddr for the socket system calls.
+     *
+     * @param[OUT] sa - Receives the sockaddr_in or sockaddr_in6.
+     *
+     * @return Length of the structure that was filled in.
+     */
+    socklen_t           ToSockAddr(InetSockAddr &sa) const
+    {
+        if (m_family == AF_INET6) {
+            memset(&sa.v6, 0, sizeof(sa.v6));
+            sa.v6.sin6_family = AF_INET6;
+            sa.v6.sin6_port = htons(m_port);
+            sa.v6.sin6_scope_id = m_scope;
+            memcpy(&sa.v6.sin6_addr, m_addr, 16);
+            return sizeof(sa.v6);
+        }
+
+        memset(&sa.v4, 0, sizeof(sa.v4));
+        sa.v4.sin_family = AF_INET;
+        sa.v4.sin_port = htons(m_port);
+        memcpy(&sa.v4.sin_addr, m_addr, 4);
+        return sizeof(sa.v4);
+    }
+
+    constexpr int       GetAddrFamily() const { return m_family; }
+    constexpr bool      IsIpv6() const { return m_family == AF_INET6; }
+    constexpr uint16_t  GetPortNumber() const { return m_port; }
+    constexpr uint32_t  GetScopeId() const { return m_scope; }
+    constexpr const uint8_t *GetBytes() const { return m_addr; }
+
+    void                SetPortNumber(uint16_t port) { m_port = port; }
+    void                SetScopeId(uint32_t scope) { m_scope = scope; }
+
+    /***
+     * Returns the IPv4 address in host order. Only meaningful for AF_INET.
+     */
+    constexpr uint32_t  GetIpv4() const
+    {
+        return ((uint32_t)m_addr[0] << 24) | ((uint32_t)m_addr[1] << 16) |
+               ((uint32_t)m_addr[2] << 8) | (uint32_t)m_addr[3];
+    }
+
+    /***
+     * Returns a 64 bit hash of address, port, family and scope.
+     */
+    size_t              Hash() const
+    {
+        uint64_t lo;
+        uint64_t hi;
+        uint64_t tail;
+
+        memcpy(&lo, m_addr, 8);
+        memcpy(&hi, m_addr + 8, 8);
+        memcpy(&tail, &m_port, 8);
+
+        uint64_t h = Mix(lo ^ 0x9e3779b97f4a7c15ULL, hi ^ 0xc2b2ae3d27d4eb4fULL);
+        return (size_t)Mix(h, tail ^ 0x165667b19e3779f9ULL);
+    }
+
+    bool                operator==(const InetAddress &rhs) const
+    {
+        return memcmp(this, &rhs, sizeof(*this)) == 0;
+    }
+
+    bool                operator!=(const InetAddress &rhs) const
+    {
+        return !(*this == rhs);
+    }
+
+private:
+    static constexpr size_t Length(const char *text)
+    {
+        size_t len = 0;
+        while (text[len] != '\0') {
+            len++;
+        }
+        return len;
+    }
+
+    static uint64_t     Mix(uint64_t a, uint64_t b)
+    {
+        __uint128_t r = (__uint128_t)a * b;
+        return (uint64_t)r ^ (uint64_t)(r >> 64);
+    }
+
+    static constexpr int HexDigit(char c)
+    {
+        return (c >= '0' && c <= '9') ? c - '0' :
+               (c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+               (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+    }
+
+    static constexpr bool ParseDecimal(const char *text, size_t len, uint32_t max,
+                                       uint32_t &value)
+    {
+        uint64_t number = 0;
+
+        value = 0;
+        if (len == 0 || len > 10) {
+            return false;
+        }
+        // Ten digits can overflow 32 bits, so the bound is checked in 64.
+        for (size_t i = 0; i < len; i++) {
+            if (text[i] < '0' || text[i] > '9') {
+                return false;
+            }
+            number = number * 10 + (uint32_t)(text[i] - '0');
+            if (number > max) {
+                return false;
+            }
+        }
+        value = (uint32_t)number;
+        return true;
+    }
+
+    static constexpr bool ParsePort(const char *text, size_t len, uint16_t &port)
+    {
+        uint32_t value = 0;
+
+        if (!ParseDecimal(text, len, 65535, value)) {
+            return false;
+        }
+        port = (uint16_t)value;
+        return true;
+    }
+
+    /***
+     * Parse dotted quad notation into four bytes.
+     */
+    static constexpr bool ParseQuad(const char *text, size_t len, uint8_t *pBytes)
+    {
+        size_t   start = 0;
+        int      octet = 0;
+        uint32_t value = 0;
+
+        for (size_t i = 0; i <= len; i++) {
+            if (i == len || text[i] == '.') {
+                // inet_pton() rejects leading zeros, which some parsers read as octal.
+                if (octet == 4 || i - start > 3 || (i - start > 1 && text[start] == '0') ||
+                    !ParseDecimal(text + start, i - start, 255, value)) {
+                    return false;
+                }
+                pBytes[octet++] = (uint8_t)value;
+                start = i + 1;
+            }
+        }
+        return octet == 4;
+    }
+
+    static constexpr bool ParseIpv4(const char *text, size_t len, InetAddress &addr)
+    {
+        addr.m_family = AF_INET;
+        return ParseQuad(text, len, addr.m_addr);
+    }
+
+    static constexpr bool ParseIpv6(const char *text, size_t len, InetAddress &addr)
+    {
+        uint8_t  bytes[16] = {};
+        size_t   out = 0;
+        size_t   gap = 0;
+        bool     hasGap = false;
+        size_t   i = 0;
+
+        addr.m_family = AF_INET6;
+
+        // Strip a numeric zone index.
+        for (size_t p = 0; p < len; p++) {
+            if (text[p] == '%') {
+                uint32_t scope = 0;
+                if (!ParseDecimal(text + p + 1, len - p - 1, 0xffffffffU, scope)) {
+                    return false;
+                }
+                addr.m_scope = scope;
+                len = p;
+                break;
+            }
+        }
+
+        if (len >= 2 && text[0] == ':' && text[1] == ':') {
+            hasGap = true;
+            i = 2;
+        } else if (len > 0 && text[0] == ':') {
+            return false;
+        }
+
+        while (i < len) {
+            size_t start = i;
+            uint32_t group = 0;
+
+            while (i < len && HexDigit(text[i]) >= 0 && i - start < 4) {
+                group = (group << 4) | (uint32_t)HexDigit(text[i]);
+                i++;
+            }
+
+            // Trailing dotted quad as in ::ffff:10.0.0.1
+            if (i < len && text[i] == '.') {
+                if (out > 12 || !ParseQuad(text + start, len - start, bytes + out)) {
+                    return false;
+                }
+                out += 4;
+                i = len;
+                break;
+            }
+
+            if (i == start || out == 16) {
+                return false;
+            }
+            bytes[out++] = (uint8_t)(group >> 8);
+            bytes[out++] = (uint8_t)group;
+
+            if (i == len) {
+                break;
+            }
+            if (text[i] != ':') {
+                return false;
+            }
+            i++;
+            if (i < len && text[i] == ':') {
+                // "::" must stand for at least one group.
+                if (hasGap || out == 16) {
+                    return false;
+                }
+                hasGap = true;
+                gap = out;
+                i++;
+            } else if (i == len) {
+                return false;
+            }
+        }
+
+        if (!hasGap) {
+            if (out != 16) {
+                return false;
+            }
+        } else {
+            if (out == 16) {
+                return false;
+            }
+            size_t shift = 16 - out;
+            for (size_t j = out; j > gap; j--) {
+                bytes[j - 1 + shift] = bytes[j - 1];
+                bytes[j - 1] = 0;
+            }
+        }
+
+        for (size_t j = 0; j < 16; j++) {
+            addr.m_addr[j] = bytes[j];
+        }
+        return true;
+    }
+
+    uint8_t             m_addr[16];
+    uint16_t            m_port;
+    uint16_t            m_family;
+    uint32_t            m_scope;
+};
+
+static_assert(sizeof(InetAddress) == 24, "InetAddress must stay compact");
+static_assert(std::is_trivially_copyable<InetAddress>::value,
+              "InetAddress must be trivially copyable");
+
+namespace std
+{
+    template<> struct hash<InetAddress>
+    {
+        size_t operator()(const InetAddress &addr) const { return addr.Hash(); }
+    };
+}
+
+#endif
@@ -0,0 +1,122 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Class for hashing and signing files
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <cstdio>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <cstring>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <system_error>
+
+#include "ipaddr.hpp"
+
+IPAddress::IPAddress(bool isIpv6) : SocketAddress(isIpv6)
+{
+}
+
+/*
+ * Resolve the name to the first address of the family the class manages. The
+ * port already set is kept.
+ */
+void
+IPAddress::SetHostName(const char *hostName)
+{
+    struct addrinfo hints;
+    struct addrinfo *pResult;
+    int             rc;
+
+    bzero(&hints, sizeof(hints));
+    hints.ai_family = GetAddrFamily();
+
+    if ((rc = getaddrinfo(hostName, NULL, &hints, &pResult)) != 0)
+    {
+	throw std::system_error(rc == EAI_SYSTEM ? errno : EHOSTUNREACH, std::system_category());
+    }
+
+    if (m_pIpAddr->sa_family == AF_INET6) {
+        m_pIpv6Addr->sin6_addr = ((sockaddr_in6 *)pResult->ai_addr)->sin6_addr;
+    } else {
+        m_pIpv4Addr->sin_addr = ((sockaddr_in *)pResult->ai_addr)->sin_addr;
+    }
+    freeaddrinfo(pResult);
+
+    m_sHostName = hostName;
+    m_cFormattedAddr.clear();
+}
+
+/*
+ * Returns the stored name, or looks up the name of the stored address. An
+ * address without a name is returned in numeric form.
+ */
+const char *
+IPAddress::GetHostName()
+{
+    if (m_sHostName.empty())
+    {
+        char host[NI_MAXHOST];
+
+        if (getnameinfo(m_pIpAddr, SizeOf(), host, sizeof(host), NULL, 0, 0) != 0)
+        {
+            return GetAddress();
+        }
+        m_sHostName = host;
+    }
+    return m_sHostName.c_str();
+}
+
+void
+IPAddress::SetAddress(const char *ipAddr)
+{
+    void *pAddr;
+
+    if (m_pIpAddr->sa_family == AF_INET6) {
+        pAddr = &m_pIpv6Addr->sin6_addr;
+    } else {
+        pAddr = &m_pIpv4Addr->sin_addr;
+    }
+
+    if (inet_pton(m_pIpAddr->sa_family, ipAddr, pAddr) != 1)
+    {
+	throw std::system_error(EINVAL, std::system_category());
+    }
+
+    m_cFormattedAddr = ipAddr;
+    m_sHostName.clear();
+}
+
+/*
+ * The address is formatted from the sockaddr each time, so an address set
+ * through SocketAddress is reflected.
+ */
+const char *
+IPAddress::GetAddress()
+{
+    char        text[INET6_ADDRSTRLEN];
+    const void  *pAddr;
+
+    if (m_pIpAddr->sa_family == AF_INET6) {
+        pAddr = &m_pIpv6Addr->sin6_addr;
+    } else {
+        pAddr = &m_pIpv4Addr->sin_addr;
+    }
+
+    if (inet_ntop(m_pIpAddr->sa_family, pAddr, text, sizeof(text)) != NULL) {
+        m_cFormattedAddr = text;
+    }
+    return m_cFormattedAddr.c_str();
+}
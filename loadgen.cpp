@@ -0,0 +1,1087 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Loopback traffic load generator with a matching echo or sink server
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * loadgen [options]
+ *
+ *   -s, --server           Run only the echo (or sink) server
+ *   -c, --client           Run only the client; by default both run in one process
+ *   -u, --udp              Use UDP datagrams instead of TCP connections
+ *   -6, --ipv6             Use ::1 instead of 127.0.0.1
+ *   -p, --port=N           Port number (9000)
+ *   -n, --connections=N    TCP connections or UDP flows (1)
+ *   -t, --threads=N        Client and server threads (1)
+ *   -m, --size=N           Message size in bytes, at least 8 (64)
+ *   -r, --rate=N           Messages per second over all flows; 0 is closed loop (0)
+ *   -d, --duration=N       Seconds to measure (10)
+ *   -w, --warmup=N         Seconds to run before measuring (1)
+ *   -k, --sink             The server discards messages instead of echoing them
+ *   -R, --reconnect        TCP client opens a new connection for every message
+ *   -H, --handoff=PATH     TCP server takes its listener from a running server
+ *                          on control socket PATH ('@name' for an abstract
+ *                          name), then hands it on to the next one started
+ *
+ * Closed loop keeps one message outstanding per flow and sends the next as soon
+ * as the reply arrives. Open loop sends at a fixed rate regardless of replies.
+ * Each message carries the time it was meant to be sent and its latency is
+ * measured from then, not from when the send actually happened, so stalls in
+ * the client or server are charged to every message they delayed instead of
+ * being hidden by coordinated omission.
+ *
+ * Between sends less than a millisecond apart an open loop client polls without
+ * sleeping, so client and server threads should have cores of their own.
+ *
+ * A restart is measured by running "loadgen -s -H @lg" and a client with -R,
+ * then starting a second "loadgen -s -H @lg" while the client runs. The new
+ * server takes over the listening socket and the old one finishes the
+ * connections it has and exits. The client counts refused connects and its
+ * latency includes the connect, so a gap in accepting shows up in both.
+ * bench/restart.sh runs this against a stop and start on the same port.
+ *
+ * The address is always the loopback address; this tool is not meant to be
+ * pointed at other hosts.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "socket.hpp"
+#include "connection.hpp"
+#include "handoff.hpp"
+#include "inetaddr.hpp"
+#include "getopt_windows/getopt.h"
+
+static const size_t   BUFFER_SIZE = 65536;
+static const int      MAX_EVENTS = 64;
+static const uint64_t NS_PER_SEC = 1000000000ULL;
+static const uint64_t UDP_TIMEOUT_NS = NS_PER_SEC;
+static const uint64_t LISTENER_TAG = ~0ULL;
+static const uint64_t HANDOFF_WAIT_NS = 10 * NS_PER_SEC;
+static const uint64_t DRAIN_NS = 5 * NS_PER_SEC;
+static const int      HANDOFF_TIMEOUT_MS = 5000;
+
+// Set once the listener has been handed to a successor.
+static std::atomic<bool> s_draining(false);
+static std::atomic<int>  s_serving(0);
+
+struct Config
+{
+    bool        server;
+    bool        client;
+    bool        udp;
+    bool        ipv6;
+    bool        sink;
+    bool        reconnect;
+    const char *handoff;
+    uint16_t    port;
+    int         connections;
+    int         threads;
+    int         size;
+    double      rate;
+    int         duration;
+    int         warmup;
+};
+
+static uint64_t
+NowNs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static bool
+WouldBlock(const std::system_error &e)
+{
+    return e.code().value() == EAGAIN || e.code().value() == EWOULDBLOCK;
+}
+
+/***
+ * @class Log linear latency histogram in nanoseconds. Values below 64 have a
+ *        bucket each; above that every power of two is split into 32 buckets,
+ *        which keeps the error under about 3% at any magnitude in 15 KB.
+ */
+class LatencyHistogram
+{
+public:
+    static const int SUB_BITS = 5;
+    static const int BUCKETS = (65 - SUB_BITS) << SUB_BITS;
+
+    LatencyHistogram()
+    {
+        memset(m_counts, 0, sizeof(m_counts));
+        m_total = 0;
+        m_sum = 0;
+        m_max = 0;
+    }
+
+    void Record(uint64_t value)
+    {
+        m_counts[Index(value)]++;
+        m_total++;
+        m_sum += value;
+        if (value > m_max) {
+            m_max = value;
+        }
+    }
+
+    void Merge(const LatencyHistogram &other)
+    {
+        for (int i = 0; i < BUCKETS; i++) {
+            m_counts[i] += other.m_counts[i];
+        }
+        m_total += other.m_total;
+        m_sum += other.m_sum;
+        if (other.m_max > m_max) {
+            m_max = other.m_max;
+        }
+    }
+
+    /***
+     * Returns the highest value that falls in the same bucket as the requested
+     * percentile, so the result is never lower than the true value.
+     */
+    uint64_t Percentile(double percent) const
+    {
+        uint64_t rank = (uint64_t)ceil(percent / 100.0 * m_total);
+        uint64_t seen = 0;
+
+        if (rank == 0) {
+            rank = 1;
+        }
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += m_counts[i];
+            if (seen >= rank) {
+                uint64_t upper = Highest(i);
+                return upper < m_max ? upper : m_max;
+            }
+        }
+        return m_max;
+    }
+
+    uint64_t Count() const { return m_total; }
+    uint64_t Max() const { return m_max; }
+    double   Mean() const { return m_total ? (double)m_sum / m_total : 0.0; }
+
+private:
+    static int Index(uint64_t value)
+    {
+        if (value < (2U << SUB_BITS)) {
+            return (int)value;
+        }
+        int shift = 63 - __builtin_clzll(value) - SUB_BITS;
+        return (shift << SUB_BITS) + (int)(value >> shift);
+    }
+
+    static uint64_t Highest(int index)
+    {
+        if (index < (2 << SUB_BITS)) {
+            return index;
+        }
+        int      shift = (index >> SUB_BITS) - 1;
+        uint64_t sub = (index & ((1 << SUB_BITS) - 1)) + (1 << SUB_BITS);
+        return ((sub + 1) << shift) - 1;
+    }
+
+    uint64_t    m_counts[BUCKETS];
+    uint64_t    m_total;
+    uint64_t    m_sum;
+    uint64_t    m_max;
+};
+
+/***
+ * Totals of one client thread. Only messages meant to be sent inside the
+ * measurement window are counted.
+ */
+struct ClientStats
+{
+    LatencyHistogram    latency;
+    uint64_t            sent;
+    uint64_t            received;
+    uint64_t            timeouts;
+    uint64_t            connects;
+    uint64_t            refused;
+    uint64_t            resets;
+    uint64_t            bytesSent;
+    uint64_t            bytesReceived;
+};
+
+static InetAddress
+LoopbackAddress(const Config &cfg)
+{
+    InetAddress addr = cfg.ipv6 ? InetAddress::Parse("::1")
+                                : InetAddress::FromIpv4(INADDR_LOOPBACK);
+    addr.SetPortNumber(cfg.port);
+    return addr;
+}
+
+/*
+ * Server
+ */
+
+/***
+ * TCP server thread. Every thread waits on the shared listener with
+ * EPOLLEXCLUSIVE so a new connection wakes one of them, and keeps the
+ * connections it accepts in its own ConnectionTable. A reply that does not fit
+ * in the socket buffer is kept and the connection stops being read until it
+ * has been written, which passes back pressure on to the client. Once the
+ * listener has been handed off the thread stops accepting and returns when
+ * its last connection has closed.
+ */
+static void
+TcpServerThread(const Config &cfg, Socket *pListener)
+{
+    ConnectionTable          table;
+    std::vector<std::string> pending;
+    std::vector<char>        buffer(BUFFER_SIZE);
+    struct epoll_event       events[MAX_EVENTS];
+    int                      ep = epoll_create1(EPOLL_CLOEXEC);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.u64 = LISTENER_TAG;
+    epoll_ctl(ep, EPOLL_CTL_ADD, pListener->GetDescriptor(), &ev);
+
+    bool listening = true;
+
+    for (;;) {
+        int count = epoll_wait(ep, events, MAX_EVENTS, cfg.handoff != NULL ? 100 : -1);
+
+        // The listener stays open in the successor, so it has to be taken out
+        // of this epoll set explicitly.
+        if (listening && s_draining) {
+            epoll_ctl(ep, EPOLL_CTL_DEL, pListener->GetDescriptor(), NULL);
+            listening = false;
+        }
+        if (!listening && table.Size() == 0) {
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.u64 == LISTENER_TAG) {
+                ConnHandle handle;
+                try {
+                    handle = table.Accept(*pListener);
+                } catch (const std::system_error &e) {
+                    continue;
+                }
+                int fd = table.Get(handle)->fd;
+                int one = 1;
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                if (pending.size() <= handle.index) {
+                    pending.resize(handle.index + 1);
+                }
+                ev.events = EPOLLIN;
+                ev.data.u64 = ((uint64_t)handle.index << 32) | handle.generation;
+                epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+                continue;
+            }
+
+            ConnHandle   handle = { (uint32_t)(events[i].data.u64 >> 32),
+                                    (uint32_t)events[i].data.u64 };
+            std::string &out = pending[handle.index];
+            ConnectionTable::HotState *pHot = table.Get(handle);
+            bool closed = false;
+
+            if (pHot == NULL) {
+                continue;
+            }
+
+            try {
+                if (events[i].events & EPOLLOUT) {
+                    int bytes = table.Send(handle, out.data(), (int)out.size(), MSG_NOSIGNAL);
+                    out.erase(0, bytes);
+                } else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    int bytes = table.Recv(handle, buffer.data(), (int)buffer.size(), 0);
+                    if (bytes == 0) {
+                        closed = true;
+                    } else if (!cfg.sink) {
+                        int sent = 0;
+                        try {
+                            sent = table.Send(handle, buffer.data(), bytes, MSG_NOSIGNAL);
+                        } catch (const std::system_error &e) {
+                            if (!WouldBlock(e)) {
+                                throw;
+                            }
+                        }
+                        out.assign(buffer.data() + sent, bytes - sent);
+                    }
+                }
+            } catch (const std::system_error &e) {
+                closed = !WouldBlock(e);
+            }
+
+            if (closed) {
+                epoll_ctl(ep, EPOLL_CTL_DEL, pHot->fd, NULL);
+                table.Close(handle);
+                out.clear();
+                continue;
+            }
+
+            // Read again only once everything echoed so far has been written.
+            uint32_t want = out.empty() ? EPOLLIN : EPOLLOUT;
+            if (want != (events[i].events & (EPOLLIN | EPOLLOUT))) {
+                ev.events = want;
+                ev.data.u64 = events[i].data.u64;
+                epoll_ctl(ep, EPOLL_CTL_MOD, pHot->fd, &ev);
+            }
+        }
+    }
+
+    close(ep);
+    s_serving--;
+}
+
+/***
+ * UDP server thread. Each thread has its own socket on the port with
+ * SO_REUSEPORT so the kernel spreads the flows over the threads.
+ */
+static void
+UdpServerThread(const Config &cfg, Socket *pSock)
+{
+    std::vector<char> buffer(BUFFER_SIZE);
+    InetAddress       peer;
+
+    for (;;) {
+        try {
+            int bytes = pSock->RecvFrom(buffer.data(), (int)buffer.size(), 0, peer);
+            if (!cfg.sink) {
+                pSock->SendTo(buffer.data(), bytes, 0, peer);
+            }
+        } catch (const std::system_error &e) {
+            // A lost reply is seen by the client as a timeout.
+        }
+    }
+}
+
+/***
+ * Create the server sockets and start the server threads. The sockets are
+ * bound before this returns so a client started afterwards can connect. With
+ * a handoff path the TCP listener is taken from the server running on it, if
+ * there is one.
+ */
+static void
+StartServer(const Config &cfg, std::vector<std::unique_ptr<Socket> > &sockets,
+            std::vector<std::thread> &threads)
+{
+    InetAddress addr = LoopbackAddress(cfg);
+    int         one = 1;
+
+    if (cfg.udp) {
+        for (int i = 0; i < cfg.threads; i++) {
+            sockets.emplace_back(new Socket(cfg.ipv6, SOCK_DGRAM));
+            sockets.back()->SetSockOpt(SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+            sockets.back()->Bind(addr);
+            threads.emplace_back(UdpServerThread, std::cref(cfg), sockets.back().get());
+        }
+    } else {
+        HandoffReceiver receiver;
+        int             fd = -1;
+
+        if (cfg.handoff != NULL && receiver.Receive(cfg.handoff, HANDOFF_TIMEOUT_MS)) {
+            fd = receiver.Take("loadgen");
+        }
+
+        if (fd >= 0) {
+            // Still bound, listening and non-blocking in the old server.
+            sockets.emplace_back(new Socket(fd));
+        } else {
+            sockets.emplace_back(new Socket(cfg.ipv6, SOCK_STREAM));
+            sockets.back()->SetSockOpt(SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            sockets.back()->Bind(addr);
+            sockets.back()->Listen(4096);
+            sockets.back()->Fcntl(F_SETFL, O_NONBLOCK);
+        }
+
+        s_serving = cfg.threads;
+        for (int i = 0; i < cfg.threads; i++) {
+            threads.emplace_back(TcpServerThread, std::cref(cfg), sockets.back().get());
+        }
+        receiver.Ready();
+    }
+}
+
+/***
+ * Wait for a successor started with the same handoff path, give it the
+ * listener and exit once the connections accepted here have closed, or after
+ * DRAIN_NS. Does not return.
+ */
+static void
+ServeUntilHandoff(const Config &cfg, Socket &listener)
+{
+    std::unique_ptr<HandoffSender> pSender;
+    uint64_t                       deadline = NowNs() + HANDOFF_WAIT_NS;
+
+    // An abstract name is held by the predecessor until it exits.
+    while (!pSender) {
+        try {
+            pSender.reset(new HandoffSender(cfg.handoff));
+        } catch (const std::system_error &e) {
+            if (e.code().value() != EADDRINUSE || NowNs() > deadline) {
+                throw;
+            }
+            usleep(10000);
+        }
+    }
+
+    pSender->Add("loadgen", listener);
+    while (!pSender->Handoff(HANDOFF_TIMEOUT_MS)) {
+    }
+
+    s_draining = true;
+    printf("handed off, draining\n");
+    fflush(stdout);
+
+    deadline = NowNs() + DRAIN_NS;
+    while (s_serving > 0 && NowNs() < deadline) {
+        usleep(10000);
+    }
+
+    // Exit without destroying the sender: a socket file at the path now
+    // belongs to the successor and must not be removed.
+    _exit(EXIT_SUCCESS);
+}
+
+/*
+ * Client
+ */
+
+/***
+ * One TCP connection or connected UDP socket. Messages waiting to be written
+ * are kept as the times they were meant to be sent, which is all that is
+ * needed to rebuild them.
+ */
+struct Flow
+{
+    std::unique_ptr<Socket> sock;
+    int                     fd;
+    std::deque<uint64_t>    queue;          // Intended send times not yet written
+    size_t                  queueOffset;    // Bytes of the first message already written
+    bool                    wantOut;        // EPOLLOUT is registered
+    bool                    outstanding;    // Closed loop: a reply is expected
+    uint64_t                sentAt;         // Closed loop: stamp of the outstanding message
+    size_t                  rxHave;         // TCP: bytes of the current reply received
+    uint8_t                 rxStamp[8];     // TCP: stamp of the current reply
+};
+
+class ClientThread
+{
+public:
+    ClientThread(const Config &cfg, int flows, double rate, uint64_t start)
+        : m_cfg(cfg), m_rate(rate), m_message(cfg.size), m_buffer(BUFFER_SIZE)
+    {
+        m_stats.sent = 0;
+        m_stats.received = 0;
+        m_stats.timeouts = 0;
+        m_stats.connects = 0;
+        m_stats.refused = 0;
+        m_stats.resets = 0;
+        m_stats.bytesSent = 0;
+        m_stats.bytesReceived = 0;
+        m_measureStart = start + (uint64_t)cfg.warmup * NS_PER_SEC;
+        m_end = m_measureStart + (uint64_t)cfg.duration * NS_PER_SEC;
+        m_closedSink = (rate == 0 && cfg.sink);
+        m_ep = epoll_create1(EPOLL_CLOEXEC);
+
+        m_flows.resize(flows);
+        for (int i = 0; i < flows; i++) {
+            Connect(m_flows[i]);
+        }
+    }
+
+    ~ClientThread()
+    {
+        close(m_ep);
+    }
+
+    void Run();
+
+    const ClientStats &Stats() const { return m_stats; }
+
+private:
+    bool Connect(Flow &flow);
+    void Reset(Flow &flow);
+    void Enqueue(Flow &flow, uint64_t stamp);
+    void Flush(Flow &flow);
+    void Read(Flow &flow);
+    void Complete(Flow &flow, uint64_t stamp);
+    void WatchOutput(Flow &flow, bool on);
+    void CheckTimeouts(uint64_t now);
+
+    bool InWindow(uint64_t stamp) const { return stamp >= m_measureStart && stamp < m_end; }
+
+    const Config           &m_cfg;
+    double                  m_rate;
+    std::vector<Flow>       m_flows;
+    std::vector<uint8_t>    m_message;
+    std::vector<char>       m_buffer;
+    ClientStats             m_stats;
+    uint64_t                m_measureStart;
+    uint64_t                m_end;
+    bool                    m_closedSink;
+    int                     m_ep;
+};
+
+/***
+ * Open the flow's socket, closing the one it had. In reconnect mode a refused
+ * connect is counted and retried every millisecond until the run ends, so a
+ * server that stops listening is seen as refusals and as latency.
+ *
+ * @return false if the run ended before the connect succeeded.
+ */
+bool
+ClientThread::Connect(Flow &flow)
+{
+    InetAddress addr = LoopbackAddress(m_cfg);
+    int         one = 1;
+
+    for (;;) {
+        flow.sock.reset(new Socket(m_cfg.ipv6, m_cfg.udp ? SOCK_DGRAM : SOCK_STREAM));
+        try {
+            flow.sock->Connect(addr);
+            break;
+        } catch (const std::system_error &e) {
+            if (!m_cfg.reconnect || e.code().value() != ECONNREFUSED) {
+                throw;
+            }
+        }
+
+        uint64_t now = NowNs();
+        if (InWindow(now)) {
+            m_stats.refused++;
+        }
+        if (now >= m_end) {
+            flow.sock.reset();
+            return false;
+        }
+        usleep(1000);
+    }
+
+    if (!m_cfg.udp) {
+        flow.sock->SetSockOpt(IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    flow.sock->Fcntl(F_SETFL, O_NONBLOCK);
+    flow.fd = flow.sock->GetDescriptor();
+    flow.queueOffset = 0;
+    flow.wantOut = false;
+    flow.outstanding = false;
+    flow.sentAt = 0;
+    flow.rxHave = 0;
+    if (InWindow(NowNs())) {
+        m_stats.connects++;
+    }
+
+    struct epoll_event ev;
+    ev.events = m_cfg.sink ? 0u : (uint32_t)EPOLLIN;
+    ev.data.u32 = (uint32_t)(&flow - &m_flows[0]);
+    epoll_ctl(m_ep, EPOLL_CTL_ADD, flow.fd, &ev);
+    return true;
+}
+
+/***
+ * Reconnect mode: the connection failed, for example because the server
+ * exited with it open. The message in flight on it is lost and shows up as
+ * unanswered; the flow goes on with a new connection.
+ */
+void
+ClientThread::Reset(Flow &flow)
+{
+    uint64_t now = NowNs();
+
+    if (InWindow(now)) {
+        m_stats.resets++;
+    }
+    if (now >= m_end || !Connect(flow)) {
+        return;
+    }
+    if (m_rate == 0) {
+        Enqueue(flow, now);
+    } else if (!flow.queue.empty()) {
+        Flush(flow);
+    }
+}
+
+void
+ClientThread::Enqueue(Flow &flow, uint64_t stamp)
+{
+    flow.queue.push_back(stamp);
+    if (!flow.wantOut) {
+        Flush(flow);
+    }
+}
+
+void
+ClientThread::WatchOutput(Flow &flow, bool on)
+{
+    struct epoll_event ev;
+
+    if (flow.wantOut == on) {
+        return;
+    }
+    flow.wantOut = on;
+    ev.events = (m_cfg.sink ? 0u : (uint32_t)EPOLLIN) | (on ? (uint32_t)EPOLLOUT : 0u);
+    ev.data.u32 = (uint32_t)(&flow - &m_flows[0]);
+    epoll_ctl(m_ep, EPOLL_CTL_MOD, flow.fd, &ev);
+}
+
+/***
+ * Write queued messages until the queue is empty or the socket is full. A
+ * closed loop sink client has nobody to reply, so it refills the queue itself
+ * and is limited only by the socket buffer, a bounded batch at a time. In
+ * reconnect mode a connection carries a single message.
+ */
+void
+ClientThread::Flush(Flow &flow)
+{
+    int batch = 64;
+
+    for (;;) {
+        if (m_cfg.reconnect && flow.outstanding) {
+            break;
+        }
+        if (flow.queue.empty()) {
+            if (!m_closedSink || --batch == 0) {
+                break;
+            }
+            flow.queue.push_back(NowNs());
+        }
+
+        uint64_t stamp = flow.queue.front();
+        memcpy(&m_message[0], &stamp, sizeof(stamp));
+
+        int bytes;
+        try {
+            bytes = flow.sock->Send(&m_message[flow.queueOffset],
+                                    (int)(m_message.size() - flow.queueOffset), MSG_NOSIGNAL);
+        } catch (const std::system_error &e) {
+            if (!WouldBlock(e)) {
+                throw;
+            }
+            break;
+        }
+
+        flow.queueOffset += bytes;
+        if (flow.queueOffset < m_message.size()) {
+            break;
+        }
+
+        flow.queue.pop_front();
+        flow.queueOffset = 0;
+        flow.outstanding = true;
+        flow.sentAt = stamp;
+        if (InWindow(stamp)) {
+            m_stats.sent++;
+            m_stats.bytesSent += m_message.size();
+        }
+    }
+
+    WatchOutput(flow, (!flow.queue.empty() && !(m_cfg.reconnect && flow.outstanding)) || m_closedSink);
+}
+
+void
+ClientThread::Complete(Flow &flow, uint64_t stamp)
+{
+    uint64_t now = NowNs();
+
+    if (InWindow(stamp)) {
+        m_stats.latency.Record(now - stamp);
+        m_stats.received++;
+        m_stats.bytesReceived += m_message.size();
+    }
+
+    flow.outstanding = false;
+
+    // The next message's latency is counted from before its connect.
+    if (m_cfg.reconnect && (now >= m_end || !Connect(flow))) {
+        return;
+    }
+    if (m_rate == 0 && now < m_end) {
+        Enqueue(flow, now);
+    } else if (m_cfg.reconnect && !flow.queue.empty()) {
+        Flush(flow);
+    }
+}
+
+void
+ClientThread::Read(Flow &flow)
+{
+    int bytes;
+
+    try {
+        bytes = flow.sock->Recv(m_buffer.data(), (int)m_buffer.size(), 0);
+    } catch (const std::system_error &e) {
+        if (!WouldBlock(e)) {
+            throw;
+        }
+        return;
+    }
+
+    if (m_cfg.udp) {
+        uint64_t stamp;
+        if ((size_t)bytes >= sizeof(stamp)) {
+            memcpy(&stamp, m_buffer.data(), sizeof(stamp));
+            // A late reply to a message already timed out and resent is ignored.
+            if (m_rate != 0 || (flow.outstanding && stamp == flow.sentAt)) {
+                Complete(flow, stamp);
+            }
+        }
+        return;
+    }
+
+    if (bytes == 0) {
+        throw std::system_error(ECONNRESET, std::system_category());
+    }
+
+    // The stream is cut back into messages of the configured size.
+    for (int pos = 0; pos < bytes;) {
+        size_t take = m_message.size() - flow.rxHave;
+        if (take > (size_t)(bytes - pos)) {
+            take = bytes - pos;
+        }
+        if (flow.rxHave < sizeof(flow.rxStamp)) {
+            size_t stampBytes = sizeof(flow.rxStamp) - flow.rxHave;
+            memcpy(&flow.rxStamp[flow.rxHave], &m_buffer[pos], take < stampBytes ? take : stampBytes);
+        }
+        flow.rxHave += take;
+        pos += (int)take;
+
+        if (flow.rxHave == m_message.size()) {
+            uint64_t stamp;
+            memcpy(&stamp, flow.rxStamp, sizeof(stamp));
+            flow.rxHave = 0;
+            Complete(flow, stamp);
+            if (m_cfg.reconnect) {
+                break;
+            }
+        }
+    }
+}
+
+/***
+ * A closed loop UDP flow whose datagram or reply was lost would otherwise wait
+ * forever, so it is counted as a timeout and a new message is sent.
+ */
+void
+ClientThread::CheckTimeouts(uint64_t now)
+{
+    for (size_t i = 0; i < m_flows.size(); i++) {
+        Flow &flow = m_flows[i];
+
+        if (flow.outstanding && flow.queue.empty() && now - flow.sentAt > UDP_TIMEOUT_NS) {
+            if (InWindow(flow.sentAt)) {
+                m_stats.timeouts++;
+            }
+            flow.outstanding = false;
+            Enqueue(flow, now);
+        }
+    }
+}
+
+void
+ClientThread::Run()
+{
+    struct epoll_event events[MAX_EVENTS];
+    double   interval = m_rate > 0 ? NS_PER_SEC / m_rate : 0;
+    double   next = (double)NowNs();
+    uint64_t lastCheck = 0;
+    size_t   rr = 0;
+
+    if (m_rate == 0) {
+        for (size_t i = 0; i < m_flows.size(); i++) {
+            Enqueue(m_flows[i], NowNs());
+        }
+    }
+
+    for (;;) {
+        uint64_t now = NowNs();
+        int      timeout = 100;
+
+        if (now >= m_end) {
+            break;
+        }
+
+        if (m_rate > 0) {
+            // Every message due by now is queued with the time it was due,
+            // however late this loop is running.
+            while (next <= (double)now) {
+                Enqueue(m_flows[rr], (uint64_t)next);
+                rr = (rr + 1) % m_flows.size();
+                next += interval;
+            }
+            timeout = (int)((uint64_t)(next - now) / 1000000);
+        }
+
+        int count = epoll_wait(m_ep, events, MAX_EVENTS, timeout);
+        try {
+            for (int i = 0; i < count; i++) {
+                Flow &flow = m_flows[events[i].data.u32];
+
+                try {
+                    if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                        Read(flow);
+                    }
+                    if (events[i].events & EPOLLOUT) {
+                        Flush(flow);
+                    }
+                } catch (const std::system_error &e) {
+                    if (!m_cfg.reconnect) {
+                        throw;
+                    }
+                    Reset(flow);
+                }
+            }
+        } catch (const std::system_error &e) {
+            // The server went away; report what was measured so far.
+            fprintf(stderr, "loadgen: %s\n", e.what());
+            break;
+        }
+
+        if (m_cfg.udp && m_rate == 0 && !m_cfg.sink && now - lastCheck > NS_PER_SEC / 10) {
+            CheckTimeouts(now);
+            lastCheck = now;
+        }
+    }
+}
+
+static void
+Report(const Config &cfg, const std::vector<std::unique_ptr<ClientThread> > &clients)
+{
+    LatencyHistogram latency;
+    uint64_t sent = 0, received = 0, timeouts = 0, bytesSent = 0, bytesReceived = 0;
+    uint64_t connects = 0, refused = 0, resets = 0;
+
+    for (size_t i = 0; i < clients.size(); i++) {
+        const ClientStats &stats = clients[i]->Stats();
+        latency.Merge(stats.latency);
+        sent += stats.sent;
+        received += stats.received;
+        timeouts += stats.timeouts;
+        connects += stats.connects;
+        refused += stats.refused;
+        resets += stats.resets;
+        bytesSent += stats.bytesSent;
+        bytesReceived += stats.bytesReceived;
+    }
+
+    double seconds = cfg.duration;
+
+    printf("%s %s, %d %s, %d threads, %d byte messages",
+           cfg.rate > 0 ? "open loop" : "closed loop", cfg.udp ? "udp" : "tcp",
+           cfg.connections, cfg.udp ? "flows" : "connections", cfg.threads, cfg.size);
+    if (cfg.rate > 0) {
+        printf(", %.0f msg/s requested", cfg.rate);
+    }
+    if (cfg.reconnect) {
+        printf(", connection per message");
+    }
+    printf("\n");
+
+    if (cfg.reconnect) {
+        printf("connects %12llu, %llu refused, %llu reset\n", (unsigned long long)connects,
+               (unsigned long long)refused, (unsigned long long)resets);
+    }
+
+    printf("sent     %12llu msgs %10.0f msg/s %10.2f MB/s\n", (unsigned long long)sent,
+           sent / seconds, bytesSent / seconds / 1e6);
+    if (cfg.sink) {
+        return;
+    }
+    printf("received %12llu msgs %10.0f msg/s %10.2f MB/s\n", (unsigned long long)received,
+           received / seconds, bytesReceived / seconds / 1e6);
+    if (sent > received) {
+        printf("unanswered %10llu msgs", (unsigned long long)(sent - received));
+        if (timeouts != 0) {
+            printf(", %llu timed out", (unsigned long long)timeouts);
+        }
+        printf("\n");
+    }
+
+    if (latency.Count() == 0) {
+        return;
+    }
+    printf("latency usec  mean %.1f", latency.Mean() / 1e3);
+    static const double s_percentiles[] = { 50, 90, 99, 99.9, 99.99 };
+    for (size_t i = 0; i < sizeof(s_percentiles) / sizeof(s_percentiles[0]); i++) {
+        printf("  p%g %.1f", s_percentiles[i], latency.Percentile(s_percentiles[i]) / 1e3);
+    }
+    printf("  max %.1f\n", latency.Max() / 1e3);
+}
+
+static long
+ParseNumber(const char *text, const char *name, long min, long max)
+{
+    char *pEnd;
+    long  value;
+
+    errno = 0;
+    value = strtol(text, &pEnd, 10);
+    if (pEnd == text || *pEnd != '\0' || errno != 0 || value < min || value > max) {
+        fprintf(stderr, "loadgen: bad %s '%s'\n", name, text);
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+static void
+Usage()
+{
+    fprintf(stderr,
+            "usage: loadgen [-s|-c] [-u] [-6] [-p port] [-n connections] [-t threads]\n"
+            "               [-m size] [-r rate] [-d seconds] [-w seconds] [-k] [-R]\n"
+            "               [-H path]\n");
+    exit(EXIT_FAILURE);
+}
+
+static const struct option s_longOptions[] = {
+    { "server",      no_argument,       NULL, 's' },
+    { "client",      no_argument,       NULL, 'c' },
+    { "udp",         no_argument,       NULL, 'u' },
+    { "ipv6",        no_argument,       NULL, '6' },
+    { "port",        required_argument, NULL, 'p' },
+    { "connections", required_argument, NULL, 'n' },
+    { "threads",     required_argument, NULL, 't' },
+    { "size",        required_argument, NULL, 'm' },
+    { "rate",        required_argument, NULL, 'r' },
+    { "duration",    required_argument, NULL, 'd' },
+    { "warmup",      required_argument, NULL, 'w' },
+    { "sink",        no_argument,       NULL, 'k' },
+    { "reconnect",   no_argument,       NULL, 'R' },
+    { "handoff",     required_argument, NULL, 'H' },
+    { "help",        no_argument,       NULL, 'h' },
+    { NULL,          0,                 NULL, 0   }
+};
+
+int
+main(int argc, char *argv[])
+{
+    Config cfg;
+    int    opt;
+
+    cfg.server = false;
+    cfg.client = false;
+    cfg.udp = false;
+    cfg.ipv6 = false;
+    cfg.sink = false;
+    cfg.reconnect = false;
+    cfg.handoff = NULL;
+    cfg.port = 9000;
+    cfg.connections = 1;
+    cfg.threads = 1;
+    cfg.size = 64;
+    cfg.rate = 0;
+    cfg.duration = 10;
+    cfg.warmup = 1;
+
+    while ((opt = getopt_long(argc, argv, "scu6p:n:t:m:r:d:w:kRH:h", s_longOptions, NULL)) != -1) {
+        switch (opt) {
+            case 's': cfg.server = true; break;
+            case 'c': cfg.client = true; break;
+            case 'u': cfg.udp = true; break;
+            case '6': cfg.ipv6 = true; break;
+            case 'k': cfg.sink = true; break;
+            case 'R': cfg.reconnect = true; break;
+            case 'H': cfg.handoff = optarg; break;
+            case 'p': cfg.port = (uint16_t)ParseNumber(optarg, "port", 1, 65535); break;
+            case 'n': cfg.connections = (int)ParseNumber(optarg, "connection count", 1, 1000000); break;
+            case 't': cfg.threads = (int)ParseNumber(optarg, "thread count", 1, 1024); break;
+            case 'm': cfg.size = (int)ParseNumber(optarg, "message size", 8, 65507); break;
+            case 'r': cfg.rate = (double)ParseNumber(optarg, "rate", 0, LONG_MAX); break;
+            case 'd': cfg.duration = (int)ParseNumber(optarg, "duration", 1, 86400); break;
+            case 'w': cfg.warmup = (int)ParseNumber(optarg, "warmup", 0, 3600); break;
+            default:  Usage();
+        }
+    }
+
+    if (optind != argc || (cfg.server && cfg.client)) {
+        Usage();
+    }
+    // A reconnecting client moves on when a reply arrives, so it needs an
+    // echo server; a handoff needs a server process of its own.
+    if ((cfg.reconnect && (cfg.udp || cfg.sink)) || (cfg.handoff != NULL && (cfg.udp || !cfg.server))) {
+        Usage();
+    }
+    if (!cfg.server && !cfg.client) {
+        cfg.server = cfg.client = true;
+    }
+    if (cfg.threads > cfg.connections && cfg.client) {
+        cfg.threads = cfg.connections;
+    }
+
+    std::vector<std::unique_ptr<Socket> > serverSockets;
+    std::vector<std::thread>              serverThreads;
+
+    try {
+        if (cfg.server) {
+            StartServer(cfg, serverSockets, serverThreads);
+            if (!cfg.client) {
+                printf("%s %s server on port %u\n", cfg.sink ? "sink" : "echo",
+                       cfg.udp ? "udp" : "tcp", cfg.port);
+                if (cfg.handoff != NULL) {
+                    fflush(stdout);
+                    ServeUntilHandoff(cfg, *serverSockets[0]);
+                }
+                for (size_t i = 0; i < serverThreads.size(); i++) {
+                    serverThreads[i].join();
+                }
+                return EXIT_SUCCESS;
+            }
+        }
+
+        // Flows and rate are split evenly over the client threads.
+        std::vector<std::unique_ptr<ClientThread> > clients;
+        std::vector<std::thread>                    clientThreads;
+        uint64_t start = NowNs();
+
+        for (int i = 0; i < cfg.threads; i++) {
+            int flows = cfg.connections / cfg.threads + (i < cfg.connections % cfg.threads);
+            clients.emplace_back(new ClientThread(cfg, flows, cfg.rate / cfg.threads, start));
+        }
+        for (int i = 0; i < cfg.threads; i++) {
+            clientThreads.emplace_back(&ClientThread::Run, clients[i].get());
+        }
+        for (int i = 0; i < cfg.threads; i++) {
+            clientThreads[i].join();
+        }
+
+        Report(cfg, clients);
+    } catch (const std::system_error &e) {
+        fprintf(stderr, "loadgen: %s\n", e.what());
+        exit(EXIT_FAILURE);
+    }
+
+    // Server threads run until the process exits.
+    fflush(stdout);
+    _exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,341 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Transmit pacing with per socket and per destination token buckets
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <system_error>
+#include <sys/socket.h>
+#include <linux/net_tstamp.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "pacer.hpp"
+
+#ifndef SO_TXTIME
+#define SO_TXTIME               61
+#define SCM_TXTIME              SO_TXTIME
+#endif
+#ifndef SO_MAX_PACING_RATE
+#define SO_MAX_PACING_RATE      47
+#endif
+
+// Sleeps end this early and are finished by spinning, to absorb timer slack.
+static const uint64_t SPIN_NS = 60000;
+
+// With SO_TXTIME packets are queued in the kernel at most this far ahead of
+// their launch time, well inside the fq drop horizon.
+static const uint64_t TXTIME_LEAD_NS = 2000000;
+
+static uint64_t
+MonotonicNs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void
+CpuRelax()
+{
+#ifdef __SSE2__
+    _mm_pause();
+#endif
+}
+
+/*
+ * Build the msghdr for one datagram, with an SCM_TXTIME launch time if
+ * txtime is set.
+ */
+static void
+FillMessage(struct msghdr &hdr, struct iovec &iov, InetSockAddr &sa, char *pControl,
+            const void *buff, size_t len, const InetAddress *pPeer, bool txtime, uint64_t departure)
+{
+    memset(&hdr, 0, sizeof(hdr));
+    iov.iov_base = (void *)buff;
+    iov.iov_len = len;
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+
+    if (pPeer != NULL) {
+        hdr.msg_name = &sa;
+        hdr.msg_namelen = pPeer->ToSockAddr(sa);
+    }
+
+    if (txtime) {
+        hdr.msg_control = pControl;
+        hdr.msg_controllen = CMSG_SPACE(sizeof(uint64_t));
+
+        struct cmsghdr *pCmsg = CMSG_FIRSTHDR(&hdr);
+        pCmsg->cmsg_level = SOL_SOCKET;
+        pCmsg->cmsg_type = SCM_TXTIME;
+        pCmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+        memcpy(CMSG_DATA(pCmsg), &departure, sizeof(departure));
+    }
+}
+
+PacedSender::PacedSender(Socket &sock, uint64_t rate, uint32_t burst, PacingMode mode) : m_sock(sock)
+{
+    m_mode = mode;
+    m_peerRate = 0;
+    m_peerBurst = 0;
+    m_window = 0;
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    if (mode == PACE_TXTIME) {
+        struct sock_txtime txtime;
+
+        txtime.clockid = CLOCK_MONOTONIC;
+        txtime.flags = 0;
+        if (setsockopt(sock.GetDescriptor(), SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) < 0) {
+            m_mode = PACE_USERSPACE;
+        }
+    } else if (mode == PACE_FQ) {
+        unsigned long unlimited = ~0UL;
+
+        if (setsockopt(sock.GetDescriptor(), SOL_SOCKET, SO_MAX_PACING_RATE, &unlimited, sizeof(unlimited)) < 0) {
+            m_mode = PACE_USERSPACE;
+        }
+    }
+
+    SetRate(rate, burst);
+}
+
+void
+PacedSender::SetRate(uint64_t rate, uint32_t burst)
+{
+    if (m_mode == PACE_FQ) {
+        unsigned long maxRate = rate != 0 ? (unsigned long)rate : ~0UL;
+
+        m_sock.SetSockOpt(SOL_SOCKET, SO_MAX_PACING_RATE, &maxRate, sizeof(maxRate));
+        return;
+    }
+    m_bucket.SetRate(rate, burst);
+}
+
+void
+PacedSender::SetPeerRate(const InetAddress &peer, uint64_t rate, uint32_t burst)
+{
+    bool inserted;
+
+    m_peers.Insert(peer, (uint32_t)(MonotonicNs() / 1000000000ULL), inserted)->SetRate(rate, burst);
+}
+
+void
+PacedSender::SetDefaultPeerRate(uint64_t rate, uint32_t burst)
+{
+    m_peerRate = rate;
+    m_peerBurst = burst;
+}
+
+size_t
+PacedSender::ExpirePeers(uint32_t idle, size_t budget)
+{
+    return m_peers.Expire((uint32_t)(MonotonicNs() / 1000000000ULL), idle, budget,
+                          [](const InetAddress &, TokenBucket &) {});
+}
+
+/*
+ * Departure time of the next packet, the later of now and what the socket and
+ * the destination bucket allow. Nothing is consumed until Commit().
+ */
+uint64_t
+PacedSender::Departure(uint64_t now, const InetAddress *pPeer, TokenBucket *&pPeerBucket)
+{
+    uint64_t departure = now;
+
+    if (m_bucket.Earliest() > departure) {
+        departure = m_bucket.Earliest();
+    }
+
+    pPeerBucket = NULL;
+    if (pPeer != NULL) {
+        uint32_t seconds = (uint32_t)(now / 1000000000ULL);
+
+        if (m_peerRate != 0) {
+            bool inserted;
+            pPeerBucket = m_peers.Insert(*pPeer, seconds, inserted);
+            if (inserted) {
+                pPeerBucket->SetRate(m_peerRate, m_peerBurst);
+            }
+        } else {
+            pPeerBucket = m_peers.Find(*pPeer, seconds);
+        }
+
+        if (pPeerBucket != NULL && pPeerBucket->Earliest() > departure) {
+            departure = pPeerBucket->Earliest();
+        }
+    }
+    return departure;
+}
+
+void
+PacedSender::Commit(uint64_t departure, uint32_t len, TokenBucket *pPeerBucket)
+{
+    m_bucket.Consume(departure, len);
+    if (pPeerBucket != NULL) {
+        pPeerBucket->Consume(departure, len);
+    }
+}
+
+void
+PacedSender::WaitFor(uint64_t departure)
+{
+    uint64_t now = MonotonicNs();
+    uint64_t start = now;
+
+    // The kernel holds a packet until its launch time, so only keep the
+    // queue from running too far ahead.
+    if (m_mode == PACE_TXTIME) {
+        departure = departure > TXTIME_LEAD_NS ? departure - TXTIME_LEAD_NS : 0;
+    }
+    if (departure <= now) {
+        return;
+    }
+
+    if (departure - now > SPIN_NS) {
+        struct timespec ts;
+        uint64_t        wake = departure - SPIN_NS;
+
+        ts.tv_sec = (time_t)(wake / 1000000000ULL);
+        ts.tv_nsec = (long)(wake % 1000000000ULL);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+        }
+    }
+    while ((now = MonotonicNs()) < departure) {
+        CpuRelax();
+    }
+    m_stats.waitNs += now - start;
+}
+
+void
+PacedSender::Account(int packets, uint64_t bytes, uint64_t departure)
+{
+    m_stats.packets += packets;
+    m_stats.bytes += bytes;
+
+    if (m_mode != PACE_TXTIME) {
+        uint64_t now = MonotonicNs();
+        if (now > departure && now - departure > m_stats.maxLateNs) {
+            m_stats.maxLateNs = now - departure;
+        }
+    }
+}
+
+int
+PacedSender::SendOne(const void *buff, int len, uint32_t flags, const InetAddress *pPeer)
+{
+    struct msghdr  hdr;
+    struct iovec   iov;
+    InetSockAddr   sa;
+    char           control[CMSG_SPACE(sizeof(uint64_t))];
+    TokenBucket   *pPeerBucket;
+    ssize_t        bytes;
+    uint64_t       departure = Departure(MonotonicNs(), pPeer, pPeerBucket);
+
+    Commit(departure, (uint32_t)len, pPeerBucket);
+    WaitFor(departure);
+
+    FillMessage(hdr, iov, sa, control, buff, len, pPeer, m_mode == PACE_TXTIME, departure);
+    do {
+        m_stats.syscalls++;
+    } while ((bytes = sendmsg(m_sock.GetDescriptor(), &hdr, flags)) < 0 && errno == EINTR);
+
+    if (bytes < 0)
+    {
+	throw std::system_error(errno, std::system_category());
+    }
+
+    Account(1, bytes, departure);
+    return (int)bytes;
+}
+
+int
+PacedSender::SendTo(const void *buff, int len, uint32_t flags, const InetAddress &peer)
+{
+    return SendOne(buff, len, flags, &peer);
+}
+
+int
+PacedSender::Send(const void *buff, int len, uint32_t flags)
+{
+    return SendOne(buff, len, flags, NULL);
+}
+
+int
+PacedSender::SendBatch(const PacedMessage *msgs, int count, uint32_t flags)
+{
+    struct mmsghdr hdrs[BATCH_MAX];
+    struct iovec   iovs[BATCH_MAX];
+    InetSockAddr   addrs[BATCH_MAX];
+    char           control[BATCH_MAX][CMSG_SPACE(sizeof(uint64_t))];
+    bool           txtime = m_mode == PACE_TXTIME;
+    uint64_t       window = txtime ? TXTIME_LEAD_NS : m_window;
+    int            sent = 0;
+
+    while (sent < count) {
+        uint64_t now = MonotonicNs();
+        uint64_t first = 0;
+        uint64_t bytes = 0;
+        int      n = 0;
+
+        // Gather the packets due within the window of the first one. The clock
+        // is read once, so packets already due all depart together.
+        while (n < BATCH_MAX && sent + n < count) {
+            const PacedMessage &msg = msgs[sent + n];
+            TokenBucket        *pPeerBucket;
+            uint64_t            departure = Departure(now, &msg.peer, pPeerBucket);
+
+            if (n == 0) {
+                first = departure;
+            } else if (departure > first + window) {
+                break;
+            }
+
+            Commit(departure, msg.len, pPeerBucket);
+            FillMessage(hdrs[n].msg_hdr, iovs[n], addrs[n], control[n], msg.buff, msg.len,
+                        &msg.peer, txtime, departure);
+            hdrs[n].msg_len = 0;
+            bytes += msg.len;
+            n++;
+        }
+
+        WaitFor(first);
+
+        // Tokens of packets an error leaves unsent are not returned.
+        for (int done = 0; done < n; ) {
+            int rc;
+
+            m_stats.syscalls++;
+            if ((rc = sendmmsg(m_sock.GetDescriptor(), &hdrs[done], n - done, flags)) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (sent + done > 0) {
+                    return sent + done;
+                }
+	        throw std::system_error(errno, std::system_category());
+            }
+            done += rc;
+        }
+
+        Account(n, bytes, first);
+        sent += n;
+    }
+    return sent;
+}
@@ -0,0 +1,206 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Transmit pacing with per socket and per destination token buckets
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef PACER_HPP
+#define PACER_HPP
+
+#include <stdint.h>
+#include <cstddef>
+#include "socket.hpp"
+#include "inetaddr.hpp"
+#include "peertable.hpp"
+
+/***
+ * @class Token bucket kept as a theoretical arrival time, as in the generic cell
+ *        rate algorithm: a packet may leave once the clock is within the burst
+ *        tolerance of the time the bucket would next be empty. This needs no
+ *        periodic refill and gives every packet an exact departure time rather
+ *        than a yes or no answer. A rate of zero means unlimited.
+ */
+class TokenBucket
+{
+public:
+                        TokenBucket() : m_rate(0), m_tolerance(0), m_tat(0) {}
+
+    /***
+     * @param[IN] rate  - Bytes per second, 0 for no limit.
+     * @param[IN] burst - Bytes that may be sent back to back after an idle period.
+     */
+    void                SetRate(uint64_t rate, uint32_t burst)
+    {
+        m_rate = rate;
+        m_tolerance = rate != 0 ? (uint64_t)burst * 1000000000ULL / rate : 0;
+    }
+
+    uint64_t            GetRate() const { return m_rate; }
+
+    /***
+     * Earliest time, in nanoseconds, that the next packet conforms.
+     */
+    uint64_t            Earliest() const
+    {
+        return m_tat > m_tolerance ? m_tat - m_tolerance : 0;
+    }
+
+    /***
+     * Account for len bytes leaving at time departure.
+     */
+    void                Consume(uint64_t departure, uint32_t len)
+    {
+        if (m_rate == 0) {
+            return;
+        }
+        m_tat = (m_tat > departure ? m_tat : departure) + (uint64_t)len * 1000000000ULL / m_rate;
+    }
+
+private:
+    uint64_t            m_rate;
+    uint64_t            m_tolerance;    // Burst expressed as nanoseconds at m_rate
+    uint64_t            m_tat;          // Time the bucket would be full again
+};
+
+/***
+ * One datagram of a PacedSender::SendBatch().
+ */
+struct PacedMessage
+{
+    const void         *buff;
+    uint32_t            len;
+    InetAddress         peer;
+};
+
+/***
+ * @class Paces datagrams sent through a Socket so bursts leave at the configured
+ *        rate instead of overrunning switch and receiver buffers. A token bucket
+ *        for the socket and one per destination both have to allow a packet;
+ *        it leaves at the later of the two departure times.
+ *
+ *        PACE_USERSPACE sleeps with clock_nanosleep() until shortly before the
+ *        departure and spins the rest of the way. PACE_TXTIME hands every
+ *        departure to the kernel as an SO_TXTIME launch time and PACE_FQ hands
+ *        the socket rate to the kernel as SO_MAX_PACING_RATE, leaving only the
+ *        destination buckets in userspace. Both kernel modes need the fq qdisc
+ *        on the egress device, which is not checked; without it packets leave
+ *        unpaced. If the socket option is refused the sender falls back to
+ *        PACE_USERSPACE, which GetMode() reports.
+ *
+ *        An object is used by one thread at a time.
+ */
+class PacedSender
+{
+public:
+    enum PacingMode
+    {
+        PACE_USERSPACE,
+        PACE_TXTIME,
+        PACE_FQ
+    };
+
+    struct Stats
+    {
+        uint64_t        packets;
+        uint64_t        bytes;
+        uint64_t        syscalls;
+        uint64_t        waitNs;         // Time spent waiting for departures
+        uint64_t        maxLateNs;      // Worst lateness of a send against its departure
+    };
+
+    static const int    BATCH_MAX = 64;
+
+    /***
+     * Class constructor.
+     *
+     * @param[IN] sock  - Datagram socket to send on.
+     * @param[IN] rate  - Socket rate in bytes per second, 0 for no limit.
+     * @param[IN] burst - Bytes the socket may send back to back.
+     * @param[IN] mode  - How departures are enforced.
+     */
+                        PacedSender(Socket &sock, uint64_t rate, uint32_t burst,
+                                    PacingMode mode = PACE_USERSPACE);
+
+    void                SetRate(uint64_t rate, uint32_t burst);
+
+    /***
+     * Limit one destination. Replaces the default for that peer.
+     */
+    void                SetPeerRate(const InetAddress &peer, uint64_t rate, uint32_t burst);
+
+    /***
+     * Limit every destination not given its own rate. 0 for no limit.
+     */
+    void                SetDefaultPeerRate(uint64_t rate, uint32_t burst);
+
+    /***
+     * Let SendBatch() send a packet up to window nanoseconds before its
+     * departure so that packets due close together share one sendmmsg().
+     * Ignored with PACE_TXTIME, where each packet carries its own time.
+     */
+    void                SetBatchWindow(uint64_t window) { m_window = window; }
+
+    /***
+     * Send as Socket::SendTo() once the packet's departure time is reached.
+     *
+     * @throws std::system_error if the send fails.
+     */
+    int                 SendTo(const void *buff, int len, uint32_t flags, const InetAddress &peer);
+
+    /***
+     * Send as Socket::Send() on a connected socket, paced by the socket bucket.
+     */
+    int                 Send(const void *buff, int len, uint32_t flags);
+
+    /***
+     * Send a batch of datagrams with sendmmsg(), as many per call as the batch
+     * window or launch times allow.
+     *
+     * @return Number of datagrams sent, which is count unless an error stops
+     *         the batch part way.
+     *
+     * @throws std::system_error if the first datagram cannot be sent.
+     */
+    int                 SendBatch(const PacedMessage *msgs, int count, uint32_t flags);
+
+    /***
+     * Drop destination buckets idle for more than idle seconds, examining at
+     * most budget slots. A rate given with SetPeerRate() is dropped too and
+     * the peer falls back to the default when it is next used.
+     */
+    size_t              ExpirePeers(uint32_t idle, size_t budget);
+
+    PacingMode          GetMode() const { return m_mode; }
+    const Stats        &GetStats() const { return m_stats; }
+
+private:
+                        PacedSender(const PacedSender &);
+    PacedSender        &operator=(const PacedSender &);
+
+    uint64_t            Departure(uint64_t now, const InetAddress *pPeer, TokenBucket *&pPeerBucket);
+    void                Commit(uint64_t departure, uint32_t len, TokenBucket *pPeerBucket);
+    void                WaitFor(uint64_t departure);
+    void                Account(int packets, uint64_t bytes, uint64_t departure);
+    int                 SendOne(const void *buff, int len, uint32_t flags, const InetAddress *pPeer);
+
+    Socket                 &m_sock;
+    PacingMode              m_mode;
+    TokenBucket             m_bucket;
+    PeerTable<TokenBucket>  m_peers;
+    uint64_t                m_peerRate;
+    uint32_t                m_peerBurst;
+    uint64_t                m_window;
+    Stats                   m_stats;
+};
+
+#endif
@@ -0,0 +1,479 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Open addressing table of per-peer sessions keyed by socket address
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef PEERTABLE_HPP
+#define PEERTABLE_HPP
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <utility>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "inetaddr.hpp"
+
+/***
+ * @class Flat hash table mapping the binary address of a peer, as returned by
+ *        Socket::RecvFrom(), to a session object. Keys and sessions are stored inline
+ *        in one slot array and each slot has a one byte control tag holding seven bits
+ *        of the hash, so a probe compares sixteen tags with a single SSE2 instruction
+ *        before touching any key.
+ *
+ *        When the table fills it allocates one twice the size and moves a few slots
+ *        on every insert instead of rehashing all at once, so no single packet pays
+ *        for a full rehash. Sessions carry the time they were last seen and Expire()
+ *        removes idle ones a bounded number of slots at a time.
+ *
+ *        Session must be default constructible. Pointers returned by the table are
+ *        valid until the next Insert(), Erase() or Expire().
+ */
+template<typename Session>
+class PeerTable
+{
+public:
+    /***
+     * Class constructor.
+     *
+     * @param[IN] capacity - Expected number of peers.
+     */
+                        PeerTable(size_t capacity = 64)
+    {
+        size_t groups = 1;
+
+        while (groups * GROUP_SIZE * 7 / 8 < capacity) {
+            groups <<= 1;
+        }
+        Allocate(m_table, groups);
+        memset(&m_old, 0, sizeof(m_old));
+        m_migrate = 0;
+        m_expire = 0;
+        m_oldExpire = 0;
+    }
+
+                        ~PeerTable()
+    {
+        Release(m_table);
+        Release(m_old);
+    }
+
+    /***
+     * Find the session for a peer.
+     *
+     * @return Pointer to the session or NULL if the peer is unknown.
+     */
+    Session            *Find(const InetAddress &peer)
+    {
+        Slot *pSlot = FindSlot(peer, peer.Hash());
+        return (pSlot != NULL) ? &pSlot->session : (Session *)NULL;
+    }
+
+    /***
+     * Find the session for a peer and record that it was seen at time now.
+     */
+    Session            *Find(const InetAddress &peer, uint32_t now)
+    {
+        Slot *pSlot = FindSlot(peer, peer.Hash());
+
+        if (pSlot == NULL) {
+            return (Session *)NULL;
+        }
+        pSlot->lastSeen = now;
+        return &pSlot->session;
+    }
+
+    /***
+     * Find the sessions for a whole receive batch. Hashes for all peers are computed
+     * and their control groups prefetched before any is probed.
+     *
+     * @param[IN]  peers    - Source addresses of the batch.
+     * @param[IN]  count    - Number of addresses.
+     * @param[OUT] sessions - One session pointer or NULL per address.
+     * @param[IN]  now      - Time recorded as last seen for found sessions.
+     */
+    void                FindBatch(const InetAddress *peers, size_t count, Session **sessions,
+                                  uint32_t now)
+    {
+        const size_t batch = 16;
+        size_t       hashes[batch];
+
+        for (size_t base = 0; base < count; base += batch) {
+            size_t n = (count - base < batch) ? count - base : batch;
+
+            for (size_t i = 0; i < n; i++) {
+                hashes[i] = peers[base + i].Hash();
+                size_t group = (hashes[i] >> 7) & (m_table.capacity / GROUP_SIZE - 1);
+                __builtin_prefetch(&m_table.ctrl[group * GROUP_SIZE]);
+                __builtin_prefetch(&m_table.slots[group * GROUP_SIZE]);
+            }
+
+            for (size_t i = 0; i < n; i++) {
+                Slot *pSlot = FindSlot(peers[base + i], hashes[i]);
+                if (pSlot != NULL) {
+                    pSlot->lastSeen = now;
+                    sessions[base + i] = &pSlot->session;
+                } else {
+                    sessions[base + i] = (Session *)NULL;
+                }
+            }
+        }
+    }
+
+    /***
+     * Find the session for a peer, creating a default constructed one if there is none.
+     *
+     * @param[IN]  peer     - Peer address.
+     * @param[IN]  now      - Time recorded as last seen.
+     * @param[OUT] inserted - Set to true if the session was created by this call.
+     */
+    Session            *Insert(const InetAddress &peer, uint32_t now, bool &inserted)
+    {
+        size_t hash = peer.Hash();
+        Slot  *pSlot;
+
+        Migrate();
+
+        if ((pSlot = Probe(m_table, peer, hash)) != NULL) {
+            inserted = false;
+        } else if (m_old.capacity != 0 && (pSlot = Probe(m_old, peer, hash)) != NULL) {
+            // Move the peer ahead of the migration cursor.
+            Slot *pNew = Place(m_table, peer, hash);
+            new (&pNew->session) Session(std::move(pSlot->session));
+            Remove(m_old, pSlot);
+            pSlot = pNew;
+            inserted = false;
+        } else {
+            if ((m_table.used + m_table.deleted + 1) * 8 > m_table.capacity * 7) {
+                Grow();
+            }
+            pSlot = Place(m_table, peer, hash);
+            new (&pSlot->session) Session();
+            inserted = true;
+        }
+
+        pSlot->lastSeen = now;
+        return &pSlot->session;
+    }
+
+    /***
+     * Remove a peer.
+     *
+     * @return true if the peer was in the table.
+     */
+    bool                Erase(const InetAddress &peer)
+    {
+        size_t hash = peer.Hash();
+        Slot  *pSlot;
+
+        if ((pSlot = Probe(m_table, peer, hash)) != NULL) {
+            Remove(m_table, pSlot);
+            return true;
+        }
+        if (m_old.capacity != 0 && (pSlot = Probe(m_old, peer, hash)) != NULL) {
+            Remove(m_old, pSlot);
+            return true;
+        }
+        return false;
+    }
+
+    /***
+     * Remove sessions not seen for idle time units. Each call examines at most budget
+     * slots, continuing where the previous call stopped, so it can run from the
+     * receive loop without stalling it.
+     *
+     * @param[IN] now      - Current time in the units passed to Insert() and Find().
+     * @param[IN] idle     - Sessions last seen more than this long ago are removed.
+     * @param[IN] budget   - Maximum number of slots to examine.
+     * @param[IN] onExpire - Called with the address and session before removal.
+     *
+     * @return Number of sessions removed.
+     */
+    template<typename Callback>
+    size_t              Expire(uint32_t now, uint32_t idle, size_t budget, Callback onExpire)
+    {
+        size_t removed = 0;
+
+        Migrate();
+
+        // Slots still waiting in the old table are examined first; otherwise
+        // they would only age out once the resize had finished.
+        if (m_old.capacity != 0) {
+            if (m_oldExpire < m_migrate) {
+                m_oldExpire = m_migrate;
+            }
+            for (; budget != 0 && m_oldExpire < m_old.capacity; budget--) {
+                if (m_old.ctrl[m_oldExpire] >= 0) {
+                    Slot *pSlot = &m_old.slots[m_oldExpire];
+                    if ((uint32_t)(now - pSlot->lastSeen) > idle) {
+                        onExpire(pSlot->peer, pSlot->session);
+                        Remove(m_old, pSlot);
+                        removed++;
+                    }
+                }
+                m_oldExpire++;
+            }
+        }
+
+        for (; budget != 0; budget--) {
+            if (m_expire >= m_table.capacity) {
+                m_expire = 0;
+            }
+
+            if (m_table.ctrl[m_expire] >= 0) {
+                Slot *pSlot = &m_table.slots[m_expire];
+                if ((uint32_t)(now - pSlot->lastSeen) > idle) {
+                    onExpire(pSlot->peer, pSlot->session);
+                    Remove(m_table, pSlot);
+                    removed++;
+                }
+            }
+            m_expire++;
+        }
+        return removed;
+    }
+
+    /***
+     * Number of sessions in the table.
+     */
+    size_t              Size() const { return m_table.used + m_old.used; }
+
+    /***
+     * True while slots are still being moved out of the table being replaced.
+     */
+    bool                Resizing() const { return m_old.capacity != 0; }
+
+private:
+    static const size_t GROUP_SIZE = 16;
+    static const int8_t EMPTY = -128;
+    static const int8_t DELETED = -2;
+    static const size_t MIGRATE_STEP = 32;
+
+                        PeerTable(const PeerTable &);
+    PeerTable          &operator=(const PeerTable &);
+
+    struct Slot
+    {
+        InetAddress     peer;
+        uint32_t        lastSeen;
+        Session         session;
+    };
+
+    struct Table
+    {
+        int8_t         *ctrl;
+        Slot           *slots;
+        size_t          capacity;
+        size_t          used;
+        size_t          deleted;
+    };
+
+    static void         Allocate(Table &table, size_t groups)
+    {
+        table.capacity = groups * GROUP_SIZE;
+        table.used = 0;
+        table.deleted = 0;
+        table.ctrl = new int8_t[table.capacity];
+        table.slots = (Slot *)::operator new(table.capacity * sizeof(Slot));
+        memset(table.ctrl, EMPTY, table.capacity);
+    }
+
+    static void         Release(Table &table)
+    {
+        if (table.capacity == 0) {
+            return;
+        }
+        // A table emptied by a resize has nothing to destroy, and scanning
+        // its control bytes would stall the insert that finished the resize.
+        for (size_t i = 0; table.used != 0 && i < table.capacity; i++) {
+            if (table.ctrl[i] >= 0) {
+                table.slots[i].session.~Session();
+            }
+        }
+        delete[] table.ctrl;
+        ::operator delete(table.slots);
+        table.capacity = 0;
+        table.used = 0;
+    }
+
+    /*
+     * Bit mask of the positions in a group whose control byte equals tag.
+     */
+    static uint32_t     MatchGroup(const int8_t *pCtrl, int8_t tag)
+    {
+#ifdef __SSE2__
+        __m128i group = _mm_loadu_si128((const __m128i *)pCtrl);
+        return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP_SIZE; i++) {
+            mask |= (uint32_t)(pCtrl[i] == tag) << i;
+        }
+        return mask;
+#endif
+    }
+
+    /*
+     * Bit mask of the empty or deleted positions in a group.
+     */
+    static uint32_t     MatchFree(const int8_t *pCtrl)
+    {
+#ifdef __SSE2__
+        return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)pCtrl));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP_SIZE; i++) {
+            mask |= (uint32_t)(pCtrl[i] < 0) << i;
+        }
+        return mask;
+#endif
+    }
+
+    static Slot        *Probe(Table &table, const InetAddress &peer, size_t hash)
+    {
+        size_t groupMask = table.capacity / GROUP_SIZE - 1;
+        size_t group = (hash >> 7) & groupMask;
+        int8_t tag = (int8_t)(hash & 0x7f);
+
+        for (size_t step = 1; ; step++) {
+            const int8_t *pCtrl = &table.ctrl[group * GROUP_SIZE];
+            uint32_t      match = MatchGroup(pCtrl, tag);
+
+            while (match != 0) {
+                size_t i = group * GROUP_SIZE + (size_t)__builtin_ctz(match);
+                if (table.slots[i].peer == peer) {
+                    return &table.slots[i];
+                }
+                match &= match - 1;
+            }
+
+            if (MatchGroup(pCtrl, EMPTY) != 0 || step > groupMask) {
+                return (Slot *)NULL;
+            }
+            group = (group + step) & groupMask;
+        }
+    }
+
+    /*
+     * Claim a slot for a key known not to be in the table. The session is left
+     * for the caller to construct.
+     */
+    static Slot        *Place(Table &table, const InetAddress &peer, size_t hash)
+    {
+        size_t groupMask = table.capacity / GROUP_SIZE - 1;
+        size_t group = (hash >> 7) & groupMask;
+
+        for (size_t step = 1; ; step++) {
+            uint32_t free = MatchFree(&table.ctrl[group * GROUP_SIZE]);
+
+            if (free != 0) {
+                size_t i = group * GROUP_SIZE + (size_t)__builtin_ctz(free);
+                if (table.ctrl[i] == DELETED) {
+                    table.deleted--;
+                }
+                table.ctrl[i] = (int8_t)(hash & 0x7f);
+                table.slots[i].peer = peer;
+                table.used++;
+                return &table.slots[i];
+            }
+            group = (group + step) & groupMask;
+        }
+    }
+
+    static void         Remove(Table &table, Slot *pSlot)
+    {
+        size_t i = (size_t)(pSlot - table.slots);
+        size_t group = i & ~(GROUP_SIZE - 1);
+
+        pSlot->session.~Session();
+        table.used--;
+
+        // A group that still has an empty slot ends every probe passing through it,
+        // so the slot can be reused outright instead of leaving a tombstone.
+        if (MatchGroup(&table.ctrl[group], EMPTY) != 0) {
+            table.ctrl[i] = EMPTY;
+        } else {
+            table.ctrl[i] = DELETED;
+            table.deleted++;
+        }
+    }
+
+    Slot               *FindSlot(const InetAddress &peer, size_t hash)
+    {
+        Slot *pSlot = Probe(m_table, peer, hash);
+
+        if (pSlot == NULL && m_old.capacity != 0) {
+            pSlot = Probe(m_old, peer, hash);
+        }
+        return pSlot;
+    }
+
+    void                Grow()
+    {
+        // A resize still in progress is finished before starting another.
+        while (m_old.capacity != 0) {
+            Migrate();
+        }
+
+        size_t groups = m_table.capacity / GROUP_SIZE;
+        if (m_table.used * 2 >= m_table.capacity) {
+            groups *= 2;
+        }
+
+        m_old = m_table;
+        Allocate(m_table, groups);
+        m_migrate = 0;
+        m_expire = 0;
+        m_oldExpire = 0;
+    }
+
+    /*
+     * Move the next few slots of the old table into the current one.
+     */
+    void                Migrate()
+    {
+        if (m_old.capacity == 0) {
+            return;
+        }
+
+        size_t end = m_migrate + MIGRATE_STEP;
+        if (end > m_old.capacity) {
+            end = m_old.capacity;
+        }
+
+        for (; m_migrate < end; m_migrate++) {
+            if (m_old.ctrl[m_migrate] >= 0) {
+                Slot *pOld = &m_old.slots[m_migrate];
+                Slot *pNew = Place(m_table, pOld->peer, pOld->peer.Hash());
+                pNew->lastSeen = pOld->lastSeen;
+                new (&pNew->session) Session(std::move(pOld->session));
+                Remove(m_old, pOld);
+            }
+        }
+
+        if (m_migrate == m_old.capacity) {
+            Release(m_old);
+        }
+    }
+
+    Table               m_table;
+    Table               m_old;
+    size_t              m_migrate;
+    size_t              m_expire;
+    size_t              m_oldExpire;    // Expire() position in m_old during a resize
+};
+
+#endif
@@ -0,0 +1,394 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Longest prefix match tables for IPv4 and IPv6 address prefixes
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "prefixtable.hpp"
+#include "addrtext.hpp"
+
+static const uint8_t s_v4Mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+uint32_t
+PrefixTable::Lookup(const InetAddress &addr) const
+{
+    const uint8_t *pBytes = addr.GetBytes();
+
+    if (!addr.IsIpv6()) {
+        return Lookup(addr.GetIpv4());
+    }
+
+    if (memcmp(pBytes, s_v4Mapped, sizeof(s_v4Mapped)) == 0) {
+        return Lookup(((uint32_t)pBytes[12] << 24) | ((uint32_t)pBytes[13] << 16) |
+                      ((uint32_t)pBytes[14] << 8) | (uint32_t)pBytes[15]);
+    }
+
+    return LookupIpv6(pBytes);
+}
+
+uint32_t
+PrefixTable::LookupIpv6(const uint8_t *pBytes) const
+{
+    if (m_root6.empty()) {
+        return PREFIX_NO_MATCH;
+    }
+
+    uint32_t entry = m_root6[((uint32_t)pBytes[0] << 8) | pBytes[1]];
+
+    for (int i = 2; (entry & EXTENDED) && i < 16; i++) {
+        entry = Step(m_nodes[entry & ~EXTENDED], pBytes[i]);
+    }
+    return entry;
+}
+
+void
+PrefixTable::Lookup(const InetAddress *addrs, size_t count, uint32_t *values) const
+{
+    const size_t batch = 16;
+
+    for (size_t base = 0; base < count; base += batch) {
+        size_t n = std::min(batch, count - base);
+        size_t pending[batch];
+        size_t waiting = 0;
+
+        for (size_t i = 0; i < n; i++) {
+            const InetAddress &addr = addrs[base + i];
+            const uint8_t     *pBytes = addr.GetBytes();
+
+            if (!addr.IsIpv6()) {
+                if (!m_tbl24.empty()) {
+                    __builtin_prefetch(&m_tbl24[addr.GetIpv4() >> 8]);
+                }
+            } else if (!m_root6.empty()) {
+                __builtin_prefetch(&m_root6[((uint32_t)pBytes[0] << 8) | pBytes[1]]);
+            }
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            const InetAddress &addr = addrs[base + i];
+            const uint8_t     *pBytes = addr.GetBytes();
+
+            if (!addr.IsIpv6() || m_root6.empty() ||
+                memcmp(pBytes, s_v4Mapped, sizeof(s_v4Mapped)) == 0) {
+                values[base + i] = Lookup(addr);
+                continue;
+            }
+
+            uint32_t entry = m_root6[((uint32_t)pBytes[0] << 8) | pBytes[1]];
+
+            values[base + i] = entry;
+            if (entry & EXTENDED) {
+                __builtin_prefetch(&m_nodes[entry & ~EXTENDED]);
+                pending[waiting++] = base + i;
+            }
+        }
+
+        for (int depth = 2; waiting != 0 && depth < 16; depth++) {
+            size_t still = 0;
+
+            for (size_t k = 0; k < waiting; k++) {
+                size_t   i = pending[k];
+                uint32_t entry = Step(m_nodes[values[i] & ~EXTENDED], addrs[i].GetBytes()[depth]);
+
+                values[i] = entry;
+                if (entry & EXTENDED) {
+                    __builtin_prefetch(&m_nodes[entry & ~EXTENDED]);
+                    pending[still++] = i;
+                }
+            }
+            waiting = still;
+        }
+    }
+}
+
+size_t
+PrefixTable::MemoryUsage() const
+{
+    return (m_tbl24.capacity() + m_root6.capacity() + m_leaves.capacity()) * sizeof(uint32_t) +
+           m_nodes.capacity() * sizeof(Node);
+}
+
+void
+PrefixTableBuilder::Add(const InetAddress &prefix, int length, uint32_t value)
+{
+    Entry entry;
+    int   maxLength = prefix.IsIpv6() ? 128 : 32;
+
+    if (length < 0) {
+        length = 0;
+    } else if (length > maxLength) {
+        length = maxLength;
+    }
+
+    entry.prefix = prefix;
+    entry.prefix.SetPortNumber(0);
+    entry.prefix.SetScopeId(0);
+    entry.length = (uint32_t)length;
+    entry.value = value & ~0x80000000U;
+    m_entries.push_back(entry);
+}
+
+void
+PrefixTableBuilder::Add(SocketAddress &prefix, int length, uint32_t value)
+{
+    Add(InetAddress::FromSockAddr((sockaddr *)prefix), length, value);
+}
+
+bool
+PrefixTableBuilder::Add(const char *cidr, uint32_t value)
+{
+    InetAddress prefix;
+    const char *pSlash = strchr(cidr, '/');
+    size_t      len = (pSlash != NULL) ? (size_t)(pSlash - cidr) : strlen(cidr);
+    int         length;
+
+    if (!ParseAddress(cidr, len, prefix)) {
+        return false;
+    }
+
+    if (pSlash != NULL) {
+        char *pEnd;
+        long  bits = strtol(pSlash + 1, &pEnd, 10);
+        if (pEnd == pSlash + 1 || *pEnd != '\0' || bits < 0 ||
+            bits > (prefix.IsIpv6() ? 128 : 32)) {
+            return false;
+        }
+        length = (int)bits;
+    } else {
+        length = prefix.IsIpv6() ? 128 : 32;
+    }
+
+    Add(prefix, length, value);
+    return true;
+}
+
+/*
+ * Each family is built in two passes. The prefixes no longer than the first
+ * level are filled into it shortest first, so a longer one overwrites the
+ * shorter ones it lies within. The rest are then grouped by the first level
+ * entry they extend, and each group is built into a node seeded with that
+ * entry, which pushes the shorter prefixes down into it.
+ */
+std::shared_ptr<const PrefixTable>
+PrefixTableBuilder::Build() const
+{
+    std::shared_ptr<PrefixTable> table(new PrefixTable());
+    std::vector<Entry> ipv4;
+    std::vector<Entry> ipv6;
+
+    for (size_t i = 0; i < m_entries.size(); i++) {
+        (m_entries[i].prefix.IsIpv6() ? ipv6 : ipv4).push_back(m_entries[i]);
+    }
+    if (!ipv4.empty()) {
+        BuildIpv4(*table, ipv4);
+    }
+    if (!ipv6.empty()) {
+        BuildIpv6(*table, ipv6);
+    }
+
+    table->m_prefixes = m_entries.size();
+    table->m_nodes.shrink_to_fit();
+    table->m_leaves.shrink_to_fit();
+    return table;
+}
+
+void
+PrefixTableBuilder::BuildIpv4(PrefixTable &table, std::vector<Entry> &entries)
+{
+    size_t i = 0;
+
+    for (size_t e = 0; e < entries.size(); e++) {
+        uint32_t length = entries[e].length;
+        uint32_t mask = (length == 0) ? 0 : 0xffffffffU << (32 - length);
+
+        entries[e].prefix = InetAddress::FromIpv4(entries[e].prefix.GetIpv4() & mask);
+    }
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const Entry &a, const Entry &b) { return a.length < b.length; });
+
+    table.m_tbl24.assign(1 << 24, PREFIX_NO_MATCH);
+    for (; i < entries.size() && entries[i].length <= 24; i++) {
+        uint32_t first = entries[i].prefix.GetIpv4() >> 8;
+        uint32_t count = 1U << (24 - entries[i].length);
+        std::fill(table.m_tbl24.begin() + first, table.m_tbl24.begin() + first + count,
+                  entries[i].value);
+    }
+
+    // The sort is stable, so each group stays shortest first.
+    std::stable_sort(entries.begin() + i, entries.end(), [](const Entry &a, const Entry &b) {
+        return (a.prefix.GetIpv4() >> 8) < (b.prefix.GetIpv4() >> 8);
+    });
+
+    while (i < entries.size()) {
+        uint32_t key = entries[i].prefix.GetIpv4() >> 8;
+        uint32_t slots[256];
+        bool     isChild[256] = {};
+        uint32_t index = (uint32_t)table.m_nodes.size();
+
+        std::fill(slots, slots + 256, table.m_tbl24[key]);
+        for (; i < entries.size() && (entries[i].prefix.GetIpv4() >> 8) == key; i++) {
+            uint32_t first = entries[i].prefix.GetIpv4() & 0xff;
+            uint32_t count = 1U << (32 - entries[i].length);
+            std::fill(slots + first, slots + first + count, entries[i].value);
+        }
+
+        table.m_nodes.resize(index + 1);
+        Compress(table, slots, isChild, 0, index);
+        table.m_tbl24[key] = index | PrefixTable::EXTENDED;
+    }
+}
+
+void
+PrefixTableBuilder::BuildIpv6(PrefixTable &table, std::vector<Entry> &entries)
+{
+    size_t i = 0;
+
+    // Clear the host bits.
+    for (size_t e = 0; e < entries.size(); e++) {
+        uint8_t bytes[16];
+
+        memcpy(bytes, entries[e].prefix.GetBytes(), sizeof(bytes));
+        for (uint32_t bit = entries[e].length; bit < 128; bit++) {
+            bytes[bit >> 3] &= (uint8_t)~(0x80 >> (bit & 7));
+        }
+        entries[e].prefix = InetAddress::FromIpv6(bytes);
+    }
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const Entry &a, const Entry &b) { return a.length < b.length; });
+
+    table.m_root6.assign(1 << 16, PREFIX_NO_MATCH);
+    for (; i < entries.size() && entries[i].length <= 16; i++) {
+        const uint8_t *pBytes = entries[i].prefix.GetBytes();
+        uint32_t       first = ((uint32_t)pBytes[0] << 8) | pBytes[1];
+        uint32_t       count = 1U << (16 - entries[i].length);
+        std::fill(table.m_root6.begin() + first, table.m_root6.begin() + first + count,
+                  entries[i].value);
+    }
+
+    // In address order the prefixes under any node are adjacent, and a prefix
+    // comes before the ones it contains, as the shorter of two equal addresses
+    // sorts first.
+    std::stable_sort(entries.begin() + i, entries.end(), [](const Entry &a, const Entry &b) {
+        int order = memcmp(a.prefix.GetBytes(), b.prefix.GetBytes(), 16);
+        return order < 0 || (order == 0 && a.length < b.length);
+    });
+
+    while (i < entries.size()) {
+        const uint8_t *pBytes = entries[i].prefix.GetBytes();
+        uint32_t       key = ((uint32_t)pBytes[0] << 8) | pBytes[1];
+        uint32_t       index = (uint32_t)table.m_nodes.size();
+        size_t         end = i;
+
+        while (end < entries.size() && memcmp(entries[end].prefix.GetBytes(), pBytes, 2) == 0) {
+            end++;
+        }
+        table.m_nodes.resize(index + 1);
+        BuildNode(table, &entries[i], end - i, 2, table.m_root6[key], index);
+        table.m_root6[key] = index | PrefixTable::EXTENDED;
+        i = end;
+    }
+}
+
+/*
+ * Build the node at index from the prefixes under it, which are in address
+ * order, for the given byte of the address. The prefixes ending within this
+ * byte are filled in over the inherited value and the rest are passed to
+ * children, whose slots are reserved together before any child is built.
+ */
+void
+PrefixTableBuilder::BuildNode(PrefixTable &table, const Entry *pEntries, size_t count,
+                              uint32_t byte, uint32_t inherit, uint32_t index)
+{
+    uint32_t slots[256];
+    bool     isChild[256] = {};
+    uint32_t depth = 8 * (byte + 1);
+    uint32_t children = 0;
+
+    std::fill(slots, slots + 256, inherit);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t length = pEntries[i].length;
+        uint32_t value = pEntries[i].prefix.GetBytes()[byte];
+
+        // Those ending in an earlier byte were filled in by an ancestor.
+        if (length <= depth - 8) {
+            continue;
+        }
+        if (length <= depth) {
+            std::fill(slots + value, slots + value + (1U << (depth - length)), pEntries[i].value);
+        } else if (!isChild[value]) {
+            isChild[value] = true;
+            children++;
+        }
+    }
+
+    uint32_t childBase = (uint32_t)table.m_nodes.size();
+    uint32_t child = childBase;
+
+    table.m_nodes.resize(childBase + children);
+    Compress(table, slots, isChild, childBase, index);
+
+    for (size_t i = 0; i < count; ) {
+        uint32_t value = pEntries[i].prefix.GetBytes()[byte];
+        size_t   end = i;
+
+        while (end < count && pEntries[end].prefix.GetBytes()[byte] == value) {
+            end++;
+        }
+        if (isChild[value]) {
+            BuildNode(table, pEntries + i, end - i, byte + 1, slots[value], child++);
+        }
+        i = end;
+    }
+}
+
+/*
+ * Store the 256 slots of a node as bitmaps, the child slots pointing into the
+ * children from childBase and each run of equal values among the rest kept once.
+ */
+void
+PrefixTableBuilder::Compress(PrefixTable &table, const uint32_t *pSlots, const bool *pIsChild,
+                             uint32_t childBase, uint32_t index)
+{
+    PrefixTable::Node node;
+    uint32_t          children = 0;
+    uint32_t          leaves = 0;
+    uint32_t          last = 0;
+
+    memset(&node, 0, sizeof(node));
+    node.childBase = childBase;
+    node.leafBase = (uint32_t)table.m_leaves.size();
+
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t word = b >> 6;
+        uint64_t bit = 1ULL << (b & 63);
+
+        if ((b & 63) == 0) {
+            node.childrenBefore[word] = (uint8_t)children;
+            node.leavesBefore[word] = (uint8_t)leaves;
+        }
+        if (pIsChild[b]) {
+            node.children[word] |= bit;
+            children++;
+        } else if (leaves == 0 || pSlots[b] != last) {
+            node.leaves[word] |= bit;
+            table.m_leaves.push_back(pSlots[b]);
+            last = pSlots[b];
+            leaves++;
+        }
+    }
+    table.m_nodes[index] = node;
+}
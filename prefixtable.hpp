@@ -0,0 +1,244 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Longest prefix match tables for IPv4 and IPv6 address prefixes
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef PREFIXTABLE_HPP
+#define PREFIXTABLE_HPP
+
+#include <stdint.h>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "ipaddr.hpp"
+#include "inetaddr.hpp"
+
+/***
+ * Value returned by a lookup that matched no prefix.
+ */
+#define PREFIX_NO_MATCH     0x7fffffffU
+
+class PrefixTableBuilder;
+
+/***
+ * @class Immutable longest prefix match table. IPv4 uses the DIR-24-8 layout, a
+ *        direct table indexed by the top 24 bits with 256 way extension nodes for
+ *        longer prefixes, so a lookup is one to three dependent loads. IPv6 uses a
+ *        16 bit root table followed by 8 bit stride nodes with prefixes pushed to
+ *        the leaves. The nodes are compressed as in Poptrie, so one costs 80 bytes
+ *        plus 4 per distinct run of values rather than 1 KB. IPv4 mapped IPv6
+ *        addresses, as returned by a dual stack Accept(), are looked up in the IPv4
+ *        table.
+ *
+ *        Tables are built with PrefixTableBuilder and replaced as a whole through
+ *        AtomicPrefixTable, so readers never see a partly updated table.
+ */
+class PrefixTable
+{
+public:
+    /***
+     * Find the value of the longest prefix containing the address.
+     *
+     * @return The value given to PrefixTableBuilder::Add() or PREFIX_NO_MATCH.
+     */
+    uint32_t            Lookup(const InetAddress &addr) const;
+
+    /***
+     * @overload IPv4 address in host order.
+     */
+    uint32_t            Lookup(uint32_t hostAddr) const
+    {
+        if (m_tbl24.empty()) {
+            return PREFIX_NO_MATCH;
+        }
+
+        uint32_t entry = m_tbl24[hostAddr >> 8];
+        if (entry & EXTENDED) {
+            entry = LeafAt(m_nodes[entry & ~EXTENDED], hostAddr & 0xff);
+        }
+        return entry;
+    }
+
+    /***
+     * Look up a batch of addresses such as one recvmmsg() worth of peers. The first
+     * level entries for the whole batch are prefetched before any is resolved, and
+     * the IPv6 addresses then descend the nodes together, prefetching the next node
+     * of each before taking the next step of any, so the cache misses overlap.
+     *
+     * @param[IN]  addrs  - Addresses to look up.
+     * @param[IN]  count  - Number of addresses.
+     * @param[OUT] values - Receives one result per address.
+     */
+    void                Lookup(const InetAddress *addrs, size_t count, uint32_t *values) const;
+
+    /***
+     * Number of prefixes the table was built from.
+     */
+    size_t              Size() const { return m_prefixes; }
+
+    /***
+     * Bytes of memory held by the lookup structures.
+     */
+    size_t              MemoryUsage() const;
+
+private:
+    friend class PrefixTableBuilder;
+
+    static const uint32_t EXTENDED = 0x80000000U;
+
+    /*
+     * A stride 8 node. Bit b of children is set if byte value b continues in a
+     * child node; the children are stored consecutively from childBase. Among
+     * the other byte values, bit b of leaves marks where a run of equal values
+     * begins, and each run's value is stored once from leafBase. The counts of
+     * bits in the words before each word spare counting them on every lookup.
+     */
+    struct Node
+    {
+        uint64_t        children[4];
+        uint64_t        leaves[4];
+        uint32_t        childBase;
+        uint32_t        leafBase;
+        uint8_t         childrenBefore[4];
+        uint8_t         leavesBefore[4];
+    };
+
+                        PrefixTable() : m_prefixes(0) {}
+
+    uint32_t            LookupIpv6(const uint8_t *pBytes) const;
+
+    /*
+     * Without -mpopcnt the builtin is a call into libgcc on every node step.
+     */
+    static uint32_t     Popcount(uint64_t bits)
+    {
+#ifdef __POPCNT__
+        return (uint32_t)__builtin_popcountll(bits);
+#else
+        bits -= (bits >> 1) & 0x5555555555555555ULL;
+        bits = (bits & 0x3333333333333333ULL) + ((bits >> 2) & 0x3333333333333333ULL);
+        bits = (bits + (bits >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+        return (uint32_t)((bits * 0x0101010101010101ULL) >> 56);
+#endif
+    }
+
+    uint32_t            LeafAt(const Node &node, uint32_t byte) const
+    {
+        uint32_t word = byte >> 6;
+        uint64_t upTo = ~0ULL >> (63 - (byte & 63));
+
+        return m_leaves[node.leafBase + node.leavesBefore[word] + Popcount(node.leaves[word] & upTo) - 1];
+    }
+
+    /*
+     * Follow one byte of an IPv6 address through a node.
+     *
+     * @return The child marked EXTENDED, or the value of the leaf.
+     */
+    uint32_t            Step(const Node &node, uint32_t byte) const
+    {
+        uint32_t word = byte >> 6;
+        uint64_t bit = 1ULL << (byte & 63);
+
+        if (node.children[word] & bit) {
+            return EXTENDED | (node.childBase + node.childrenBefore[word] +
+                               Popcount(node.children[word] & (bit - 1)));
+        }
+        return LeafAt(node, byte);
+    }
+
+    std::vector<uint32_t>   m_tbl24;
+    std::vector<uint32_t>   m_root6;
+    std::vector<Node>       m_nodes;
+    std::vector<uint32_t>   m_leaves;
+    size_t                  m_prefixes;
+};
+
+/***
+ * @class Collects prefixes and compiles them into a PrefixTable.
+ */
+class PrefixTableBuilder
+{
+public:
+    /***
+     * Add a prefix. A prefix added twice keeps the last value.
+     *
+     * @param[IN] prefix - Network address, bits past the prefix length are ignored.
+     * @param[IN] length - Prefix length in bits.
+     * @param[IN] value  - Value returned for addresses matching this prefix, less
+     *                     than PREFIX_NO_MATCH.
+     */
+    void                Add(const InetAddress &prefix, int length, uint32_t value);
+
+    /***
+     * @overload
+     */
+    void                Add(SocketAddress &prefix, int length, uint32_t value);
+
+    /***
+     * Add a prefix in "address/length" notation. An address with no length is a
+     * host route.
+     *
+     * @return false if the string is not a valid prefix.
+     */
+    bool                Add(const char *cidr, uint32_t value);
+
+    /***
+     * Compile the collected prefixes. The builder may be reused afterwards.
+     */
+    std::shared_ptr<const PrefixTable> Build() const;
+
+private:
+    struct Entry
+    {
+        InetAddress     prefix;
+        uint32_t        length;
+        uint32_t        value;
+    };
+
+    static void         BuildIpv4(PrefixTable &table, std::vector<Entry> &entries);
+    static void         BuildIpv6(PrefixTable &table, std::vector<Entry> &entries);
+    static void         BuildNode(PrefixTable &table, const Entry *pEntries, size_t count,
+                                  uint32_t byte, uint32_t inherit, uint32_t index);
+    static void         Compress(PrefixTable &table, const uint32_t *pSlots, const bool *pIsChild,
+                                 uint32_t childBase, uint32_t index);
+
+    std::vector<Entry>  m_entries;
+};
+
+/***
+ * @class Holder for the current table that is swapped atomically on reload. Readers
+ *        take a reference with Current() once per batch of lookups; the old table
+ *        is freed when the last reader drops it.
+ */
+class AtomicPrefixTable
+{
+public:
+                        AtomicPrefixTable() : m_table(PrefixTableBuilder().Build()) {}
+
+    std::shared_ptr<const PrefixTable> Current() const
+    {
+        return std::atomic_load(&m_table);
+    }
+
+    void                Replace(std::shared_ptr<const PrefixTable> table)
+    {
+        std::atomic_store(&m_table, table);
+    }
+
+private:
+    std::shared_ptr<const PrefixTable> m_table;
+};
+
+#endif
@@ -0,0 +1,1449 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Reliable, ordered message transport over UDP
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <system_error>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "reliable.hpp"
+
+/*
+ * Wire format. All integers are in network order.
+ *
+ *   SYN, SYNACK, RESET:  type(1) connection id(4)
+ *   DATA:                type(1) connection id(4) packet number(4) frames...
+ *
+ *   STREAM:  type(1) stream(2) message seq(4) message length(4) offset(4) length(2) data
+ *   ACK:     type(1) ack delay us(4) window(4) count(1) { highest(4) lowest(4) } * count
+ *   CLOSE:   type(1)
+ *   PING:    type(1)
+ *
+ * ACK ranges are listed from the highest packet number down.
+ *
+ * Packet numbers are 64 bits and never wrap; only their low 32 bits are sent,
+ * and the receiver restores the rest from the largest number it has seen.
+ */
+enum PacketType
+{
+    PACKET_SYN = 1,
+    PACKET_SYNACK = 2,
+    PACKET_DATA = 3,
+    PACKET_RESET = 4
+};
+
+enum FrameType
+{
+    FRAME_STREAM = 1,
+    FRAME_ACK = 2,
+    FRAME_CLOSE = 3,
+    FRAME_PING = 4
+};
+
+static const size_t   CONTROL_SIZE = 5;
+static const size_t   PACKET_HEADER = 9;
+static const size_t   STREAM_HEADER = 17;
+static const size_t   ACK_HEADER = 10;
+static const size_t   ACK_RANGES_MAX = 16;
+static const size_t   RECEIVED_RANGES_MAX = 64;
+static const uint32_t ACK_EVERY = 2;                // Ack eliciting packets per acknowledgment
+static const uint32_t BACKOFF_MAX = 6;
+static const uint32_t SEQ_AHEAD_MAX = 4096;         // Messages a stream holds ahead of the one it delivers next
+static const uint32_t PARTIAL_COST = 64;            // Receive buffer bytes charged for each partial message
+static const uint32_t RX_BATCHES = 8;               // recvmmsg() calls per poll at most
+
+static const uint64_t INITIAL_RTO_US = 250000;
+static const uint64_t INITIAL_RTT_US = 1000;        // For pacing before the first sample
+static const uint64_t INITIAL_CWND_PACKETS = 10;
+static const uint64_t MIN_RTT_WINDOW_US = 10000000;
+static const uint64_t PACING_BURST_US = 1000;       // Packets due this close together leave in one batch
+static const uint32_t BW_ROUNDS = 10;
+static const uint32_t FULL_BW_ROUNDS = 3;
+static const double   STARTUP_GAIN = 2.885;
+static const double   CYCLE_GAINS[8] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+
+static uint64_t
+NowUs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline void
+Put16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static inline void
+Put32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static inline uint16_t
+Get16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t
+Get32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/*
+ * Restore a packet number from its low 32 bits: of the numbers ending in
+ * those bits, take the one nearest to expected, the successor of the
+ * largest number seen so far. Packets more than 2^31 apart are never in
+ * flight together, so the answer is unambiguous.
+ */
+static inline uint64_t
+DecodePn(uint32_t truncated, uint64_t expected)
+{
+    const uint64_t window = 1ULL << 32;
+    uint64_t       candidate = (expected & ~(window - 1)) | truncated;
+
+    if (candidate + window / 2 <= expected) {
+        candidate += window;
+    } else if (candidate > expected + window / 2 && candidate >= window) {
+        candidate -= window;
+    }
+    return candidate;
+}
+
+/*
+ * Returns whether saved frames include a CLOSE.
+ */
+static bool
+HasClose(const std::vector<uint8_t> &frames)
+{
+    size_t i = 0;
+
+    while (i < frames.size()) {
+        if (frames[i] == FRAME_CLOSE) {
+            return true;
+        }
+        i += frames[i] == FRAME_STREAM ? STREAM_HEADER + Get16(&frames[i + 15]) : 1;
+    }
+    return false;
+}
+
+ReliableConnection::ReliableConnection(ReliableEndpoint &endpoint, const InetAddress &peer,
+                                       uint32_t id, State state, uint64_t now) :
+    m_endpoint(endpoint), m_peer(peer), m_id(id), m_state(state)
+{
+    uint64_t mtu = endpoint.m_options.mtu;
+
+    m_error = 0;
+    m_accepted = false;
+    m_released = false;
+    m_closeWanted = false;
+    m_closeSent = false;
+    m_closeAcked = false;
+    m_peerClosed = false;
+    m_synAckPending = false;
+    m_synSentUs = now;
+    m_synCount = 0;
+    m_lastRecvUs = now;
+
+    m_queuedBytes = 0;
+    m_retransmitBytes = 0;
+    m_sentBase = 0;
+    m_nextPn = 0;
+    m_largestAcked = 0;
+    m_anyAcked = false;
+    m_bytesInFlight = 0;
+    m_lastAckUs = now;
+    m_backoff = 0;
+    m_peerWindow = endpoint.m_options.recvBuffer;
+    m_pingPending = false;
+    m_closePn = 0;
+
+    m_largestRecv = 0;
+    m_largestRecvUs = now;
+    m_unacked = 0;
+    m_ackNow = false;
+    m_ackDeadline = 0;
+    m_lastWindow = endpoint.m_options.recvBuffer;
+    m_bufferedBytes = 0;
+    m_receivedBytes = 0;
+
+    m_srttUs = 0;
+    m_rttVarUs = 0;
+    m_minRttUs = 0;
+    m_minRttStamp = now;
+    m_delivered = 0;
+    m_deliveredUs = now;
+    m_firstSentUs = now;
+    m_round = 0;
+    m_nextRoundDelivered = 0;
+    memset(m_bwRing, 0, sizeof(m_bwRing));
+    m_btlBw = 0;
+    m_fullBw = 0;
+    m_fullBwRounds = 0;
+    m_mode = MODE_STARTUP;
+    m_cycle = 0;
+    m_cycleStamp = now;
+    m_pacingGain = STARTUP_GAIN;
+    m_cwndGain = STARTUP_GAIN;
+    m_cwnd = INITIAL_CWND_PACKETS * mtu;
+    m_pacer.SetRate((uint64_t)(STARTUP_GAIN * m_cwnd * 1000000 / INITIAL_RTT_US), 2 * mtu);
+
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void
+ReliableConnection::Check() const
+{
+    if (m_state == STATE_FAILED)
+    {
+	throw std::system_error(m_error, std::system_category());
+    }
+}
+
+void
+ReliableConnection::Fail(int error)
+{
+    if (m_state != STATE_FAILED) {
+        m_state = STATE_FAILED;
+        m_error = error;
+    }
+}
+
+/*
+ * Returns whether the endpoint may forget the connection once the application
+ * has let go of it.
+ */
+bool
+ReliableConnection::IsDone() const
+{
+    return m_state == STATE_FAILED || (m_closeAcked && m_peerClosed);
+}
+
+int
+ReliableConnection::Send(uint16_t stream, const void *buff, int len, int timeout)
+{
+    uint32_t limit = m_endpoint.m_options.sendBuffer;
+
+    Check();
+    if (m_closeWanted)
+    {
+	throw std::system_error(EPIPE, std::system_category());
+    }
+    if (len < 0 || (uint32_t)len > m_endpoint.m_options.recvBuffer)
+    {
+	throw std::system_error(EMSGSIZE, std::system_category());
+    }
+
+    // A message larger than the whole buffer goes out once the buffer is empty.
+    if (!m_endpoint.WaitFor(timeout, [this, len, limit]() {
+            uint64_t buffered = m_queuedBytes + m_retransmitBytes + m_bytesInFlight;
+            return m_state == STATE_FAILED || buffered == 0 || buffered + len <= limit;
+        })) {
+        return 0;
+    }
+    Check();
+
+    OutStream &out = m_outStreams[stream];
+    OutMessage msg;
+
+    msg.data.assign((const uint8_t *)buff, (const uint8_t *)buff + len);
+    msg.seq = out.nextSeq++;
+    msg.offset = 0;
+    if (out.queue.empty()) {
+        m_active.push_back(stream);
+    }
+    out.queue.push_back(std::move(msg));
+    m_queuedBytes += len;
+
+    m_endpoint.Transmit(NowUs());
+    m_endpoint.Flush();
+    return len;
+}
+
+int
+ReliableConnection::Recv(uint16_t &stream, void *buff, int len, int timeout)
+{
+    uint32_t limit = m_endpoint.m_options.recvBuffer;
+    int      bytes;
+
+    if (!m_endpoint.WaitFor(timeout, [this]() {
+            return !m_ready.empty() || m_peerClosed || m_state == STATE_FAILED;
+        })) {
+        return 0;
+    }
+
+    // Whatever arrived before a failure is still delivered.
+    if (m_ready.empty()) {
+        Check();
+        return 0;
+    }
+
+    InMessage &msg = m_ready.front();
+
+    bytes = std::min(len, (int)msg.data.size());
+    memcpy(buff, msg.data.data(), bytes);
+    stream = msg.stream;
+    m_bufferedBytes -= msg.data.size();
+    m_receivedBytes -= msg.data.size();
+    m_stats.bytesReceived += msg.data.size();
+    m_ready.pop_front();
+
+    // The peer stops when the window it last heard of runs out; tell it as
+    // soon as a good part of the buffer is free again.
+    if (m_lastWindow < limit / 4 && Window() >= limit / 2) {
+        m_ackNow = true;
+        m_endpoint.Transmit(NowUs());
+        m_endpoint.Flush();
+    }
+    return bytes;
+}
+
+bool
+ReliableConnection::Close(int timeout)
+{
+    bool acked;
+
+    m_closeWanted = true;
+    m_endpoint.WaitFor(timeout, [this]() {
+        return m_closeAcked || m_state == STATE_FAILED;
+    });
+
+    acked = m_closeAcked;
+    m_released = true;
+    return acked;
+}
+
+ReliableConnection::Stats
+ReliableConnection::GetStats() const
+{
+    Stats stats = m_stats;
+
+    stats.srttUs = (uint32_t)m_srttUs;
+    stats.minRttUs = (uint32_t)m_minRttUs;
+    stats.cwnd = m_cwnd;
+    stats.pacingRate = m_pacer.GetRate();
+    stats.bytesInFlight = m_bytesInFlight;
+    return stats;
+}
+
+uint32_t
+ReliableConnection::Window() const
+{
+    uint32_t limit = m_endpoint.m_options.recvBuffer;
+
+    return m_receivedBytes < limit ? (uint32_t)(limit - m_receivedBytes) : 0;
+}
+
+/*
+ * Process a DATA packet already matched to this connection.
+ */
+void
+ReliableConnection::OnPacket(const uint8_t *pData, size_t len, uint64_t now)
+{
+    const uint8_t *p = pData + PACKET_HEADER;
+    const uint8_t *pEnd = pData + len;
+    uint64_t       pn = DecodePn(Get32(pData + 5), m_received.empty() ? 0 : m_largestRecv + 1);
+    bool           eliciting = false;
+
+    m_lastRecvUs = now;
+    m_stats.packetsReceived++;
+    if (m_state == STATE_SYN_SENT) {
+        m_state = STATE_ESTABLISHED;
+    }
+
+    // A malformed frame ends the packet; what came before it stands.
+    while (p < pEnd) {
+        size_t room = pEnd - p;
+        size_t size;
+
+        switch (*p) {
+        case FRAME_STREAM:
+            if (room < STREAM_HEADER || room < (size = STREAM_HEADER + Get16(p + 15))) {
+                return;
+            }
+            // A refused frame ends the packet unacknowledged.
+            if (!OnStream(p, Get16(p + 15))) {
+                return;
+            }
+            eliciting = true;
+            break;
+        case FRAME_ACK:
+            if (room < ACK_HEADER || room < (size = ACK_HEADER + 8 * (size_t)p[9])) {
+                return;
+            }
+            OnAck(p, now);
+            break;
+        case FRAME_CLOSE:
+            // Acknowledged at once; this side may be gone after a round trip.
+            m_peerClosed = true;
+            m_ackNow = true;
+            eliciting = true;
+            size = 1;
+            break;
+        case FRAME_PING:
+            eliciting = true;
+            size = 1;
+            break;
+        default:
+            return;
+        }
+        p += size;
+    }
+
+    if (RecordReceived(pn, now)) {
+        m_ackNow = true;
+    }
+    if (eliciting) {
+        if (++m_unacked >= ACK_EVERY) {
+            m_ackNow = true;
+        } else if (m_ackDeadline == 0) {
+            m_ackDeadline = now + (uint64_t)m_endpoint.m_options.maxAckDelayMs * 1000;
+        }
+    }
+}
+
+/*
+ * Add a packet number to the received ranges.
+ *
+ * @return true if it was out of order or a duplicate, which is acknowledged at
+ *         once so the sender learns of the gap.
+ */
+bool
+ReliableConnection::RecordReceived(uint64_t pn, uint64_t now)
+{
+    size_t i = m_received.size();
+    bool   inOrder = m_received.empty() || pn == m_largestRecv + 1;
+
+    if (m_received.empty() || pn > m_largestRecv) {
+        m_largestRecv = pn;
+        m_largestRecvUs = now;
+    }
+
+    // Nearly every packet extends the last range.
+    while (i > 0 && m_received[i - 1].first > pn) {
+        i--;
+    }
+    if (i > 0 && m_received[i - 1].second >= pn) {
+        return true;
+    }
+
+    if (i > 0 && m_received[i - 1].second + 1 == pn) {
+        m_received[i - 1].second = pn;
+        if (i < m_received.size() && m_received[i].first == pn + 1) {
+            m_received[i - 1].second = m_received[i].second;
+            m_received.erase(m_received.begin() + i);
+        }
+    } else if (i < m_received.size() && m_received[i].first == pn + 1) {
+        m_received[i].first = pn;
+    } else {
+        m_received.insert(m_received.begin() + i, std::make_pair(pn, pn));
+    }
+
+    if (m_received.size() > RECEIVED_RANGES_MAX) {
+        m_received.erase(m_received.begin());
+    }
+    return !inOrder;
+}
+
+/*
+ * @return false if the frame was refused because its message would not fit in
+ *         the receive buffer or is too far ahead of its stream. The packet is
+ *         then left unacknowledged and the peer sends the frame again.
+ */
+bool
+ReliableConnection::OnStream(const uint8_t *pFrame, uint16_t len)
+{
+    uint16_t       stream = Get16(pFrame + 1);
+    uint32_t       seq = Get32(pFrame + 3);
+    uint32_t       msgLen = Get32(pFrame + 7);
+    uint32_t       offset = Get32(pFrame + 11);
+    const uint8_t *pData = pFrame + STREAM_HEADER;
+    uint64_t       limit = m_endpoint.m_options.recvBuffer;
+
+    if ((uint64_t)offset + len > msgLen || msgLen > limit) {
+        return true;
+    }
+
+    InStream &in = m_inStreams[stream];
+    uint32_t  ahead = seq - in.nextSeq;
+
+    // Sequence numbers wrap; the half behind nextSeq has been delivered.
+    if (ahead >= 0x80000000u) {
+        return true;
+    }
+    if (ahead > SEQ_AHEAD_MAX) {
+        return false;
+    }
+
+    auto it = in.partial.find(seq);
+
+    if (it == in.partial.end()) {
+        uint64_t cost = (uint64_t)msgLen + PARTIAL_COST;
+
+        // The message a stream delivers next may take the buffer past its
+        // limit, up to twice, so the messages held behind it cannot stall it.
+        if (m_bufferedBytes + cost > (ahead == 0 ? 2 * limit : limit)) {
+            return false;
+        }
+        it = in.partial.emplace(seq, Partial()).first;
+        it->second.data.resize(msgLen);
+        it->second.received = 0;
+        m_bufferedBytes += cost;
+    } else if (it->second.data.size() != msgLen) {
+        return true;
+    }
+
+    Partial &part = it->second;
+
+    if (!part.offsets.insert(offset).second) {
+        return true;
+    }
+    memcpy(part.data.data() + offset, pData, len);
+    part.received += len;
+    m_receivedBytes += len;
+
+    // Deliver every complete message the stream is now up to.
+    for (it = in.partial.find(in.nextSeq);
+         it != in.partial.end() && it->second.received == it->second.data.size();
+         it = in.partial.find(in.nextSeq)) {
+        InMessage msg;
+
+        msg.stream = stream;
+        msg.data = std::move(it->second.data);
+        m_ready.push_back(std::move(msg));
+        in.partial.erase(it);
+        in.nextSeq++;
+        m_bufferedBytes -= PARTIAL_COST;
+    }
+    return true;
+}
+
+void
+ReliableConnection::OnAck(const uint8_t *pFrame, uint64_t now)
+{
+    uint32_t    delayUs = Get32(pFrame + 1);
+    uint32_t    count = pFrame[9];
+    uint64_t    largest;
+    SentPacket *pNewest = NULL;
+    uint64_t    newestPn = 0;
+    bool        any = false;
+
+    if (count == 0 || m_nextPn == 0) {
+        return;
+    }
+    m_peerWindow = Get32(pFrame + 5);
+    largest = DecodePn(Get32(pFrame + ACK_HEADER), m_nextPn - 1);
+
+    for (uint32_t r = 0; r < count; r++) {
+        uint64_t hi = DecodePn(Get32(pFrame + ACK_HEADER + 8 * r), m_nextPn - 1);
+        uint64_t lo = DecodePn(Get32(pFrame + ACK_HEADER + 8 * r + 4), m_nextPn - 1);
+
+        hi = std::min(hi, m_nextPn - 1);
+        lo = std::max(lo, m_sentBase);
+        for (uint64_t pn = lo; pn <= hi; pn++) {
+            SentPacket &packet = m_sent[pn - m_sentBase];
+
+            if (packet.done) {
+                continue;
+            }
+            packet.done = true;
+            any = true;
+
+            if (m_closeSent && pn == m_closePn) {
+                m_closeAcked = true;
+            }
+            if (packet.inFlight) {
+                m_bytesInFlight -= packet.bytes;
+                m_delivered += packet.bytes;
+                m_deliveredUs = now;
+                if (pNewest == NULL || pn > newestPn) {
+                    pNewest = &packet;
+                    newestPn = pn;
+                }
+            }
+        }
+    }
+
+    if (any) {
+        m_lastAckUs = now;
+        m_backoff = 0;
+    }
+    if (pNewest != NULL) {
+        if (newestPn == largest) {
+            UpdateRtt(now - pNewest->sentUs, delayUs, now);
+        }
+        UpdateModel(*pNewest, now);
+    }
+    if (!m_anyAcked || largest > m_largestAcked) {
+        m_largestAcked = std::min(largest, m_nextPn - 1);
+        m_anyAcked = true;
+    }
+
+    DetectLosses(now);
+    while (!m_sent.empty() && m_sent.front().done) {
+        m_sent.pop_front();
+        m_sentBase++;
+    }
+}
+
+void
+ReliableConnection::UpdateRtt(uint64_t rttUs, uint64_t ackDelayUs, uint64_t now)
+{
+    if (rttUs == 0) {
+        rttUs = 1;
+    }
+    if (m_minRttUs == 0 || rttUs <= m_minRttUs || now - m_minRttStamp > MIN_RTT_WINDOW_US) {
+        m_minRttUs = rttUs;
+        m_minRttStamp = now;
+    }
+
+    // The peer's ack delay is only trusted as far as the minimum RTT allows.
+    if (rttUs > m_minRttUs + ackDelayUs) {
+        rttUs -= ackDelayUs;
+    }
+
+    if (m_srttUs == 0) {
+        m_srttUs = rttUs;
+        m_rttVarUs = rttUs / 2;
+    } else {
+        uint64_t diff = m_srttUs > rttUs ? m_srttUs - rttUs : rttUs - m_srttUs;
+
+        m_rttVarUs = (3 * m_rttVarUs + diff) / 4;
+        m_srttUs = (7 * m_srttUs + rttUs) / 8;
+    }
+}
+
+/*
+ * Update the path model from the delivery rate sample of the newest packet
+ * an ack covered, then derive the pacing rate and congestion window.
+ */
+void
+ReliableConnection::UpdateModel(const SentPacket &newest, uint64_t now)
+{
+    uint64_t mtu = m_endpoint.m_options.mtu;
+    uint64_t sendElapsed = newest.sentUs - newest.firstSentUs;
+    uint64_t ackElapsed = now - newest.deliveredUs;
+    uint64_t interval = std::max(sendElapsed, ackElapsed);
+    uint64_t rate = 0;
+    bool     roundStart = false;
+
+    m_firstSentUs = newest.sentUs;
+
+    if (newest.delivered >= m_nextRoundDelivered) {
+        m_round++;
+        m_nextRoundDelivered = m_delivered;
+        m_bwRing[m_round % BW_ROUNDS] = 0;
+        roundStart = true;
+    }
+
+    // Intervals shorter than the minimum RTT come from acks bunched together.
+    if (interval != 0 && interval >= m_minRttUs) {
+        rate = (m_delivered - newest.delivered) * 1000000 / interval;
+    }
+    if (rate != 0 && (!newest.appLimited || rate >= m_btlBw)) {
+        uint64_t &slot = m_bwRing[m_round % BW_ROUNDS];
+
+        slot = std::max(slot, rate);
+        m_btlBw = *std::max_element(m_bwRing, m_bwRing + BW_ROUNDS);
+    }
+
+    if (roundStart && m_mode == MODE_STARTUP && !newest.appLimited) {
+        if (m_btlBw >= m_fullBw * 5 / 4) {
+            m_fullBw = m_btlBw;
+            m_fullBwRounds = 0;
+        } else if (++m_fullBwRounds >= FULL_BW_ROUNDS) {
+            m_mode = MODE_DRAIN;
+            m_pacingGain = 1 / STARTUP_GAIN;
+        }
+    }
+
+    uint64_t bdp = m_btlBw * m_minRttUs / 1000000;
+
+    if (m_mode == MODE_DRAIN && m_bytesInFlight <= bdp) {
+        m_mode = MODE_PROBE_BW;
+        m_cwndGain = 2;
+        m_cycle = (uint32_t)(m_endpoint.Random() % 7);
+        m_cycle += m_cycle != 0;        // Never start by draining
+        m_cycleStamp = now;
+        m_pacingGain = CYCLE_GAINS[m_cycle];
+    } else if (m_mode == MODE_PROBE_BW && now - m_cycleStamp > m_minRttUs) {
+        m_cycle = (m_cycle + 1) % 8;
+        m_cycleStamp = now;
+        m_pacingGain = CYCLE_GAINS[m_cycle];
+    }
+
+    if (m_btlBw != 0) {
+        uint64_t pacingRate = (uint64_t)(m_pacingGain * m_btlBw);
+
+        // Receive batching bunches acks, so keep room for a couple of batches
+        // even when the product of rate and RTT is tiny, as on loopback.
+        m_cwnd = std::max((uint64_t)(m_cwndGain * bdp), 2 * ReliableEndpoint::BATCH_MAX * mtu);
+        m_pacer.SetRate(pacingRate, (uint32_t)std::max(2 * mtu, pacingRate * PACING_BURST_US / 1000000));
+    }
+}
+
+void
+ReliableConnection::DetectLosses(uint64_t now)
+{
+    uint64_t lossDelay = std::max(m_srttUs * 9 / 8, (uint64_t)1000);
+
+    if (!m_anyAcked) {
+        return;
+    }
+
+    for (size_t i = 0; i < m_sent.size(); i++) {
+        uint64_t    pn = m_sentBase + i;
+        SentPacket &packet = m_sent[i];
+
+        if (pn >= m_largestAcked) {
+            break;
+        }
+        if (!packet.done && (m_largestAcked - pn >= 3 || now - packet.sentUs >= lossDelay)) {
+            OnPacketLost(packet);
+        }
+    }
+}
+
+void
+ReliableConnection::OnPacketLost(SentPacket &packet)
+{
+    packet.done = true;
+    if (packet.inFlight) {
+        m_bytesInFlight -= packet.bytes;
+    }
+    m_stats.packetsLost++;
+
+    if (!packet.frames.empty()) {
+        m_retransmitBytes += packet.frames.size();
+        m_retransmit.push_back(std::move(packet.frames));
+    }
+}
+
+/*
+ * The retransmission timer expired: nothing was acknowledged for a whole RTO.
+ * Everything outstanding is sent again and the timer backs off.
+ */
+void
+ReliableConnection::OnTimeout(uint64_t now)
+{
+    m_stats.timeouts++;
+    for (size_t i = 0; i < m_sent.size(); i++) {
+        if (!m_sent[i].done) {
+            OnPacketLost(m_sent[i]);
+        }
+    }
+    while (!m_sent.empty() && m_sent.front().done) {
+        m_sent.pop_front();
+        m_sentBase++;
+    }
+
+    if (m_backoff < BACKOFF_MAX) {
+        m_backoff++;
+    }
+    m_lastAckUs = now;
+}
+
+uint64_t
+ReliableConnection::RtoUs() const
+{
+    const ReliableOptions &options = m_endpoint.m_options;
+
+    if (m_srttUs == 0) {
+        return INITIAL_RTO_US;
+    }
+    return std::max((uint64_t)options.minRtoMs * 1000,
+                    m_srttUs + 4 * m_rttVarUs + (uint64_t)options.maxAckDelayMs * 1000);
+}
+
+/*
+ * Time the retransmission timer, or the probe of a closed peer window, fires.
+ * Zero if neither is armed.
+ */
+uint64_t
+ReliableConnection::RtoDeadline() const
+{
+    uint64_t rto = RtoUs() << m_backoff;
+
+    if (m_bytesInFlight > 0) {
+        return std::max(m_lastAckUs, m_sent.front().sentUs) + rto;
+    }
+    if (HasData() && m_peerWindow < m_endpoint.m_options.mtu) {
+        return m_lastAckUs + rto;
+    }
+    return 0;
+}
+
+void
+ReliableConnection::OnTimers(uint64_t now)
+{
+    uint64_t idle = (uint64_t)m_endpoint.m_options.idleTimeoutMs * 1000;
+    uint64_t deadline;
+
+    if (m_state == STATE_FAILED) {
+        return;
+    }
+
+    // Give up on a peer that stopped answering while it owed us something.
+    if (now - m_lastRecvUs > idle &&
+        (m_bytesInFlight > 0 || m_state == STATE_SYN_SENT || m_closeWanted || m_pingPending)) {
+        Fail(ETIMEDOUT);
+        return;
+    }
+
+    if (m_state == STATE_SYN_SENT) {
+        if (now >= m_synSentUs + (INITIAL_RTO_US << std::min(m_synCount, BACKOFF_MAX))) {
+            m_endpoint.SendControl(m_peer, PACKET_SYN, m_id);
+            m_synSentUs = now;
+            m_synCount++;
+        }
+        return;
+    }
+
+    if ((deadline = RtoDeadline()) != 0 && now >= deadline) {
+        if (m_bytesInFlight > 0) {
+            OnTimeout(now);
+        } else {
+            m_pingPending = true;
+            m_backoff = std::min(m_backoff + 1, BACKOFF_MAX);
+            m_lastAckUs = now;
+        }
+    }
+}
+
+uint64_t
+ReliableConnection::NextWake(uint64_t now) const
+{
+    uint64_t wake = UINT64_MAX;
+    uint64_t deadline;
+
+    if (m_state == STATE_FAILED) {
+        return wake;
+    }
+    if (m_state == STATE_SYN_SENT) {
+        return m_synSentUs + (INITIAL_RTO_US << std::min(m_synCount, BACKOFF_MAX));
+    }
+
+    if (m_ackNow || m_pingPending || m_synAckPending) {
+        return now;
+    }
+    if (m_ackDeadline != 0) {
+        wake = std::min(wake, m_ackDeadline);
+    }
+    if ((deadline = RtoDeadline()) != 0) {
+        wake = std::min(wake, deadline);
+    }
+    if ((!m_retransmit.empty() || (HasData() && m_bytesInFlight < m_peerWindow)) && m_bytesInFlight < m_cwnd) {
+        wake = std::min(wake, std::max(now, m_pacer.Earliest() / 1000));
+    }
+    if (m_bytesInFlight > 0 || m_closeWanted) {
+        wake = std::min(wake, m_lastRecvUs + (uint64_t)m_endpoint.m_options.idleTimeoutMs * 1000 + 1);
+    }
+    return wake;
+}
+
+bool
+ReliableConnection::HasData() const
+{
+    return m_queuedBytes > 0 || !m_active.empty() || !m_retransmit.empty() ||
+           (m_closeWanted && !m_closeSent && m_bytesInFlight == 0);
+}
+
+/*
+ * Whether congestion control and pacing let a packet go now. Retransmissions
+ * ignore the peer's window: they fill gaps in messages it already holds room
+ * for, and would otherwise deadlock against a buffer full of partial messages.
+ */
+bool
+ReliableConnection::CanSendData(uint64_t now) const
+{
+    return m_state == STATE_ESTABLISHED && m_bytesInFlight < m_cwnd && m_pacer.Earliest() <= now * 1000;
+}
+
+size_t
+ReliableConnection::PutAck(uint8_t *pOut, size_t room, uint64_t now)
+{
+    size_t count = std::min(m_received.size(), ACK_RANGES_MAX);
+
+    if (m_received.empty() || room < ACK_HEADER + 8) {
+        return 0;
+    }
+    count = std::min(count, (room - ACK_HEADER) / 8);
+
+    m_lastWindow = Window();
+    pOut[0] = FRAME_ACK;
+    Put32(pOut + 1, (uint32_t)(now - m_largestRecvUs));
+    Put32(pOut + 5, m_lastWindow);
+    pOut[9] = (uint8_t)count;
+    for (size_t r = 0; r < count; r++) {
+        const std::pair<uint64_t, uint64_t> &range = m_received[m_received.size() - 1 - r];
+
+        Put32(pOut + ACK_HEADER + 8 * r, (uint32_t)range.second);
+        Put32(pOut + ACK_HEADER + 8 * r + 4, (uint32_t)range.first);
+    }
+
+    m_ackNow = false;
+    m_ackDeadline = 0;
+    m_unacked = 0;
+    return ACK_HEADER + 8 * count;
+}
+
+/*
+ * Build the next packet into pOut, which has room for one MTU.
+ *
+ * @return Size of the packet, or 0 if there is nothing that may be sent now.
+ */
+size_t
+ReliableConnection::BuildPacket(uint8_t *pOut, uint64_t now)
+{
+    size_t     mtu = m_endpoint.m_options.mtu;
+    bool       ackDue = m_ackNow || (m_ackDeadline != 0 && now >= m_ackDeadline);
+    bool       data = HasData() && CanSendData(now);
+    bool       eliciting = false;
+    uint64_t   pn = m_nextPn;
+    uint8_t   *p = pOut + PACKET_HEADER;
+    size_t     room = mtu - PACKET_HEADER;
+    SentPacket packet;
+
+    if (m_state != STATE_ESTABLISHED || (!ackDue && !data && !m_pingPending)) {
+        return 0;
+    }
+
+    pOut[0] = PACKET_DATA;
+    Put32(pOut + 1, m_id);
+    Put32(pOut + 5, (uint32_t)pn);
+
+    if (data) {
+        // Lost frames go first so a stream is not held up behind new data.
+        while (!m_retransmit.empty() && m_retransmit.front().size() <= room) {
+            std::vector<uint8_t> &frames = m_retransmit.front();
+
+            memcpy(p, frames.data(), frames.size());
+            p += frames.size();
+            room -= frames.size();
+            m_retransmitBytes -= frames.size();
+            m_stats.bytesRetransmitted += frames.size();
+            if (HasClose(frames)) {
+                m_closePn = pn;
+            }
+            packet.frames.insert(packet.frames.end(), frames.begin(), frames.end());
+            m_retransmit.pop_front();
+            eliciting = true;
+        }
+
+        // Then one fragment from each stream with queued messages in turn.
+        while (!m_active.empty() && room > STREAM_HEADER && m_bytesInFlight < m_peerWindow) {
+            uint16_t    stream = m_active.front();
+            OutStream  &out = m_outStreams[stream];
+            OutMessage &msg = out.queue.front();
+            size_t      chunk = std::min(msg.data.size() - msg.offset, std::min(room - STREAM_HEADER, (size_t)65535));
+
+            p[0] = FRAME_STREAM;
+            Put16(p + 1, stream);
+            Put32(p + 3, msg.seq);
+            Put32(p + 7, (uint32_t)msg.data.size());
+            Put32(p + 11, msg.offset);
+            Put16(p + 15, (uint16_t)chunk);
+            memcpy(p + STREAM_HEADER, msg.data.data() + msg.offset, chunk);
+            packet.frames.insert(packet.frames.end(), p, p + STREAM_HEADER + chunk);
+            p += STREAM_HEADER + chunk;
+            room -= STREAM_HEADER + chunk;
+
+            msg.offset += (uint32_t)chunk;
+            m_queuedBytes -= chunk;
+            m_stats.bytesSent += chunk;
+            eliciting = true;
+
+            m_active.pop_front();
+            if (msg.offset == msg.data.size()) {
+                out.queue.pop_front();
+            }
+            if (!out.queue.empty()) {
+                m_active.push_back(stream);
+            }
+        }
+
+        // CLOSE follows only once everything before it has been acknowledged,
+        // so the peer has all the data when it sees it.
+        if (m_closeWanted && !m_closeSent && !eliciting && m_bytesInFlight == 0 && m_active.empty() &&
+            m_retransmit.empty() && room > 0) {
+            *p++ = FRAME_CLOSE;
+            room--;
+            packet.frames.push_back(FRAME_CLOSE);
+            m_closeSent = true;
+            m_closePn = pn;
+            eliciting = true;
+        }
+    }
+
+    if (m_pingPending && !eliciting && room > 0) {
+        *p++ = FRAME_PING;
+        room--;
+        eliciting = true;
+    }
+    m_pingPending = false;
+
+    if (ackDue || m_unacked > 0) {
+        size_t size = PutAck(p, room, now);
+
+        p += size;
+        room -= size;
+    }
+
+    if (p == pOut + PACKET_HEADER) {
+        return 0;
+    }
+
+    packet.sentUs = now;
+    packet.bytes = (uint32_t)(p - pOut);
+    packet.inFlight = eliciting;
+    packet.done = !eliciting;
+    packet.appLimited = false;
+    if (eliciting) {
+        if (m_bytesInFlight == 0) {
+            m_deliveredUs = now;
+            m_firstSentUs = now;
+        }
+        m_bytesInFlight += packet.bytes;
+        m_pacer.Consume(now * 1000, packet.bytes);
+        packet.appLimited = !HasData() && m_bytesInFlight < m_cwnd;
+    }
+    packet.delivered = m_delivered;
+    packet.deliveredUs = m_deliveredUs;
+    packet.firstSentUs = m_firstSentUs;
+
+    m_sent.push_back(std::move(packet));
+    m_nextPn++;
+    while (!m_sent.empty() && m_sent.front().done) {
+        m_sent.pop_front();
+        m_sentBase++;
+    }
+    m_stats.packetsSent++;
+    return p - pOut;
+}
+
+ReliableEndpoint::ReliableEndpoint(const InetAddress &local, const ReliableOptions &options) :
+    m_options(options), m_sock(local.IsIpv6(), SOCK_DGRAM)
+{
+    int size = 4 << 20;
+
+    m_backlogMax = 0;
+    m_listening = false;
+    m_random = ((uint64_t)options.seed << 1) | 1;
+    m_txCount = 0;
+    m_txData.resize((size_t)BATCH_MAX * options.mtu);
+    m_rxData.resize((size_t)BATCH_MAX * options.mtu);
+
+    // Larger buffers ride out bursts between polls; the kernel may cap them.
+    setsockopt(m_sock.GetDescriptor(), SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(m_sock.GetDescriptor(), SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+    m_sock.Bind(local);
+    m_sock.GetSockName(m_local);
+}
+
+ReliableEndpoint::~ReliableEndpoint()
+{
+    Flush();
+}
+
+void
+ReliableEndpoint::Listen(int backlog)
+{
+    m_listening = true;
+    m_backlogMax = backlog > 0 ? backlog : 1;
+}
+
+ReliableConnection *
+ReliableEndpoint::Accept(int timeout)
+{
+    ReliableConnection *pConn;
+
+    if (!WaitFor(timeout, [this]() { return !m_backlog.empty(); })) {
+        return NULL;
+    }
+
+    pConn = m_backlog.front();
+    m_backlog.pop_front();
+    pConn->m_accepted = true;
+    return pConn;
+}
+
+ReliableConnection *
+ReliableEndpoint::Connect(const InetAddress &peer, int timeout)
+{
+    ReliableConnection **ppExisting = m_peers.Find(peer);
+    uint64_t             now = NowUs();
+    bool                 inserted;
+
+    if (ppExisting != NULL) {
+        if ((*ppExisting)->m_state != ReliableConnection::STATE_FAILED)
+        {
+	    throw std::system_error(EISCONN, std::system_category());
+        }
+        m_peers.Erase(peer);
+    }
+
+    std::random_device  device;
+    ReliableConnection *pConn = new ReliableConnection(*this, peer, device() | 1,
+                                                       ReliableConnection::STATE_SYN_SENT, now);
+
+    m_conns.push_back(std::unique_ptr<ReliableConnection>(pConn));
+    *m_peers.Insert(peer, 0, inserted) = pConn;
+    pConn->m_accepted = true;
+    SendControl(peer, PACKET_SYN, pConn->m_id);
+    pConn->m_synCount = 1;
+
+    WaitFor(timeout, [pConn]() { return pConn->m_state != ReliableConnection::STATE_SYN_SENT; });
+
+    if (pConn->m_state != ReliableConnection::STATE_ESTABLISHED) {
+        int error = pConn->m_state == ReliableConnection::STATE_FAILED ? pConn->m_error : ETIMEDOUT;
+
+        pConn->Fail(error);
+        pConn->m_released = true;
+	throw std::system_error(error, std::system_category());
+    }
+    return pConn;
+}
+
+template<typename Cond>
+bool
+ReliableEndpoint::WaitFor(int timeout, Cond cond)
+{
+    uint64_t start = NowUs();
+    uint64_t limit = timeout < 0 ? UINT64_MAX : (uint64_t)timeout * 1000;
+
+    for (;;) {
+        uint64_t elapsed;
+
+        if (cond()) {
+            return true;
+        }
+        if ((elapsed = NowUs() - start) >= limit) {
+            return false;
+        }
+        PollUs(limit - elapsed);
+    }
+}
+
+void
+ReliableEndpoint::Poll(int timeout)
+{
+    PollUs(timeout < 0 ? UINT64_MAX : (uint64_t)timeout * 1000);
+}
+
+/*
+ * Sleep until the next datagram or timer, at most waitUs, and service
+ * everything that is due. Nothing is serviced before sleeping: callers test
+ * their condition between polls, and it may be what the servicing changes.
+ */
+void
+ReliableEndpoint::PollUs(uint64_t waitUs)
+{
+    uint64_t        now = NowUs();
+    uint64_t        wake;
+    struct pollfd   fds;
+    struct timespec ts;
+
+    wake = m_delayed.empty() ? UINT64_MAX : m_delayed.front().due;
+    for (size_t i = 0; i < m_conns.size(); i++) {
+        wake = std::min(wake, m_conns[i]->NextWake(now));
+    }
+    if (wake > now) {
+        waitUs = std::min(waitUs, wake - now);
+    } else {
+        waitUs = 0;
+    }
+
+    if (waitUs != 0) {
+        fds.fd = m_sock.GetDescriptor();
+        fds.events = POLLIN;
+        fds.revents = 0;
+        if (waitUs != UINT64_MAX) {
+            ts.tv_sec = (time_t)(waitUs / 1000000);
+            ts.tv_nsec = (long)(waitUs % 1000000) * 1000;
+        }
+        ppoll(&fds, 1, waitUs == UINT64_MAX ? NULL : &ts, NULL);
+    }
+
+    Service(NowUs());
+}
+
+void
+ReliableEndpoint::Service(uint64_t now)
+{
+    Receive(now);
+    for (size_t i = 0; i < m_conns.size(); i++) {
+        m_conns[i]->OnTimers(now);
+    }
+    Transmit(now);
+    Flush();
+    Reap();
+}
+
+uint64_t
+ReliableEndpoint::Random()
+{
+    m_random ^= m_random >> 12;
+    m_random ^= m_random << 25;
+    m_random ^= m_random >> 27;
+    return m_random * 0x2545f4914f6cdd1dULL;
+}
+
+void
+ReliableEndpoint::Receive(uint64_t now)
+{
+    struct mmsghdr hdrs[BATCH_MAX];
+    struct iovec   iovs[BATCH_MAX];
+    InetSockAddr   addrs[BATCH_MAX];
+    size_t         mtu = m_options.mtu;
+
+    for (uint32_t batch = 0; batch < RX_BATCHES; batch++) {
+        int count;
+
+        for (int i = 0; i < BATCH_MAX; i++) {
+            iovs[i].iov_base = &m_rxData[i * mtu];
+            iovs[i].iov_len = mtu;
+            memset(&hdrs[i].msg_hdr, 0, sizeof(hdrs[i].msg_hdr));
+            hdrs[i].msg_hdr.msg_name = &addrs[i];
+            hdrs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            hdrs[i].msg_hdr.msg_iov = &iovs[i];
+            hdrs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        if ((count = recvmmsg(m_sock.GetDescriptor(), hdrs, BATCH_MAX, MSG_DONTWAIT, NULL)) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNREFUSED) {
+                break;
+            }
+	    throw std::system_error(errno, std::system_category());
+        }
+
+        for (int i = 0; i < count; i++) {
+            InetAddress    peer = InetAddress::FromSockAddr(&addrs[i].sa);
+            const uint8_t *pData = &m_rxData[i * mtu];
+            size_t         len = hdrs[i].msg_len;
+
+            if (m_options.lossRate > 0 && (Random() >> 11) * (1.0 / 9007199254740992.0) < m_options.lossRate) {
+                continue;
+            }
+            if (m_options.delayUs != 0) {
+                Delayed delayed;
+
+                delayed.due = now + m_options.delayUs;
+                delayed.peer = peer;
+                delayed.data.assign(pData, pData + len);
+                m_delayed.push_back(std::move(delayed));
+                continue;
+            }
+            Deliver(peer, pData, len, now);
+        }
+
+        if (count < BATCH_MAX) {
+            break;
+        }
+    }
+
+    while (!m_delayed.empty() && m_delayed.front().due <= now) {
+        Delayed &delayed = m_delayed.front();
+
+        Deliver(delayed.peer, delayed.data.data(), delayed.data.size(), now);
+        m_delayed.pop_front();
+    }
+}
+
+void
+ReliableEndpoint::Deliver(const InetAddress &peer, const uint8_t *pData, size_t len, uint64_t now)
+{
+    ReliableConnection **ppConn;
+    ReliableConnection  *pConn;
+    uint32_t             id;
+    bool                 inserted;
+
+    if (len < CONTROL_SIZE) {
+        return;
+    }
+    id = Get32(pData + 1);
+    ppConn = m_peers.Find(peer);
+    pConn = ppConn != NULL && (*ppConn)->m_id == id ? *ppConn : NULL;
+
+    switch (pData[0]) {
+    case PACKET_SYN:
+        if (pConn != NULL) {
+            pConn->m_synAckPending = pConn->m_state != ReliableConnection::STATE_FAILED;
+            return;
+        }
+        if (!m_listening || m_backlog.size() >= m_backlogMax) {
+            return;
+        }
+
+        // A new id from a known peer means it started over.
+        if (ppConn != NULL) {
+            (*ppConn)->Fail(ECONNRESET);
+            m_peers.Erase(peer);
+        }
+        pConn = new ReliableConnection(*this, peer, id, ReliableConnection::STATE_ESTABLISHED, now);
+        m_conns.push_back(std::unique_ptr<ReliableConnection>(pConn));
+        *m_peers.Insert(peer, 0, inserted) = pConn;
+        m_backlog.push_back(pConn);
+        pConn->m_synAckPending = true;
+        break;
+
+    case PACKET_SYNACK:
+        if (pConn != NULL && pConn->m_state == ReliableConnection::STATE_SYN_SENT) {
+            pConn->m_state = ReliableConnection::STATE_ESTABLISHED;
+            pConn->m_lastRecvUs = now;
+        }
+        break;
+
+    case PACKET_DATA:
+        if (len < PACKET_HEADER) {
+            return;
+        }
+        if (pConn == NULL) {
+            SendControl(peer, PACKET_RESET, id);
+        } else if (pConn->m_state != ReliableConnection::STATE_FAILED) {
+            pConn->OnPacket(pData, len, now);
+        }
+        break;
+
+    case PACKET_RESET:
+        // A peer that sends RESET after our CLOSE has already finished.
+        if (pConn != NULL && pConn->m_closeSent) {
+            pConn->m_closeAcked = true;
+            pConn->m_peerClosed = true;
+        } else if (pConn != NULL) {
+            pConn->Fail(ECONNRESET);
+        }
+        break;
+    }
+}
+
+void
+ReliableEndpoint::Transmit(uint64_t now)
+{
+    size_t mtu = m_options.mtu;
+
+    for (size_t i = 0; i < m_conns.size(); i++) {
+        ReliableConnection *pConn = m_conns[i].get();
+        size_t              len;
+
+        if (pConn->m_synAckPending) {
+            SendControl(pConn->m_peer, PACKET_SYNACK, pConn->m_id);
+            pConn->m_synAckPending = false;
+        }
+
+        for (;;) {
+            if (m_txCount == BATCH_MAX) {
+                Flush();
+            }
+            if ((len = pConn->BuildPacket(&m_txData[m_txCount * mtu], now)) == 0) {
+                break;
+            }
+            m_txAddrLens[m_txCount] = pConn->m_peer.ToSockAddr(m_txAddrs[m_txCount]);
+            m_txLens[m_txCount] = len;
+            m_txCount++;
+        }
+    }
+}
+
+/*
+ * Send the batched packets. A packet the kernel will not take is treated as
+ * lost on the wire and recovered the same way.
+ */
+void
+ReliableEndpoint::Flush()
+{
+    struct mmsghdr hdrs[BATCH_MAX];
+    struct iovec   iovs[BATCH_MAX];
+    size_t         mtu = m_options.mtu;
+    int            done = 0;
+
+    for (int i = 0; i < m_txCount; i++) {
+        iovs[i].iov_base = &m_txData[i * mtu];
+        iovs[i].iov_len = m_txLens[i];
+        memset(&hdrs[i].msg_hdr, 0, sizeof(hdrs[i].msg_hdr));
+        hdrs[i].msg_hdr.msg_name = &m_txAddrs[i];
+        hdrs[i].msg_hdr.msg_namelen = m_txAddrLens[i];
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (done < m_txCount) {
+        int rc = sendmmsg(m_sock.GetDescriptor(), &hdrs[done], m_txCount - done, 0);
+
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            done++;
+        } else {
+            done += rc;
+        }
+    }
+    m_txCount = 0;
+}
+
+void
+ReliableEndpoint::SendControl(const InetAddress &peer, uint8_t type, uint32_t id)
+{
+    uint8_t      packet[CONTROL_SIZE];
+    InetSockAddr sa;
+    socklen_t    len = peer.ToSockAddr(sa);
+
+    packet[0] = type;
+    Put32(packet + 1, id);
+    sendto(m_sock.GetDescriptor(), packet, sizeof(packet), 0, &sa.sa, len);
+}
+
+/*
+ * Free connections nobody needs any more: closed by the application and
+ * finished, or failed before they were accepted.
+ */
+void
+ReliableEndpoint::Reap()
+{
+    for (size_t i = 0; i < m_conns.size(); ) {
+        ReliableConnection *pConn = m_conns[i].get();
+
+        if (!((pConn->m_released && pConn->IsDone()) ||
+              (!pConn->m_accepted && pConn->m_state == ReliableConnection::STATE_FAILED))) {
+            i++;
+            continue;
+        }
+
+        ReliableConnection **ppConn = m_peers.Find(pConn->m_peer);
+
+        if (ppConn != NULL && *ppConn == pConn) {
+            m_peers.Erase(pConn->m_peer);
+        }
+        m_backlog.erase(std::remove(m_backlog.begin(), m_backlog.end(), pConn), m_backlog.end());
+
+        m_conns[i].swap(m_conns.back());
+        m_conns.pop_back();
+    }
+}
@@ -0,0 +1,417 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Reliable, ordered message transport over UDP
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef RELIABLE_HPP
+#define RELIABLE_HPP
+
+#include <stdint.h>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include <sys/socket.h>
+#include "socket.hpp"
+#include "inetaddr.hpp"
+#include "peertable.hpp"
+#include "pacer.hpp"
+
+class ReliableEndpoint;
+
+/***
+ * Settings shared by an endpoint and its connections.
+ */
+struct ReliableOptions
+{
+    uint16_t            mtu;            // Largest datagram sent
+    uint32_t            sendBuffer;     // Bytes a connection queues or has in flight before Send() blocks
+    uint32_t            recvBuffer;     // Bytes of unread and partial messages a connection holds; the next
+                                        // message due on a stream may take it to twice this
+    uint32_t            minRtoMs;
+    uint32_t            maxAckDelayMs;
+    uint32_t            idleTimeoutMs;  // A connection that hears nothing for this long fails
+
+    // Impairments applied to datagrams as this endpoint receives them, for
+    // testing on loopback.
+    double              lossRate;       // Fraction of datagrams dropped
+    uint32_t            delayUs;        // Delay added to every datagram
+    uint32_t            seed;
+
+                        ReliableOptions() :
+                            mtu(1400), sendBuffer(4 << 20), recvBuffer(4 << 20), minRtoMs(20),
+                            maxAckDelayMs(5), idleTimeoutMs(10000), lossRate(0), delayUs(0), seed(1) {}
+};
+
+/***
+ * @class One connection of a ReliableEndpoint. Messages are sent on numbered
+ *        streams and arrive whole and in order within their stream; a lost
+ *        packet delays only the streams it carried. Every packet has a new
+ *        packet number, retransmissions included, and acknowledgments list the
+ *        ranges received, so losses are found from the gaps in one round trip
+ *        and RTT samples are never ambiguous.
+ *
+ *        Sending is paced at a rate taken from a model of the path, as in BBR:
+ *        the highest delivery rate seen over the last ten round trips and the
+ *        lowest RTT. The congestion window is twice their product. Loss is not
+ *        taken as a sign of congestion, so random loss on a long link costs
+ *        only the retransmissions.
+ *
+ *        Connections are created by ReliableEndpoint::Connect() and Accept()
+ *        and belong to the endpoint. The blocking calls drive the endpoint, so
+ *        all connections of an endpoint progress while any of them waits.
+ *        An endpoint and its connections are used by one thread at a time.
+ */
+class ReliableConnection
+{
+public:
+    struct Stats
+    {
+        uint64_t        packetsSent;
+        uint64_t        packetsReceived;
+        uint64_t        bytesSent;          // Message bytes, first transmissions only
+        uint64_t        bytesRetransmitted;
+        uint64_t        bytesReceived;      // Message bytes delivered to Recv()
+        uint64_t        packetsLost;
+        uint64_t        timeouts;           // Retransmission timer expiries
+        uint32_t        srttUs;
+        uint32_t        minRttUs;
+        uint64_t        cwnd;
+        uint64_t        pacingRate;         // Bytes per second
+        uint64_t        bytesInFlight;
+    };
+
+    /***
+     * Queue a message on a stream.
+     *
+     * @param[IN] stream  - Stream to send on. Messages of one stream arrive in order.
+     * @param[IN] timeout - Milliseconds to wait for send buffer space, negative to wait forever.
+     *
+     * @return len, or 0 if the buffer stayed full for the whole timeout.
+     *
+     * @throws std::system_error with EPIPE after Close(), ECONNRESET or ETIMEDOUT
+     *         if the connection failed, and EMSGSIZE for a message too large to send.
+     */
+    int                 Send(uint16_t stream, const void *buff, int len, int timeout);
+
+    /***
+     * Receive the next complete message from any stream. A message longer than
+     * len is truncated, as with a datagram socket.
+     *
+     * @param[OUT] stream  - Stream the message arrived on.
+     * @param[IN]  timeout - Milliseconds to wait, negative to wait forever.
+     *
+     * @return Bytes copied, or 0 on timeout or once the peer has closed and
+     *         everything it sent has been read; IsPeerClosed() tells them apart.
+     *
+     * @throws std::system_error with ECONNRESET or ETIMEDOUT if the connection failed.
+     */
+    int                 Recv(uint16_t &stream, void *buff, int len, int timeout);
+
+    /***
+     * Send everything queued, tell the peer no more is coming and give the
+     * connection back to the endpoint. Waits up to timeout milliseconds for
+     * the peer to acknowledge; the endpoint finishes the close in later polls
+     * if it has not. The connection must not be used afterwards.
+     *
+     * @return true if the peer acknowledged everything in time.
+     */
+    bool                Close(int timeout);
+
+    bool                IsPeerClosed() const { return m_peerClosed; }
+    const InetAddress  &GetPeer() const { return m_peer; }
+    Stats               GetStats() const;
+
+private:
+    friend class ReliableEndpoint;
+
+    enum State
+    {
+        STATE_SYN_SENT,
+        STATE_ESTABLISHED,
+        STATE_FAILED
+    };
+
+    enum Mode
+    {
+        MODE_STARTUP,
+        MODE_DRAIN,
+        MODE_PROBE_BW
+    };
+
+    struct OutMessage
+    {
+        std::vector<uint8_t> data;
+        uint32_t        seq;
+        uint32_t        offset;         // Bytes already cut into fragments
+    };
+
+    struct OutStream
+    {
+        uint32_t        nextSeq;
+        std::deque<OutMessage> queue;
+
+                        OutStream() : nextSeq(0) {}
+    };
+
+    struct SentPacket
+    {
+        uint64_t        sentUs;
+        uint64_t        delivered;      // Connection delivered count when sent
+        uint64_t        deliveredUs;
+        uint64_t        firstSentUs;    // Send time of the newest packet acknowledged when sent
+        uint32_t        bytes;
+        bool            inFlight;       // Counted in m_bytesInFlight
+        bool            done;           // Acknowledged or declared lost
+        bool            appLimited;
+        std::vector<uint8_t> frames;    // Frames to send again if the packet is lost
+    };
+
+    struct Partial
+    {
+        std::vector<uint8_t> data;
+        std::set<uint32_t> offsets;     // Fragments received
+        uint32_t        received;
+    };
+
+    struct InStream
+    {
+        uint32_t        nextSeq;        // Next message to deliver
+        std::map<uint32_t, Partial> partial;
+
+                        InStream() : nextSeq(0) {}
+    };
+
+    struct InMessage
+    {
+        uint16_t        stream;
+        std::vector<uint8_t> data;
+    };
+
+                        ReliableConnection(ReliableEndpoint &endpoint, const InetAddress &peer,
+                                           uint32_t id, State state, uint64_t now);
+                        ReliableConnection(const ReliableConnection &);
+    ReliableConnection &operator=(const ReliableConnection &);
+
+    void                Check() const;
+    void                Fail(int error);
+    bool                IsDone() const;
+
+    // Receive side
+    void                OnPacket(const uint8_t *pData, size_t len, uint64_t now);
+    bool                OnStream(const uint8_t *pFrame, uint16_t len);
+    void                OnAck(const uint8_t *pFrame, uint64_t now);
+    bool                RecordReceived(uint64_t pn, uint64_t now);
+    uint32_t            Window() const;
+
+    // Send side
+    size_t              BuildPacket(uint8_t *pOut, uint64_t now);
+    size_t              PutAck(uint8_t *pOut, size_t room, uint64_t now);
+    bool                HasData() const;
+    bool                CanSendData(uint64_t now) const;
+    void                OnPacketLost(SentPacket &packet);
+    void                DetectLosses(uint64_t now);
+    void                OnTimeout(uint64_t now);
+    void                OnTimers(uint64_t now);
+    uint64_t            RtoUs() const;
+    uint64_t            RtoDeadline() const;
+    uint64_t            NextWake(uint64_t now) const;
+
+    // Path model
+    void                UpdateModel(const SentPacket &newest, uint64_t now);
+    void                UpdateRtt(uint64_t rttUs, uint64_t ackDelayUs, uint64_t now);
+
+    ReliableEndpoint   &m_endpoint;
+    InetAddress         m_peer;
+    uint32_t            m_id;
+    State               m_state;
+    int                 m_error;
+    bool                m_accepted;         // Handed to the application
+    bool                m_released;         // Close() has returned; the endpoint may free it
+    bool                m_closeWanted;
+    bool                m_closeSent;
+    bool                m_closeAcked;
+    bool                m_peerClosed;
+    bool                m_synAckPending;
+    uint64_t            m_synSentUs;
+    uint32_t            m_synCount;
+    uint64_t            m_lastRecvUs;
+
+    // Send side
+    std::unordered_map<uint16_t, OutStream> m_outStreams;
+    std::deque<uint16_t>    m_active;       // Streams with queued messages, served round robin
+    std::deque<std::vector<uint8_t> > m_retransmit;
+    uint64_t            m_queuedBytes;      // Not yet cut into packets
+    uint64_t            m_retransmitBytes;
+    std::deque<SentPacket>  m_sent;
+    uint64_t            m_sentBase;         // Packet number of m_sent.front()
+    uint64_t            m_nextPn;
+    uint64_t            m_largestAcked;
+    bool                m_anyAcked;
+    uint64_t            m_bytesInFlight;
+    uint64_t            m_lastAckUs;        // Last time an ack removed something from flight
+    uint32_t            m_backoff;
+    uint32_t            m_peerWindow;
+    bool                m_pingPending;
+    uint64_t            m_closePn;
+
+    // Receive side
+    std::vector<std::pair<uint64_t, uint64_t> > m_received;    // Ranges, ascending
+    uint64_t            m_largestRecv;
+    uint64_t            m_largestRecvUs;
+    uint32_t            m_unacked;          // Ack eliciting packets since the last ack
+    bool                m_ackNow;
+    uint64_t            m_ackDeadline;
+    uint32_t            m_lastWindow;       // Window sent in the last ack
+    std::unordered_map<uint16_t, InStream> m_inStreams;
+    std::deque<InMessage>   m_ready;
+    uint64_t            m_bufferedBytes;    // Held for m_ready and partial messages
+    uint64_t            m_receivedBytes;    // Arrived of those; the window is what remains
+
+    // Path model
+    uint64_t            m_srttUs;
+    uint64_t            m_rttVarUs;
+    uint64_t            m_minRttUs;
+    uint64_t            m_minRttStamp;
+    uint64_t            m_delivered;
+    uint64_t            m_deliveredUs;
+    uint64_t            m_firstSentUs;
+    uint64_t            m_round;
+    uint64_t            m_nextRoundDelivered;
+    uint64_t            m_bwRing[10];       // Highest delivery rate of each of the last rounds
+    uint64_t            m_btlBw;
+    uint64_t            m_fullBw;
+    uint32_t            m_fullBwRounds;
+    Mode                m_mode;
+    uint32_t            m_cycle;
+    uint64_t            m_cycleStamp;
+    double              m_pacingGain;
+    double              m_cwndGain;
+    uint64_t            m_cwnd;
+    TokenBucket         m_pacer;
+
+    Stats               m_stats;
+};
+
+/***
+ * @class UDP socket carrying any number of ReliableConnections, told apart by
+ *        peer address. Each Poll() reads datagrams with recvmmsg(), runs the
+ *        timers of every connection and sends whatever pacing allows with
+ *        sendmmsg(), so a busy connection costs a few system calls per batch
+ *        rather than per packet.
+ *
+ *        The interface follows Socket: Listen() and Accept() on the server,
+ *        Connect() on the client, with timeouts in milliseconds.
+ */
+class ReliableEndpoint
+{
+public:
+    static const int    BATCH_MAX = 32;
+
+    /***
+     * Class constructor. Binds the UDP socket.
+     *
+     * @param[IN] local - Address to bind, port 0 for any.
+     *
+     * @throws std::system_error if the socket cannot be bound.
+     */
+                        ReliableEndpoint(const InetAddress &local, const ReliableOptions &options = ReliableOptions());
+                        ~ReliableEndpoint();
+
+    /***
+     * Accept connections, holding up to backlog of them for Accept().
+     */
+    void                Listen(int backlog);
+
+    /***
+     * Wait for a new connection.
+     *
+     * @return The connection, or NULL on timeout.
+     */
+    ReliableConnection *Accept(int timeout);
+
+    /***
+     * Open a connection and wait for the peer to answer.
+     *
+     * @throws std::system_error with ETIMEDOUT if it does not answer in time,
+     *         or EISCONN if there is already a connection to the peer.
+     */
+    ReliableConnection *Connect(const InetAddress &peer, int timeout);
+
+    /***
+     * Wait up to timeout milliseconds for a datagram or a timer, then receive,
+     * run timers and send once. The blocking calls of the connections loop
+     * on this; a program that only sends can call it to keep acknowledgments
+     * and retransmissions going.
+     */
+    void                Poll(int timeout);
+
+    const InetAddress  &GetLocalAddress() const { return m_local; }
+    Socket             &GetSocket() { return m_sock; }
+    size_t              Connections() const { return m_conns.size(); }
+
+private:
+    friend class ReliableConnection;
+
+    struct Delayed
+    {
+        uint64_t        due;
+        InetAddress     peer;
+        std::vector<uint8_t> data;
+    };
+
+                        ReliableEndpoint(const ReliableEndpoint &);
+    ReliableEndpoint   &operator=(const ReliableEndpoint &);
+
+    /***
+     * Wait until cond() holds or timeout milliseconds pass.
+     */
+    template<typename Cond>
+    bool                WaitFor(int timeout, Cond cond);
+
+    void                PollUs(uint64_t waitUs);
+    void                Service(uint64_t now);
+    void                Receive(uint64_t now);
+    void                Deliver(const InetAddress &peer, const uint8_t *pData, size_t len, uint64_t now);
+    void                Transmit(uint64_t now);
+    void                Flush();
+    void                SendControl(const InetAddress &peer, uint8_t type, uint32_t id);
+    void                Reap();
+    uint64_t            Random();
+
+    ReliableOptions         m_options;
+    Socket                  m_sock;
+    InetAddress             m_local;
+    PeerTable<ReliableConnection *> m_peers;
+    std::vector<std::unique_ptr<ReliableConnection> > m_conns;
+    std::deque<ReliableConnection *> m_backlog;
+    size_t                  m_backlogMax;
+    bool                    m_listening;
+    std::deque<Delayed>     m_delayed;
+    uint64_t                m_random;
+
+    // Outgoing batch
+    std::vector<uint8_t>    m_txData;
+    InetSockAddr            m_txAddrs[BATCH_MAX];
+    socklen_t               m_txAddrLens[BATCH_MAX];
+    size_t                  m_txLens[BATCH_MAX];
+    int                     m_txCount;
+
+    std::vector<uint8_t>    m_rxData;
+};
+
+#endif
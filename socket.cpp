@@ -23,16 +23,95 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #else
 #include <sys/socket.h>
 #include <poll.h>
+#include <linux/tcp.h>
+#define closesocket(fd) close(fd)
 #endif
+#include <atomic>
 #include <cstring>
 #include <csignal>
 #include <fcntl.h>
 #include <system_error>
 
 #include "socket.hpp"
+#include "addrtext.hpp"
+#include "socktap.hpp"
+#include "socktrace.hpp"
+
+/*
+ * Report a completed operation to the active SocketTap, if there is one.
+ */
+static inline void
+Tap(int fd, int direction, const void *buff, int bytes, const InetAddress *pPeer)
+{
+    SocketTap *pTap = SocketTap::Active();
+
+    if (pTap != NULL) {
+        pTap->Capture(fd, direction, buff, bytes, pPeer);
+    }
+}
+
+static inline void
+Tap(int fd, int direction, const void *buff, int bytes, const sockaddr *pPeer)
+{
+    SocketTap *pTap = SocketTap::Active();
+
+    if (pTap != NULL) {
+        InetAddress peer = InetAddress::FromSockAddr(pPeer);
+        pTap->Capture(fd, direction, buff, bytes, &peer);
+    }
+}
+
+static inline void
+TapForget(int fd)
+{
+    if (SocketTap::Active() != NULL) {
+        SocketTap::Forget(fd);
+    }
+}
+
+/*
+ * Fast Open state of a Socket. A result is pending until the handshake has
+ * finished and GetFastOpenResult() has counted it.
+ */
+enum FastOpenState
+{
+    FO_NONE,
+    FO_LISTENING,
+    FO_ACTIVE,
+    FO_PASSIVE,
+    FO_COUNTED,
+    FO_FALLBACK
+};
+
+// From linux/tcp.h, which names its states only in the kernel.
+static const int STATE_SYN_SENT = 2;
+static const int STATE_SYN_RECV = 3;
+
+// Indexes into s_fastOpenCounts, in the order of FastOpenStats.
+enum FastOpenCounter
+{
+    FOC_ATTEMPTS,
+    FOC_ACCEPTED,
+    FOC_NO_COOKIE,
+    FOC_NOT_ACKED,
+    FOC_SYN_RETRANSMITTED,
+    FOC_FALLBACK,
+    FOC_PASSIVE_ACCEPTED,
+    FOC_PASSIVE_REGULAR,
+    FOC_COUNT
+};
+
+static std::atomic<uint64_t> s_fastOpenCounts[FOC_COUNT];
+
+static inline void
+CountFastOpen(int counter)
+{
+    s_fastOpenCounts[counter].fetch_add(1, std::memory_order_relaxed);
+}
 
 Socket::Socket(bool isIpv6, int type) : IPAddress(isIpv6)
 {
+    m_fastOpen = FO_NONE;
     if ((m_sockfd = socket((isIpv6)?AF_INET6:AF_INET, type, 0)) < 0)
     {
 	throw std::system_error(errno, std::system_category());
@@ -40,8 +119,43 @@ Socket::Socket(bool isIpv6, int type) : IPAddress(isIpv6)
     }
 }
 
+/*
+ * Returns whether an open descriptor is an IPv6 socket, so an adopted socket
+ * can be given the right address family.
+ */
+static bool
+DescriptorIsIpv6(int sockfd)
+{
+    sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+
+    if (getsockname(sockfd, (sockaddr *)&addr, &len) < 0)
+    {
+	throw std::system_error(errno, std::system_category());
+    }
+    return addr.ss_family == AF_INET6;
+}
+
+/*
+ * Adopt a descriptor that is already open, such as a listener received from
+ * the process being replaced. The Socket owns the descriptor from now on. Its
+ * local address is read back so the socket needs no second Bind().
+ */
+Socket::Socket(int sockfd) : IPAddress(DescriptorIsIpv6(sockfd))
+{
+    socklen_t len = SizeOf();
+
+    m_sockfd = sockfd;
+    m_fastOpen = FO_NONE;
+    if (getsockname(m_sockfd, m_pIpAddr, &len) < 0)
+    {
+	throw std::system_error(errno, std::system_category());
+    }
+}
+
 Socket::~Socket()
 {
+    TapForget(m_sockfd);
     closesocket(m_sockfd);
 }
 
@@ -53,11 +167,14 @@ Socket::Connect(const char *ipAddr, int port)
     SetAddress(ipAddr);
     SetPortNumber(port);
 
+    SOCKET_PROBE(connect_entry, m_sockfd, 0, -1, m_pIpAddr);
     if ( (rc = connect(m_sockfd, this->m_pIpAddr, SizeOf())) < 0)
     {
+        SOCKET_PROBE(connect_return, m_sockfd, -1, errno, m_pIpAddr);
 	throw std::system_error(errno, std::system_category());
 	return errno;
     }
+    SOCKET_PROBE(connect_return, m_sockfd, rc, 0, m_pIpAddr);
     return rc;
 }
 
@@ -69,12 +186,94 @@ Socket::Bind(const char *ipAddr, int port)
     SetAddress(ipAddr);
     SetPortNumber(port);
 
+    SOCKET_PROBE(bind_entry, m_sockfd, 0, -1, m_pIpAddr);
     if ( (rc = bind(m_sockfd, this->m_pIpAddr, SizeOf())) < 0 )
     {
+        SOCKET_PROBE(bind_return, m_sockfd, -1, errno, m_pIpAddr);
+	throw std::system_error(errno, std::system_category());
+	return errno;
+    }
+
+    SOCKET_PROBE(bind_return, m_sockfd, rc, 0, m_pIpAddr);
+    return rc;
+}
+
+int
+Socket::Connect(const InetAddress &addr)
+{
+    int rc;
+    InetSockAddr sa;
+    socklen_t len = addr.ToSockAddr(sa);
+
+    SOCKET_PROBE(connect_entry, m_sockfd, 0, -1, &sa);
+    if ( (rc = connect(m_sockfd, &sa.sa, len)) < 0)
+    {
+        SOCKET_PROBE(connect_return, m_sockfd, -1, errno, &sa);
+	throw std::system_error(errno, std::system_category());
+	return errno;
+    }
+    SOCKET_PROBE(connect_return, m_sockfd, rc, 0, &sa);
+    return rc;
+}
+
+/*
+ * Connect and carry the first data in the SYN with MSG_FASTOPEN. Without a
+ * cached cookie the kernel asks the server for one and sends the data once the
+ * handshake completes. If Fast Open is disabled on this host the call falls
+ * back to connect() and send().
+ *
+ * Returns the bytes sent, or 0 if a non-blocking socket is still connecting
+ * and queued nothing.
+ */
+int
+Socket::Connect(const InetAddress &addr, const void *buff, int len, uint32_t flags)
+{
+    int             bytes;
+    InetSockAddr    sa;
+    socklen_t       saLen = addr.ToSockAddr(sa);
+
+    CountFastOpen(FOC_ATTEMPTS);
+    SOCKET_PROBE(connect_entry, m_sockfd, len, -1, &sa);
+    if ( ( bytes = sendto(m_sockfd, buff, len, flags | MSG_FASTOPEN, &sa.sa, saLen) ) < 0 )
+    {
+        if (errno == EINPROGRESS) {
+            SOCKET_PROBE(connect_return, m_sockfd, 0, EINPROGRESS, &sa);
+            m_fastOpen = FO_ACTIVE;
+            return 0;
+        }
+        SOCKET_PROBE(connect_return, m_sockfd, -1, errno, &sa);
+        if (errno != EOPNOTSUPP) {
+	    throw std::system_error(errno, std::system_category());
+        }
+
+        CountFastOpen(FOC_FALLBACK);
+        m_fastOpen = FO_FALLBACK;
+        Connect(addr);
+        return Send(buff, len, flags);
+    }
+
+    SOCKET_PROBE(connect_return, m_sockfd, bytes, 0, &sa);
+    m_fastOpen = FO_ACTIVE;
+    Tap(m_sockfd, TAP_SEND, buff, bytes, (const InetAddress *)NULL);
+    return bytes;
+}
+
+int
+Socket::Bind(const InetAddress &addr)
+{
+    int rc;
+    InetSockAddr sa;
+    socklen_t len = addr.ToSockAddr(sa);
+
+    SOCKET_PROBE(bind_entry, m_sockfd, 0, -1, &sa);
+    if ( (rc = bind(m_sockfd, &sa.sa, len)) < 0 )
+    {
+        SOCKET_PROBE(bind_return, m_sockfd, -1, errno, &sa);
 	throw std::system_error(errno, std::system_category());
 	return errno;
     }
 
+    SOCKET_PROBE(bind_return, m_sockfd, rc, 0, &sa);
     return rc;
 }
 
@@ -86,12 +285,15 @@ Socket::Bind(int port)
     SetIPAddressAny();
     SetPortNumber(port);
 
+    SOCKET_PROBE(bind_entry, m_sockfd, 0, -1, m_pIpAddr);
     if ( (rc = bind(m_sockfd, this->m_pIpAddr, SizeOf())) < 0 )
     {
+        SOCKET_PROBE(bind_return, m_sockfd, -1, errno, m_pIpAddr);
 	throw std::system_error(errno, std::system_category());
 	return errno;
     }
 
+    SOCKET_PROBE(bind_return, m_sockfd, rc, 0, m_pIpAddr);
     return rc;
 }
 
@@ -100,15 +302,32 @@ Socket::Listen(int backlog)
 {
     int rc;
 
+    SOCKET_PROBE(listen_entry, m_sockfd, backlog, -1, 0);
     if ( (rc = listen(m_sockfd, backlog)) < 0 )
     {
+        SOCKET_PROBE(listen_return, m_sockfd, -1, errno, 0);
 	throw std::system_error(errno, std::system_category());
 	return errno;
     }
 
+    SOCKET_PROBE(listen_return, m_sockfd, rc, 0, 0);
     return rc;
 }
 
+/*
+ * Listen and accept data in the SYN from clients holding a valid cookie.
+ * fastOpenQueue limits the connections that have been handed data but have
+ * not finished their handshake; beyond it SYNs fall back to a plain
+ * handshake. The server bit of the net.ipv4.tcp_fastopen sysctl must be set.
+ */
+int
+Socket::Listen(int backlog, int fastOpenQueue)
+{
+    SetSockOpt(IPPROTO_TCP, TCP_FASTOPEN, &fastOpenQueue, sizeof(fastOpenQueue));
+    m_fastOpen = FO_LISTENING;
+    return Listen(backlog);
+}
+
 
 int
 Socket::Accept(Socket &remoteHost)
@@ -116,26 +335,56 @@ Socket::Accept(Socket &remoteHost)
     sockaddr *saRemote = remoteHost.m_pIpAddr;
     socklen_t len = remoteHost.SizeOf();
 
+    TapForget(remoteHost.m_sockfd);
     close(remoteHost.m_sockfd);
+    SOCKET_PROBE(accept_entry, m_sockfd, 0, -1, 0);
     if ((remoteHost.m_sockfd = accept(m_sockfd, saRemote, &len)) < 0)
     {
+        SOCKET_PROBE(accept_return, m_sockfd, -1, errno, 0);
 	throw std::system_error(errno, std::system_category());
 	return errno;
     }
+    SOCKET_PROBE(accept_return, m_sockfd, remoteHost.m_sockfd, 0, saRemote);
+    remoteHost.m_fastOpen = m_fastOpen == FO_LISTENING ? FO_PASSIVE : FO_NONE;
 
     return remoteHost.m_sockfd;
 }
 
+/*
+ * Accept a connection without building a Socket for it. The caller owns the
+ * returned descriptor and the peer address is not retrieved.
+ */
+int
+Socket::Accept()
+{
+    int fd;
+
+    SOCKET_PROBE(accept_entry, m_sockfd, 0, -1, 0);
+    if ((fd = accept(m_sockfd, NULL, NULL)) < 0)
+    {
+        SOCKET_PROBE(accept_return, m_sockfd, -1, errno, 0);
+	throw std::system_error(errno, std::system_category());
+	return errno;
+    }
+
+    SOCKET_PROBE(accept_return, m_sockfd, fd, 0, 0);
+    return fd;
+}
+
 int
 Socket::Recv(void *pBuffer, int len, unsigned int flags)
 {
     int bytes;
 
+    SOCKET_PROBE(recv_entry, m_sockfd, len, -1, 0);
     if ( ( bytes = recv(m_sockfd, pBuffer, len, flags) ) < 0 )
     {
+        SOCKET_PROBE(recv_return, m_sockfd, -1, errno, 0);
 	throw std::system_error(errno, std::system_category());
 	return errno;
     }
+    SOCKET_PROBE(recv_return, m_sockfd, bytes, 0, 0);
+    Tap(m_sockfd, TAP_RECV, pBuffer, bytes, (const InetAddress *)NULL);
     return bytes;
 }
 
@@ -150,14 +399,21 @@ Socket::Recv(void *pBuffer, int len, unsigned int flags, int timeout)
    fds[ 0 ].fd = m_sockfd;
    fds[ 0 ].events = POLLIN;
 
+    SOCKET_PROBE(recv_entry, m_sockfd, len, timeout, 0);
     int rc = poll( fds, nfds, timeout );
-    if ( ( rc <= 0 ) || ( fds[0].revents != POLLIN ) ) return rc;
+    if ( ( rc <= 0 ) || ( fds[0].revents != POLLIN ) ) {
+        SOCKET_PROBE(recv_return, m_sockfd, rc, rc < 0 ? errno : 0, 0);
+        return rc;
+    }
 
     if ( ( bytes = recv(m_sockfd, pBuffer, len, flags) ) < 0 )
     {
+        SOCKET_PROBE(recv_return, m_sockfd, -1, errno, 0);
 	throw std::system_error(errno, std::system_category());
 	return errno;
     }
+    SOCKET_PROBE(recv_return, m_sockfd, bytes, 0, 0);
+    Tap(m_sockfd, TAP_RECV, pBuffer, bytes, (const InetAddress *)NULL);
     return bytes;
 }
 
@@ -167,11 +423,15 @@ Socket::RecvFrom(void *buff, int len, uint32_t flags, Socket &client)
     int             bytes;
     socklen_t saLen = client.SizeOf();
 
+    SOCKET_PROBE(recvfrom_entry, m_sockfd, len, -1, 0);
     if ( ( bytes = recvfrom(m_sockfd, buff, len, flags, client, &saLen) ) < 0 )
     {
+        SOCKET_PROBE(recvfrom_return, m_sockfd, -1, errno, 0);
 	throw std::system_error(errno, std::system_category());
 	return errno;
     }
+    SOCKET_PROBE(recvfrom_return, m_sockfd, bytes, 0, (const sockaddr *)client);
+    Tap(m_sockfd, TAP_RECV, buff, bytes, (const sockaddr *)client);
     return bytes;
 }
 
@@ -187,14 +447,41 @@ Socket::RecvFrom(void *buff, int len, uint32_t flags, Socket &client, int timeou
    fds[ 0 ].fd = m_sockfd;
    fds[ 0 ].events = POLLIN;
 
+    SOCKET_PROBE(recvfrom_entry, m_sockfd, len, timeout, 0);
     int rc = poll( fds, nfds, timeout );
-    if ( ( rc <= 0 ) || ( fds[0].revents != POLLIN ) ) return rc;
+    if ( ( rc <= 0 ) || ( fds[0].revents != POLLIN ) ) {
+        SOCKET_PROBE(recvfrom_return, m_sockfd, rc, rc < 0 ? errno : 0, 0);
+        return rc;
+    }
 
     if ( ( bytes = recvfrom(m_sockfd, buff, len, flags, client, &saLen) ) < 0 )
     {
+        SOCKET_PROBE(recvfrom_return, m_sockfd, -1, errno, 0);
 	throw std::system_error(errno, std::system_category());
 	return errno;
     }
+    SOCKET_PROBE(recvfrom_return, m_sockfd, bytes, 0, (const sockaddr *)client);
+    Tap(m_sockfd, TAP_RECV, buff, bytes, (const sockaddr *)client);
+    return bytes;
+}
+
+int
+Socket::RecvFrom(void *buff, int len, uint32_t flags, InetAddress &peer)
+{
+    int             bytes;
+    InetSockAddr    sa;
+    socklen_t       saLen = sizeof(sa);
+
+    SOCKET_PROBE(recvfrom_entry, m_sockfd, len, -1, 0);
+    if ( ( bytes = recvfrom(m_sockfd, buff, len, flags, &sa.sa, &saLen) ) < 0 )
+    {
+        SOCKET_PROBE(recvfrom_return, m_sockfd, -1, errno, 0);
+	throw std::system_error(errno, std::system_category());
+	return errno;
+    }
+    SOCKET_PROBE(recvfrom_return, m_sockfd, bytes, 0, &sa);
+    peer = InetAddress::FromSockAddr(&sa.sa);
+    Tap(m_sockfd, TAP_RECV, buff, bytes, &peer);
     return bytes;
 }
 
@@ -203,12 +490,16 @@ Socket::Send(const void *buffer, int len, uint32_t flags)
 {
     int bytes;
 
+    SOCKET_PROBE(send_entry, m_sockfd, len, -1, 0);
     if ( ( bytes = send(m_sockfd, buffer, len, flags) ) < 0 )
     {
+        SOCKET_PROBE(send_return, m_sockfd, -1, errno, 0);
 	throw std::system_error(errno, std::system_category());
 	return errno;
     }
 
+    SOCKET_PROBE(send_return, m_sockfd, bytes, 0, 0);
+    Tap(m_sockfd, TAP_SEND, buffer, bytes, (const InetAddress *)NULL);
     return bytes;
 }
 
@@ -236,31 +527,84 @@ printf("%x", ((unsigned char*)buffer)[i]);
 }
 printf("\n");
 */
+    SOCKET_PROBE(sendto_entry, m_sockfd, len, -1, (const sockaddr *)client);
     if ( ( bytes = sendto(m_sockfd, buffer, len, flags, client, saLen) ) < 0 )
     {
+        SOCKET_PROBE(sendto_return, m_sockfd, -1, errno, (const sockaddr *)client);
 	throw std::system_error(errno, std::system_category());
 	return errno;
     }
 
+    SOCKET_PROBE(sendto_return, m_sockfd, bytes, 0, (const sockaddr *)client);
+    Tap(m_sockfd, TAP_SEND, buffer, bytes, (const sockaddr *)client);
     return bytes;
 }
 
 int
-Socket::GetSockName(const char* &ipAddr, int &port)
+Socket::SendTo(const void *buffer, int len, uint32_t flags, const InetAddress &peer)
 {
-    IPAddress addr;
-    //SocketAddress   addr;
-    socklen_t       len = addr.SizeOf();
+    int             bytes;
+    InetSockAddr    sa;
+    socklen_t       saLen = peer.ToSockAddr(sa);
 
+    SOCKET_PROBE(sendto_entry, m_sockfd, len, -1, &sa);
+    if ( ( bytes = sendto(m_sockfd, buffer, len, flags, &sa.sa, saLen) ) < 0 )
+    {
+        SOCKET_PROBE(sendto_return, m_sockfd, -1, errno, &sa);
+	throw std::system_error(errno, std::system_category());
+	return errno;
+    }
 
-    if (getsockname(m_sockfd, (sockaddr *)addr, &len) < 0)
+    SOCKET_PROBE(sendto_return, m_sockfd, bytes, 0, &sa);
+    Tap(m_sockfd, TAP_SEND, buffer, bytes, &peer);
+    return bytes;
+}
+
+int
+Socket::GetSockName(InetAddress &addr)
+{
+    InetSockAddr    sa;
+    socklen_t       len = sizeof(sa);
+
+    SOCKET_PROBE(getsockname_entry, m_sockfd, 0, -1, 0);
+    if (getsockname(m_sockfd, &sa.sa, &len) < 0)
     {
+        SOCKET_PROBE(getsockname_return, m_sockfd, -1, errno, 0);
 	throw std::system_error(errno, std::system_category());
 	return errno;
     }
+    SOCKET_PROBE(getsockname_return, m_sockfd, 0, 0, &sa.sa);
+
+    addr = InetAddress::FromSockAddr(&sa.sa);
+    return 0;
+}
+
+int
+Socket::GetSockName(char *ipAddr, size_t len, int &port)
+{
+    InetAddress addr;
+
+    GetSockName(addr);
+    if (FormatAddress(addr, ipAddr, len) == 0)
+    {
+	throw std::system_error(ERANGE, std::system_category());
+    }
+    port = addr.GetPortNumber();
+    return 0;
+}
+
+/*
+ * The address used to point into a local IPAddress that was gone by the time
+ * the caller looked at it. It is now formatted into a per thread buffer that
+ * stays valid until the next call on the same thread.
+ */
+int
+Socket::GetSockName(const char* &ipAddr, int &port)
+{
+    static thread_local char text[ADDRTEXT_MAX];
 
-    ipAddr = addr.GetAddress();
-    addr.GetPortNumber(port);
+    GetSockName(text, sizeof(text), port);
+    ipAddr = text;
     return 0;
 }
 
@@ -297,11 +641,14 @@ Socket::GetSockOpt(int level, int optName, void *optVal, socklen_t *optLen)
 {
     int rc;
 
+    SOCKET_PROBE(getsockopt_entry, m_sockfd, level, optName, 0);
     if ( (rc = getsockopt(m_sockfd, level, optName, optVal, optLen)) < 0 )
     {
+        SOCKET_PROBE(getsockopt_return, m_sockfd, -1, errno, 0);
 	throw std::system_error(errno, std::system_category());
 	return errno;
     }
+    SOCKET_PROBE(getsockopt_return, m_sockfd, rc, 0, 0);
 
     return rc;
 }
@@ -311,11 +658,14 @@ Socket::SetSockOpt(int level, int optName, const void *optVal, socklen_t optLen)
 {
     int rc;
 
+    SOCKET_PROBE(setsockopt_entry, m_sockfd, level, optName, 0);
     if ( (rc = setsockopt(m_sockfd, level, optName, optVal, optLen)) < 0 )
     {
+        SOCKET_PROBE(setsockopt_return, m_sockfd, -1, errno, 0);
 	throw std::system_error(errno, std::system_category());
 	return errno;
     }
+    SOCKET_PROBE(setsockopt_return, m_sockfd, rc, 0, 0);
 
     return rc;
 }
@@ -325,11 +675,78 @@ Socket::Fcntl(int cmd, int arg)
 {
     int rc;
 
+    SOCKET_PROBE(fcntl_entry, m_sockfd, cmd, arg, 0);
     if ( (rc = fcntl(m_sockfd, cmd, arg)) < 0 )
     {
+        SOCKET_PROBE(fcntl_return, m_sockfd, -1, errno, 0);
 	throw std::system_error(errno, std::system_category());
 	return errno;
     }
+    SOCKET_PROBE(fcntl_return, m_sockfd, rc, 0, 0);
 
     return rc;
 }
+
+FastOpenResult
+Socket::GetFastOpenResult()
+{
+    struct tcp_info info;
+    socklen_t       len = sizeof(info);
+    FastOpenResult  result = FASTOPEN_UNUSED;
+
+    if (m_fastOpen == FO_FALLBACK) {
+        return FASTOPEN_FALLBACK;
+    }
+    if (m_fastOpen == FO_NONE || m_fastOpen == FO_LISTENING) {
+        return FASTOPEN_UNUSED;
+    }
+
+    memset(&info, 0, sizeof(info));
+    GetSockOpt(IPPROTO_TCP, TCP_INFO, &info, &len);
+
+    if (info.tcpi_options & TCPI_OPT_SYN_DATA) {
+        result = FASTOPEN_ACCEPTED;
+    } else {
+        switch (info.tcpi_fastopen_client_fail) {
+        case 1:
+            result = FASTOPEN_NO_COOKIE;
+            break;
+        case 2:
+            result = FASTOPEN_NOT_ACKED;
+            break;
+        case 3:
+            result = FASTOPEN_SYN_RETRANSMITTED;
+            break;
+        }
+    }
+
+    // Count each connection once, when the handshake is over.
+    if (m_fastOpen == FO_ACTIVE && info.tcpi_state != STATE_SYN_SENT) {
+        static const int counters[] = { -1, FOC_ACCEPTED, FOC_NO_COOKIE, FOC_NOT_ACKED, FOC_SYN_RETRANSMITTED };
+
+        if (counters[result] >= 0) {
+            CountFastOpen(counters[result]);
+        }
+        m_fastOpen = FO_COUNTED;
+    } else if (m_fastOpen == FO_PASSIVE && info.tcpi_state != STATE_SYN_RECV) {
+        CountFastOpen(result == FASTOPEN_ACCEPTED ? FOC_PASSIVE_ACCEPTED : FOC_PASSIVE_REGULAR);
+        m_fastOpen = FO_COUNTED;
+    }
+    return result;
+}
+
+FastOpenStats
+Socket::GetFastOpenStats()
+{
+    FastOpenStats stats;
+
+    stats.attempts = s_fastOpenCounts[FOC_ATTEMPTS].load(std::memory_order_relaxed);
+    stats.accepted = s_fastOpenCounts[FOC_ACCEPTED].load(std::memory_order_relaxed);
+    stats.noCookie = s_fastOpenCounts[FOC_NO_COOKIE].load(std::memory_order_relaxed);
+    stats.notAcked = s_fastOpenCounts[FOC_NOT_ACKED].load(std::memory_order_relaxed);
+    stats.synRetransmitted = s_fastOpenCounts[FOC_SYN_RETRANSMITTED].load(std::memory_order_relaxed);
+    stats.fallback = s_fastOpenCounts[FOC_FALLBACK].load(std::memory_order_relaxed);
+    stats.passiveAccepted = s_fastOpenCounts[FOC_PASSIVE_ACCEPTED].load(std::memory_order_relaxed);
+    stats.passiveRegular = s_fastOpenCounts[FOC_PASSIVE_REGULAR].load(std::memory_order_relaxed);
+    return stats;
+}
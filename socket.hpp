@@ -21,34 +21,89 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include "ipaddr.hpp"
+#include "inetaddr.hpp"
+
+/***
+ * Outcome of TCP Fast Open on one connection.
+ */
+enum FastOpenResult
+{
+    FASTOPEN_UNUSED,                // Plain handshake
+    FASTOPEN_ACCEPTED,              // Data carried in the SYN was acknowledged
+    FASTOPEN_NO_COOKIE,             // No cookie was cached; one was requested and the data waited for the handshake
+    FASTOPEN_NOT_ACKED,             // The peer ignored the data in the SYN and it was sent again
+    FASTOPEN_SYN_RETRANSMITTED,     // The SYN with data timed out and was retried without it
+    FASTOPEN_FALLBACK               // The kernel refused Fast Open; connect() and send() were used
+};
+
+/***
+ * Process wide Fast Open counters. Outcomes are counted by
+ * Socket::GetFastOpenResult(), once per connection.
+ */
+struct FastOpenStats
+{
+    uint64_t            attempts;           // Connect() calls carrying data
+    uint64_t            accepted;
+    uint64_t            noCookie;
+    uint64_t            notAcked;
+    uint64_t            synRetransmitted;
+    uint64_t            fallback;
+    uint64_t            passiveAccepted;    // Accepted connections whose SYN carried data
+    uint64_t            passiveRegular;     // Plain handshakes accepted by a Fast Open listener
+};
 
 class Socket : public IPAddress
 {
 public:
     Socket(bool isIPv6, int type);
+    explicit Socket(int sockfd);
     ~Socket();
 
     int Connect(const char *ipAddr, int port);
+    int Connect(const InetAddress &addr);
+    int Connect(const InetAddress &addr, const void *buff, int len, uint32_t flags);
     int Bind(const char *ipAddr, int port);
+    int Bind(const InetAddress &addr);
     int Bind(int port);
     int Listen(int backlog);
+    int Listen(int backlog, int fastOpenQueue);
     int Accept(Socket &remoteHost);
+    int Accept();
 
     int Recv(void *buff, int len, uint32_t flags);
     int Recv(void *buff, int len, uint32_t flags, int timeout);
     int RecvFrom(void *buff, int len, uint32_t flags, Socket &sock);
     int RecvFrom(void *buff, int len, uint32_t flags, Socket &sock, int timeout);
+    int RecvFrom(void *buff, int len, uint32_t flags, InetAddress &peer);
     int Send(const void *buff, int len, uint32_t flags);
     int SendTo(const void *buff, int len, uint32_t flags, Socket &sock);
+    int SendTo(const void *buff, int len, uint32_t flags, const InetAddress &peer);
 
     int GetSockOpt(int level, int optName, void *optVal, socklen_t *optLen);
     int	SetSockOpt(int level, int optName, const void *optVal, socklen_t optLen);
 
     int GetSockName(const char* &ipAddr, int &port);
+    int GetSockName(char *ipAddr, size_t len, int &port);
+    int GetSockName(InetAddress &addr);
     int Fcntl(int cmd, int arg);
 
+    /*
+     * The descriptor stays owned by the Socket. It is exposed for readiness
+     * APIs such as poll() and epoll that need to register it.
+     */
+    int GetDescriptor() const { return m_sockfd; }
+
+    /*
+     * TCP Fast Open outcome of a connection made by Connect() with data or
+     * accepted from a Fast Open listener. Call it once the peer has answered;
+     * the first call after the handshake adds the outcome to the stats.
+     */
+    FastOpenResult GetFastOpenResult();
+    static FastOpenStats GetFastOpenStats();
+
 protected:
     int m_sockfd;
+    int m_fastOpen;
 };
 
 #endif
@@ -0,0 +1,347 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Socket tuning specifications parsed from option strings
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "sockopts.hpp"
+#include "getopt_windows/getopt.h"
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL            46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL     69
+#endif
+
+enum OptionKind {
+    KIND_FLAG,          // Boolean, "name" alone means on
+    KIND_INT,           // Plain integer
+    KIND_SIZE,          // Integer with optional K, M or G suffix
+    KIND_LINGER,        // struct linger, value is the timeout in seconds
+    KIND_STRING,        // Short string such as a congestion control name
+    KIND_TOS            // IP_TOS or IPV6_TCLASS depending on the family
+};
+
+struct OptionDesc
+{
+    int         level;
+    int         optName;
+    int         kind;
+    bool        tcpOnly;
+};
+
+/*
+ * The names are kept in their own array because that is what getsubopt takes.
+ * Both tables must stay in the same order.
+ */
+static const char *const s_names[] = {
+    "nodelay",
+    "quickack",
+    "cork",
+    "keepalive",
+    "keepidle",
+    "keepintvl",
+    "keepcnt",
+    "user_timeout",
+    "notsent_lowat",
+    "congestion",
+    "rcvbuf",
+    "sndbuf",
+    "rcvlowat",
+    "busy_poll",
+    "prefer_busy_poll",
+    "priority",
+    "mark",
+    "reuseaddr",
+    "reuseport",
+    "linger",
+    "tos",
+    NULL
+};
+
+static const OptionDesc s_options[] = {
+    { IPPROTO_TCP, TCP_NODELAY,          KIND_FLAG,   true  },
+    { IPPROTO_TCP, TCP_QUICKACK,         KIND_FLAG,   true  },
+    { IPPROTO_TCP, TCP_CORK,             KIND_FLAG,   true  },
+    { SOL_SOCKET,  SO_KEEPALIVE,         KIND_FLAG,   false },
+    { IPPROTO_TCP, TCP_KEEPIDLE,         KIND_INT,    true  },
+    { IPPROTO_TCP, TCP_KEEPINTVL,        KIND_INT,    true  },
+    { IPPROTO_TCP, TCP_KEEPCNT,          KIND_INT,    true  },
+    { IPPROTO_TCP, TCP_USER_TIMEOUT,     KIND_INT,    true  },
+    { IPPROTO_TCP, TCP_NOTSENT_LOWAT,    KIND_SIZE,   true  },
+    { IPPROTO_TCP, TCP_CONGESTION,       KIND_STRING, true  },
+    { SOL_SOCKET,  SO_RCVBUF,            KIND_SIZE,   false },
+    { SOL_SOCKET,  SO_SNDBUF,            KIND_SIZE,   false },
+    { SOL_SOCKET,  SO_RCVLOWAT,          KIND_SIZE,   false },
+    { SOL_SOCKET,  SO_BUSY_POLL,         KIND_INT,    false },
+    { SOL_SOCKET,  SO_PREFER_BUSY_POLL,  KIND_FLAG,   false },
+    { SOL_SOCKET,  SO_PRIORITY,          KIND_INT,    false },
+    { SOL_SOCKET,  SO_MARK,              KIND_INT,    false },
+    { SOL_SOCKET,  SO_REUSEADDR,         KIND_FLAG,   false },
+    { SOL_SOCKET,  SO_REUSEPORT,         KIND_FLAG,   false },
+    { SOL_SOCKET,  SO_LINGER,            KIND_LINGER, false },
+    { IPPROTO_IP,  IP_TOS,               KIND_TOS,    false },
+};
+
+static const SubOptTable &
+OptionNames()
+{
+    static const SubOptTable table(s_names);
+    return table;
+}
+
+static void
+BadOption(const SubOptValue &opt, const char *reason)
+{
+    throw std::invalid_argument(std::string(opt.name, opt.nameLen + (opt.value ? opt.valueLen + 1 : 0)) +
+                                ": " + reason);
+}
+
+/*
+ * Convert the value of a suboption according to its kind.
+ */
+static int
+ParseValue(const SubOptValue &opt, int kind)
+{
+    char  text[32];
+    char *pEnd;
+
+    if (opt.value == NULL) {
+        if (kind != KIND_FLAG) {
+            BadOption(opt, "value required");
+        }
+        return 1;
+    }
+
+    if (opt.valueLen == 0 || opt.valueLen >= sizeof(text)) {
+        BadOption(opt, "bad value");
+    }
+    memcpy(text, opt.value, opt.valueLen);
+    text[opt.valueLen] = '\0';
+
+    if (kind == KIND_FLAG) {
+        if (strcmp(text, "1") == 0 || strcmp(text, "on") == 0 || strcmp(text, "yes") == 0) {
+            return 1;
+        }
+        if (strcmp(text, "0") == 0 || strcmp(text, "off") == 0 || strcmp(text, "no") == 0) {
+            return 0;
+        }
+        BadOption(opt, "expected 0 or 1");
+    }
+
+    errno = 0;
+    long long value = strtoll(text, &pEnd, 10);
+    if (pEnd == text || errno != 0) {
+        BadOption(opt, "not a number");
+    }
+
+    if (kind == KIND_SIZE) {
+        int shift = 0;
+
+        switch (*pEnd) {
+            case 'k': case 'K': shift = 10; pEnd++; break;
+            case 'm': case 'M': shift = 20; pEnd++; break;
+            case 'g': case 'G': shift = 30; pEnd++; break;
+            default: break;
+        }
+
+        // Shifting a negative or too large value is undefined, so range check first.
+        if (value < 0 || value > (INT_MAX >> shift)) {
+            BadOption(opt, "out of range");
+        }
+        value <<= shift;
+    }
+
+    if (*pEnd != '\0') {
+        BadOption(opt, "trailing characters");
+    }
+    if (value < 0 || value > INT_MAX) {
+        BadOption(opt, "out of range");
+    }
+    return (int)value;
+}
+
+SocketTuning::SocketTuning()
+{
+    m_count = 0;
+}
+
+SocketTuning::SocketTuning(const char *spec)
+{
+    m_count = 0;
+    Parse(spec);
+}
+
+void
+SocketTuning::Parse(const char *spec)
+{
+    const char  *pNext = spec;
+    SubOptValue  opt;
+
+    while (*pNext != '\0') {
+        int index = getsubopt(&pNext, OptionNames(), opt);
+
+        if (index < 0) {
+            if (opt.nameLen == 0) {
+                continue;
+            }
+            BadOption(opt, "unknown socket option");
+        }
+
+        const OptionDesc &desc = s_options[index];
+        Compiled compiled;
+
+        compiled.option = index;
+        compiled.text[0] = '\0';
+        if (desc.kind == KIND_STRING) {
+            if (opt.value == NULL || opt.valueLen == 0 || opt.valueLen >= sizeof(compiled.text)) {
+                BadOption(opt, "bad name");
+            }
+            memcpy(compiled.text, opt.value, opt.valueLen);
+            compiled.text[opt.valueLen] = '\0';
+            compiled.value = 0;
+        } else {
+            compiled.value = ParseValue(opt, desc.kind);
+        }
+
+        // A repeated option replaces the earlier one.
+        size_t i;
+        for (i = 0; i < m_count; i++) {
+            if (m_settings[i].option == index) {
+                break;
+            }
+        }
+        if (i == m_count) {
+            if (m_count == MAX_SETTINGS) {
+                BadOption(opt, "too many options");
+            }
+            m_count++;
+        }
+        m_settings[i] = compiled;
+    }
+}
+
+void
+SocketTuning::Apply(Socket &sock) const
+{
+    int type = -1;
+
+    for (size_t i = 0; i < m_count; i++) {
+        const Compiled   &setting = m_settings[i];
+        const OptionDesc &desc = s_options[setting.option];
+
+        // The socket type is only needed, and only fetched, for TCP options.
+        if (desc.tcpOnly) {
+            if (type == -1) {
+                socklen_t len = sizeof(type);
+                sock.GetSockOpt(SOL_SOCKET, SO_TYPE, &type, &len);
+            }
+            if (type != SOCK_STREAM) {
+                continue;
+            }
+        }
+
+        switch (desc.kind) {
+            case KIND_STRING:
+                sock.SetSockOpt(desc.level, desc.optName, setting.text, strlen(setting.text));
+                break;
+
+            case KIND_LINGER: {
+                struct linger lg;
+                lg.l_onoff = 1;
+                lg.l_linger = setting.value;
+                sock.SetSockOpt(desc.level, desc.optName, &lg, sizeof(lg));
+                break;
+            }
+
+            case KIND_TOS:
+                if (sock.GetAddrFamily() == AF_INET6) {
+                    sock.SetSockOpt(IPPROTO_IPV6, IPV6_TCLASS, &setting.value, sizeof(int));
+                } else {
+                    sock.SetSockOpt(desc.level, desc.optName, &setting.value, sizeof(int));
+                }
+                break;
+
+            default:
+                sock.SetSockOpt(desc.level, desc.optName, &setting.value, sizeof(int));
+                break;
+        }
+    }
+}
+
+size_t
+SocketTuning::Effective(Socket &sock, Setting *settings) const
+{
+    size_t filled = 0;
+
+    for (size_t i = 0; i < m_count; i++) {
+        const Compiled   &setting = m_settings[i];
+        const OptionDesc &desc = s_options[setting.option];
+        Setting          &out = settings[filled];
+
+        out.name = s_names[setting.option];
+        out.requested = setting.value;
+        out.effective = 0;
+
+        try {
+            switch (desc.kind) {
+                case KIND_STRING: {
+                    char      name[sizeof(setting.text)];
+                    socklen_t len = sizeof(name);
+                    sock.GetSockOpt(desc.level, desc.optName, name, &len);
+                    out.requested = 1;
+                    out.effective = (strncmp(name, setting.text, len) == 0);
+                    break;
+                }
+
+                case KIND_LINGER: {
+                    struct linger lg;
+                    socklen_t     len = sizeof(lg);
+                    sock.GetSockOpt(desc.level, desc.optName, &lg, &len);
+                    out.effective = lg.l_onoff ? lg.l_linger : -1;
+                    break;
+                }
+
+                default: {
+                    int       level = desc.level;
+                    int       optName = desc.optName;
+                    socklen_t len = sizeof(out.effective);
+                    if (desc.kind == KIND_TOS && sock.GetAddrFamily() == AF_INET6) {
+                        level = IPPROTO_IPV6;
+                        optName = IPV6_TCLASS;
+                    }
+                    sock.GetSockOpt(level, optName, &out.effective, &len);
+                    break;
+                }
+            }
+        } catch (const std::system_error &) {
+            // Options Apply() skipped, such as TCP options on a UDP socket,
+            // are not reported.
+            continue;
+        }
+        filled++;
+    }
+    return filled;
+}
@@ -0,0 +1,102 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Socket tuning specifications parsed from option strings
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef SOCKOPTS_HPP
+#define SOCKOPTS_HPP
+
+#include <stdint.h>
+#include <cstddef>
+#include "socket.hpp"
+
+/***
+ * @class A set of socket options compiled from a specification string such as
+ *
+ *            nodelay,rcvbuf=4M,busy_poll=50,quickack,congestion=bbr
+ *
+ *        The string is split with getsubopt and every name and value is checked
+ *        when the spec is parsed, so a typo is reported once at startup rather
+ *        than as a failed system call on each socket. Apply() then issues exactly
+ *        one SetSockOpt() per distinct option; a name given twice keeps the last
+ *        value. Numbers are decimal, sizes accept K, M and G suffixes and flags
+ *        accept =0 or =1.
+ */
+class SocketTuning
+{
+public:
+    /***
+     * Value requested and value the kernel reports for one option. For string
+     * options such as congestion, effective is 1 if the kernel uses the name given.
+     */
+    struct Setting
+    {
+        const char     *name;
+        int             requested;
+        int             effective;
+    };
+
+    static const size_t MAX_SETTINGS = 32;
+
+                        SocketTuning();
+
+    /***
+     * Class constructor that parses a spec.
+     *
+     * @param[IN] spec - Comma separated option list.
+     *
+     * @throws std::invalid_argument naming the offending suboption.
+     */
+    explicit            SocketTuning(const char *spec);
+
+    /***
+     * Add the options in a spec to the set. May be called more than once.
+     *
+     * @throws std::invalid_argument naming the offending suboption.
+     */
+    void                Parse(const char *spec);
+
+    /***
+     * Set every option in the set on a socket. Options that only apply to TCP
+     * are skipped on other socket types.
+     *
+     * @throws std::system_error if the kernel rejects an option.
+     */
+    void                Apply(Socket &sock) const;
+
+    /***
+     * Read back the value the kernel uses for every option in the set. Note that
+     * Linux reports twice the requested rcvbuf and sndbuf.
+     *
+     * @param[OUT] settings - Array of at least Size() entries.
+     *
+     * @return Number of entries filled in.
+     */
+    size_t              Effective(Socket &sock, Setting *settings) const;
+
+    size_t              Size() const { return m_count; }
+
+private:
+    struct Compiled
+    {
+        int             option;     // Index into the option descriptor table
+        int             value;
+        char            text[16];   // Value of string options
+    };
+
+    Compiled            m_settings[MAX_SETTINGS];
+    size_t              m_count;
+};
+
+#endif
@@ -0,0 +1,765 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Capture of Socket traffic to a pcap file and its replay
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <system_error>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+#include "socktap.hpp"
+#include "socket.hpp"
+
+static const uint32_t PCAP_MAGIC_US = 0xa1b2c3d4;
+static const uint32_t PCAP_MAGIC_NS = 0xa1b23c4d;
+static const uint32_t LINKTYPE_RAW = 101;
+
+// The file is mapped in pieces of this size as it grows.
+static const uint64_t CHUNK_SIZE = 64ULL << 20;
+
+static const int      FLOW_SLOTS = 64;
+static const int      FD_EPOCHS = 4096;
+static const size_t   MAX_HEADERS = 40 + 20;
+
+// How long a replay waits at the end for servers to close their connections.
+static const uint64_t LINGER_NS = 1000000000ULL;
+
+struct PcapFileHeader
+{
+    uint32_t    magic;
+    uint16_t    versionMajor;
+    uint16_t    versionMinor;
+    int32_t     thisZone;
+    uint32_t    sigFigs;
+    uint32_t    snapLen;
+    uint32_t    linkType;
+};
+
+struct PcapRecordHeader
+{
+    uint32_t    seconds;
+    uint32_t    fraction;       // Nanoseconds or microseconds, by the file magic
+    uint32_t    capturedLen;
+    uint32_t    originalLen;
+};
+
+/*
+ * Bumped when a descriptor is closed so cached flows of a reused number are
+ * refreshed. Descriptors share counters modulo FD_EPOCHS, which only costs
+ * an extra lookup.
+ */
+static std::atomic<uint32_t> s_fdEpoch[FD_EPOCHS];
+
+static std::atomic<uint64_t> s_nextSerial(1);
+
+static thread_local uint64_t t_tapSerial;
+static thread_local void    *t_pBuffer;
+
+std::atomic<SocketTap*> SocketTap::s_pActive(NULL);
+
+/*
+ * What a thread knows about one descriptor.
+ */
+struct SocketTap::Flow
+{
+    int32_t         fd;
+    uint32_t        epoch;
+    bool            tcp;
+    InetAddress     local;
+    InetAddress     peer;
+    uint32_t        seqOut;
+    uint32_t        seqIn;
+};
+
+struct SocketTap::ThreadBuffer
+{
+    std::atomic<bool>   busy;       // Held by the owner while appending and by Stop()
+    std::vector<char>   data;
+    size_t              used;
+    uint64_t            pending;    // Records in data
+    uint64_t            records;    // Records written to the file
+    uint64_t            bytes;
+    Flow                flows[FLOW_SLOTS];
+};
+
+static uint64_t
+MonotonicNs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void
+Put16(char *p, uint16_t value)
+{
+    value = htons(value);
+    memcpy(p, &value, 2);
+}
+
+static inline void
+Put32(char *p, uint32_t value)
+{
+    value = htonl(value);
+    memcpy(p, &value, 4);
+}
+
+static uint16_t
+Ipv4Checksum(const char *pHeader)
+{
+    uint32_t sum = 0;
+
+    for (int i = 0; i < 20; i += 2) {
+        sum += ((uint8_t)pHeader[i] << 8) | (uint8_t)pHeader[i + 1];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+static void
+Lock(std::atomic<bool> &busy)
+{
+    while (busy.exchange(true, std::memory_order_acquire)) {
+        sched_yield();
+    }
+}
+
+SocketTap::SocketTap(const char *path, uint32_t snapLen, size_t bufferSize, uint64_t maxSize)
+{
+    PcapFileHeader header;
+
+    m_snapLen = snapLen;
+    m_bufferSize = bufferSize > snapLen + sizeof(PcapRecordHeader) + MAX_HEADERS ?
+                   bufferSize : snapLen + sizeof(PcapRecordHeader) + MAX_HEADERS;
+    m_maxSize = maxSize;
+    m_serial = s_nextSerial.fetch_add(1);
+    m_offset.store(sizeof(header));
+    m_end.store(UINT64_MAX);
+    m_dropped.store(0);
+    m_stopped.store(false);
+    m_chunkCount = (size_t)((maxSize + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    m_chunks.reset(new std::atomic<char*>[m_chunkCount]);
+    for (size_t i = 0; i < m_chunkCount; i++) {
+        m_chunks[i].store(NULL);
+    }
+
+    if ((m_fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+    {
+	throw std::system_error(errno, std::system_category());
+    }
+
+    header.magic = PCAP_MAGIC_NS;
+    header.versionMajor = 2;
+    header.versionMinor = 4;
+    header.thisZone = 0;
+    header.sigFigs = 0;
+    header.snapLen = snapLen + MAX_HEADERS;
+    header.linkType = LINKTYPE_RAW;
+
+    if (pwrite(m_fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+    {
+        int err = errno;
+        close(m_fd);
+	throw std::system_error(err, std::system_category());
+    }
+}
+
+SocketTap::~SocketTap()
+{
+    Stop();
+    for (size_t i = 0; i < m_chunkCount; i++) {
+        char *p = m_chunks[i].load();
+        if (p != NULL) {
+            munmap(p, CHUNK_SIZE);
+        }
+    }
+    close(m_fd);
+}
+
+void
+SocketTap::Start()
+{
+    SocketTap *pNone = NULL;
+
+    if (m_stopped.load())
+    {
+	throw std::system_error(EINVAL, std::system_category());
+    }
+    if (!s_pActive.compare_exchange_strong(pNone, this))
+    {
+	throw std::system_error(EBUSY, std::system_category());
+    }
+}
+
+void
+SocketTap::Stop()
+{
+    SocketTap                  *pSelf = this;
+    std::vector<ThreadBuffer*>  buffers;
+
+    s_pActive.compare_exchange_strong(pSelf, NULL);
+    if (m_stopped.exchange(true)) {
+        return;
+    }
+
+    // No buffer is added once m_stopped is set.
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        for (size_t i = 0; i < m_buffers.size(); i++) {
+            buffers.push_back(m_buffers[i].get());
+        }
+    }
+
+    for (size_t i = 0; i < buffers.size(); i++) {
+        Lock(buffers[i]->busy);
+        Flush(*buffers[i]);
+        buffers[i]->busy.store(false, std::memory_order_release);
+    }
+
+    uint64_t end = m_offset.load();
+    if (end > m_end.load()) {
+        end = m_end.load();
+    }
+    if (ftruncate(m_fd, (off_t)end) < 0) {
+        // The records are intact; the file only keeps unused space at the end.
+    }
+}
+
+void
+SocketTap::Forget(int fd)
+{
+    if (fd >= 0) {
+        s_fdEpoch[fd % FD_EPOCHS].fetch_add(1, std::memory_order_release);
+    }
+}
+
+SocketTap::Stats
+SocketTap::GetStats() const
+{
+    Stats stats;
+
+    std::lock_guard<std::mutex> guard(m_lock);
+    stats.records = 0;
+    stats.bytes = 0;
+    stats.dropped = m_dropped.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < m_buffers.size(); i++) {
+        stats.records += m_buffers[i]->records;
+        stats.bytes += m_buffers[i]->bytes;
+    }
+    return stats;
+}
+
+SocketTap::ThreadBuffer *
+SocketTap::LocalBuffer()
+{
+    if (t_tapSerial == m_serial) {
+        return (ThreadBuffer *)t_pBuffer;
+    }
+
+    std::lock_guard<std::mutex> guard(m_lock);
+    if (m_stopped.load()) {
+        return NULL;
+    }
+
+    ThreadBuffer *pBuffer = new ThreadBuffer;
+    pBuffer->busy.store(false);
+    pBuffer->data.resize(m_bufferSize);
+    pBuffer->used = 0;
+    pBuffer->pending = 0;
+    pBuffer->records = 0;
+    pBuffer->bytes = 0;
+    for (int i = 0; i < FLOW_SLOTS; i++) {
+        pBuffer->flows[i].fd = -1;
+    }
+    m_buffers.push_back(std::unique_ptr<ThreadBuffer>(pBuffer));
+
+    t_tapSerial = m_serial;
+    t_pBuffer = pBuffer;
+    return pBuffer;
+}
+
+SocketTap::Flow &
+SocketTap::LookupFlow(ThreadBuffer &buffer, int fd)
+{
+    Flow    &flow = buffer.flows[(uint32_t)fd % FLOW_SLOTS];
+    uint32_t epoch = s_fdEpoch[fd % FD_EPOCHS].load(std::memory_order_acquire);
+
+    if (flow.fd == fd && flow.epoch == epoch) {
+        return flow;
+    }
+
+    InetSockAddr sa;
+    socklen_t    len;
+    int          type = SOCK_DGRAM;
+
+    flow.fd = fd;
+    flow.epoch = epoch;
+    flow.seqOut = 0;
+    flow.seqIn = 0;
+
+    len = sizeof(type);
+    getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len);
+    flow.tcp = type == SOCK_STREAM;
+
+    len = sizeof(sa);
+    flow.local = getsockname(fd, &sa.sa, &len) == 0 ? InetAddress::FromSockAddr(&sa.sa) : InetAddress();
+    len = sizeof(sa);
+    flow.peer = getpeername(fd, &sa.sa, &len) == 0 ? InetAddress::FromSockAddr(&sa.sa) : InetAddress();
+    return flow;
+}
+
+void
+SocketTap::Capture(int fd, int direction, const void *buff, int len, const InetAddress *pPeer)
+{
+    ThreadBuffer *pBuffer;
+
+    if (len < 0 || (pBuffer = LocalBuffer()) == NULL) {
+        return;
+    }
+
+    Lock(pBuffer->busy);
+    if (m_stopped.load(std::memory_order_relaxed)) {
+        pBuffer->busy.store(false, std::memory_order_release);
+        return;
+    }
+
+    Flow              &flow = LookupFlow(*pBuffer, fd);
+    const InetAddress &peer = pPeer != NULL ? *pPeer : flow.peer;
+    bool               ipv6 = peer.GetAddrFamily() != 0 ? peer.IsIpv6() : flow.local.IsIpv6();
+    size_t             ipLen = ipv6 ? 40 : 20;
+    size_t             l4Len = flow.tcp ? 20 : 8;
+    uint32_t           captured = (uint32_t)len < m_snapLen ? (uint32_t)len : m_snapLen;
+    size_t             need = sizeof(PcapRecordHeader) + ipLen + l4Len + captured;
+    struct timespec    ts;
+
+    if (pBuffer->used + need > pBuffer->data.size()) {
+        Flush(*pBuffer);
+    }
+
+    // Addresses of the other family, as on a dual stack socket, are left zero.
+    static const uint8_t zero[16] = { 0 };
+    const InetAddress   &src = direction == TAP_SEND ? flow.local : peer;
+    const InetAddress   &dst = direction == TAP_SEND ? peer : flow.local;
+    const uint8_t       *pSrc = src.IsIpv6() == ipv6 && src.GetAddrFamily() != 0 ? src.GetBytes() : zero;
+    const uint8_t       *pDst = dst.IsIpv6() == ipv6 && dst.GetAddrFamily() != 0 ? dst.GetBytes() : zero;
+    char                *p = &pBuffer->data[pBuffer->used];
+    PcapRecordHeader     record;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    record.seconds = (uint32_t)ts.tv_sec;
+    record.fraction = (uint32_t)ts.tv_nsec;
+    record.capturedLen = (uint32_t)(ipLen + l4Len + captured);
+    record.originalLen = (uint32_t)(ipLen + l4Len + len);
+    memcpy(p, &record, sizeof(record));
+    p += sizeof(record);
+
+    memset(p, 0, ipLen + l4Len);
+    uint32_t total = (uint32_t)(l4Len + len);
+    if (ipv6) {
+        p[0] = 0x60;
+        Put16(p + 4, total > 0xffff ? 0xffff : (uint16_t)total);
+        p[6] = flow.tcp ? IPPROTO_TCP : IPPROTO_UDP;
+        p[7] = 64;
+        memcpy(p + 8, pSrc, 16);
+        memcpy(p + 24, pDst, 16);
+    } else {
+        total += 20;
+        p[0] = 0x45;
+        Put16(p + 2, total > 0xffff ? 0xffff : (uint16_t)total);
+        Put16(p + 6, 0x4000);
+        p[8] = 64;
+        p[9] = flow.tcp ? IPPROTO_TCP : IPPROTO_UDP;
+        memcpy(p + 12, pSrc, 4);
+        memcpy(p + 16, pDst, 4);
+        Put16(p + 10, Ipv4Checksum(p));
+    }
+    p += ipLen;
+
+    Put16(p, src.GetPortNumber());
+    Put16(p + 2, dst.GetPortNumber());
+    if (flow.tcp) {
+        uint32_t &seq = direction == TAP_SEND ? flow.seqOut : flow.seqIn;
+        uint32_t  ack = direction == TAP_SEND ? flow.seqIn : flow.seqOut;
+
+        Put32(p + 4, seq);
+        Put32(p + 8, ack);
+        p[12] = 5 << 4;
+        p[13] = 0x18;           // PSH, ACK
+        Put16(p + 14, 0xffff);
+        seq += (uint32_t)len;
+    } else {
+        uint32_t udpLen = 8 + (uint32_t)len;
+        Put16(p + 4, udpLen > 0xffff ? 0xffff : (uint16_t)udpLen);
+    }
+    p += l4Len;
+
+    memcpy(p, buff, captured);
+    pBuffer->used += need;
+    pBuffer->pending++;
+
+    pBuffer->busy.store(false, std::memory_order_release);
+}
+
+/*
+ * Copy a thread's buffer into its reserved place in the file. Called with
+ * the buffer held.
+ */
+void
+SocketTap::Flush(ThreadBuffer &buffer)
+{
+    size_t   used = buffer.used;
+    uint64_t start;
+    uint64_t pos;
+
+    if (used == 0) {
+        return;
+    }
+
+    buffer.used = 0;
+    start = pos = m_offset.fetch_add(used);
+
+    if (pos + used <= m_maxSize) {
+        const char *pSrc = &buffer.data[0];
+        size_t      left = used;
+
+        while (left > 0) {
+            size_t   chunk = (size_t)(pos / CHUNK_SIZE);
+            uint64_t offset = pos % CHUNK_SIZE;
+            size_t   n = (size_t)(CHUNK_SIZE - offset) < left ? (size_t)(CHUNK_SIZE - offset) : left;
+            char    *pBase = MapChunk(chunk);
+
+            if (pBase == NULL) {
+                break;
+            }
+            memcpy(pBase + offset, pSrc, n);
+            pSrc += n;
+            pos += n;
+            left -= n;
+        }
+
+        if (left == 0) {
+            buffer.records += buffer.pending;
+            buffer.bytes += used;
+            buffer.pending = 0;
+            return;
+        }
+    }
+
+    // The file is full: everything from here on is lost, so it ends at start.
+    uint64_t end = m_end.load();
+    while (start < end && !m_end.compare_exchange_weak(end, start)) {
+    }
+    m_dropped.fetch_add(buffer.pending);
+    buffer.pending = 0;
+}
+
+char *
+SocketTap::MapChunk(size_t chunk)
+{
+    char *p;
+
+    if (chunk >= m_chunkCount) {
+        return NULL;
+    }
+    if ((p = m_chunks[chunk].load(std::memory_order_acquire)) != NULL) {
+        return p;
+    }
+
+    std::lock_guard<std::mutex> guard(m_lock);
+    if ((p = m_chunks[chunk].load(std::memory_order_relaxed)) != NULL) {
+        return p;
+    }
+
+    struct stat st;
+    off_t       end = (off_t)((chunk + 1) * CHUNK_SIZE);
+
+    // Allocate the blocks now: a store to a hole in the mapping on a full
+    // disk would raise SIGBUS instead of failing here.
+    if (fstat(m_fd, &st) < 0 || (st.st_size < end && posix_fallocate(m_fd, st.st_size, end - st.st_size) != 0)) {
+        return NULL;
+    }
+
+    void *pMap = mmap(NULL, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, (off_t)(chunk * CHUNK_SIZE));
+    if (pMap == MAP_FAILED) {
+        return NULL;
+    }
+
+    p = (char *)pMap;
+    m_chunks[chunk].store(p, std::memory_order_release);
+    return p;
+}
+
+PcapReplayer::PcapReplayer(const char *path)
+{
+    struct stat    st;
+    PcapFileHeader header;
+    int            fd;
+
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+    {
+	throw std::system_error(errno, std::system_category());
+    }
+    if (fstat(fd, &st) < 0)
+    {
+        int err = errno;
+        close(fd);
+	throw std::system_error(err, std::system_category());
+    }
+    if ((size_t)st.st_size < sizeof(header))
+    {
+        close(fd);
+	throw std::system_error(EINVAL, std::system_category());
+    }
+
+    m_size = (size_t)st.st_size;
+    void *pMap = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int   err = errno;
+    close(fd);
+    if (pMap == MAP_FAILED)
+    {
+	throw std::system_error(err, std::system_category());
+    }
+    m_pData = (const uint8_t *)pMap;
+
+    memcpy(&header, m_pData, sizeof(header));
+    m_swapped = header.magic == __builtin_bswap32(PCAP_MAGIC_US) ||
+                header.magic == __builtin_bswap32(PCAP_MAGIC_NS);
+    if (m_swapped) {
+        header.magic = __builtin_bswap32(header.magic);
+        header.linkType = __builtin_bswap32(header.linkType);
+    }
+    m_nanoseconds = header.magic == PCAP_MAGIC_NS;
+
+    if ((header.magic != PCAP_MAGIC_US && header.magic != PCAP_MAGIC_NS) ||
+        (header.linkType & 0xffff) != LINKTYPE_RAW)
+    {
+        munmap((void *)m_pData, m_size);
+	throw std::system_error(EINVAL, std::system_category());
+    }
+}
+
+PcapReplayer::~PcapReplayer()
+{
+    munmap((void *)m_pData, m_size);
+}
+
+/*
+ * Read and throw away whatever the server sent back, waiting up to timeout
+ * milliseconds for it.
+ *
+ * @return Number of connections the server closed.
+ */
+static int
+DrainReplies(int epollFd, int timeout)
+{
+    struct epoll_event events[64];
+    char               scratch[16384];
+    int                closed = 0;
+    int                n;
+
+    if ((n = epoll_wait(epollFd, events, 64, timeout)) <= 0) {
+        return 0;
+    }
+
+    for (int i = 0; i < n; i++) {
+        int     fd = ((Socket *)events[i].data.ptr)->GetDescriptor();
+        ssize_t bytes;
+
+        while ((bytes = recv(fd, scratch, sizeof(scratch), MSG_DONTWAIT)) > 0) {
+        }
+        if (bytes == 0 || (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            // Closed by the server; stop watching it.
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+            closed++;
+        }
+    }
+    return closed;
+}
+
+void
+PcapReplayer::Replay(uint16_t serverPort, const InetAddress &target, double speed)
+{
+    std::unordered_map<InetAddress, std::unique_ptr<Socket> > flows;
+    std::vector<char>   payload(65536);
+    size_t              pos = sizeof(PcapFileHeader);
+    uint64_t            start = MonotonicNs();
+    uint64_t            firstTime = 0;
+    bool                first = true;
+    int                 connections = 0;
+    int                 epollFd;
+
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    if ((epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+	throw std::system_error(errno, std::system_category());
+    }
+
+    try {
+        while (pos + sizeof(PcapRecordHeader) <= m_size) {
+            PcapRecordHeader record;
+
+            memcpy(&record, m_pData + pos, sizeof(record));
+            if (m_swapped) {
+                record.seconds = __builtin_bswap32(record.seconds);
+                record.fraction = __builtin_bswap32(record.fraction);
+                record.capturedLen = __builtin_bswap32(record.capturedLen);
+                record.originalLen = __builtin_bswap32(record.originalLen);
+            }
+            if (pos + sizeof(record) + record.capturedLen > m_size) {
+                break;
+            }
+
+            const uint8_t *pPacket = m_pData + pos + sizeof(record);
+            pos += sizeof(record) + record.capturedLen;
+
+            // Pull the addresses and ports out of the made up headers.
+            InetSockAddr sa;
+            size_t       ipLen;
+            int          protocol;
+
+            memset(&sa, 0, sizeof(sa));
+            if (record.capturedLen >= 40 && (pPacket[0] >> 4) == 6) {
+                ipLen = 40;
+                protocol = pPacket[6];
+                sa.v6.sin6_family = AF_INET6;
+                memcpy(&sa.v6.sin6_addr, pPacket + 8, 16);
+            } else if (record.capturedLen >= 20 && (pPacket[0] >> 4) == 4) {
+                ipLen = (pPacket[0] & 0xf) * 4;
+                protocol = pPacket[9];
+                sa.v4.sin_family = AF_INET;
+                memcpy(&sa.v4.sin_addr, pPacket + 12, 4);
+            } else {
+                continue;
+            }
+
+            if ((protocol != IPPROTO_TCP && protocol != IPPROTO_UDP) || record.capturedLen < ipLen + 8) {
+                continue;
+            }
+
+            const uint8_t *pL4 = pPacket + ipLen;
+            size_t         l4Len = protocol == IPPROTO_TCP ? (size_t)(pL4[12] >> 4) * 4 : 8;
+            uint16_t       dstPort = (uint16_t)((pL4[2] << 8) | pL4[3]);
+
+            if (dstPort != serverPort || record.capturedLen < ipLen + l4Len ||
+                record.originalLen <= ipLen + l4Len) {
+                continue;
+            }
+
+            size_t length = record.originalLen - ipLen - l4Len;
+            size_t captured = record.capturedLen - ipLen - l4Len;
+            if (length > payload.size()) {
+                length = payload.size();
+            }
+            if (captured > length) {
+                captured = length;
+            }
+
+            if (sa.sa.sa_family == AF_INET6) {
+                memcpy(&sa.v6.sin6_port, pL4, 2);
+            } else {
+                memcpy(&sa.v4.sin_port, pL4, 2);
+            }
+            InetAddress source = InetAddress::FromSockAddr(&sa.sa);
+
+            std::unique_ptr<Socket> &pSock = flows[source];
+            if (!pSock) {
+                struct epoll_event event;
+
+                pSock.reset(new Socket(target.IsIpv6(), protocol == IPPROTO_TCP ? SOCK_STREAM : SOCK_DGRAM));
+                pSock->Connect(target);
+                event.events = EPOLLIN;
+                event.data.ptr = pSock.get();
+                epoll_ctl(epollFd, EPOLL_CTL_ADD, pSock->GetDescriptor(), &event);
+                m_stats.flows++;
+                if (protocol == IPPROTO_TCP) {
+                    connections++;
+                }
+            }
+
+            // Hold the packet until its place in the scaled timeline.
+            uint64_t stamp = (uint64_t)record.seconds * 1000000000ULL +
+                             (m_nanoseconds ? record.fraction : (uint64_t)record.fraction * 1000);
+            uint64_t now = MonotonicNs();
+
+            if (first) {
+                firstTime = stamp;
+                first = false;
+            }
+            if (speed > 0 && stamp < firstTime) {
+                // Records written by several threads are not strictly in time
+                // order, and the realtime clock behind the stamps can step
+                // back. A packet stamped before the first one has no place in
+                // the timeline; it goes out at once and is not counted as lag.
+                DrainReplies(epollFd, 0);
+            } else if (speed > 0) {
+                uint64_t due = start + (uint64_t)((double)(stamp - firstTime) / speed);
+
+                while ((now = MonotonicNs()) < due) {
+                    DrainReplies(epollFd, (int)((due - now) / 1000000));
+                }
+                if (now - due > m_stats.maxLagNs) {
+                    m_stats.maxLagNs = now - due;
+                }
+            } else {
+                DrainReplies(epollFd, 0);
+            }
+
+            // Bytes the capture cut off are sent as zeros.
+            memcpy(&payload[0], pPacket + ipLen + l4Len, captured);
+            memset(&payload[captured], 0, length - captured);
+
+            for (size_t sent = 0; sent < length; ) {
+                sent += pSock->Send(&payload[sent], (int)(length - sent), MSG_NOSIGNAL);
+                if (protocol == IPPROTO_UDP) {
+                    break;
+                }
+            }
+
+            m_stats.packets++;
+            m_stats.bytes += length;
+        }
+
+        // Half close the connections and read until the server is done, so
+        // it is not reset with replies still in flight.
+        for (std::unordered_map<InetAddress, std::unique_ptr<Socket> >::iterator it = flows.begin();
+             it != flows.end(); ++it) {
+            shutdown(it->second->GetDescriptor(), SHUT_WR);
+        }
+        uint64_t deadline = MonotonicNs() + LINGER_NS;
+        while (connections > 0 && MonotonicNs() < deadline) {
+            connections -= DrainReplies(epollFd, 10);
+        }
+    } catch (...) {
+        close(epollFd);
+        throw;
+    }
+
+    close(epollFd);
+}
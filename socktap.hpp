@@ -0,0 +1,193 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Capture of Socket traffic to a pcap file and its replay
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef SOCKTAP_HPP
+#define SOCKTAP_HPP
+
+#include <stdint.h>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "inetaddr.hpp"
+
+enum TapDirection
+{
+    TAP_SEND,
+    TAP_RECV
+};
+
+/***
+ * @class Records what passes through Socket::Send(), Recv(), SendTo() and
+ *        RecvFrom() into a nanosecond pcap file. Each operation becomes one
+ *        packet with a made up IPv4 or IPv6 and UDP or TCP header carrying the
+ *        local and peer addresses, so the file opens in any pcap tool. TCP
+ *        sequence numbers count the bytes of each connection as seen by one
+ *        thread; checksums are left zero.
+ *
+ *        Records are appended to a buffer owned by the calling thread. A full
+ *        buffer reserves its place in the file with one atomic add and is
+ *        copied into a shared writable mapping of the file, so threads never
+ *        wait for each other or for a write() call. Addresses and the protocol
+ *        of a descriptor are looked up once per thread and cached until the
+ *        Socket holding it is closed.
+ *
+ *        Only one tap is active at a time. Stop() may be called while other
+ *        threads use sockets; the destructor may not.
+ */
+class SocketTap
+{
+public:
+    struct Stats
+    {
+        uint64_t        records;
+        uint64_t        bytes;          // Bytes written to the file
+        uint64_t        dropped;        // Records lost because the file was full
+    };
+
+    /***
+     * Class constructor. Creates or truncates the file and writes its header.
+     *
+     * @param[IN] path       - Capture file.
+     * @param[IN] snapLen    - Payload bytes kept per operation. Lower it to cut
+     *                         the cost of a tap left running in production; the
+     *                         replayer pads cut payloads with zeros.
+     * @param[IN] bufferSize - Bytes buffered per thread before they are copied to the file.
+     * @param[IN] maxSize    - Largest file to write.
+     *
+     * @throws std::system_error if the file cannot be created.
+     */
+                        SocketTap(const char *path, uint32_t snapLen = 65535,
+                                  size_t bufferSize = 256 * 1024, uint64_t maxSize = 1ULL << 32);
+                        ~SocketTap();
+
+    /***
+     * Make this the tap every Socket reports to.
+     *
+     * @throws std::system_error with EBUSY if another tap is active.
+     */
+    void                Start();
+
+    /***
+     * Stop capturing, write out every thread's buffer and trim the file to
+     * the data written.
+     */
+    void                Stop();
+
+    /***
+     * Returns the active tap or NULL. This is the only cost a Socket pays when
+     * nothing is being captured.
+     */
+    static SocketTap   *Active() { return s_pActive.load(std::memory_order_acquire); }
+
+    /***
+     * Record one operation.
+     *
+     * @param[IN] fd        - Socket descriptor.
+     * @param[IN] direction - TAP_SEND or TAP_RECV.
+     * @param[IN] pPeer     - Peer address, or NULL for a connected socket.
+     */
+    void                Capture(int fd, int direction, const void *buff, int len, const InetAddress *pPeer);
+
+    /***
+     * A descriptor is being closed; drop what any thread cached about it.
+     */
+    static void         Forget(int fd);
+
+    Stats               GetStats() const;
+
+private:
+    struct Flow;
+    struct ThreadBuffer;
+
+                        SocketTap(const SocketTap &);
+    SocketTap          &operator=(const SocketTap &);
+
+    ThreadBuffer       *LocalBuffer();
+    Flow               &LookupFlow(ThreadBuffer &buffer, int fd);
+    void                Flush(ThreadBuffer &buffer);
+    char               *MapChunk(size_t chunk);
+
+    static std::atomic<SocketTap*>  s_pActive;
+
+    int                                         m_fd;
+    uint32_t                                    m_snapLen;
+    size_t                                      m_bufferSize;
+    uint64_t                                    m_maxSize;
+    uint64_t                                    m_serial;
+    std::atomic<uint64_t>                       m_offset;   // Next free byte of the file
+    std::atomic<uint64_t>                       m_end;      // End of the data, once the file is full
+    std::atomic<uint64_t>                       m_dropped;
+    std::atomic<bool>                           m_stopped;
+    size_t                                      m_chunkCount;
+    std::unique_ptr<std::atomic<char*>[]>       m_chunks;
+    mutable std::mutex                          m_lock;     // Guards m_buffers and chunk mapping
+    std::vector<std::unique_ptr<ThreadBuffer> > m_buffers;
+};
+
+/***
+ * @class Sends the traffic of a capture to a server again, with the original
+ *        timing or scaled by a speed factor. Every captured payload addressed
+ *        to the server port is replayed; each source address and port of the
+ *        capture gets its own connected socket, TCP or UDP as captured, so
+ *        the server sees the same number of flows. Replies are read and
+ *        discarded.
+ */
+class PcapReplayer
+{
+public:
+    struct Stats
+    {
+        uint64_t        packets;
+        uint64_t        bytes;
+        uint64_t        flows;
+        uint64_t        maxLagNs;       // Latest a packet went out against its schedule
+    };
+
+    /***
+     * Class constructor. Maps the capture file.
+     *
+     * @throws std::system_error if the file cannot be read or is not a raw IP capture.
+     */
+    explicit            PcapReplayer(const char *path);
+                        ~PcapReplayer();
+
+    /***
+     * Replay the capture.
+     *
+     * @param[IN] serverPort - Port the captured server listened on.
+     * @param[IN] target     - Address of the server to drive.
+     * @param[IN] speed      - 2.0 replays twice as fast, 0 as fast as possible.
+     *
+     * @throws std::system_error if a connection or send fails.
+     */
+    void                Replay(uint16_t serverPort, const InetAddress &target, double speed = 1.0);
+
+    const Stats        &GetStats() const { return m_stats; }
+
+private:
+                        PcapReplayer(const PcapReplayer &);
+    PcapReplayer       &operator=(const PcapReplayer &);
+
+    const uint8_t      *m_pData;
+    size_t              m_size;
+    bool                m_nanoseconds;
+    bool                m_swapped;
+    Stats               m_stats;
+};
+
+#endif
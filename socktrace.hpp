@@ -0,0 +1,57 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Statically defined tracepoints for Socket operations
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef SOCKTRACE_HPP
+#define SOCKTRACE_HPP
+
+/*
+ * USDT probes of provider "socket", one pair per Socket operation:
+ *
+ *     <op>_entry(fd, len, timeout, peer)
+ *     <op>_return(fd, result, error, peer)
+ *
+ * for op in connect, bind, listen, accept, send, sendto, recv and recvfrom.
+ * len is the byte count requested, or the backlog for listen; timeout is in
+ * milliseconds and -1 for calls without one. result is the byte count or
+ * return value, -1 on failure with the errno in error. peer points to a
+ * sockaddr_in or sockaddr_in6, or is 0 when the call has no address.
+ *
+ * getsockopt, setsockopt, getsockname and fcntl have the same pairs, but their
+ * entry probes carry the call's own arguments in place of len and timeout:
+ * level and option name for getsockopt and setsockopt, command and argument
+ * for fcntl, and 0 and -1 for getsockname. getsockname_return passes the local
+ * address as peer.
+ *
+ * A probe compiles to a single nop plus a note in the ELF file, so it costs
+ * nothing until a tracer attaches; the arguments are values already in
+ * registers. Without <sys/sdt.h>, or with SOCKET_NO_PROBES defined, the macro
+ * expands to nothing. The scripts in tools/ show how to use them.
+ */
+#if defined(__has_include) && !defined(SOCKET_NO_PROBES)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SOCKET_PROBES 1
+#endif
+#endif
+
+#ifdef SOCKET_PROBES
+#define SOCKET_PROBE(name, fd, a, b, peer) \
+    DTRACE_PROBE4(socket, name, (int)(fd), (long)(a), (long)(b), (const void *)(peer))
+#else
+#define SOCKET_PROBE(name, fd, a, b, peer) do { } while (0)
+#endif
+
+#endif
@@ -0,0 +1,438 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Periodic TCP_INFO sampling of live connections
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <system_error>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <linux/rtnetlink.h>
+#include <linux/tcp.h>
+
+#include "tcpinfo.hpp"
+
+static const size_t NETLINK_BUFFER = 64 * 1024;
+
+// Socket states from the kernel's net/tcp_states.h, which is not exported.
+enum
+{
+    STATE_TIME_WAIT = 6,
+    STATE_CLOSE = 7,
+    STATE_LISTEN = 10
+};
+
+static uint64_t
+MonotonicNs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+TcpInfoHistogram::TcpInfoHistogram()
+{
+    Reset();
+}
+
+void
+TcpInfoHistogram::Reset()
+{
+    memset(m_counts, 0, sizeof(m_counts));
+    m_count = 0;
+    m_max = 0;
+}
+
+int
+TcpInfoHistogram::Bucket(uint64_t value)
+{
+    if (value < (1u << SUB_BITS)) {
+        return (int)value;
+    }
+    int shift = 63 - __builtin_clzll(value) - SUB_BITS;
+    return ((shift + 1) << SUB_BITS) + (int)((value >> shift) - (1u << SUB_BITS));
+}
+
+uint64_t
+TcpInfoHistogram::UpperBound(int bucket)
+{
+    if (bucket < (1 << SUB_BITS)) {
+        return (uint64_t)bucket;
+    }
+    int      shift = (bucket >> SUB_BITS) - 1;
+    uint64_t mantissa = (uint64_t)(bucket & ((1 << SUB_BITS) - 1)) + (1u << SUB_BITS);
+
+    // Wraps to UINT64_MAX for the last bucket.
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void
+TcpInfoHistogram::Record(uint64_t value)
+{
+    m_counts[Bucket(value)]++;
+    m_count++;
+    if (value > m_max) {
+        m_max = value;
+    }
+}
+
+uint64_t
+TcpInfoHistogram::Percentile(double percentile) const
+{
+    if (m_count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * m_count + 0.5);
+    uint64_t seen = 0;
+
+    if (rank == 0) {
+        rank = 1;
+    }
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += m_counts[i];
+        if (seen >= rank) {
+            uint64_t bound = UpperBound(i);
+            return bound < m_max ? bound : m_max;
+        }
+    }
+    return m_max;
+}
+
+TcpInfoSampler::TcpInfoSampler(SampleMode mode, size_t depth)
+{
+    m_mode = mode;
+    m_depth = depth > 0 ? depth : 1;
+    m_netlinkFd = -1;
+    m_used = 0;
+    m_cursor = 0;
+    m_startNs = MonotonicNs();
+    m_nowMs = 0;
+    memset(&m_cost, 0, sizeof(m_cost));
+
+    if (mode == SAMPLE_NETLINK) {
+        if ((m_netlinkFd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG)) < 0)
+        {
+	    throw std::system_error(errno, std::system_category());
+        }
+        m_buffer.resize(NETLINK_BUFFER);
+    }
+}
+
+TcpInfoSampler::~TcpInfoSampler()
+{
+    if (m_netlinkFd >= 0) {
+        close(m_netlinkFd);
+    }
+}
+
+ConnHandle
+TcpInfoSampler::Track(int fd)
+{
+    struct stat st;
+    ConnHandle  handle;
+    Entry      *pEntry;
+
+    // The socket inode is what sock_diag reports it by.
+    if (fstat(fd, &st) < 0)
+    {
+	throw std::system_error(errno, std::system_category());
+    }
+
+    if (!m_free.empty()) {
+        handle.index = m_free.back();
+        m_free.pop_back();
+        pEntry = &m_entries[handle.index];
+    } else {
+        handle.index = (uint32_t)m_entries.size();
+        m_entries.push_back(Entry());
+        m_samples.resize(m_samples.size() + m_depth);
+        pEntry = &m_entries.back();
+        pEntry->generation = 0;
+    }
+
+    pEntry->fd = fd;
+    pEntry->inode = (uint64_t)st.st_ino;
+    pEntry->head = 0;
+    pEntry->count = 0;
+    handle.generation = pEntry->generation;
+
+    m_byInode[pEntry->inode] = handle.index;
+    m_used++;
+    return handle;
+}
+
+void
+TcpInfoSampler::Untrack(ConnHandle handle)
+{
+    Entry *pEntry = (Entry *)Lookup(handle);
+
+    if (pEntry == NULL) {
+        return;
+    }
+
+    m_byInode.erase(pEntry->inode);
+    pEntry->fd = -1;
+    pEntry->generation++;
+    m_free.push_back(handle.index);
+    m_used--;
+}
+
+const TcpInfoSampler::Entry *
+TcpInfoSampler::Lookup(ConnHandle handle) const
+{
+    if (handle.index >= m_entries.size()) {
+        return NULL;
+    }
+
+    const Entry *pEntry = &m_entries[handle.index];
+    if (pEntry->fd < 0 || pEntry->generation != handle.generation) {
+        return NULL;
+    }
+    return pEntry;
+}
+
+/*
+ * Append a sample built from a struct tcp_info of len bytes, which is shorter
+ * than ours when the kernel is older than the headers.
+ */
+void
+TcpInfoSampler::Store(uint32_t index, const void *pInfo, size_t len)
+{
+    struct tcp_info info;
+    Entry          &entry = m_entries[index];
+    TcpSample      &sample = m_samples[index * m_depth + entry.head];
+
+    memset(&info, 0, sizeof(info));
+    memcpy(&info, pInfo, len < sizeof(info) ? len : sizeof(info));
+
+    sample.timeMs = m_nowMs;
+    sample.rttUs = info.tcpi_rtt;
+    sample.rttVarUs = info.tcpi_rttvar;
+    sample.minRttUs = info.tcpi_min_rtt;
+    sample.cwnd = info.tcpi_snd_cwnd;
+    sample.ssthresh = info.tcpi_snd_ssthresh;
+    sample.totalRetrans = info.tcpi_total_retrans;
+    sample.lost = info.tcpi_lost;
+    sample.deliveryRate = info.tcpi_delivery_rate;
+    sample.bytesAcked = info.tcpi_bytes_acked;
+
+    entry.head = (uint32_t)((entry.head + 1) % m_depth);
+    if (entry.count < m_depth) {
+        entry.count++;
+    }
+}
+
+size_t
+TcpInfoSampler::Sample(size_t limit)
+{
+    uint64_t start = MonotonicNs();
+    size_t   sampled;
+
+    m_cost.syscalls = 0;
+    m_nowMs = (uint32_t)((start - m_startNs) / 1000000);
+    if (m_mode == SAMPLE_NETLINK) {
+        sampled = SampleNetlink();
+    } else {
+        sampled = SampleSockOpt(limit);
+    }
+
+    m_cost.sampled = sampled;
+    m_cost.elapsedNs = MonotonicNs() - start;
+    return sampled;
+}
+
+size_t
+TcpInfoSampler::SampleSockOpt(size_t limit)
+{
+    size_t          total = m_entries.size();
+    size_t          sampled = 0;
+    struct tcp_info info;
+
+    if (limit == 0 || limit > m_used) {
+        limit = m_used;
+    }
+
+    for (size_t visited = 0; visited < total && sampled < limit; visited++) {
+        if (m_cursor >= total) {
+            m_cursor = 0;
+        }
+
+        uint32_t index = (uint32_t)m_cursor++;
+        if (m_entries[index].fd < 0) {
+            continue;
+        }
+
+        socklen_t len = sizeof(info);
+        m_cost.syscalls++;
+        if (getsockopt(m_entries[index].fd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0) {
+            continue;
+        }
+        Store(index, &info, len);
+        sampled++;
+    }
+    return sampled;
+}
+
+size_t
+TcpInfoSampler::SampleNetlink()
+{
+    if (m_used == 0) {
+        return 0;
+    }
+    return DumpFamily(AF_INET) + DumpFamily(AF_INET6);
+}
+
+/*
+ * Dump every TCP socket of one address family with its tcp_info and store a
+ * sample for those that are tracked.
+ */
+size_t
+TcpInfoSampler::DumpFamily(int family)
+{
+    struct
+    {
+        struct nlmsghdr         nlh;
+        struct inet_diag_req_v2 req;
+    } request;
+    struct sockaddr_nl kernel;
+    size_t             sampled = 0;
+
+    memset(&request, 0, sizeof(request));
+    request.nlh.nlmsg_len = sizeof(request);
+    request.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    request.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request.req.sdiag_family = (uint8_t)family;
+    request.req.sdiag_protocol = IPPROTO_TCP;
+    request.req.idiag_ext = 1 << (INET_DIAG_INFO - 1);
+    // Everything but listeners, time wait and closed sockets.
+    request.req.idiag_states = ~((1u << STATE_LISTEN) | (1u << STATE_TIME_WAIT) | (1u << STATE_CLOSE));
+
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+
+    m_cost.syscalls++;
+    if (sendto(m_netlinkFd, &request, sizeof(request), 0, (sockaddr *)&kernel, sizeof(kernel)) < 0)
+    {
+	throw std::system_error(errno, std::system_category());
+    }
+
+    for (;;) {
+        ssize_t bytes;
+
+        m_cost.syscalls++;
+        if ((bytes = recv(m_netlinkFd, &m_buffer[0], m_buffer.size(), 0)) < 0)
+        {
+            if (errno == EINTR) {
+                continue;
+            }
+	    throw std::system_error(errno, std::system_category());
+        }
+
+        int len = (int)bytes;
+        for (struct nlmsghdr *pNlh = (struct nlmsghdr *)&m_buffer[0]; NLMSG_OK(pNlh, len); pNlh = NLMSG_NEXT(pNlh, len)) {
+            if (pNlh->nlmsg_type == NLMSG_DONE) {
+                return sampled;
+            }
+            if (pNlh->nlmsg_type == NLMSG_ERROR) {
+                struct nlmsgerr *pErr = (struct nlmsgerr *)NLMSG_DATA(pNlh);
+                throw std::system_error(-pErr->error, std::system_category());
+            }
+            if (pNlh->nlmsg_type != SOCK_DIAG_BY_FAMILY) {
+                continue;
+            }
+
+            struct inet_diag_msg *pMsg = (struct inet_diag_msg *)NLMSG_DATA(pNlh);
+            std::unordered_map<uint64_t, uint32_t>::const_iterator it = m_byInode.find(pMsg->idiag_inode);
+            if (it == m_byInode.end()) {
+                continue;
+            }
+
+            int attrLen = (int)(pNlh->nlmsg_len - NLMSG_LENGTH(sizeof(*pMsg)));
+            for (struct rtattr *pAttr = (struct rtattr *)(pMsg + 1); RTA_OK(pAttr, attrLen); pAttr = RTA_NEXT(pAttr, attrLen)) {
+                if (pAttr->rta_type == INET_DIAG_INFO) {
+                    Store(it->second, RTA_DATA(pAttr), RTA_PAYLOAD(pAttr));
+                    sampled++;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+size_t
+TcpInfoSampler::GetSamples(ConnHandle handle, TcpSample *pOut, size_t max) const
+{
+    const Entry *pEntry = Lookup(handle);
+    size_t       n = 0;
+
+    if (pEntry == NULL) {
+        return 0;
+    }
+
+    const TcpSample *pRing = &m_samples[handle.index * m_depth];
+    for (size_t slot = pEntry->head; n < pEntry->count && n < max; n++) {
+        slot = (slot + m_depth - 1) % m_depth;
+        pOut[n] = pRing[slot];
+    }
+    return n;
+}
+
+const TcpSample *
+TcpInfoSampler::Latest(ConnHandle handle) const
+{
+    const Entry *pEntry = Lookup(handle);
+
+    if (pEntry == NULL || pEntry->count == 0) {
+        return NULL;
+    }
+    return &m_samples[handle.index * m_depth + (pEntry->head + m_depth - 1) % m_depth];
+}
+
+void
+TcpInfoSampler::Summarize(TcpInfoSummary &summary) const
+{
+    summary.rttUs.Reset();
+    summary.minRttUs.Reset();
+    summary.cwnd.Reset();
+    summary.retransmits.Reset();
+    summary.deliveryRate.Reset();
+    summary.connections = 0;
+
+    for (size_t i = 0; i < m_entries.size(); i++) {
+        const Entry &entry = m_entries[i];
+
+        if (entry.fd < 0 || entry.count == 0) {
+            continue;
+        }
+
+        const TcpSample *pRing = &m_samples[i * m_depth];
+        const TcpSample &newest = pRing[(entry.head + m_depth - 1) % m_depth];
+        const TcpSample &oldest = pRing[(entry.head + m_depth - entry.count) % m_depth];
+
+        summary.rttUs.Record(newest.rttUs);
+        summary.minRttUs.Record(newest.minRttUs);
+        summary.cwnd.Record(newest.cwnd);
+        summary.retransmits.Record(newest.totalRetrans - oldest.totalRetrans);
+        summary.deliveryRate.Record(newest.deliveryRate);
+        summary.connections++;
+    }
+}
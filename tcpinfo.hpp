@@ -0,0 +1,210 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Periodic TCP_INFO sampling of live connections
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef TCPINFO_HPP
+#define TCPINFO_HPP
+
+#include <stdint.h>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+#include "socket.hpp"
+#include "connection.hpp"
+
+/***
+ * @struct The fields of struct tcp_info worth keeping, in 48 bytes.
+ */
+struct TcpSample
+{
+    uint32_t    timeMs;         // Milliseconds since the sampler was created
+    uint32_t    rttUs;          // Smoothed round trip time
+    uint32_t    rttVarUs;
+    uint32_t    minRttUs;
+    uint32_t    cwnd;           // Congestion window in segments
+    uint32_t    ssthresh;
+    uint32_t    totalRetrans;   // Segments retransmitted over the connection's life
+    uint32_t    lost;           // Segments currently thought lost
+    uint64_t    deliveryRate;   // Bytes per second, from the last ACKed flight
+    uint64_t    bytesAcked;
+};
+
+/***
+ * @class Histogram of 64 bit values with buckets a sixteenth of a power of two
+ *        wide, so any percentile is within about 6% of the true value.
+ */
+class TcpInfoHistogram
+{
+public:
+                        TcpInfoHistogram();
+
+    void                Record(uint64_t value);
+    void                Reset();
+
+    /***
+     * @param[IN] percentile - 0 to 100.
+     *
+     * @return Upper bound of the bucket holding the percentile, 0 if empty.
+     */
+    uint64_t            Percentile(double percentile) const;
+
+    uint64_t            Count() const { return m_count; }
+    uint64_t            Max() const { return m_max; }
+
+private:
+    static const int    SUB_BITS = 4;
+    static const int    BUCKETS = (65 - SUB_BITS) << SUB_BITS;
+
+    static int          Bucket(uint64_t value);
+    static uint64_t     UpperBound(int bucket);
+
+    uint32_t            m_counts[BUCKETS];
+    uint64_t            m_count;
+    uint64_t            m_max;
+};
+
+/***
+ * @struct Distributions over every tracked connection, built from the newest
+ *         sample of each and, for retransmits, the change across its ring.
+ */
+struct TcpInfoSummary
+{
+    TcpInfoHistogram    rttUs;
+    TcpInfoHistogram    minRttUs;
+    TcpInfoHistogram    cwnd;
+    TcpInfoHistogram    retransmits;    // Retransmitted segments within the ring window
+    TcpInfoHistogram    deliveryRate;
+    size_t              connections;
+};
+
+/***
+ * @class Samples TCP_INFO for a set of connections and keeps the last few samples
+ *        of each in one flat ring buffer, depth entries per connection. The
+ *        sampler does not own the descriptors; Untrack() a connection before
+ *        closing it.
+ *
+ *        By default each connection costs one getsockopt() call per sample, and
+ *        Sample() takes a limit so a large set is swept across several calls at a
+ *        bounded cost each. With SAMPLE_NETLINK one sock_diag dump returns
+ *        TCP_INFO for every TCP socket in the network namespace, matched to the
+ *        tracked ones by inode, which is far fewer system calls when most sockets
+ *        on the host are tracked and more work when few of them are.
+ *
+ *        An object is used by one thread at a time.
+ */
+class TcpInfoSampler
+{
+public:
+    enum SampleMode
+    {
+        SAMPLE_GETSOCKOPT,
+        SAMPLE_NETLINK
+    };
+
+    /***
+     * What the last Sample() call cost.
+     */
+    struct SampleCost
+    {
+        size_t          sampled;        // Connections that got a new sample
+        size_t          syscalls;
+        uint64_t        elapsedNs;
+    };
+
+    /***
+     * Class constructor.
+     *
+     * @param[IN] mode  - How TCP_INFO is read.
+     * @param[IN] depth - Samples kept per connection.
+     *
+     * @throws std::system_error if the netlink socket cannot be opened.
+     */
+                        TcpInfoSampler(SampleMode mode = SAMPLE_GETSOCKOPT, size_t depth = 8);
+                        ~TcpInfoSampler();
+
+    /***
+     * Start sampling a connected TCP socket.
+     *
+     * @throws std::system_error if the descriptor is not valid.
+     */
+    ConnHandle          Track(int fd);
+    ConnHandle          Track(Socket &sock) { return Track(sock.GetDescriptor()); }
+    void                Untrack(ConnHandle handle);
+
+    /***
+     * Take a sample of up to limit connections, continuing round robin from
+     * where the previous call stopped. In SAMPLE_NETLINK mode the limit is
+     * ignored and every tracked connection is sampled.
+     *
+     * @param[IN] limit - Most connections to sample, 0 for all of them.
+     *
+     * @return Number of connections sampled.
+     *
+     * @throws std::system_error if the netlink dump fails.
+     */
+    size_t              Sample(size_t limit = 0);
+
+    /***
+     * Copy the samples of a connection, newest first.
+     *
+     * @return Number of samples copied.
+     */
+    size_t              GetSamples(ConnHandle handle, TcpSample *pOut, size_t max) const;
+
+    /***
+     * Returns the newest sample of a connection or NULL if it has none.
+     */
+    const TcpSample    *Latest(ConnHandle handle) const;
+
+    void                Summarize(TcpInfoSummary &summary) const;
+
+    const SampleCost   &GetLastCost() const { return m_cost; }
+    size_t              Size() const { return m_used; }
+
+private:
+    struct Entry
+    {
+        int32_t         fd;
+        uint32_t        generation;
+        uint64_t        inode;
+        uint32_t        head;           // Ring slot the next sample goes to
+        uint32_t        count;
+    };
+
+                        TcpInfoSampler(const TcpInfoSampler &);
+    TcpInfoSampler     &operator=(const TcpInfoSampler &);
+
+    const Entry        *Lookup(ConnHandle handle) const;
+    void                Store(uint32_t index, const void *pInfo, size_t len);
+    size_t              SampleSockOpt(size_t limit);
+    size_t              SampleNetlink();
+    size_t              DumpFamily(int family);
+
+    SampleMode                              m_mode;
+    size_t                                  m_depth;
+    int                                     m_netlinkFd;
+    std::vector<Entry>                      m_entries;
+    std::vector<TcpSample>                  m_samples;
+    std::vector<uint32_t>                   m_free;
+    std::unordered_map<uint64_t, uint32_t>  m_byInode;
+    std::vector<char>                       m_buffer;
+    size_t                                  m_used;
+    size_t                                  m_cursor;
+    uint64_t                                m_startNs;
+    uint32_t                                m_nowMs;        // Time stamp of this Sample() call
+    SampleCost                              m_cost;
+};
+
+#endif
@@ -0,0 +1,314 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+UDP server giving busy peers their own connected socket
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <system_error>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+
+#include "udpsession.hpp"
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF    51
+#endif
+
+static uint32_t
+MonotonicMs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/*
+ * Send every datagram that no connected socket claims to the first socket of
+ * the reuseport group, which is the shared one. Connected sockets are matched
+ * before the program runs, so promoted peers still reach their own socket.
+ */
+static bool
+AttachSteering(int fd)
+{
+    struct sock_filter code[] = { BPF_STMT(BPF_RET | BPF_K, 0) };
+    struct sock_fprog  prog;
+
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == 0;
+}
+
+UdpSessionServer::UdpSessionServer(const InetAddress &local, const Options &options) :
+    m_options(options), m_shared(local.IsIpv6(), SOCK_DGRAM)
+{
+    struct epoll_event event;
+    int                on = 1;
+
+    m_ready = 0;
+    m_next = 0;
+    m_hotCheck = 0;
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    m_shared.SetSockOpt(SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    m_shared.Bind(local);
+    m_shared.GetSockName(m_local);
+    m_canPromote = AttachSteering(m_shared.GetDescriptor());
+
+    if ((m_epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+	throw std::system_error(errno, std::system_category());
+    }
+
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_shared.GetDescriptor(), &event) < 0)
+    {
+        int error = errno;
+        close(m_epollFd);
+	throw std::system_error(error, std::system_category());
+    }
+}
+
+UdpSessionServer::~UdpSessionServer()
+{
+    m_hot.clear();
+    close(m_epollFd);
+}
+
+int
+UdpSessionServer::RecvFrom(void *buff, int len, InetAddress &peer, int timeout)
+{
+    int bytes;
+    int rc;
+
+    for (;;) {
+        while (m_next < m_ready) {
+            if (ReadReady(buff, len, peer, bytes)) {
+                return bytes;
+            }
+        }
+
+        while ((rc = epoll_wait(m_epollFd, m_events, EVENTS_MAX, timeout)) < 0 && errno == EINTR) {
+        }
+        if (rc < 0)
+        {
+	    throw std::system_error(errno, std::system_category());
+        }
+        if (rc == 0) {
+            return 0;
+        }
+        m_ready = rc;
+        m_next = 0;
+    }
+}
+
+/*
+ * Read one datagram from the next ready socket. Epoll is level triggered, so a
+ * socket with more queued is reported again by the next epoll_wait().
+ */
+bool
+UdpSessionServer::ReadReady(void *buff, int len, InetAddress &peer, int &bytes)
+{
+    struct epoll_event &event = m_events[m_next++];
+    HotPeer            *pHot = (HotPeer *)event.data.ptr;
+    uint32_t            now = MonotonicMs();
+
+    // Cleared by Demote() when the socket was closed after epoll_wait().
+    if (event.events == 0) {
+        return false;
+    }
+
+    try {
+        if (pHot == NULL) {
+            bool inserted;
+
+            bytes = m_shared.RecvFrom(buff, len, MSG_DONTWAIT, peer);
+            m_stats.sharedRecv++;
+            Count(*m_peers.Insert(peer, now / 1000, inserted), peer, now);
+        } else {
+            bytes = pHot->sock.Recv(buff, len, MSG_DONTWAIT);
+            peer = pHot->peer;
+            m_stats.hotRecv++;
+            pHot->packets++;
+            m_peers.Find(peer, now / 1000);
+        }
+    } catch (const std::system_error &e) {
+        // A connected socket reports ICMP errors from its peer on the next read.
+        if (e.code().value() == EAGAIN || e.code().value() == ECONNREFUSED) {
+            return false;
+        }
+        throw;
+    }
+    return true;
+}
+
+int
+UdpSessionServer::SendTo(const void *buff, int len, const InetAddress &peer)
+{
+    uint32_t   now = MonotonicMs();
+    bool       inserted;
+    PeerState *pState = m_peers.Insert(peer, now / 1000, inserted);
+    int        bytes;
+
+    if (pState->pHot != NULL) {
+        m_stats.hotSend++;
+        pState->pHot->packets++;
+        return pState->pHot->sock.Send(buff, len, 0);
+    }
+
+    bytes = m_shared.SendTo(buff, len, 0, peer);
+    m_stats.sharedSend++;
+    Count(*pState, peer, now);
+    return bytes;
+}
+
+bool
+UdpSessionServer::IsHot(const InetAddress &peer)
+{
+    PeerState *pState = m_peers.Find(peer);
+
+    return pState != NULL && pState->pHot != NULL;
+}
+
+size_t
+UdpSessionServer::Expire(size_t budget)
+{
+    uint32_t now = MonotonicMs();
+
+    DemoteSlow(budget, now);
+    return m_peers.Expire(now / 1000, m_options.idleSeconds, budget,
+                          [this](const InetAddress &, PeerState &state) {
+                              if (state.pHot != NULL) {
+                                  Demote(state);
+                              }
+                          });
+}
+
+/*
+ * Count a datagram to or from a peer on the shared socket and promote the
+ * peer once it reaches the threshold within one window.
+ */
+void
+UdpSessionServer::Count(PeerState &state, const InetAddress &peer, uint32_t now)
+{
+    // A datagram queued on the shared socket just before the peer was promoted.
+    if (state.pHot != NULL) {
+        return;
+    }
+
+    if (now - state.windowStart >= m_options.windowMs) {
+        state.windowStart = now;
+        state.packets = 0;
+    }
+
+    if (++state.packets >= m_options.hotPackets && m_canPromote && m_hot.size() < m_options.maxHot) {
+        Promote(state, peer, now);
+    }
+}
+
+void
+UdpSessionServer::Promote(PeerState &state, const InetAddress &peer, uint32_t now)
+{
+    std::unique_ptr<HotPeer> pHot(new HotPeer(m_local.IsIpv6()));
+    struct epoll_event       event;
+    int                      on = 1;
+
+    // If the socket cannot be set up, out of descriptors say, the peer has to
+    // earn another try.
+    state.packets = 0;
+    try {
+        pHot->sock.SetSockOpt(SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+        pHot->sock.Bind(m_local);
+        pHot->sock.Connect(peer);
+    } catch (const std::system_error &) {
+        return;
+    }
+
+    event.events = EPOLLIN;
+    event.data.ptr = pHot.get();
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, pHot->sock.GetDescriptor(), &event) < 0) {
+        return;
+    }
+
+    pHot->peer = peer;
+    pHot->index = m_hot.size();
+    pHot->windowStart = now;
+    state.pHot = pHot.get();
+    m_hot.push_back(std::move(pHot));
+    m_stats.promoted++;
+}
+
+/*
+ * Close a peer's socket. Its traffic goes back to the shared socket; anything
+ * still queued on the closed one is lost.
+ */
+void
+UdpSessionServer::Demote(PeerState &state)
+{
+    HotPeer *pHot = state.pHot;
+    size_t   index = pHot->index;
+
+    for (int i = m_next; i < m_ready; i++) {
+        if (m_events[i].data.ptr == pHot) {
+            m_events[i].events = 0;
+        }
+    }
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, pHot->sock.GetDescriptor(), NULL);
+
+    m_hot[index].swap(m_hot.back());
+    m_hot[index]->index = index;
+    m_hot.pop_back();
+
+    state.pHot = NULL;
+    state.packets = 0;
+    m_stats.demoted++;
+}
+
+/*
+ * Check the next few hot peers whose window has ended and demote those that
+ * exchanged fewer than coldPackets datagrams per window over it. The window
+ * may have run long if Expire() was called late, so the count is scaled to
+ * the time it covers.
+ */
+void
+UdpSessionServer::DemoteSlow(size_t budget, uint32_t now)
+{
+    for (; budget != 0 && !m_hot.empty(); budget--) {
+        if (m_hotCheck >= m_hot.size()) {
+            m_hotCheck = 0;
+        }
+
+        HotPeer *pHot = m_hot[m_hotCheck].get();
+        uint32_t elapsed = now - pHot->windowStart;
+
+        if (elapsed < m_options.windowMs) {
+            m_hotCheck++;
+            continue;
+        }
+
+        if ((uint64_t)pHot->packets * m_options.windowMs < (uint64_t)m_options.coldPackets * elapsed) {
+            // Demote() moves the last hot peer into this position, so it is
+            // checked next without advancing.
+            Demote(*m_peers.Find(pHot->peer));
+            continue;
+        }
+        pHot->windowStart = now;
+        pHot->packets = 0;
+        m_hotCheck++;
+    }
+}
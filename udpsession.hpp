@@ -0,0 +1,172 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+UDP server giving busy peers their own connected socket
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef UDPSESSION_HPP
+#define UDPSESSION_HPP
+
+#include <stdint.h>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <sys/epoll.h>
+#include "socket.hpp"
+#include "inetaddr.hpp"
+#include "peertable.hpp"
+
+/***
+ * @class UDP server socket that moves busy peers onto sockets of their own, as
+ *        QUIC servers do. Every peer starts on one shared socket. A peer that
+ *        exchanges enough datagrams within a window is promoted: a socket is
+ *        bound to the same local address with SO_REUSEPORT and connect()ed to
+ *        the peer. The kernel then delivers that peer's datagrams to its own
+ *        receive queue, and sends to it are plain send() calls on a socket with a
+ *        cached route. A promoted peer whose traffic falls below a lower rate
+ *        is demoted and its socket closed, and peers that go quiet are forgotten.
+ *
+ *        A reuseport program on the shared socket steers all traffic from peers
+ *        that are not promoted to it, so a new socket receives nothing between
+ *        its bind() and connect(). If the kernel refuses the program, nobody is
+ *        promoted and the server works as a plain shared socket.
+ *
+ *        An object is used by one thread at a time.
+ */
+class UdpSessionServer
+{
+public:
+    struct Options
+    {
+        uint32_t        hotPackets;     // Datagrams within the window that make a peer hot
+        uint32_t        coldPackets;    // Fewer within the window make a hot peer cold again
+        uint32_t        windowMs;
+        size_t          maxHot;         // Most peers with their own socket
+        uint32_t        idleSeconds;    // Peers quiet this long are forgotten
+
+                        Options() : hotPackets(64), coldPackets(16), windowMs(1000), maxHot(1024),
+                                    idleSeconds(30) {}
+    };
+
+    struct Stats
+    {
+        uint64_t        sharedRecv;
+        uint64_t        hotRecv;
+        uint64_t        sharedSend;
+        uint64_t        hotSend;
+        uint64_t        promoted;
+        uint64_t        demoted;
+    };
+
+    /***
+     * Class constructor. Binds the shared socket.
+     *
+     * @param[IN] local   - Address to serve on. Port 0 picks a free port.
+     * @param[IN] options - When to promote and demote peers.
+     *
+     * @throws std::system_error if the socket cannot be bound.
+     */
+                        UdpSessionServer(const InetAddress &local, const Options &options = Options());
+                        ~UdpSessionServer();
+
+    /***
+     * Receive the next datagram from any peer.
+     *
+     * @param[OUT] peer    - Sender of the datagram.
+     * @param[IN]  timeout - Milliseconds to wait, negative to wait forever.
+     *
+     * @return Bytes received, or 0 on timeout.
+     *
+     * @throws std::system_error if a receive fails.
+     */
+    int                 RecvFrom(void *buff, int len, InetAddress &peer, int timeout);
+
+    /***
+     * Send a datagram, on the peer's own socket if it has one.
+     *
+     * @throws std::system_error if the send fails.
+     */
+    int                 SendTo(const void *buff, int len, const InetAddress &peer);
+
+    /***
+     * Demote hot peers whose rate over their last window fell below coldPackets
+     * and forget peers idle for longer than the configured time, closing their
+     * sockets. Examines at most budget hot peers and budget peers per call, so
+     * it should be called at least once a window.
+     *
+     * @return Number of peers forgotten.
+     */
+    size_t              Expire(size_t budget = 256);
+
+    /***
+     * Returns whether promotion is available, which needs reuseport programs.
+     */
+    bool                CanPromote() const { return m_canPromote; }
+
+    bool                IsHot(const InetAddress &peer);
+    size_t              HotPeers() const { return m_hot.size(); }
+    const InetAddress  &GetLocalAddress() const { return m_local; }
+    Socket             &GetSharedSocket() { return m_shared; }
+    const Stats        &GetStats() const { return m_stats; }
+
+private:
+    /***
+     * A promoted peer and its connected socket.
+     */
+    struct HotPeer
+    {
+        Socket          sock;
+        InetAddress     peer;
+        size_t          index;          // Position in m_hot
+        uint32_t        windowStart;    // Milliseconds
+        uint32_t        packets;        // Datagrams since windowStart
+
+                        HotPeer(bool isIpv6) : sock(isIpv6, SOCK_DGRAM), index(0), windowStart(0),
+                                               packets(0) {}
+    };
+
+    struct PeerState
+    {
+        uint32_t        windowStart;    // Milliseconds
+        uint32_t        packets;
+        HotPeer        *pHot;
+
+                        PeerState() : windowStart(0), packets(0), pHot(NULL) {}
+    };
+
+    static const int    EVENTS_MAX = 64;
+
+                        UdpSessionServer(const UdpSessionServer &);
+    UdpSessionServer   &operator=(const UdpSessionServer &);
+
+    void                Count(PeerState &state, const InetAddress &peer, uint32_t nowMs);
+    void                Promote(PeerState &state, const InetAddress &peer, uint32_t nowMs);
+    void                Demote(PeerState &state);
+    void                DemoteSlow(size_t budget, uint32_t nowMs);
+    bool                ReadReady(void *buff, int len, InetAddress &peer, int &bytes);
+
+    Options                                 m_options;
+    Socket                                  m_shared;
+    InetAddress                             m_local;
+    PeerTable<PeerState>                    m_peers;
+    std::vector<std::unique_ptr<HotPeer> >  m_hot;
+    int                                     m_epollFd;
+    bool                                    m_canPromote;
+    struct epoll_event                      m_events[EVENTS_MAX];
+    int                                     m_ready;    // Events from the last epoll_wait()
+    int                                     m_next;     // Next of those to read from
+    size_t                                  m_hotCheck; // Next of m_hot for DemoteSlow()
+    Stats                                   m_stats;
+};
+
+#endif
@@ -0,0 +1,439 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Work stealing worker pool for accepted connections
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <cerrno>
+#include <chrono>
+#include <exception>
+#include <system_error>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "workpool.hpp"
+
+static const int MAX_EVENTS = 64;
+static const int ACCEPT_BATCH = 16;
+static const int TASK_BATCH = 16;
+
+static const uint32_t CONNECTION_EVENTS = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+
+PoolConnection::PoolConnection(int fd, size_t home) : m_sock(fd)
+{
+    m_source.kind = SOURCE_CONNECTION;
+    m_source.pListener = NULL;
+    m_source.pConn = this;
+    m_home = home;
+    m_target = home;
+    m_lastThief = home;
+    m_stealRun = 0;
+    m_prev = NULL;
+    m_next = NULL;
+    userData = NULL;
+}
+
+WorkerPool::WorkerPool(ConnectionHandler &handler, size_t workers) : m_handler(handler)
+{
+    if (workers == 0) {
+        workers = std::thread::hardware_concurrency();
+        if (workers == 0) {
+            workers = 1;
+        }
+    }
+
+    m_stop.store(false);
+    m_draining.store(false);
+    m_connections.store(0);
+    m_pHead = NULL;
+    m_started = false;
+
+    for (size_t i = 0; i < workers; i++) {
+        std::unique_ptr<Worker> pWorker(new Worker);
+        struct epoll_event ev;
+
+        pWorker->sleeping.store(false);
+        pWorker->accepted.store(0);
+        pWorker->tasks.store(0);
+        pWorker->stolen.store(0);
+        pWorker->migrated.store(0);
+        pWorker->wake.kind = SOURCE_WAKE;
+        pWorker->wake.pListener = NULL;
+        pWorker->wake.pConn = NULL;
+
+        if ((pWorker->epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        {
+	    throw std::system_error(errno, std::system_category());
+        }
+        if ((pWorker->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        {
+            int err = errno;
+            close(pWorker->epollFd);
+	    throw std::system_error(err, std::system_category());
+        }
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = &pWorker->wake;
+        epoll_ctl(pWorker->epollFd, EPOLL_CTL_ADD, pWorker->wakeFd, &ev);
+        m_workers.push_back(std::move(pWorker));
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    Stop();
+    for (size_t i = 0; i < m_workers.size(); i++) {
+        close(m_workers[i]->epollFd);
+        close(m_workers[i]->wakeFd);
+    }
+}
+
+void
+WorkerPool::AddListener(Socket &listener)
+{
+    std::unique_ptr<PollSource> pSource(new PollSource);
+    struct epoll_event ev;
+
+    listener.Fcntl(F_SETFL, listener.Fcntl(F_GETFL, 0) | O_NONBLOCK);
+
+    pSource->kind = SOURCE_LISTENER;
+    pSource->pListener = &listener;
+    pSource->pConn = NULL;
+
+    // EPOLLEXCLUSIVE wakes one waiting worker per connection instead of all.
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = pSource.get();
+    for (size_t i = 0; i < m_workers.size(); i++) {
+        if (epoll_ctl(m_workers[i]->epollFd, EPOLL_CTL_ADD, listener.GetDescriptor(), &ev) < 0)
+        {
+	    throw std::system_error(errno, std::system_category());
+        }
+    }
+    m_listeners.push_back(std::move(pSource));
+}
+
+void
+WorkerPool::Start()
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    m_started = true;
+    for (size_t i = 0; i < m_workers.size(); i++) {
+        m_workers[i]->thread = std::thread(&WorkerPool::Run, this, i);
+
+        // One worker per core keeps each readiness loop next to its caches.
+        if (cpus > 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(i % cpus, &set);
+            pthread_setaffinity_np(m_workers[i]->thread.native_handle(), sizeof(set), &set);
+        }
+    }
+}
+
+size_t
+WorkerPool::Drain(int timeout)
+{
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+    m_draining.store(true);
+    for (size_t i = 0; i < m_listeners.size(); i++) {
+        for (size_t w = 0; w < m_workers.size(); w++) {
+            epoll_ctl(m_workers[w]->epollFd, EPOLL_CTL_DEL,
+                      m_listeners[i]->pListener->GetDescriptor(), NULL);
+        }
+    }
+
+    while (Connections() != 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return Connections();
+}
+
+void
+WorkerPool::Stop()
+{
+    if (m_started) {
+        m_stop.store(true);
+        for (size_t i = 0; i < m_workers.size(); i++) {
+            Wake(*m_workers[i]);
+        }
+        for (size_t i = 0; i < m_workers.size(); i++) {
+            m_workers[i]->thread.join();
+        }
+        m_started = false;
+    }
+
+    // The workers are gone so connections queued or idle can be closed here.
+    while (m_pHead != NULL) {
+        Close(m_pHead);
+    }
+}
+
+WorkerPool::WorkerStats
+WorkerPool::GetStats(size_t worker) const
+{
+    const Worker &w = *m_workers[worker];
+    WorkerStats stats;
+
+    stats.accepted = w.accepted.load(std::memory_order_relaxed);
+    stats.tasks = w.tasks.load(std::memory_order_relaxed);
+    stats.stolen = w.stolen.load(std::memory_order_relaxed);
+    stats.migrated = w.migrated.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void
+WorkerPool::Wake(Worker &worker)
+{
+    uint64_t one = 1;
+
+    if (write(worker.wakeFd, &one, sizeof(one)) < 0) {
+        // The counter is already non-zero, so the worker will wake anyway.
+    }
+}
+
+/*
+ * Wake one sleeping worker so it can steal from a deque that has more than
+ * its owner can run right away.
+ */
+void
+WorkerPool::WakeIdle()
+{
+    for (size_t i = 0; i < m_workers.size(); i++) {
+        bool sleeping = true;
+
+        if (m_workers[i]->sleeping.compare_exchange_strong(sleeping, false)) {
+            Wake(*m_workers[i]);
+            return;
+        }
+    }
+}
+
+bool
+WorkerPool::AnyWork() const
+{
+    for (size_t i = 0; i < m_workers.size(); i++) {
+        if (m_workers[i]->deque.Size() != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+PoolConnection *
+WorkerPool::Steal(size_t index)
+{
+    size_t count = m_workers.size();
+
+    // Start after ourselves so thieves spread over the victims.
+    for (size_t i = 1; i < count; i++) {
+        PoolConnection *pConn = m_workers[(index + i) % count]->deque.Steal();
+        if (pConn != NULL) {
+            return pConn;
+        }
+    }
+    return NULL;
+}
+
+void
+WorkerPool::Accept(size_t index, Socket &listener)
+{
+    Worker &worker = *m_workers[index];
+
+    for (int i = 0; i < ACCEPT_BATCH; i++) {
+        int fd;
+
+        try {
+            fd = listener.Accept();
+        } catch (const std::system_error &e) {
+            return;
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        PoolConnection *pConn = new PoolConnection(fd, index);
+
+        {
+            std::lock_guard<std::mutex> lock(m_listLock);
+            pConn->m_next = m_pHead;
+            if (m_pHead != NULL) {
+                m_pHead->m_prev = pConn;
+            }
+            m_pHead = pConn;
+        }
+        m_connections.fetch_add(1, std::memory_order_relaxed);
+        worker.accepted.fetch_add(1, std::memory_order_relaxed);
+
+        m_handler.OnAccept(*pConn);
+
+        struct epoll_event ev;
+        ev.events = CONNECTION_EVENTS;
+        ev.data.ptr = &pConn->m_source;
+        epoll_ctl(worker.epollFd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+void
+WorkerPool::Close(PoolConnection *pConn)
+{
+    epoll_ctl(m_workers[pConn->m_home]->epollFd, EPOLL_CTL_DEL, pConn->m_sock.GetDescriptor(), NULL);
+    m_handler.OnClose(*pConn);
+
+    {
+        std::lock_guard<std::mutex> lock(m_listLock);
+        if (pConn->m_prev != NULL) {
+            pConn->m_prev->m_next = pConn->m_next;
+        } else {
+            m_pHead = pConn->m_next;
+        }
+        if (pConn->m_next != NULL) {
+            pConn->m_next->m_prev = pConn->m_prev;
+        }
+    }
+    m_connections.fetch_sub(1, std::memory_order_relaxed);
+    delete pConn;
+}
+
+/*
+ * Run the handler for a readable connection and arm it again, on another
+ * worker's loop if it has been moved.
+ */
+void
+WorkerPool::RunTask(size_t index, PoolConnection *pConn, bool stolen)
+{
+    Worker &worker = *m_workers[index];
+    bool    keep;
+
+    try {
+        keep = m_handler.OnReadable(*pConn);
+    } catch (const std::exception &e) {
+        keep = false;
+    }
+
+    worker.tasks.fetch_add(1, std::memory_order_relaxed);
+    if (stolen) {
+        worker.stolen.fetch_add(1, std::memory_order_relaxed);
+        if (pConn->m_lastThief == index) {
+            pConn->m_stealRun++;
+        } else {
+            pConn->m_lastThief = index;
+            pConn->m_stealRun = 1;
+        }
+        // Its home worker is busy every time the connection is ready.
+        if (pConn->m_stealRun >= MIGRATE_AFTER && pConn->m_target == pConn->m_home) {
+            pConn->m_target = index;
+        }
+    } else {
+        pConn->m_stealRun = 0;
+    }
+
+    if (!keep || m_stop.load(std::memory_order_relaxed)) {
+        Close(pConn);
+        return;
+    }
+
+    struct epoll_event ev;
+    int fd = pConn->m_sock.GetDescriptor();
+
+    ev.events = CONNECTION_EVENTS;
+    ev.data.ptr = &pConn->m_source;
+
+    if (pConn->m_target != pConn->m_home && pConn->m_target < m_workers.size()) {
+        // Nobody else can touch the connection while its one shot is disarmed.
+        epoll_ctl(m_workers[pConn->m_home]->epollFd, EPOLL_CTL_DEL, fd, NULL);
+        pConn->m_home = pConn->m_target;
+        pConn->m_stealRun = 0;
+        epoll_ctl(m_workers[pConn->m_home]->epollFd, EPOLL_CTL_ADD, fd, &ev);
+        worker.migrated.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        pConn->m_target = pConn->m_home;
+        epoll_ctl(m_workers[pConn->m_home]->epollFd, EPOLL_CTL_MOD, fd, &ev);
+    }
+}
+
+void
+WorkerPool::Run(size_t index)
+{
+    Worker            &worker = *m_workers[index];
+    struct epoll_event events[MAX_EVENTS];
+
+    while (!m_stop.load(std::memory_order_acquire)) {
+        int count = epoll_wait(worker.epollFd, events, MAX_EVENTS, 0);
+
+        if (count <= 0) {
+            PoolConnection *pConn = worker.deque.Pop();
+            bool stolen = false;
+
+            if (pConn == NULL && (pConn = Steal(index)) != NULL) {
+                stolen = true;
+            }
+            if (pConn != NULL) {
+                RunTask(index, pConn, stolen);
+                continue;
+            }
+
+            // Nothing to run. Announce that we are going to sleep, then look
+            // once more so work pushed in between is not missed.
+            worker.sleeping.store(true);
+            if (AnyWork()) {
+                worker.sleeping.store(false);
+                continue;
+            }
+            count = epoll_wait(worker.epollFd, events, MAX_EVENTS, -1);
+            worker.sleeping.store(false);
+        }
+
+        for (int i = 0; i < count; i++) {
+            PollSource *pSource = (PollSource *)events[i].data.ptr;
+
+            switch (pSource->kind) {
+                case SOURCE_WAKE: {
+                    uint64_t value;
+                    if (read(worker.wakeFd, &value, sizeof(value)) < 0) {
+                        // Already reset by an earlier wakeup.
+                    }
+                    break;
+                }
+
+                case SOURCE_LISTENER:
+                    if (!m_draining.load(std::memory_order_relaxed)) {
+                        Accept(index, *pSource->pListener);
+                    }
+                    break;
+
+                default:
+                    if (!worker.deque.Push(pSource->pConn)) {
+                        RunTask(index, pSource->pConn, false);
+                    }
+                    break;
+            }
+        }
+
+        if (worker.deque.Size() > 1) {
+            WakeIdle();
+        }
+
+        for (int i = 0; i < TASK_BATCH; i++) {
+            PoolConnection *pConn = worker.deque.Pop();
+            if (pConn == NULL) {
+                break;
+            }
+            RunTask(index, pConn, false);
+        }
+    }
+}
@@ -0,0 +1,324 @@
+/*
+Copyright (C) 2012 Charles E Sluder
+Work stealing worker pool for accepted connections
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef WORKPOOL_HPP
+#define WORKPOOL_HPP
+
+#include <stdint.h>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "socket.hpp"
+
+/***
+ * @class Chase-Lev work stealing deque with a fixed power of two capacity. The
+ *        owning thread pushes and pops at the bottom without locking; any other
+ *        thread may steal from the top, which costs one compare and swap.
+ *        Uses the memory orderings of Le, Pop, Cohen and Zappa Nardelli, "Correct
+ *        and Efficient Work-Stealing for Weak Memory Models", PPoPP 2013.
+ */
+template<typename T>
+class WorkStealingDeque
+{
+public:
+    explicit            WorkStealingDeque(size_t capacity = 4096)
+        : m_items(new std::atomic<T*>[capacity]), m_mask((int64_t)capacity - 1)
+    {
+        m_top.store(0, std::memory_order_relaxed);
+        m_bottom.store(0, std::memory_order_relaxed);
+    }
+
+    /***
+     * Owner only. Returns false if the deque is full.
+     */
+    bool                Push(T *item)
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_acquire);
+
+        if (b - t > m_mask) {
+            return false;
+        }
+        m_items[b & m_mask].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /***
+     * Owner only. Returns the most recently pushed item or NULL.
+     */
+    T                  *Pop()
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return NULL;
+        }
+
+        T *item = m_items[b & m_mask].load(std::memory_order_relaxed);
+        if (t == b) {
+            // Last item: race any thief for it.
+            if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                               std::memory_order_relaxed)) {
+                item = NULL;
+            }
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    /***
+     * Any thread. Returns the oldest item or NULL if the deque is empty or
+     * another thread won the race for it.
+     */
+    T                  *Steal()
+    {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+
+        if (t >= b) {
+            return NULL;
+        }
+
+        T *item = m_items[t & m_mask].load(std::memory_order_relaxed);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                           std::memory_order_relaxed)) {
+            return NULL;
+        }
+        return item;
+    }
+
+    /***
+     * Approximate number of items, exact only for the owner.
+     */
+    size_t              Size() const
+    {
+        int64_t n = m_bottom.load(std::memory_order_relaxed) - m_top.load(std::memory_order_relaxed);
+        return n > 0 ? (size_t)n : 0;
+    }
+
+private:
+    // Top and bottom are kept on separate cache lines. Padding is used rather
+    // than alignas, which C++14 operator new does not honour.
+    char                                m_pad0[64];
+    std::atomic<int64_t>                m_top;
+    char                                m_pad1[64 - sizeof(std::atomic<int64_t>)];
+    std::atomic<int64_t>                m_bottom;
+    char                                m_pad2[64 - sizeof(std::atomic<int64_t>)];
+    std::unique_ptr<std::atomic<T*>[]>  m_items;
+    int64_t                             m_mask;
+};
+
+class WorkerPool;
+class PoolConnection;
+
+enum PollSourceKind
+{
+    SOURCE_CONNECTION,
+    SOURCE_LISTENER,
+    SOURCE_WAKE
+};
+
+/***
+ * What a WorkerPool epoll registration points at.
+ */
+struct PollSource
+{
+    int                 kind;
+    Socket             *pListener;
+    PoolConnection     *pConn;
+};
+
+/***
+ * @class An accepted connection owned by a WorkerPool. Each connection is
+ *        registered with the readiness loop of one worker, its home, but when
+ *        it becomes readable any idle worker may run it. Only one worker runs
+ *        a given connection at a time.
+ */
+class PoolConnection
+{
+public:
+    Socket             &GetSocket() { return m_sock; }
+
+    /***
+     * Index of the worker whose readiness loop watches the connection.
+     */
+    size_t              GetWorker() const { return m_home; }
+
+    /***
+     * Move the connection to another worker once the current callback returns,
+     * for example to put it next to related connections.
+     */
+    void                MoveTo(size_t worker) { m_target = worker; }
+
+    void               *userData;       // Free for the handler
+
+private:
+    friend class WorkerPool;
+
+                        PoolConnection(int fd, size_t home);
+
+    PollSource          m_source;
+    Socket              m_sock;
+    size_t              m_home;
+    size_t              m_target;
+    size_t              m_lastThief;
+    uint32_t            m_stealRun;     // Consecutive runs by m_lastThief
+    PoolConnection     *m_prev;
+    PoolConnection     *m_next;
+};
+
+/***
+ * @class Callbacks for the connections of a WorkerPool. They run on worker
+ *        threads, never concurrently for the same connection.
+ */
+class ConnectionHandler
+{
+public:
+    virtual             ~ConnectionHandler() {}
+
+    virtual void        OnAccept(PoolConnection &) {}
+
+    /***
+     * The socket, which is non-blocking, has data or has been closed by the
+     * peer. An exception thrown here closes the connection.
+     *
+     * @return false to close the connection.
+     */
+    virtual bool        OnReadable(PoolConnection &conn) = 0;
+
+    virtual void        OnClose(PoolConnection &) {}
+};
+
+/***
+ * @class Server framework with one worker thread per core. Every worker has its
+ *        own epoll readiness loop and a work stealing deque. Readable connections
+ *        are pushed on the deque of the worker that saw them; a worker with
+ *        nothing to do steals from the others, so a few heavy connections no
+ *        longer pin one thread while the rest sit idle. A connection that keeps
+ *        being run by the same thief is moved to that worker's loop.
+ *
+ *        Listeners are shared by all workers with EPOLLEXCLUSIVE and each
+ *        connection is armed with EPOLLONESHOT, so it is queued at most once.
+ */
+class WorkerPool
+{
+public:
+    /***
+     * Counters of one worker. Read while running they are approximate.
+     */
+    struct WorkerStats
+    {
+        uint64_t        accepted;
+        uint64_t        tasks;
+        uint64_t        stolen;
+        uint64_t        migrated;
+    };
+
+    static const uint32_t MIGRATE_AFTER = 4;
+
+    /***
+     * Class constructor.
+     *
+     * @param[IN] handler - Connection callbacks.
+     * @param[IN] workers - Number of worker threads, by default one per core.
+     */
+                        WorkerPool(ConnectionHandler &handler, size_t workers = 0);
+
+    /***
+     * Class destructor. Stops the workers and closes every connection.
+     */
+                        ~WorkerPool();
+
+    /***
+     * Accept connections from a listening socket, which is made non-blocking.
+     * The socket must outlive the pool or the next Drain().
+     */
+    void                AddListener(Socket &listener);
+
+    void                Start();
+
+    /***
+     * Stop accepting and wait for the handler to close the open connections,
+     * which it should do when each finishes its current request once
+     * IsDraining() is true. Connections still open after the timeout are
+     * closed by Stop().
+     *
+     * @param[IN] timeout - Milliseconds to wait.
+     *
+     * @return Number of connections that were still open.
+     */
+    size_t              Drain(int timeout);
+
+    bool                IsDraining() const { return m_draining.load(std::memory_order_relaxed); }
+
+    /***
+     * Stop the workers and close every remaining connection.
+     */
+    void                Stop();
+
+    size_t              Size() const { return m_workers.size(); }
+    size_t              Connections() const { return m_connections.load(std::memory_order_relaxed); }
+    WorkerStats         GetStats(size_t worker) const;
+
+private:
+    struct Worker
+    {
+        WorkStealingDeque<PoolConnection>   deque;
+        std::thread                         thread;
+        int                                 epollFd;
+        int                                 wakeFd;
+        PollSource                          wake;
+        std::atomic<bool>                   sleeping;
+        std::atomic<uint64_t>               accepted;
+        std::atomic<uint64_t>               tasks;
+        std::atomic<uint64_t>               stolen;
+        std::atomic<uint64_t>               migrated;
+    };
+
+                        WorkerPool(const WorkerPool &);
+    WorkerPool         &operator=(const WorkerPool &);
+
+    void                Run(size_t index);
+    void                Accept(size_t index, Socket &listener);
+    void                RunTask(size_t index, PoolConnection *pConn, bool stolen);
+    PoolConnection     *Steal(size_t index);
+    bool                AnyWork() const;
+    void                WakeIdle();
+    void                Wake(Worker &worker);
+    void                Close(PoolConnection *pConn);
+
+    ConnectionHandler                      &m_handler;
+    std::vector<std::unique_ptr<Worker> >   m_workers;
+    std::vector<std::unique_ptr<PollSource> > m_listeners;
+    std::atomic<bool>                       m_stop;
+    std::atomic<bool>                       m_draining;
+    std::atomic<size_t>                     m_connections;
+    std::mutex                              m_listLock;
+    PoolConnection                         *m_pHead;
+    bool                                    m_started;
+};
+
+#endif